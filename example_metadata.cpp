@@ -60,7 +60,9 @@ void example_reading( const std::string& filePath ){
 	if( !stream.get_file_metadata().empty() ){
 		std::cout << "File metadata:" << std::endl;
 		
-		for( std::map< std::string, prtio::prt_meta_value >::const_iterator it = stream.get_file_metadata().begin(), itEnd = stream.get_file_metadata().end(); it != itEnd; ++it ){
+		prtio::prt_meta_map metadata = stream.get_file_metadata();
+
+		for( prtio::prt_meta_map::const_iterator it = metadata.begin(), itEnd = metadata.end(); it != itEnd; ++it ){
 			std::cout << "\tName: \"" << it->first << "\" Value: { " << std::flush;
 			to_cout( it->second ); 
 			std::cout << " }" << std::endl;
@@ -70,10 +72,10 @@ void example_reading( const std::string& filePath ){
 	for( std::size_t i = 0, iEnd = stream.layout().num_channels(); i < iEnd; ++i ){
 		const std::string& channelName = stream.layout().get_channel_name( i );
 		
-		const std::map< std::string, prtio::prt_meta_value >& metadata = stream.get_channel_metadata( channelName );
+		prtio::prt_meta_map metadata = stream.get_channel_metadata( channelName );
 		
 		std::cout << "Channel \"" << channelName << "\" metadata:" << std::endl;
-		for( std::map< std::string, prtio::prt_meta_value >::const_iterator it = metadata.begin(), itEnd = metadata.end(); it != itEnd; ++it ){
+		for( prtio::prt_meta_map::const_iterator it = metadata.begin(), itEnd = metadata.end(); it != itEnd; ++it ){
 			std::cout << "\tName: \"" << it->first << "\" Value: { " << std::flush;
 			to_cout( it->second ); 
 			std::cout << " }" << std::endl;
@@ -0,0 +1,381 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the machinery for overlapping file I/O with compression. A single background thread reads ahead
+ * or writes behind through a ring of buffers, so slow storage (ex. network shares) and the CPU are busy at the same time.
+ */
+
+#pragma once
+
+#include <prtio/detail/threading.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace prtio{
+namespace detail{
+
+/**
+ * Reads a file sequentially on a background thread, keeping a ring of buffers filled ahead of the caller.
+ */
+class async_reader{
+public:
+	/**
+	 * A buffer of file data being read on the background thread.
+	 */
+	class chunk : public thread_task{
+		friend class async_reader;
+
+		std::ifstream* m_file;
+		std::streamoff m_offset;
+
+	public:
+		std::vector<char> data; //The buffer the file data is read into.
+		std::size_t size;       //The number of bytes to read, which is less than the buffer's size at the end of the file.
+
+	private:
+		chunk( std::ifstream& file, std::size_t capacity ) : m_file( &file ), m_offset( 0 ), data( capacity ), size( 0 )
+		{}
+
+	protected:
+		virtual void run(){
+			m_file->clear();
+			m_file->seekg( m_offset, std::ios::beg );
+			m_file->read( &data.front(), size );
+
+			if( static_cast<std::size_t>( m_file->gcount() ) != size )
+				throw std::ios_base::failure( "Failed to read from the file" );
+		}
+	};
+
+private:
+	std::string m_filePath;
+	std::ifstream m_file; //Only used on the background thread once reading has started.
+	std::streamoff m_fileSize;
+	std::streamoff m_nextOffset; //The file offset of the next chunk to submit.
+
+	thread_pool m_pool;
+	std::vector< chunk* > m_chunks;
+	std::deque< chunk* > m_pending; //The chunks being read, in file order.
+	std::vector< chunk* > m_free;   //The chunks that aren't in use.
+
+	chunk* m_current;  //The chunk the caller is consuming, or NULL.
+	std::size_t m_pos; //The offset in 'm_current' of the next byte to consume.
+
+private:
+	async_reader( const async_reader& );
+	async_reader& operator=( const async_reader& );
+
+	/**
+	 * Submits free chunks for reading until the ring is full or the end of the file is reached.
+	 */
+	void fill(){
+		while( !m_free.empty() && m_nextOffset < m_fileSize ){
+			chunk* c = m_free.back();
+			m_free.pop_back();
+
+			c->m_offset = m_nextOffset;
+			c->size = static_cast<std::size_t>( (std::min)( static_cast<std::streamoff>( c->data.size() ), m_fileSize - m_nextOffset ) );
+			m_nextOffset += static_cast<std::streamoff>( c->size );
+
+			m_pending.push_back( c );
+			m_pool.submit( c );
+		}
+	}
+
+	/**
+	 * Waits for all the chunks in flight, discarding them.
+	 */
+	void drain(){
+		if( m_current ){
+			m_free.push_back( m_current );
+			m_current = NULL;
+		}
+
+		while( !m_pending.empty() ){
+			chunk* c = m_pending.front();
+			m_pending.pop_front();
+			m_free.push_back( c );
+
+			try{
+				m_pool.wait( c );
+			}catch( ... ){
+				//The data is being discarded, so the error doesn't matter.
+			}
+		}
+	}
+
+	/**
+	 * Recycles the current chunk and waits for the next one.
+	 * @return False if there is no more data in the file.
+	 */
+	bool next_chunk(){
+		if( m_current ){
+			m_free.push_back( m_current );
+			m_current = NULL;
+		}
+
+		this->fill();
+
+		if( m_pending.empty() )
+			return false;
+
+		chunk* c = m_pending.front();
+		m_pending.pop_front();
+
+		try{
+			m_pool.wait( c );
+		}catch( const std::exception& e ){
+			m_free.push_back( c );
+			throw std::ios_base::failure( "Failed to read from file \"" + m_filePath + "\": " + e.what() );
+		}
+
+		m_current = c;
+		m_pos = 0;
+
+		this->fill();
+
+		return true;
+	}
+
+public:
+	/**
+	 * Opens the file for reading on the background thread. Call start() to begin reading.
+	 * @param filePath The file to read.
+	 * @param chunkSize The size in bytes of each buffer in the ring.
+	 * @param numChunks The number of buffers in the ring. One is consumed while the others are read ahead.
+	 */
+	async_reader( const std::string& filePath, std::size_t chunkSize, std::size_t numChunks = 4 )
+		: m_filePath( filePath ), m_fileSize( 0 ), m_nextOffset( 0 ), m_pool( 1 ), m_current( NULL ), m_pos( 0 )
+	{
+		m_file.open( filePath.c_str(), std::ios::in | std::ios::binary );
+		if( m_file.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + filePath + "\"" );
+
+		m_file.seekg( 0, std::ios::end );
+		m_fileSize = static_cast<std::streamoff>( m_file.tellg() );
+
+		for( std::size_t i = 0; i < (std::max)( std::size_t(2), numChunks ); ++i ){
+			m_chunks.push_back( new chunk( m_file, (std::max)( std::size_t(1), chunkSize ) ) );
+			m_free.push_back( m_chunks.back() );
+		}
+	}
+
+	~async_reader(){
+		this->drain();
+
+		for( std::vector< chunk* >::iterator it = m_chunks.begin(), itEnd = m_chunks.end(); it != itEnd; ++it )
+			delete *it;
+	}
+
+	/**
+	 * Discards any data read ahead, and starts reading from a new location.
+	 * @param offset The file offset to read from.
+	 */
+	void start( std::streamoff offset ){
+		this->drain();
+
+		m_nextOffset = offset;
+		m_pos = 0;
+
+		this->fill();
+	}
+
+	/**
+	 * Consumes all the data that the next buffer holds, without copying it.
+	 * @param outSize Receives the number of bytes returned, which is 0 at the end of the file.
+	 * @return The data, which stays valid until the next call to any function of this object.
+	 */
+	const char* next( std::size_t& outSize ){
+		while( !m_current || m_pos == m_current->size ){
+			if( !this->next_chunk() ){
+				outSize = 0;
+				return NULL;
+			}
+		}
+
+		const char* result = &m_current->data.front() + m_pos;
+		outSize = m_current->size - m_pos;
+		m_pos = m_current->size;
+		return result;
+	}
+
+	/**
+	 * Consumes and copies bytes from the file.
+	 * @return The number of bytes copied, which is less than 'numBytes' only at the end of the file.
+	 */
+	std::size_t read( char* dest, std::size_t numBytes ){
+		std::size_t result = 0;
+		while( result < numBytes ){
+			if( !m_current || m_pos == m_current->size ){
+				if( !this->next_chunk() )
+					break;
+				continue;
+			}
+
+			std::size_t n = (std::min)( numBytes - result, m_current->size - m_pos );
+			memcpy( dest + result, &m_current->data.front() + m_pos, n );
+
+			m_pos += n;
+			result += n;
+		}
+		return result;
+	}
+
+	/**
+	 * @return True if all the data of the file has been consumed.
+	 */
+	bool at_end(){
+		while( !m_current || m_pos == m_current->size ){
+			if( !this->next_chunk() )
+				return true;
+		}
+		return false;
+	}
+};
+
+/**
+ * Writes to a stream on a background thread, collecting the data in a ring of buffers so the caller only waits when
+ * all of them are full.
+ */
+class async_writer{
+	/**
+	 * A buffer of data being written on the background thread.
+	 */
+	class chunk : public thread_task{
+		friend class async_writer;
+
+		std::ostream* m_out;
+
+	public:
+		std::vector<char> data; //The buffer the data is collected in.
+		std::size_t size;       //The number of bytes in 'data'.
+
+	private:
+		chunk( std::ostream& out, std::size_t capacity ) : m_out( &out ), data( capacity ), size( 0 )
+		{}
+
+	protected:
+		virtual void run(){
+			m_out->write( &data.front(), static_cast<std::streamsize>( size ) );
+		}
+	};
+
+	thread_pool m_pool;
+	std::vector< chunk* > m_chunks;
+	std::deque< chunk* > m_pending; //The chunks being written, in order.
+	std::vector< chunk* > m_free;   //The chunks that aren't in use.
+	chunk* m_current;               //The chunk collecting data, or NULL.
+
+private:
+	async_writer( const async_writer& );
+	async_writer& operator=( const async_writer& );
+
+	/**
+	 * Waits for the oldest chunk being written, and returns it to the free list.
+	 */
+	void wait_front(){
+		chunk* c = m_pending.front();
+		m_pending.pop_front();
+		m_free.push_back( c );
+
+		m_pool.wait( c );
+	}
+
+public:
+	/**
+	 * @param out The stream to write to. Until finish() returns, it must only be used through this object.
+	 * @param chunkSize The size in bytes of each buffer in the ring.
+	 * @param numChunks The number of buffers in the ring. One collects data while the others are written.
+	 */
+	async_writer( std::ostream& out, std::size_t chunkSize, std::size_t numChunks = 4 ) : m_pool( 1 ), m_current( NULL ){
+		for( std::size_t i = 0; i < (std::max)( std::size_t(2), numChunks ); ++i ){
+			m_chunks.push_back( new chunk( out, (std::max)( std::size_t(1), chunkSize ) ) );
+			m_free.push_back( m_chunks.back() );
+		}
+	}
+
+	/**
+	 * Waits for the background thread without writing the partially filled buffer. Call finish() first to keep it.
+	 */
+	~async_writer(){
+		while( !m_pending.empty() ){
+			try{
+				this->wait_front();
+			}catch( ... ){
+				//Can't throw from a destructor, and finish() would have reported the error.
+			}
+		}
+
+		for( std::vector< chunk* >::iterator it = m_chunks.begin(), itEnd = m_chunks.end(); it != itEnd; ++it )
+			delete *it;
+	}
+
+	/**
+	 * Copies data to be written, handing off each buffer to the background thread once it is full.
+	 * @note Errors writing earlier data are thrown here as std::runtime_error.
+	 */
+	void write( const char* data, std::size_t numBytes ){
+		while( numBytes > 0 ){
+			if( !m_current ){
+				if( m_free.empty() )
+					this->wait_front();
+
+				m_current = m_free.back();
+				m_free.pop_back();
+				m_current->size = 0;
+			}
+
+			std::size_t n = (std::min)( numBytes, m_current->data.size() - m_current->size );
+			memcpy( &m_current->data.front() + m_current->size, data, n );
+
+			m_current->size += n;
+			data += n;
+			numBytes -= n;
+
+			if( m_current->size == m_current->data.size() ){
+				m_pending.push_back( m_current );
+				m_pool.submit( m_current );
+				m_current = NULL;
+			}
+		}
+	}
+
+	/**
+	 * Writes any remaining data and waits for the background thread, so the stream can be used directly again.
+	 * @note Errors writing any of the data are thrown here as std::runtime_error.
+	 */
+	void finish(){
+		if( m_current ){
+			if( m_current->size > 0 ){
+				m_pending.push_back( m_current );
+				m_pool.submit( m_current );
+			}else{
+				m_free.push_back( m_current );
+			}
+			m_current = NULL;
+		}
+
+		while( !m_pending.empty() )
+			this->wait_front();
+	}
+};
+
+}//namespace detail
+}//namespace prtio
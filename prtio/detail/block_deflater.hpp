@@ -0,0 +1,333 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the machinery for compressing particle data as independent blocks, optionally on many threads.
+ * Each block is a raw deflate segment that ends on a byte boundary with an empty stored block (ie. a Z_FULL_FLUSH), so
+ * concatenating the blocks between a zlib header and trailer produces a single valid zlib stream. With any other codec
+ * each block is a frame as described in codec.hpp.
+ */
+
+#pragma once
+
+#include <prtio/detail/codec.hpp>
+#include <prtio/detail/filter.hpp>
+#include <prtio/detail/threading.hpp>
+#include <prtio/prt_compression_options.hpp>
+
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * Computes the 2 byte zlib stream header that deflate() would produce, for a stream assembled from raw blocks.
+	 * @param level The zlib compression level used to compress the blocks.
+	 * @param strategy The zlib compression strategy used to compress the blocks.
+	 * @param windowBits The base two logarithm of the window size used to compress the blocks.
+	 * @param out The location to write the header to.
+	 */
+	inline void get_zlib_header( int level, int strategy, int windowBits, unsigned char out[2] ){
+		unsigned header = (Z_DEFLATED + ((windowBits - 8) << 4)) << 8;
+
+		unsigned levelFlags;
+		if( strategy >= Z_HUFFMAN_ONLY )
+			levelFlags = 0;
+		else if( level == Z_DEFAULT_COMPRESSION )
+			levelFlags = 2;
+		else if( level < 2 )
+			levelFlags = 0;
+		else if( level < 6 )
+			levelFlags = 1;
+		else if( level == 6 )
+			levelFlags = 2;
+		else
+			levelFlags = 3;
+
+		header |= (levelFlags << 6);
+		header += 31 - (header % 31);
+
+		out[0] = static_cast<unsigned char>( header >> 8 );
+		out[1] = static_cast<unsigned char>( header & 0xff );
+	}
+
+	/**
+	 * Computes the bytes that finish a zlib stream assembled from raw blocks: an empty final deflate block followed by the
+	 * big-endian adler32 checksum of the uncompressed data.
+	 * @param adler The adler32 checksum of all the uncompressed data in the stream.
+	 * @param out The location to write the trailer to.
+	 */
+	inline void get_zlib_trailer( uLong adler, unsigned char out[6] ){
+		out[0] = 0x03;
+		out[1] = 0x00;
+		out[2] = static_cast<unsigned char>( (adler >> 24) & 0xff );
+		out[3] = static_cast<unsigned char>( (adler >> 16) & 0xff );
+		out[4] = static_cast<unsigned char>( (adler >> 8) & 0xff );
+		out[5] = static_cast<unsigned char>( adler & 0xff );
+	}
+
+/**
+ * This class compresses blocks of particle data independently of each other, handing them back in the order they
+ * were submitted. When using more than one thread, the blocks are compressed concurrently on a thread_pool.
+ */
+class block_deflater{
+public:
+	/**
+	 * A single block of particles, and its compressed representation once finished.
+	 */
+	class block : public thread_task{
+		friend class block_deflater;
+
+		z_stream m_zstream;
+		codecs::option m_codec;
+		int m_level;
+		bool m_framed;
+		const particle_filter* m_filter;
+		std::vector<char> m_filtered; //The filtered particle data, if 'm_filter' is enabled.
+		std::vector<char> m_column;   //The frame of a single channel array, for filter_columns.
+
+	public:
+		std::vector<char> input;     //The uncompressed particle data.
+		std::vector<char> output;    //The compressed particle data.
+		std::size_t numParticles;    //The number of particles in 'input'.
+		uLong adler;                 //The adler32 checksum of 'input'. Only computed for zlib blocks that aren't framed.
+		prt_uint32 checksum;         //The block_checksum() of 'output', recorded in the block index.
+		float bounds[6];             //The box around the particles' positions, recorded in the block index. Not used for compression.
+
+	private:
+		block( const compression_options& options, const particle_filter* filter )
+			: m_codec( options.codec ), m_level( options.level ), m_framed( uses_frames( options.codec, *filter ) ), m_filter( filter ), numParticles( 0 ), adler( 0 ), checksum( 0 )
+		{
+			memset( &m_zstream, 0, sizeof(z_stream) );
+
+			if( m_codec == codecs::codec_zlib && Z_OK != deflateInit2( &m_zstream, options.level, Z_DEFLATED, -options.windowBits, options.memLevel, options.strategy ) )
+				throw std::runtime_error( "Unable to initialize a zlib deflate stream for block compression" );
+		}
+
+		~block(){
+			if( m_codec == codecs::codec_zlib )
+				deflateEnd( &m_zstream );
+		}
+
+		/**
+		 * Compresses 'srcLength' bytes into a single frame, including the frame header.
+		 */
+		void compress_frame( const char* src, std::size_t srcLength, std::vector<char>& dest ){
+			if( m_codec == codecs::codec_zlib ){
+				zlib_compress_frame( m_zstream, src, srcLength, dest );
+			}else{
+				dest.resize( codec_frame_header_size + codec_compress_bound( m_codec, srcLength ) );
+				dest.resize( codec_compress( m_codec, m_level, src, srcLength, &dest.front() ) );
+			}
+		}
+
+		/**
+		 * Compresses each channel array of a block filtered by filter_columns into its own frame, all in a single frame.
+		 */
+		void compress_columns( const std::vector<char>& data ){
+			output.resize( codec_frame_header_size );
+
+			const char* src = data.empty() ? NULL : &data.front();
+			for( std::size_t i = 0, iEnd = m_filter->num_columns(); i < iEnd; ++i ){
+				std::size_t columnLength = m_filter->column_size( i ) * numParticles;
+
+				this->compress_frame( src, columnLength, m_column );
+				output.insert( output.end(), m_column.begin(), m_column.end() );
+
+				src += columnLength;
+			}
+
+			if( output.size() - codec_frame_header_size > static_cast<std::size_t>( (std::numeric_limits<prt_int32>::max)() ) )
+				throw std::runtime_error( "Cannot compress more than 2GB of particles in a single frame" );
+
+			prt_int32 header[2] = { static_cast<prt_int32>( output.size() - codec_frame_header_size ), static_cast<prt_int32>( data.size() ) };
+			memcpy( &output.front(), header, codec_frame_header_size );
+		}
+
+		void compress(){
+			if( m_framed ){
+				if( m_filter->enabled() && !input.empty() ){
+					m_filtered.resize( input.size() );
+					m_filter->apply( &input.front(), numParticles, &m_filtered.front() );
+				}else{
+					m_filtered.clear();
+				}
+
+				const std::vector<char>& data = m_filter->enabled() ? m_filtered : input;
+
+				if( m_filter->columnar() )
+					this->compress_columns( data );
+				else
+					this->compress_frame( data.empty() ? NULL : &data.front(), data.size(), output );
+				return;
+			}
+
+			if( Z_OK != deflateReset( &m_zstream ) )
+				throw std::runtime_error( "deflateReset() failed during block compression" );
+
+			adler = adler32( adler32( 0L, Z_NULL, 0 ), reinterpret_cast<const Bytef*>( input.empty() ? NULL : &input.front() ), static_cast<uInt>( input.size() ) );
+
+			//Leave room for the sync marker deflateBound() doesn't account for.
+			output.resize( deflateBound( &m_zstream, static_cast<uLong>( input.size() ) ) + 16 );
+
+			m_zstream.next_in = reinterpret_cast<Bytef*>( input.empty() ? NULL : &input.front() );
+			m_zstream.avail_in = static_cast<uInt>( input.size() );
+			m_zstream.next_out = reinterpret_cast<Bytef*>( &output.front() );
+			m_zstream.avail_out = static_cast<uInt>( output.size() );
+
+			for(;;){
+				int ret = deflate( &m_zstream, Z_FULL_FLUSH );
+				if( ret != Z_OK && ret != Z_BUF_ERROR )
+					throw std::runtime_error( std::string() + "deflate() failed during block compression:\n\t" + zError(ret) );
+
+				if( m_zstream.avail_out != 0 )
+					break;
+
+				//Ran out of room, which shouldn't really happen. Grow the output and keep going.
+				std::size_t used = output.size();
+				output.resize( used * 2 );
+				m_zstream.next_out = reinterpret_cast<Bytef*>( &output.front() + used );
+				m_zstream.avail_out = static_cast<uInt>( output.size() - used );
+			}
+
+			output.resize( output.size() - m_zstream.avail_out );
+		}
+
+	protected:
+		virtual void run(){
+			this->compress();
+
+			//Checksumming here keeps it off the thread writing the file.
+			checksum = block_checksum( output.empty() ? NULL : &output.front(), output.size() );
+		}
+	};
+
+private:
+	particle_filter m_filter;     //The filter applied to each block before compressing it.
+	thread_pool* m_pool;          //The worker threads, or NULL if compressing on the calling thread.
+	std::vector< block* > m_blocks; //All the blocks this object owns.
+	std::vector< block* > m_free;   //Blocks available for submit().
+	std::deque< block* > m_pending; //Blocks that have been submitted, in the order of submission.
+
+private:
+	block_deflater( const block_deflater& );
+	block_deflater& operator=( const block_deflater& );
+
+public:
+	/**
+	 * @param numThreads The number of threads to compress on. If 1 the compression is done on the calling thread during submit().
+	 * @param options The codec and its settings to compress with.
+	 * @param filter The filter to apply to each block before compressing it. If enabled, the blocks are compressed as codec frames.
+	 */
+	block_deflater( std::size_t numThreads, const compression_options& options, const particle_filter& filter = particle_filter() ) : m_filter( filter ), m_pool( NULL ){
+		try{
+			if( numThreads > 1 )
+				m_pool = new thread_pool( numThreads );
+
+			//Allow enough blocks in flight to keep all the threads busy while the finished ones are written.
+			std::size_t numBlocks = ( m_pool ) ? 2 * m_pool->size() : 1;
+			for( std::size_t i = 0; i < numBlocks; ++i ){
+				m_blocks.push_back( new block( options, &m_filter ) );
+				m_free.push_back( m_blocks.back() );
+			}
+		}catch( ... ){
+			this->destroy();
+			throw;
+		}
+	}
+
+	~block_deflater(){
+		this->destroy();
+	}
+
+	/**
+	 * @return True if submit() can be called without first calling pop_front().
+	 */
+	bool can_submit() const {
+		return !m_free.empty();
+	}
+
+	/**
+	 * @return True if there are no submitted blocks waiting to be collected with front() & pop_front().
+	 */
+	bool empty() const {
+		return m_pending.empty();
+	}
+
+	/**
+	 * Starts compressing a block of particles.
+	 * @param data The particle data to compress. It is swapped into the block, leaving 'data' with a recycled buffer of unspecified content.
+	 * @param numParticles The number of particles stored in 'data'.
+	 * @param bounds The box around the particles' positions, passed through to the finished block.
+	 * @note can_submit() must be true.
+	 */
+	void submit( std::vector<char>& data, std::size_t numParticles, const float bounds[6] ){
+		block* b = m_free.back();
+		m_free.pop_back();
+
+		b->input.swap( data );
+		b->numParticles = numParticles;
+		memcpy( b->bounds, bounds, sizeof(b->bounds) );
+
+		m_pending.push_back( b );
+
+		if( m_pool )
+			m_pool->submit( b );
+		else
+			b->run();
+	}
+
+	/**
+	 * Waits for the oldest submitted block to finish compressing.
+	 * @return The oldest submitted block, which remains valid until pop_front().
+	 * @note empty() must be false.
+	 */
+	const block& front(){
+		block* b = m_pending.front();
+		if( m_pool )
+			m_pool->wait( b );
+		return *b;
+	}
+
+	/**
+	 * Recycles the oldest submitted block, after front() has returned it.
+	 */
+	void pop_front(){
+		m_free.push_back( m_pending.front() );
+		m_pending.pop_front();
+	}
+
+private:
+	void destroy(){
+		//Deleting the pool finishes any queued work before the blocks are deleted.
+		delete m_pool;
+		m_pool = NULL;
+
+		for( std::vector< block* >::iterator it = m_blocks.begin(), itEnd = m_blocks.end(); it != itEnd; ++it )
+			delete *it;
+
+		m_blocks.clear();
+		m_free.clear();
+		m_pending.clear();
+	}
+};
+
+}//namespace detail
+}//namespace prtio
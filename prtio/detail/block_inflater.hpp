@@ -0,0 +1,383 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the machinery for decompressing the independent blocks of a block indexed PRT file on many threads.
+ */
+
+#pragma once
+
+#include <prtio/detail/codec.hpp>
+#include <prtio/detail/filter.hpp>
+#include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/threading.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace prtio{
+namespace detail{
+
+/**
+ * This class decompresses blocks of particles concurrently on a thread_pool. Each block is read from the file by the
+ * thread that decompresses it, through its own file stream.
+ */
+class block_inflater{
+public:
+	/**
+	 * A single block of particles, and its decompressed particle data once finished.
+	 */
+	class block : public thread_task{
+		friend class block_inflater;
+
+		std::string m_filePath;
+		std::ifstream m_fin;
+		codecs::option m_codec;
+		bool m_framed;
+		const particle_filter* m_filter;
+		z_stream m_zstream;
+		std::vector<char> m_input;
+		std::vector<char> m_filtered; //The decompressed data before unfiltering, if 'm_filter' is enabled.
+
+	public:
+		std::size_t index;           //The index of the block in the file's block index.
+		prt_int64 dataOffset;        //The file offset of the block's compressed data.
+		std::size_t dataLength;      //The number of bytes of compressed data in the block.
+		std::size_t numParticles;    //The number of particles in the block.
+		std::size_t particleSize;    //The size of a single particle in bytes.
+		std::vector<char> output;    //The decompressed particle data.
+		std::vector<bool> columnMask; //For files written with filter_columns, the channel arrays to decompress. Empty for all of them.
+		prt_block_checksum_v1 checksum; //The checksum of the compressed data from the block index, checked before decompressing it if its length isn't -1.
+
+	private:
+		block( const std::string& filePath, codecs::option codec, const particle_filter* filter )
+			: m_filePath( filePath ), m_codec( codec ), m_framed( uses_frames( codec, *filter ) ), m_filter( filter ), index( 0 ), dataOffset( 0 ), dataLength( 0 ), numParticles( 0 ), particleSize( 0 ), checksum( unknown_block_checksum() ){
+			memset( &m_zstream, 0, sizeof(z_stream) );
+
+			m_fin.open( filePath.c_str(), std::ios::in | std::ios::binary );
+			if( m_fin.fail() )
+				throw std::ios_base::failure( "Failed to open file \"" + filePath + "\"" );
+
+			if( codec == codecs::codec_zlib && Z_OK != inflateInit2( &m_zstream, -MAX_WBITS ) )
+				throw std::runtime_error( "Unable to initialize a zlib inflate stream for input stream \"" + filePath + "\"." );
+		}
+
+		~block(){
+			if( m_codec == codecs::codec_zlib )
+				inflateEnd( &m_zstream );
+		}
+
+		void throw_invalid_block(){
+			std::stringstream ss;
+			ss << "Block " << index << " of file \"" << m_filePath << "\" did not contain the number of particles it claimed";
+			throw std::runtime_error( ss.str() );
+		}
+
+		void decompress_frame(){
+			std::size_t compressedLength = 0, uncompressedLength = 0;
+
+			if( m_input.size() < codec_frame_header_size || !read_codec_frame_header( &m_input.front(), compressedLength, uncompressedLength ) ||
+				compressedLength != m_input.size() - codec_frame_header_size || uncompressedLength != output.size() )
+			{
+				this->throw_invalid_block();
+			}
+
+			std::vector<char>& dest = m_filter->enabled() ? m_filtered : output;
+			dest.resize( output.size() );
+
+			codec_decompress( m_codec, &m_input.front() + codec_frame_header_size, compressedLength, dest.empty() ? NULL : &dest.front(), dest.size() );
+
+			if( m_filter->enabled() && !output.empty() )
+				m_filter->reverse( &m_filtered.front(), numParticles, &output.front() );
+		}
+
+		/**
+		 * Compares the compressed data read into 'm_input' with the block's checksum, so corrupt data is reported as such
+		 * instead of as whatever error decompressing it would cause.
+		 */
+		void check_input(){
+			if( checksum.dataLength < 0 )
+				return;
+
+			if( checksum.dataLength > static_cast<prt_int64>( m_input.size() ) ||
+				checksum.checksum != block_checksum( m_input.empty() ? NULL : &m_input.front(), static_cast<std::size_t>( checksum.dataLength ) ) )
+			{
+				std::stringstream ss;
+				ss << "Block " << index << " of file \"" << m_filePath << "\" does not match its checksum, the file is corrupt";
+				throw std::runtime_error( ss.str() );
+			}
+		}
+
+		void read_at( prt_int64 offset, char* dest, std::size_t length ){
+			m_fin.clear();
+			m_fin.seekg( static_cast<std::istream::off_type>( offset ), std::ios::beg );
+			m_fin.read( dest, length );
+			if( static_cast<std::size_t>( m_fin.gcount() ) != length )
+				throw std::ios_base::failure( "Failed to read from file \"" + m_filePath + "\"" );
+		}
+
+		/**
+		 * Copies bytes of the block from 'm_input' when all of it was read to check its checksum, otherwise reads them from the file.
+		 */
+		void read_block_at( prt_int64 offset, char* dest, std::size_t length, bool loaded ){
+			if( loaded )
+				memcpy( dest, &m_input[ static_cast<std::size_t>( offset - dataOffset ) ], length );
+			else
+				this->read_at( offset, dest, length );
+		}
+
+		/**
+		 * Reads and decompresses a block written with filter_columns. Only the channel arrays in 'columnMask' are decompressed,
+		 * and unless the block has a checksum to check, only they are read from the file.
+		 */
+		void read_columns(){
+			char header[codec_frame_header_size];
+			std::size_t compressedLength = 0, uncompressedLength = 0;
+
+			if( dataLength < codec_frame_header_size )
+				this->throw_invalid_block();
+
+			const bool loaded = checksum.dataLength >= 0;
+			if( loaded ){
+				m_input.resize( dataLength );
+				this->read_at( dataOffset, &m_input.front(), dataLength );
+				this->check_input();
+			}
+
+			this->read_block_at( dataOffset, header, codec_frame_header_size, loaded );
+			if( !read_codec_frame_header( header, compressedLength, uncompressedLength ) || compressedLength != dataLength - codec_frame_header_size || uncompressedLength != output.size() )
+				this->throw_invalid_block();
+
+			prt_int64 pos = dataOffset + static_cast<prt_int64>( codec_frame_header_size );
+			const prt_int64 end = dataOffset + static_cast<prt_int64>( dataLength );
+
+			for( std::size_t i = 0, iEnd = m_filter->num_columns(); i < iEnd; ++i ){
+				if( end - pos < static_cast<prt_int64>( codec_frame_header_size ) )
+					this->throw_invalid_block();
+
+				this->read_block_at( pos, header, codec_frame_header_size, loaded );
+				pos += static_cast<prt_int64>( codec_frame_header_size );
+
+				if( !read_codec_frame_header( header, compressedLength, uncompressedLength ) || end - pos < static_cast<prt_int64>( compressedLength ) ||
+					uncompressedLength != m_filter->column_size( i ) * numParticles )
+				{
+					this->throw_invalid_block();
+				}
+
+				if( ( columnMask.empty() || columnMask[i] ) && uncompressedLength > 0 ){
+					const char* compressed;
+					if( loaded ){
+						compressed = ( compressedLength > 0 ) ? &m_input[ static_cast<std::size_t>( pos - dataOffset ) ] : NULL;
+					}else{
+						m_input.resize( compressedLength );
+						if( compressedLength > 0 )
+							this->read_at( pos, &m_input.front(), compressedLength );
+						compressed = m_input.empty() ? NULL : &m_input.front();
+					}
+
+					m_filtered.resize( uncompressedLength );
+					codec_decompress( m_codec, compressed, compressedLength, &m_filtered.front(), uncompressedLength );
+
+					m_filter->reverse_column( i, &m_filtered.front(), numParticles, &output.front() );
+				}
+
+				pos += static_cast<prt_int64>( compressedLength );
+			}
+
+			if( pos != end )
+				this->throw_invalid_block();
+		}
+
+	protected:
+		virtual void run(){
+			output.resize( numParticles * particleSize );
+
+			if( m_filter->columnar() ){
+				this->read_columns();
+				return;
+			}
+
+			m_input.resize( dataLength );
+
+			if( dataLength > 0 )
+				this->read_at( dataOffset, &m_input.front(), dataLength );
+
+			this->check_input();
+
+			if( m_framed ){
+				this->decompress_frame();
+				return;
+			}
+
+			if( output.empty() )
+				return;
+
+			if( Z_OK != inflateReset( &m_zstream ) )
+				throw std::runtime_error( "Unable to reset the zlib inflate stream for input stream \"" + m_filePath + "\"." );
+
+			m_zstream.next_in = reinterpret_cast<Bytef*>( m_input.empty() ? NULL : &m_input.front() );
+			m_zstream.avail_in = static_cast<uInt>( m_input.size() );
+			m_zstream.next_out = reinterpret_cast<Bytef*>( &output.front() );
+			m_zstream.avail_out = static_cast<uInt>( output.size() );
+
+			while( m_zstream.avail_out != 0 ){
+				int ret = inflate( &m_zstream, Z_SYNC_FLUSH );
+				if( ( Z_OK != ret && Z_STREAM_END != ret ) || ( Z_STREAM_END == ret && m_zstream.avail_out != 0 ) ){
+					std::stringstream ss;
+					ss << "inflate() on block " << index << " of file \"" << m_filePath << "\" failed:\n\t";
+					ss << ( Z_STREAM_END == ret ? "The block did not contain the number of particles it claimed" : zError(ret) );
+
+					throw std::runtime_error( ss.str() );
+				}
+			}
+		}
+	};
+
+private:
+	particle_filter m_filter; //The filter to reverse on each block after decompressing it.
+	thread_pool m_pool;
+	std::vector< block* > m_blocks; //All the blocks this object owns.
+	std::vector< block* > m_free;   //Blocks available for submit().
+	std::deque< block* > m_pending; //Blocks that have been submitted, in the order of submission.
+
+private:
+	block_inflater( const block_inflater& );
+	block_inflater& operator=( const block_inflater& );
+
+public:
+	/**
+	 * @param filePath The file to read blocks from.
+	 * @param codec The codec the file's particles were compressed with.
+	 * @param filter The filter the file's particles were compressed with.
+	 * @param numThreads The number of threads to decompress on. If 0, it uses hardware_concurrency().
+	 */
+	block_inflater( const std::string& filePath, codecs::option codec, const particle_filter& filter, std::size_t numThreads ) : m_filter( filter ), m_pool( numThreads ){
+		try{
+			//Allow enough blocks in flight to keep all the threads busy while the finished ones are consumed.
+			for( std::size_t i = 0, iEnd = 2 * m_pool.size(); i < iEnd; ++i ){
+				m_blocks.push_back( new block( filePath, codec, &m_filter ) );
+				m_free.push_back( m_blocks.back() );
+			}
+		}catch( ... ){
+			this->destroy();
+			throw;
+		}
+	}
+
+	~block_inflater(){
+		this->destroy();
+	}
+
+	/**
+	 * @return True if submit() can be called without first calling pop_front().
+	 */
+	bool can_submit() const {
+		return !m_free.empty();
+	}
+
+	/**
+	 * @return True if there are no submitted blocks waiting to be collected.
+	 */
+	bool empty() const {
+		return m_pending.empty();
+	}
+
+	/**
+	 * Starts decompressing a block of particles.
+	 * @param columnMask For files written with filter_columns, true for each channel array that needs to be decompressed. Empty for all of them.
+	 * @param checksum The block's checksum from the block index, or NULL if it doesn't have one. Since only part of a
+	 *                 filter_columns block is read, those aren't checked.
+	 * @note can_submit() must be true.
+	 */
+	void submit( std::size_t index, prt_int64 dataOffset, std::size_t dataLength, std::size_t numParticles, std::size_t particleSize,
+		const std::vector<bool>& columnMask = std::vector<bool>(), const prt_block_checksum_v1* checksum = NULL )
+	{
+		block* b = m_free.back();
+		m_free.pop_back();
+
+		b->index = index;
+		b->dataOffset = dataOffset;
+		b->dataLength = dataLength;
+		b->numParticles = numParticles;
+		b->particleSize = particleSize;
+		b->columnMask = columnMask;
+		b->checksum = checksum ? *checksum : unknown_block_checksum();
+
+		m_pending.push_back( b );
+		m_pool.submit( b );
+	}
+
+	/**
+	 * Waits for the oldest submitted block to finish decompressing.
+	 * @return The oldest submitted block, which remains valid until pop_front().
+	 * @note empty() must be false.
+	 */
+	const block& front(){
+		block* b = m_pending.front();
+		m_pool.wait( b );
+		return *b;
+	}
+
+	/**
+	 * Finds a submitted block that has already finished decompressing, and makes it the front block. If none have finished
+	 * it waits for the oldest one.
+	 * @return The front block, which remains valid until pop_front().
+	 * @note empty() must be false.
+	 */
+	const block& any_finished(){
+		for( std::deque< block* >::iterator it = m_pending.begin(), itEnd = m_pending.end(); it != itEnd; ++it ){
+			if( m_pool.is_done( *it ) ){
+				std::swap( *it, m_pending.front() );
+				break;
+			}
+		}
+		return this->front();
+	}
+
+	/**
+	 * Recycles the front block, after front() or any_finished() has returned it.
+	 */
+	void pop_front(){
+		m_free.push_back( m_pending.front() );
+		m_pending.pop_front();
+	}
+
+private:
+	void destroy(){
+		//Wait for any running blocks before deleting them.
+		for( std::deque< block* >::iterator it = m_pending.begin(), itEnd = m_pending.end(); it != itEnd; ++it ){
+			try{
+				m_pool.wait( *it );
+			}catch( ... ){
+			}
+		}
+
+		for( std::vector< block* >::iterator it = m_blocks.begin(), itEnd = m_blocks.end(); it != itEnd; ++it )
+			delete *it;
+
+		m_blocks.clear();
+		m_free.clear();
+		m_pending.clear();
+	}
+};
+
+}//namespace detail
+}//namespace prtio
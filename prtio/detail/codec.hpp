@@ -0,0 +1,358 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the compression codecs that can be used for the particle data of a PRT file instead of zlib.
+ *
+ * zlib is the codec of the PRT file spec, and is always used unless another is chosen. The other codecs are recorded in a
+ * 'Cdec' header chunk holding the codec's four character code and level (2 x prt_int32). The particle data then starts
+ * with the same four character code, which readers that don't know about codecs will reject as an invalid zlib stream,
+ * followed by a sequence of independently compressed frames:
+ *   prt_int32 compressedLength, prt_int32 uncompressedLength, then 'compressedLength' bytes of compressed particles.
+ *
+ * zlib particle data is normally a single zlib stream, as in the PRT file spec. Files that need independent frames with
+ * zlib (see filter.hpp) use the same framing, where each frame is a raw deflate stream.
+ *
+ * zstd and lz4 are only available when PRTIO_USE_ZSTD and PRTIO_USE_LZ4 are defined, and the libraries are linked.
+ */
+
+#pragma once
+
+#include <prtio/detail/prt_header.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#ifdef PRTIO_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef PRTIO_USE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+namespace prtio{
+
+namespace codecs{
+	enum option{
+		codec_zlib, // The standard PRT compression. Files are readable by any PRT reader.
+		codec_none, // The particle data is stored uncompressed.
+		codec_zstd, // zstd, at levels 1 to 22 (or negative levels for faster compression). Requires PRTIO_USE_ZSTD.
+		codec_lz4,  // lz4, using the fast compressor at level 1 and below, or the high compression compressor at higher levels. Requires PRTIO_USE_LZ4.
+		codec_count // This must be the last entry. It's a marker for the number of codecs.
+	};
+}
+
+namespace detail{
+
+	//This is the size of the header at the start of each frame of codec compressed particles.
+	const std::size_t codec_frame_header_size = 8;
+
+	/**
+	 * @return The four character code that identifies the codec in the file.
+	 */
+	inline prt_int32 codec_fourcc( codecs::option codec ){
+		static const char magic[][4] = { {'z', 'l', 'i', 'b'}, {'n', 'o', 'n', 'e'}, {'z', 's', 't', 'd'}, {'l', 'z', '4', ' '} };
+		return *reinterpret_cast<const prt_int32*>( magic[ codec ] );
+	}
+
+	/**
+	 * Finds the codec with the given four character code.
+	 * @return True if 'fourcc' is a known codec, which is stored in 'outCodec'.
+	 */
+	inline bool codec_from_fourcc( prt_int32 fourcc, codecs::option& outCodec ){
+		for( int i = 0; i < codecs::codec_count; ++i ){
+			if( codec_fourcc( static_cast<codecs::option>( i ) ) == fourcc ){
+				outCodec = static_cast<codecs::option>( i );
+				return true;
+			}
+		}
+		return false;
+	}
+
+	inline const char* codec_name( codecs::option codec ){
+		static const char* names[] = { "zlib", "none", "zstd", "lz4" };
+		return names[ codec ];
+	}
+
+	/**
+	 * @return True if this build of the library supports the codec.
+	 */
+	inline bool is_codec_available( codecs::option codec ){
+		switch( codec ){
+		case codecs::codec_zlib:
+		case codecs::codec_none:
+			return true;
+#ifdef PRTIO_USE_ZSTD
+		case codecs::codec_zstd:
+			return true;
+#endif
+#ifdef PRTIO_USE_LZ4
+		case codecs::codec_lz4:
+			return true;
+#endif
+		default:
+			return false;
+		}
+	}
+
+	/**
+	 * Throws a std::runtime_error if this build of the library doesn't support the codec.
+	 * @param codec The codec to check.
+	 * @param filePath The file being read or written, for the error message.
+	 */
+	inline void check_codec_available( codecs::option codec, const std::string& filePath ){
+		if( !is_codec_available( codec ) ){
+			std::string macroName = ( codec == codecs::codec_zstd ) ? "PRTIO_USE_ZSTD" : "PRTIO_USE_LZ4";
+			throw std::runtime_error( std::string() + "The file \"" + filePath + "\" uses the " + codec_name( codec ) + " codec, which requires building with " + macroName + " defined." );
+		}
+	}
+
+	/**
+	 * @return The compression level used for the codec when none is specified.
+	 */
+	inline int codec_default_level( codecs::option codec ){
+		switch( codec ){
+		case codecs::codec_zlib:
+			return -1; // Z_DEFAULT_COMPRESSION
+		case codecs::codec_zstd:
+			return 3;
+		case codecs::codec_lz4:
+			return 1;
+		default:
+			return 0;
+		}
+	}
+
+	/**
+	 * @return The largest number of bytes that compressing 'srcLength' bytes with the codec can produce, not including the frame header.
+	 */
+	inline std::size_t codec_compress_bound( codecs::option codec, std::size_t srcLength ){
+		switch( codec ){
+#ifdef PRTIO_USE_ZSTD
+		case codecs::codec_zstd:
+			return ZSTD_compressBound( srcLength );
+#endif
+#ifdef PRTIO_USE_LZ4
+		case codecs::codec_lz4:
+			return static_cast<std::size_t>( LZ4_compressBound( static_cast<int>( srcLength ) ) );
+#endif
+		default:
+			return srcLength;
+		}
+	}
+
+	/**
+	 * Compresses a block of particles into a single frame, including the frame header.
+	 * @param codec The codec to compress with. Must not be codec_zlib, which uses a single zlib stream instead of frames.
+	 * @param level The compression level.
+	 * @param src The particle data to compress. No more than 2GB.
+	 * @param srcLength The number of bytes in 'src'.
+	 * @param dest The location to write the frame to. Must have room for codec_frame_header_size + codec_compress_bound( codec, srcLength ) bytes.
+	 * @return The number of bytes in the frame.
+	 */
+	inline std::size_t codec_compress( codecs::option codec, int level, const char* src, std::size_t srcLength, char* dest ){
+		if( srcLength > static_cast<std::size_t>( (std::numeric_limits<prt_int32>::max)() ) )
+			throw std::runtime_error( "Cannot compress more than 2GB of particles in a single frame" );
+
+		//Only the optional codecs have levels.
+		(void)level;
+
+		char* destData = dest + codec_frame_header_size;
+		std::size_t destLength = 0;
+
+		switch( codec ){
+		case codecs::codec_none:
+			memcpy( destData, src, srcLength );
+			destLength = srcLength;
+			break;
+#ifdef PRTIO_USE_ZSTD
+		case codecs::codec_zstd:{
+			std::size_t result = ZSTD_compress( destData, codec_compress_bound( codec, srcLength ), src, srcLength, level );
+			if( ZSTD_isError( result ) )
+				throw std::runtime_error( std::string() + "ZSTD_compress() failed:\n\t" + ZSTD_getErrorName( result ) );
+			destLength = result;
+			break;
+		}
+#endif
+#ifdef PRTIO_USE_LZ4
+		case codecs::codec_lz4:{
+			int bound = static_cast<int>( codec_compress_bound( codec, srcLength ) );
+			int result = ( level > 1 ) ?
+				LZ4_compress_HC( src, destData, static_cast<int>( srcLength ), bound, level ) :
+				LZ4_compress_default( src, destData, static_cast<int>( srcLength ), bound );
+			if( result <= 0 && srcLength > 0 )
+				throw std::runtime_error( "LZ4 compression failed" );
+			destLength = static_cast<std::size_t>( result );
+			break;
+		}
+#endif
+		default:
+			throw std::logic_error( std::string() + "The " + codec_name( codec ) + " codec cannot compress frames" );
+		}
+
+		prt_int32 header[2] = { static_cast<prt_int32>( destLength ), static_cast<prt_int32>( srcLength ) };
+		memcpy( dest, header, codec_frame_header_size );
+
+		return codec_frame_header_size + destLength;
+	}
+
+	/**
+	 * Compresses a block of particles into a single zlib frame, including the frame header. zlib frames need a deflate
+	 * stream so that its settings can be chosen, so they are compressed with this instead of codec_compress().
+	 * @param zstream A raw deflate stream (negative windowBits in deflateInit2()), which is reset before use.
+	 * @param src The particle data to compress. No more than 2GB.
+	 * @param srcLength The number of bytes in 'src'.
+	 * @param dest The frame. It is resized to hold the frame.
+	 */
+	inline void zlib_compress_frame( z_stream& zstream, const char* src, std::size_t srcLength, std::vector<char>& dest ){
+		if( srcLength > static_cast<std::size_t>( (std::numeric_limits<prt_int32>::max)() ) )
+			throw std::runtime_error( "Cannot compress more than 2GB of particles in a single frame" );
+
+		if( Z_OK != deflateReset( &zstream ) )
+			throw std::runtime_error( "deflateReset() failed during frame compression" );
+
+		dest.resize( codec_frame_header_size + deflateBound( &zstream, static_cast<uLong>( srcLength ) ) );
+
+		zstream.next_in = reinterpret_cast<Bytef*>( const_cast<char*>( src ) );
+		zstream.avail_in = static_cast<uInt>( srcLength );
+		zstream.next_out = reinterpret_cast<Bytef*>( &dest.front() + codec_frame_header_size );
+		zstream.avail_out = static_cast<uInt>( dest.size() - codec_frame_header_size );
+
+		int ret = deflate( &zstream, Z_FINISH );
+		if( ret != Z_STREAM_END )
+			throw std::runtime_error( std::string() + "deflate() failed during frame compression:\n\t" + ( ret == Z_OK ? "Ran out of room" : zError(ret) ) );
+
+		dest.resize( dest.size() - zstream.avail_out );
+
+		prt_int32 header[2] = { static_cast<prt_int32>( dest.size() - codec_frame_header_size ), static_cast<prt_int32>( srcLength ) };
+		memcpy( &dest.front(), header, codec_frame_header_size );
+	}
+
+	/**
+	 * Reads the header at the start of a frame.
+	 * @param header The codec_frame_header_size bytes of the header.
+	 * @param outCompressedLength The number of compressed bytes following the header.
+	 * @param outUncompressedLength The number of bytes the frame decompresses to.
+	 * @return False if the header isn't valid.
+	 */
+	inline bool read_codec_frame_header( const char* header, std::size_t& outCompressedLength, std::size_t& outUncompressedLength ){
+		prt_int32 lengths[2];
+		memcpy( lengths, header, codec_frame_header_size );
+
+		if( lengths[0] < 0 || lengths[1] < 0 )
+			return false;
+
+		outCompressedLength = static_cast<std::size_t>( lengths[0] );
+		outUncompressedLength = static_cast<std::size_t>( lengths[1] );
+
+		return true;
+	}
+
+	/**
+	 * Decompresses the data of a frame, throwing a std::runtime_error if it doesn't decompress to exactly 'destLength' bytes.
+	 * @param codec The codec the frame was compressed with.
+	 * @param src The compressed data following the frame header.
+	 * @param srcLength The number of bytes in 'src'.
+	 * @param dest The location to decompress to.
+	 * @param destLength The uncompressed length from the frame header.
+	 */
+	inline void codec_decompress( codecs::option codec, const char* src, std::size_t srcLength, char* dest, std::size_t destLength ){
+		std::size_t result = 0;
+
+		switch( codec ){
+		case codecs::codec_zlib:{
+			z_stream zstream;
+			memset( &zstream, 0, sizeof(z_stream) );
+
+			if( Z_OK != inflateInit2( &zstream, -MAX_WBITS ) )
+				throw std::runtime_error( "Unable to initialize a zlib inflate stream for frame decompression" );
+
+			zstream.next_in = reinterpret_cast<Bytef*>( const_cast<char*>( src ) );
+			zstream.avail_in = static_cast<uInt>( srcLength );
+			zstream.next_out = reinterpret_cast<Bytef*>( dest );
+			zstream.avail_out = static_cast<uInt>( destLength );
+
+			int ret = inflate( &zstream, Z_FINISH );
+			result = destLength - zstream.avail_out;
+
+			inflateEnd( &zstream );
+
+			//Z_BUF_ERROR means the frame ended early or held more than it claimed.
+			if( ret != Z_STREAM_END )
+				throw std::runtime_error( std::string() + "inflate() failed during frame decompression:\n\t" + ( ret == Z_BUF_ERROR ? "The frame's length was wrong" : zError(ret) ) );
+			break;
+		}
+		case codecs::codec_none:
+			result = ( srcLength == destLength ) ? srcLength : 0;
+			if( result > 0 )
+				memcpy( dest, src, srcLength );
+			break;
+#ifdef PRTIO_USE_ZSTD
+		case codecs::codec_zstd:
+			result = ZSTD_decompress( dest, destLength, src, srcLength );
+			if( ZSTD_isError( result ) )
+				throw std::runtime_error( std::string() + "ZSTD_decompress() failed:\n\t" + ZSTD_getErrorName( result ) );
+			break;
+#endif
+#ifdef PRTIO_USE_LZ4
+		case codecs::codec_lz4:{
+			int r = LZ4_decompress_safe( src, dest, static_cast<int>( srcLength ), static_cast<int>( destLength ) );
+			if( r < 0 )
+				throw std::runtime_error( "LZ4_decompress_safe() failed, the data is corrupt" );
+			result = static_cast<std::size_t>( r );
+			break;
+		}
+#endif
+		default:
+			throw std::logic_error( std::string() + "The " + codec_name( codec ) + " codec cannot decompress frames" );
+		}
+
+		if( result != destLength ){
+			std::stringstream ss;
+			ss << "A " << codec_name( codec ) << " frame decompressed to " << result << " bytes instead of " << destLength;
+			throw std::runtime_error( ss.str() );
+		}
+	}
+
+	/**
+	 * Computes the checksum of a block's compressed data that is stored in the block index (see prt_block_checksum_v1).
+	 * @param data The compressed data.
+	 * @param length The number of bytes in 'data'.
+	 * @return The zlib crc32() of the data.
+	 */
+	inline prt_uint32 block_checksum( const char* data, std::size_t length ){
+		uLong crc = crc32( 0L, Z_NULL, 0 );
+
+		//crc32() takes its length as a uInt, so very large blocks are checksummed in pieces.
+		while( length > 0 ){
+			uInt numBytes = static_cast<uInt>( (std::min)( length, static_cast<std::size_t>( 1u << 30 ) ) );
+			crc = crc32( crc, reinterpret_cast<const Bytef*>( data ), numBytes );
+
+			data += numBytes;
+			length -= numBytes;
+		}
+
+		return static_cast<prt_uint32>( crc );
+	}
+
+}//namespace detail
+}//namespace prtio
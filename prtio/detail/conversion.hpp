@@ -20,6 +20,11 @@
 
 #include <cstring>
 #include <prtio/detail/data_types.hpp>
+#include <prtio/detail/half_conversion.hpp>
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
 
 namespace prtio{
 namespace detail{
@@ -69,10 +74,43 @@ namespace detail{
 		return is_signed(dest) ? data_types::sizes[dest] > data_types::sizes[src] : data_types::sizes[dest] >= data_types::sizes[src];
 	}
 
+	/**
+	 * Makes sure a channel can be extracted to a user supplied destination, throwing a std::runtime_error that
+	 * describes the mismatch if it can't.
+	 * @param name The name of the channel.
+	 * @param destType The data type being converted to.
+	 * @param destArity The arity of the destination.
+	 * @param srcType The data type of the channel.
+	 * @param srcArity The arity of the channel.
+	 */
+	inline void check_read_binding( const std::string& name, data_types::enum_t destType, std::size_t destArity, data_types::enum_t srcType, std::size_t srcArity ){
+		if( !is_compatible( destType, srcType ) ){
+			std::stringstream ss;
+			ss << "Incompatible types for channel \"" << name << "\"";
+			ss << ", cannot convert from type: \"" << data_types::names[ srcType ] << "\"";
+			ss << "to: \"" << data_types::names[ destType ] << "\"";
+
+			throw std::runtime_error( ss.str() );
+		}
+
+		if( destArity != srcArity ){
+			std::stringstream ss;
+			ss << "Incompatible types for channel \"" << name << "\"";
+			ss << ", cannot convert from arity: \"" << srcArity << "\"";
+			ss << "to: \"" << destArity << "\"";
+
+			throw std::runtime_error( ss.str() );
+		}
+	}
+
 	//This typedef is for holding a function pointer to prt_converter<T1,T2>::apply. It is used
 	//for converting and copying data at runtime.
 	typedef void(*convert_fn_t)(void*, const void*, std::size_t);
 
+	//This typedef is for holding a function pointer to strided_converter<Converter>::apply. It is used
+	//for converting and copying the same channel of many consecutive particles at runtime.
+	typedef void(*strided_convert_fn_t)(void*, std::size_t, const void*, std::size_t, std::size_t, std::size_t);
+
 	/**
 	 * This template class provides a static function that will convert data from one type
 	 * to another.
@@ -81,6 +119,9 @@ namespace detail{
 	 */
 	template <typename TDest, typename TSrc>
 	struct prt_converter{
+		typedef TDest dest_type;
+		typedef TSrc src_type;
+
 		/**
 		 * This function is used to convert data from one type to another at runtime.
 		 * @param dest A pointer to the destination data.
@@ -100,6 +141,9 @@ namespace detail{
 	 */
 	template <typename T>
 	struct prt_converter<T, T>{
+		typedef T dest_type;
+		typedef T src_type;
+
 		static void apply( void* dest, const void* src, std::size_t arity ){
 			memcpy( dest, src, sizeof(T) * arity );
 		}
@@ -112,6 +156,9 @@ namespace detail{
 	 */
 	template <typename TDest>
 	struct prt_converter<TDest, half>{
+		typedef TDest dest_type;
+		typedef half src_type;
+
 		static void apply( void* dest, const void* src, std::size_t arity ){
 			for( std::size_t i = 0; i < arity; ++i )
 				reinterpret_cast<TDest*>( dest )[i] = static_cast<TDest>( static_cast<float>( reinterpret_cast<const half*>( src )[i] ) );
@@ -125,6 +172,9 @@ namespace detail{
 	 */
 	template <typename TSrc>
 	struct prt_converter<half, TSrc>{
+		typedef half dest_type;
+		typedef TSrc src_type;
+
 		static void apply( void* dest, const void* src, std::size_t arity ){
 			for( std::size_t i = 0; i < arity; ++i )
 				reinterpret_cast<half*>( dest )[i] = static_cast<float>( reinterpret_cast<const TSrc*>( src )[i] );
@@ -137,11 +187,83 @@ namespace detail{
 	 */
 	template <>
 	struct prt_converter<half, half>{
+		typedef half dest_type;
+		typedef half src_type;
+
 		static void apply( void* dest, const void* src, std::size_t arity ){
 			memcpy( dest, src, sizeof(half) * arity );
 		}
 	};
 
+	/**
+	 * This template class applies a prt_converter to a sequence of 'count' values, each separated by a
+	 * fixed number of bytes in the source and destination.
+	 * @tparam Converter The prt_converter specialization to apply to each value.
+	 */
+	template <class Converter>
+	struct strided_converter{
+		/**
+		 * @param dest A pointer to the first destination value.
+		 * @param destStride The number of bytes between consecutive destination values.
+		 * @param src A pointer to the first source value.
+		 * @param srcStride The number of bytes between consecutive source values.
+		 * @param arity The number of consecutive elements in each value.
+		 * @param count The number of values to process.
+		 */
+		static void apply( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t arity, std::size_t count ){
+			char* pDest = static_cast<char*>( dest );
+			const char* pSrc = static_cast<const char*>( src );
+
+			//Packed arrays on both sides are a single run of elements, which the compiler can vectorize.
+			if( destStride == sizeof(typename Converter::dest_type) * arity && srcStride == sizeof(typename Converter::src_type) * arity ){
+				Converter::apply( pDest, pSrc, arity * count );
+				return;
+			}
+
+			//Give the compiler a constant arity for the common cases so it can unroll the conversion.
+			switch( arity ){
+			case 1:
+				for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride )
+					Converter::apply( pDest, pSrc, 1 );
+				break;
+			case 3:
+				for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride )
+					Converter::apply( pDest, pSrc, 3 );
+				break;
+			case 4:
+				for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride )
+					Converter::apply( pDest, pSrc, 4 );
+				break;
+			default:
+				for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride )
+					Converter::apply( pDest, pSrc, arity );
+				break;
+			}
+		}
+	};
+
+	/**
+	 * This template specialization converts float16 to float32 with the vectorized conversion from half_conversion.hpp.
+	 * @overload
+	 */
+	template <>
+	struct strided_converter< prt_converter<float, half> >{
+		static void apply( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t arity, std::size_t count ){
+			half_to_float_strided( dest, destStride, src, srcStride, arity, count );
+		}
+	};
+
+	/**
+	 * This template specialization converts float32 to float16 with the vectorized conversion from half_conversion.hpp.
+	 * @overload
+	 */
+	template <>
+	struct strided_converter< prt_converter<half, float> >{
+		static void apply( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t arity, std::size_t count ){
+			float_to_half_strided( dest, destStride, src, srcStride, arity, count );
+		}
+	};
+
 	/**
 	 * This template function is used for getting a converter to a compile-time known type,
 	 * when the source type is only known at runtime.
@@ -216,5 +338,79 @@ namespace detail{
 		}
 	}
 
+	/**
+	 * This template function is the strided equivalent of get_read_converter(), for converting a channel
+	 * of many particles in a single call.
+	 * @tparam TDest The C++ type to convert to.
+	 * @param srcType The PRT IO type of the source data.
+	 * @return A function pointer to a function that converts from 'srcType' to TDest. NULL if 'srcType' is not known.
+	 */
+	template <class TDest>
+	strided_convert_fn_t get_strided_read_converter( data_types::enum_t srcType ){
+		switch( srcType ){
+		case data_types::type_int8:
+			return &strided_converter< prt_converter<TDest, data_types::int8_t> >::apply;
+		case data_types::type_int16:
+			return &strided_converter< prt_converter<TDest, data_types::int16_t> >::apply;
+		case data_types::type_int32:
+			return &strided_converter< prt_converter<TDest, data_types::int32_t> >::apply;
+		case data_types::type_int64:
+			return &strided_converter< prt_converter<TDest, data_types::int64_t> >::apply;
+		case data_types::type_float16:
+			return &strided_converter< prt_converter<TDest, data_types::float16_t> >::apply;
+		case data_types::type_float32:
+			return &strided_converter< prt_converter<TDest, data_types::float32_t> >::apply;
+		case data_types::type_float64:
+			return &strided_converter< prt_converter<TDest, data_types::float64_t> >::apply;
+		case data_types::type_uint8:
+			return &strided_converter< prt_converter<TDest, data_types::uint8_t> >::apply;
+		case data_types::type_uint16:
+			return &strided_converter< prt_converter<TDest, data_types::uint16_t> >::apply;
+		case data_types::type_uint32:
+			return &strided_converter< prt_converter<TDest, data_types::uint32_t> >::apply;
+		case data_types::type_uint64:
+			return &strided_converter< prt_converter<TDest, data_types::uint64_t> >::apply;
+		default:
+			return NULL;
+		}
+	}
+
+	/**
+	 * This template function is the strided equivalent of get_write_converter(), for converting a channel
+	 * of many particles in a single call.
+	 * @tparam TSrc The C++ type to convert from.
+	 * @param destType The PRT IO type of the destination data.
+	 * @return A function pointer to a function that converts from TSrc to 'destType'. NULL if 'destType' is not known.
+	 */
+	template <class TSrc>
+	strided_convert_fn_t get_strided_write_converter( data_types::enum_t destType ){
+		switch( destType ){
+		case data_types::type_int8:
+			return &strided_converter< prt_converter<data_types::int8_t, TSrc> >::apply;
+		case data_types::type_int16:
+			return &strided_converter< prt_converter<data_types::int16_t, TSrc> >::apply;
+		case data_types::type_int32:
+			return &strided_converter< prt_converter<data_types::int32_t, TSrc> >::apply;
+		case data_types::type_int64:
+			return &strided_converter< prt_converter<data_types::int64_t, TSrc> >::apply;
+		case data_types::type_float16:
+			return &strided_converter< prt_converter<data_types::float16_t, TSrc> >::apply;
+		case data_types::type_float32:
+			return &strided_converter< prt_converter<data_types::float32_t, TSrc> >::apply;
+		case data_types::type_float64:
+			return &strided_converter< prt_converter<data_types::float64_t, TSrc> >::apply;
+		case data_types::type_uint8:
+			return &strided_converter< prt_converter<data_types::uint8_t, TSrc> >::apply;
+		case data_types::type_uint16:
+			return &strided_converter< prt_converter<data_types::uint16_t, TSrc> >::apply;
+		case data_types::type_uint32:
+			return &strided_converter< prt_converter<data_types::uint32_t, TSrc> >::apply;
+		case data_types::type_uint64:
+			return &strided_converter< prt_converter<data_types::uint64_t, TSrc> >::apply;
+		default:
+			return NULL;
+		}
+	}
+
 }//namespace detail
 }//namespace prtio
\ No newline at end of file
@@ -29,6 +29,7 @@
 #pragma warning( pop )
 
 #include <cctype>
+#include <cstdlib>
 #include <string>
 
 #if defined(WIN32) || defined(_WIN64)
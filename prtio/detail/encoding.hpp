@@ -0,0 +1,386 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the lossy encodings that floating point channels can be stored with to make files smaller, such
+ * as a fixed point Position or an octahedral Normal. An encoded channel is stored as a plain integer channel, and
+ * described by its "Encoding" channel metadata, so readers that don't know the encoding still see the integers:
+ *   "Encoding"       string     "Quantized" or "Octahedral".
+ *   "EncodingOffset" float32[n] For "Quantized", the value of each component stored as 0.
+ *   "EncodingScale"  float32[n] For "Quantized", the steps of the stored integer per unit of each component.
+ * A "Quantized" component is stored as round( (value - offset) * scale ), and decoded as stored / scale + offset.
+ * An "Octahedral" unit vector[3] is stored as int16[2], the octahedral projection of the vector scaled by 32767.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/data_types.hpp>
+#include <prtio/prt_metadata.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+namespace encodings{
+	/**
+	 * The lossy encodings a floating point channel can be stored with.
+	 */
+	enum option{
+		encoding_none,       // The channel is stored as its type.
+		encoding_quantized,  // Each component is stored as an integer, scaled and offset to fit a known range.
+		encoding_octahedral, // A unit vector[3] is stored as the int16[2] octahedral projection of its direction.
+		encoding_count       // This must be the last entry. It's a marker for the number of encodings.
+	};
+}
+
+namespace detail{
+
+	//The names of the channel metadata describing an encoding.
+	inline const char* encoding_meta_name(){ return "Encoding"; }
+	inline const char* encoding_offset_meta_name(){ return "EncodingOffset"; }
+	inline const char* encoding_scale_meta_name(){ return "EncodingScale"; }
+
+	inline const char* encoding_name( encodings::option encoding ){
+		static const char* names[] = { "None", "Quantized", "Octahedral" };
+		return names[ encoding ];
+	}
+
+	//This typedef is for holding a function pointer that encodes a channel of many consecutive particles. 'params' holds
+	//the encoding's offset followed by its scale, one per component, for encoding_quantized.
+	typedef void(*encode_fn_t)( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t arity, std::size_t count, const float* params );
+
+	//This typedef is for holding a function pointer that decodes a channel of many consecutive particles straight from
+	//its stored integers, instead of converting them to the destination type. 'arity' is the number of stored components.
+	typedef void(*decode_fn_t)( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t arity, std::size_t count, const float* params );
+
+	/**
+	 * @return The range of integers a quantized component is stored in. Signed types are kept symmetric around 0.
+	 */
+	inline void get_quantized_range( data_types::enum_t type, double& outLow, double& outHigh ){
+		switch( type ){
+		case data_types::type_int8:   outLow = -127.0;        outHigh = 127.0;        break;
+		case data_types::type_int16:  outLow = -32767.0;      outHigh = 32767.0;      break;
+		case data_types::type_int32:  outLow = -2147483647.0; outHigh = 2147483647.0; break;
+		case data_types::type_uint8:  outLow = 0.0;           outHigh = 255.0;        break;
+		case data_types::type_uint16: outLow = 0.0;           outHigh = 65535.0;      break;
+		case data_types::type_uint32: outLow = 0.0;           outHigh = 4294967295.0; break;
+		default:
+			throw std::logic_error( std::string() + "Channels can't be quantized to type \"" + data_types::names[ type ] + "\"" );
+		}
+	}
+
+	/**
+	 * Computes the offset and scale that map each component's range onto the whole range of the stored integer type.
+	 * @param type The integer type the components are stored as.
+	 * @param minValue The smallest value of each component.
+	 * @param maxValue The largest value of each component.
+	 * @param arity The number of components.
+	 * @param outParams Receives the offset of each component followed by the scale of each component.
+	 */
+	inline void get_quantized_params( data_types::enum_t type, const float minValue[], const float maxValue[], std::size_t arity, std::vector<float>& outParams ){
+		double low, high;
+		get_quantized_range( type, low, high );
+
+		outParams.resize( 2 * arity );
+		for( std::size_t k = 0; k < arity; ++k ){
+			//An empty range stores every value as the same integer.
+			double extent = static_cast<double>( maxValue[k] ) - static_cast<double>( minValue[k] );
+			double scale = ( extent > 0 ) ? ( high - low ) / extent : 1.0;
+
+			outParams[arity + k] = static_cast<float>( scale );
+			outParams[k] = static_cast<float>( static_cast<double>( minValue[k] ) - low / static_cast<double>( outParams[arity + k] ) );
+		}
+	}
+
+	/**
+	 * Stores components as integers of type TStored: round( (value - offset) * scale ), clamped to the integer's range.
+	 */
+	template <class TSrc, class TStored>
+	struct quantize_encoder{
+		static void apply( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t arity, std::size_t count, const float* params ){
+			double low, high;
+			get_quantized_range( data_types::traits<TStored>::data_type(), low, high );
+
+			char* pDest = static_cast<char*>( dest );
+			const char* pSrc = static_cast<const char*>( src );
+
+			for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride ){
+				const TSrc* values = reinterpret_cast<const TSrc*>( pSrc );
+
+				for( std::size_t k = 0; k < arity; ++k ){
+					double v = ( static_cast<double>( static_cast<float>( values[k] ) ) - params[k] ) * params[arity + k];
+					v = std::floor( (std::min)( high, (std::max)( low, v ) ) + 0.5 );
+
+					TStored stored = static_cast<TStored>( v );
+					memcpy( pDest + k * sizeof(TStored), &stored, sizeof(TStored) );
+				}
+			}
+		}
+	};
+
+	/**
+	 * Turns components stored as integers of type TStored back into values: stored / scale + offset. The arithmetic is
+	 * done in double from the stored integer, since types like float16 can't hold every stored integer exactly.
+	 */
+	template <class T, class TStored>
+	struct quantize_decoder{
+		static void apply( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t arity, std::size_t count, const float* params ){
+			char* pDest = static_cast<char*>( dest );
+			const char* pSrc = static_cast<const char*>( src );
+
+			for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride ){
+				T* values = reinterpret_cast<T*>( pDest );
+
+				for( std::size_t k = 0; k < arity; ++k ){
+					TStored stored;
+					memcpy( &stored, pSrc + k * sizeof(TStored), sizeof(TStored) );
+
+					values[k] = static_cast<T>( static_cast<double>( stored ) / params[arity + k] + params[k] );
+				}
+			}
+		}
+	};
+
+	inline float sign_not_zero( float v ){
+		return ( v < 0.0f ) ? -1.0f : 1.0f;
+	}
+
+	/**
+	 * Stores unit vectors[3] as the int16[2] octahedral projection of their directions.
+	 */
+	template <class TSrc>
+	struct octahedral_encoder{
+		static void apply( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t, std::size_t count, const float* ){
+			char* pDest = static_cast<char*>( dest );
+			const char* pSrc = static_cast<const char*>( src );
+
+			for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride ){
+				const TSrc* values = reinterpret_cast<const TSrc*>( pSrc );
+
+				float x = static_cast<float>( values[0] ), y = static_cast<float>( values[1] ), z = static_cast<float>( values[2] );
+
+				//Project onto the octahedron |x| + |y| + |z| = 1, folding the lower half over the upper.
+				float length = std::fabs( x ) + std::fabs( y ) + std::fabs( z );
+				if( length > 0.0f ){
+					x /= length;
+					y /= length;
+					z /= length;
+				}else{
+					x = y = 0.0f;
+					z = 1.0f;
+				}
+
+				if( z < 0.0f ){
+					float foldedX = ( 1.0f - std::fabs( y ) ) * sign_not_zero( x );
+					y = ( 1.0f - std::fabs( x ) ) * sign_not_zero( y );
+					x = foldedX;
+				}
+
+				data_types::int16_t stored[2];
+				stored[0] = static_cast<data_types::int16_t>( std::floor( (std::min)( 1.0f, (std::max)( -1.0f, x ) ) * 32767.0f + 0.5f ) );
+				stored[1] = static_cast<data_types::int16_t>( std::floor( (std::min)( 1.0f, (std::max)( -1.0f, y ) ) * 32767.0f + 0.5f ) );
+
+				memcpy( pDest, stored, sizeof(stored) );
+			}
+		}
+	};
+
+	/**
+	 * Turns the int16[2] octahedral projection of a direction back into a unit vector[3].
+	 */
+	template <class T>
+	struct octahedral_decoder{
+		static void apply( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t, std::size_t count, const float* ){
+			char* pDest = static_cast<char*>( dest );
+			const char* pSrc = static_cast<const char*>( src );
+
+			for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride ){
+				T* values = reinterpret_cast<T*>( pDest );
+
+				data_types::int16_t stored[2];
+				memcpy( stored, pSrc, sizeof(stored) );
+
+				float x = static_cast<float>( stored[0] ) / 32767.0f, y = static_cast<float>( stored[1] ) / 32767.0f;
+				float z = 1.0f - std::fabs( x ) - std::fabs( y );
+
+				if( z < 0.0f ){
+					float unfoldedX = ( 1.0f - std::fabs( y ) ) * sign_not_zero( x );
+					y = ( 1.0f - std::fabs( x ) ) * sign_not_zero( y );
+					x = unfoldedX;
+				}
+
+				float length = std::sqrt( x * x + y * y + z * z );
+
+				values[0] = static_cast<T>( x / length );
+				values[1] = static_cast<T>( y / length );
+				values[2] = static_cast<T>( z / length );
+			}
+		}
+	};
+
+	/**
+	 * @return The function that quantizes components of type TSrc to 'storedType', or NULL if it isn't an integer type.
+	 */
+	template <class TSrc>
+	inline encode_fn_t get_quantize_encoder( data_types::enum_t storedType ){
+		switch( storedType ){
+		case data_types::type_int8:
+			return &quantize_encoder<TSrc, data_types::int8_t>::apply;
+		case data_types::type_int16:
+			return &quantize_encoder<TSrc, data_types::int16_t>::apply;
+		case data_types::type_int32:
+			return &quantize_encoder<TSrc, data_types::int32_t>::apply;
+		case data_types::type_uint8:
+			return &quantize_encoder<TSrc, data_types::uint8_t>::apply;
+		case data_types::type_uint16:
+			return &quantize_encoder<TSrc, data_types::uint16_t>::apply;
+		case data_types::type_uint32:
+			return &quantize_encoder<TSrc, data_types::uint32_t>::apply;
+		default:
+			return NULL;
+		}
+	}
+
+	/**
+	 * @return The function that decodes components of 'storedType' quantized to integers into type T, or NULL if it isn't an integer type.
+	 */
+	template <class T>
+	inline decode_fn_t get_quantize_decoder( data_types::enum_t storedType ){
+		switch( storedType ){
+		case data_types::type_int8:
+			return &quantize_decoder<T, data_types::int8_t>::apply;
+		case data_types::type_int16:
+			return &quantize_decoder<T, data_types::int16_t>::apply;
+		case data_types::type_int32:
+			return &quantize_decoder<T, data_types::int32_t>::apply;
+		case data_types::type_uint8:
+			return &quantize_decoder<T, data_types::uint8_t>::apply;
+		case data_types::type_uint16:
+			return &quantize_decoder<T, data_types::uint16_t>::apply;
+		case data_types::type_uint32:
+			return &quantize_decoder<T, data_types::uint32_t>::apply;
+		default:
+			return NULL;
+		}
+	}
+
+	/**
+	 * @return The function that decodes a channel stored as 'storedType' in the given encoding to type T. Only floating
+	 *         point types are decoded.
+	 */
+	template <class T>
+	inline decode_fn_t get_decoder( encodings::option encoding, data_types::enum_t storedType ){
+		if( !is_float( data_types::traits<T>::data_type() ) )
+			return NULL;
+
+		switch( encoding ){
+		case encodings::encoding_quantized:
+			return get_quantize_decoder<T>( storedType );
+		case encodings::encoding_octahedral:
+			return &octahedral_decoder<T>::apply;
+		default:
+			return NULL;
+		}
+	}
+
+	/**
+	 * @return True if the metadata value is the string 'str'.
+	 */
+	inline bool meta_string_equals( const prt_meta_value& value, const char* str ){
+		if( value.get_type() != meta_types::type_string )
+			return false;
+
+		const uchar_type* s = value.get_string();
+		for( ; *str != '\0'; ++s, ++str ){
+			if( *s != static_cast<uchar_type>( *str ) )
+				return false;
+		}
+		return *s == 0;
+	}
+
+	/**
+	 * Finds the encoding a channel is stored with from its metadata, checking that it describes the channel.
+	 * @param name The name of the channel, for error messages.
+	 * @param ch The channel.
+	 * @param metadata The channel's metadata.
+	 * @param outParams Receives the offset of each component followed by the scale of each component, for encoding_quantized.
+	 * @return The channel's encoding, or encoding_none if it doesn't have one.
+	 */
+	inline encodings::option get_channel_encoding( const std::string& name, const prt_channel& ch, const prt_meta_map& metadata, std::vector<float>& outParams ){
+		outParams.clear();
+
+		prt_meta_map::const_iterator it = metadata.find( encoding_meta_name() );
+		if( it == metadata.end() )
+			return encodings::encoding_none;
+
+		if( meta_string_equals( it->second, encoding_name( encodings::encoding_octahedral ) ) ){
+			if( ch.type != data_types::type_int16 || ch.arity != 2 )
+				throw std::runtime_error( "The octahedral channel \"" + name + "\" isn't stored as int16[2]" );
+
+			return encodings::encoding_octahedral;
+		}
+
+		if( !meta_string_equals( it->second, encoding_name( encodings::encoding_quantized ) ) )
+			throw std::runtime_error( "The channel \"" + name + "\" is stored with an unknown encoding" );
+
+		prt_meta_map::const_iterator itOffset = metadata.find( encoding_offset_meta_name() );
+		prt_meta_map::const_iterator itScale = metadata.find( encoding_scale_meta_name() );
+
+		bool valid = is_integral( ch.type ) && data_types::sizes[ ch.type ] <= 4 && itOffset != metadata.end() && itScale != metadata.end();
+		valid = valid && itOffset->second.get_type() == meta_types::type_float32 && itOffset->second.get_arity() == ch.arity;
+		valid = valid && itScale->second.get_type() == meta_types::type_float32 && itScale->second.get_arity() == ch.arity;
+		if( !valid )
+			throw std::runtime_error( "The quantized channel \"" + name + "\" doesn't have a valid offset and scale" );
+
+		const float* offset = itOffset->second.get_ptr<float>();
+		const float* scale = itScale->second.get_ptr<float>();
+
+		outParams.assign( offset, offset + ch.arity );
+		outParams.insert( outParams.end(), scale, scale + ch.arity );
+
+		for( std::size_t k = 0; k < ch.arity; ++k ){
+			if( !( scale[k] != 0.0f ) )
+				throw std::runtime_error( "The quantized channel \"" + name + "\" has a scale of zero" );
+		}
+
+		return encodings::encoding_quantized;
+	}
+
+	/**
+	 * Checks that two files store a channel with the same encoding and parameters, so particles from both can be decoded
+	 * with the same binding.
+	 * @param name The name of the channel, for error messages.
+	 * @param lhsChannel The channel in the first file.
+	 * @param lhsMetadata The channel's metadata in the first file.
+	 * @param rhsChannel The channel in the second file.
+	 * @param rhsMetadata The channel's metadata in the second file.
+	 * @return True if the channel is decoded the same way in both files.
+	 */
+	inline bool same_channel_encoding( const std::string& name, const prt_channel& lhsChannel, const prt_meta_map& lhsMetadata, const prt_channel& rhsChannel, const prt_meta_map& rhsMetadata ){
+		std::vector<float> lhsParams, rhsParams;
+
+		if( get_channel_encoding( name, lhsChannel, lhsMetadata, lhsParams ) != get_channel_encoding( name, rhsChannel, rhsMetadata, rhsParams ) )
+			return false;
+
+		return lhsParams.size() == rhsParams.size() && ( lhsParams.empty() || memcmp( &lhsParams.front(), &rhsParams.front(), sizeof(float) * lhsParams.size() ) == 0 );
+	}
+
+}//namespace detail
+}//namespace prtio
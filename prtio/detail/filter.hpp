@@ -0,0 +1,346 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the filters that can rearrange each block of particle data before it is compressed.
+ *
+ * Filtered files record the filter in a 'Filt' header chunk holding the filter's four character code and its flags
+ * (2 x prt_int32). The particle data of a filtered file is always stored as codec frames (see codec.hpp), even with the
+ * zlib codec, so that each frame can be unfiltered on its own and readers that don't know about filters fail instead of
+ * returning scrambled particles.
+ *
+ * The shuffle filter transposes the particles of a frame from interleaved particles to one array per channel, and splits
+ * those arrays into byte planes: all the first bytes of the channel's first element, then all the second bytes, etc.
+ * Neighbouring particles tend to have similar values, so the byte planes compress much better than interleaved floats.
+ * With filter_flag_delta_id the integer "ID" channel is stored as the difference from the previous particle in the frame
+ * before being shuffled, which turns sequential IDs into a constant.
+ *
+ * The columns filter shuffles the same way, but compresses each channel's array as its own frame, so readers only need
+ * to decompress the channels they extract. The frame of a block then holds one complete codec frame per channel in the
+ * order of the channels' offsets, and its uncompressed length is that of the whole block.
+ */
+
+#pragma once
+
+#include <prtio/detail/codec.hpp>
+#include <prtio/detail/prt_header.hpp>
+#include <prtio/prt_layout.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+namespace filters{
+	enum option{
+		filter_none,    // The particles are compressed as they are laid out.
+		filter_shuffle, // The particles are transposed to channel arrays and shuffled into byte planes before compressing.
+		filter_columns, // As filter_shuffle, with each channel compressed separately so readers can decompress only the channels they use.
+		filter_count    // This must be the last entry. It's a marker for the number of filters.
+	};
+}
+
+namespace detail{
+
+	//This flag in the 'Filt' chunk indicates the integer "ID" channel is delta coded.
+	const prt_int32 filter_flag_delta_id = 1;
+
+	/**
+	 * @return The four character code that identifies the filter in the file.
+	 */
+	inline prt_int32 filter_fourcc( filters::option filter ){
+		static const char magic[][4] = { {'n', 'o', 'n', 'e'}, {'s', 'h', 'u', 'f'}, {'c', 'o', 'l', 's'} };
+		return *reinterpret_cast<const prt_int32*>( magic[ filter ] );
+	}
+
+	/**
+	 * Finds the filter with the given four character code.
+	 * @return True if 'fourcc' is a known filter, which is stored in 'outFilter'.
+	 */
+	inline bool filter_from_fourcc( prt_int32 fourcc, filters::option& outFilter ){
+		for( int i = 0; i < filters::filter_count; ++i ){
+			if( filter_fourcc( static_cast<filters::option>( i ) ) == fourcc ){
+				outFilter = static_cast<filters::option>( i );
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Adds the difference from the previous value to each value of a channel, or does the reverse.
+	 * @tparam T The unsigned integer type the same size as the channel's elements, so the differences wrap around.
+	 */
+	template <class T>
+	struct delta_coder{
+		static void encode( char* data, std::size_t stride, std::size_t arity, std::size_t count ){
+			for( std::size_t k = 0; k < arity; ++k ){
+				T prev = 0;
+				for( std::size_t i = 0; i < count; ++i ){
+					T value;
+					char* p = data + i * stride + k * sizeof(T);
+					memcpy( &value, p, sizeof(T) );
+
+					T delta = static_cast<T>( value - prev );
+					memcpy( p, &delta, sizeof(T) );
+
+					prev = value;
+				}
+			}
+		}
+
+		static void decode( char* data, std::size_t stride, std::size_t arity, std::size_t count ){
+			for( std::size_t k = 0; k < arity; ++k ){
+				T prev = 0;
+				for( std::size_t i = 0; i < count; ++i ){
+					T value;
+					char* p = data + i * stride + k * sizeof(T);
+					memcpy( &value, p, sizeof(T) );
+
+					prev = static_cast<T>( prev + value );
+					memcpy( p, &prev, sizeof(T) );
+				}
+			}
+		}
+	};
+
+/**
+ * This class applies and reverses a filter on blocks of particles with a fixed layout. It is immutable once constructed,
+ * so the same object can be used from many threads.
+ */
+class particle_filter{
+	struct channel_bytes{
+		std::size_t offset;      //The channel's offset from the start of the particle.
+		std::size_t size;        //The number of bytes in the channel, for all its elements.
+		std::size_t elementSize; //The number of bytes in a single element of the channel.
+		std::size_t arity;
+		bool delta;              //If true, the channel is delta coded before shuffling.
+
+		bool operator<( const channel_bytes& rhs ) const {
+			return offset < rhs.offset;
+		}
+	};
+
+	filters::option m_filter;
+	prt_int32 m_flags;
+	std::size_t m_particleSize;
+	std::vector<channel_bytes> m_channels; //The channels of the layout, in the order they are stored in a filtered block.
+
+public:
+	particle_filter() : m_filter( filters::filter_none ), m_flags( 0 ), m_particleSize( 0 )
+	{}
+
+	/**
+	 * @param filter The filter to apply.
+	 * @param flags The filter's flags from the 'Filt' chunk, such as filter_flag_delta_id.
+	 * @param layout The layout of the particles being filtered.
+	 */
+	particle_filter( filters::option filter, prt_int32 flags, const prt_layout& layout ) : m_filter( filter ), m_flags( flags ), m_particleSize( layout.size() ){
+		for( std::size_t i = 0, iEnd = layout.num_channels(); i < iEnd; ++i ){
+			const std::string& name = layout.get_channel_name( i );
+			const prt_channel& ch = layout.get_channel_at( i );
+
+			channel_bytes c;
+			c.offset = ch.offset;
+			c.elementSize = data_types::sizes[ ch.type ];
+			c.arity = ch.arity;
+			c.size = c.elementSize * c.arity;
+			c.delta = ( flags & filter_flag_delta_id ) != 0 && name == "ID" &&
+				ch.type != data_types::type_float16 && ch.type != data_types::type_float32 && ch.type != data_types::type_float64;
+
+			m_channels.push_back( c );
+		}
+
+		std::sort( m_channels.begin(), m_channels.end() );
+	}
+
+	/**
+	 * @return False if this is filter_none, which leaves the particles unchanged.
+	 */
+	bool enabled() const {
+		return m_filter != filters::filter_none;
+	}
+
+	filters::option filter() const {
+		return m_filter;
+	}
+
+	prt_int32 flags() const {
+		return m_flags;
+	}
+
+	/**
+	 * @return True if each channel is compressed separately, as filter_columns.
+	 */
+	bool columnar() const {
+		return m_filter == filters::filter_columns;
+	}
+
+	/**
+	 * @return The number of channel arrays in a filtered block.
+	 */
+	std::size_t num_columns() const {
+		return m_channels.size();
+	}
+
+	/**
+	 * @return The number of bytes per particle in the i'th channel array of a filtered block.
+	 */
+	std::size_t column_size( std::size_t i ) const {
+		return m_channels[i].size;
+	}
+
+	/**
+	 * Finds the channel arrays that hold the channels at the given offsets in the layout.
+	 * @param offsets The offsets of the channels being read. If empty, all the channels are read.
+	 * @param outMask For each channel array, true if it needs to be decompressed.
+	 */
+	void get_column_mask( const std::vector<std::size_t>& offsets, std::vector<bool>& outMask ) const {
+		outMask.assign( m_channels.size(), offsets.empty() );
+
+		for( std::size_t i = 0, iEnd = m_channels.size(); i < iEnd; ++i ){
+			if( std::find( offsets.begin(), offsets.end(), m_channels[i].offset ) != offsets.end() )
+				outMask[i] = true;
+		}
+	}
+
+	/**
+	 * Filters a block of particles.
+	 * @param src The particles to filter. It is modified if any channels are delta coded.
+	 * @param count The number of particles in 'src'.
+	 * @param dest The location to write the filtered block to. Must have room for count * the particle size bytes, and not overlap 'src'.
+	 */
+	void apply( char* src, std::size_t count, char* dest ) const {
+		for( std::vector<channel_bytes>::const_iterator it = m_channels.begin(), itEnd = m_channels.end(); it != itEnd; ++it ){
+			if( it->delta )
+				delta_channel( src + it->offset, *it, count, false );
+
+			//Each byte of the channel becomes a plane of 'count' bytes.
+			const char* pSrc = src + it->offset;
+			for( std::size_t i = 0; i < count; ++i, pSrc += m_particleSize ){
+				char* pDest = dest + i;
+				for( std::size_t b = 0; b < it->size; ++b, pDest += count )
+					*pDest = pSrc[b];
+			}
+
+			dest += it->size * count;
+		}
+	}
+
+	/**
+	 * Reverses apply() on a block of particles.
+	 * @param src The filtered block.
+	 * @param count The number of particles in 'src'.
+	 * @param dest The location to write the particles to. Must have room for count * the particle size bytes, and not overlap 'src'.
+	 */
+	void reverse( const char* src, std::size_t count, char* dest ) const {
+		for( std::size_t i = 0, iEnd = m_channels.size(); i < iEnd; ++i ){
+			this->reverse_column( i, src, count, dest );
+			src += m_channels[i].size * count;
+		}
+	}
+
+	/**
+	 * Reverses apply() on a single channel array of a block of particles, leaving the other channels of 'dest' untouched.
+	 * @param column The index of the channel array.
+	 * @param src The channel array, of column_size( column ) * count bytes.
+	 * @param count The number of particles in the block.
+	 * @param dest The location to write the particles to. Must have room for count * the particle size bytes, and not overlap 'src'.
+	 */
+	void reverse_column( std::size_t column, const char* src, std::size_t count, char* dest ) const {
+		const channel_bytes& c = m_channels[column];
+
+		char* pDest = dest + c.offset;
+		for( std::size_t i = 0; i < count; ++i, pDest += m_particleSize ){
+			const char* pSrc = src + i;
+			for( std::size_t b = 0; b < c.size; ++b, pSrc += count )
+				pDest[b] = *pSrc;
+		}
+
+		if( c.delta )
+			delta_channel( dest + c.offset, c, count, true );
+	}
+
+private:
+	void delta_channel( char* data, const channel_bytes& c, std::size_t count, bool decode ) const {
+		switch( c.elementSize ){
+		case 1:
+			decode ? delta_coder<data_types::uint8_t>::decode( data, m_particleSize, c.arity, count ) : delta_coder<data_types::uint8_t>::encode( data, m_particleSize, c.arity, count );
+			break;
+		case 2:
+			decode ? delta_coder<data_types::uint16_t>::decode( data, m_particleSize, c.arity, count ) : delta_coder<data_types::uint16_t>::encode( data, m_particleSize, c.arity, count );
+			break;
+		case 4:
+			decode ? delta_coder<data_types::uint32_t>::decode( data, m_particleSize, c.arity, count ) : delta_coder<data_types::uint32_t>::encode( data, m_particleSize, c.arity, count );
+			break;
+		case 8:
+			decode ? delta_coder<data_types::uint64_t>::decode( data, m_particleSize, c.arity, count ) : delta_coder<data_types::uint64_t>::encode( data, m_particleSize, c.arity, count );
+			break;
+		}
+	}
+};
+
+	/**
+	 * @return True if the particle data is stored as codec frames, instead of a single zlib stream.
+	 */
+	inline bool uses_frames( codecs::option codec, const particle_filter& filter ){
+		return codec != codecs::codec_zlib || filter.enabled();
+	}
+
+	/**
+	 * Decompresses and unfilters the channel arrays of a frame written with filter_columns.
+	 * @param codec The codec the frame was compressed with.
+	 * @param filter The columns filter.
+	 * @param src The compressed data following the frame header, which is a sequence of one codec frame per channel array.
+	 * @param srcLength The number of bytes in 'src'.
+	 * @param count The number of particles in the frame.
+	 * @param columnMask For each channel array, true if it should be decompressed. The others are skipped, leaving those
+	 *                   channels of 'dest' untouched.
+	 * @param scratch A buffer for the decompressed channel arrays.
+	 * @param dest The location to write the particles to.
+	 */
+	inline void decompress_columns( codecs::option codec, const particle_filter& filter, const char* src, std::size_t srcLength, std::size_t count,
+	                                const std::vector<bool>& columnMask, std::vector<char>& scratch, char* dest )
+	{
+		for( std::size_t i = 0, iEnd = filter.num_columns(); i < iEnd; ++i ){
+			std::size_t compressedLength, uncompressedLength;
+
+			if( srcLength < codec_frame_header_size || !read_codec_frame_header( src, compressedLength, uncompressedLength ) ||
+				srcLength - codec_frame_header_size < compressedLength || uncompressedLength != filter.column_size( i ) * count )
+			{
+				throw std::runtime_error( "A compressed channel was not valid" );
+			}
+
+			src += codec_frame_header_size;
+			srcLength -= codec_frame_header_size;
+
+			if( columnMask[i] && uncompressedLength > 0 ){
+				scratch.resize( uncompressedLength );
+				codec_decompress( codec, src, compressedLength, &scratch.front(), uncompressedLength );
+				filter.reverse_column( i, &scratch.front(), count, dest );
+			}
+
+			src += compressedLength;
+			srcLength -= compressedLength;
+		}
+
+		if( srcLength != 0 )
+			throw std::runtime_error( "A frame of compressed channels had unexpected data at its end" );
+	}
+
+}//namespace detail
+}//namespace prtio
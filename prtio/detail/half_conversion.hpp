@@ -0,0 +1,269 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains vectorized conversions between arrays of float16 and float32 values. The implementation is picked
+ * at runtime: F16C on x86 processors that support it, NEON on 64-bit ARM, and the scalar half class otherwise. Define
+ * PRTIO_NO_SIMD to always use the scalar implementation.
+ */
+
+#pragma once
+
+#include <prtio/detail/data_types.hpp>
+
+#include <cstring>
+
+#if !defined(PRTIO_NO_SIMD)
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PRTIO_HAS_F16C
+#define PRTIO_F16C_TARGET __attribute__((target("avx,f16c")))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define PRTIO_HAS_F16C
+#define PRTIO_F16C_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define PRTIO_HAS_NEON_FP16
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace prtio{
+namespace detail{
+
+	//Converts 'count' consecutive float16 values, stored as their bit patterns, to float32.
+	typedef void(*half_to_float_fn_t)(float*, const data_types::uint16_t*, std::size_t);
+
+	//Converts 'count' consecutive float32 values to float16, stored as their bit patterns.
+	typedef void(*float_to_half_fn_t)(data_types::uint16_t*, const float*, std::size_t);
+
+	inline void half_to_float_scalar( float* dest, const data_types::uint16_t* src, std::size_t count ){
+		for( std::size_t i = 0; i < count; ++i ){
+			data_types::uint16_t bits;
+			memcpy( &bits, src + i, sizeof(bits) );
+
+			half h;
+			h.setBits( bits );
+			dest[i] = static_cast<float>( h );
+		}
+	}
+
+	inline void float_to_half_scalar( data_types::uint16_t* dest, const float* src, std::size_t count ){
+		for( std::size_t i = 0; i < count; ++i ){
+			data_types::uint16_t bits = half( src[i] ).bits();
+			memcpy( dest + i, &bits, sizeof(bits) );
+		}
+	}
+
+#if defined(PRTIO_HAS_F16C)
+	/**
+	 * @return True if the processor and OS support the F16C instructions and the AVX registers they use.
+	 */
+	inline bool cpu_has_f16c(){
+		unsigned int info[4] = { 0, 0, 0, 0 };
+#if defined(_MSC_VER)
+		__cpuid( reinterpret_cast<int*>( info ), 1 );
+#else
+		if( !__get_cpuid( 1, &info[0], &info[1], &info[2], &info[3] ) )
+			return false;
+#endif
+		const unsigned int osxsave = 1u << 27, avx = 1u << 28, f16c = 1u << 29;
+		if( ( info[2] & ( osxsave | avx | f16c ) ) != ( osxsave | avx | f16c ) )
+			return false;
+
+		//Make sure the OS saves the YMM registers.
+#if defined(_MSC_VER)
+		unsigned long long xcr0 = _xgetbv( 0 );
+#else
+		unsigned int xcr0Lo, xcr0Hi;
+		__asm__ __volatile__( "xgetbv" : "=a"( xcr0Lo ), "=d"( xcr0Hi ) : "c"( 0 ) );
+		unsigned long long xcr0 = xcr0Lo;
+#endif
+		return ( xcr0 & 6 ) == 6;
+	}
+
+	PRTIO_F16C_TARGET inline void half_to_float_f16c( float* dest, const data_types::uint16_t* src, std::size_t count ){
+		std::size_t i = 0;
+		for( ; i + 8 <= count; i += 8 )
+			_mm256_storeu_ps( dest + i, _mm256_cvtph_ps( _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) ) ) );
+		half_to_float_scalar( dest + i, src + i, count - i );
+	}
+
+	PRTIO_F16C_TARGET inline void float_to_half_f16c( data_types::uint16_t* dest, const float* src, std::size_t count ){
+		std::size_t i = 0;
+		for( ; i + 8 <= count; i += 8 )
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( dest + i ), _mm256_cvtps_ph( _mm256_loadu_ps( src + i ), _MM_FROUND_TO_NEAREST_INT ) );
+		float_to_half_scalar( dest + i, src + i, count - i );
+	}
+#elif defined(PRTIO_HAS_NEON_FP16)
+	inline void half_to_float_neon( float* dest, const data_types::uint16_t* src, std::size_t count ){
+		std::size_t i = 0;
+		for( ; i + 4 <= count; i += 4 )
+			vst1q_f32( dest + i, vcvt_f32_f16( vreinterpret_f16_u16( vld1_u16( src + i ) ) ) );
+		half_to_float_scalar( dest + i, src + i, count - i );
+	}
+
+	inline void float_to_half_neon( data_types::uint16_t* dest, const float* src, std::size_t count ){
+		std::size_t i = 0;
+		for( ; i + 4 <= count; i += 4 )
+			vst1_u16( dest + i, vreinterpret_u16_f16( vcvt_f16_f32( vld1q_f32( src + i ) ) ) );
+		float_to_half_scalar( dest + i, src + i, count - i );
+	}
+#endif
+
+	/**
+	 * @return The fastest float16 to float32 array conversion supported by this processor.
+	 */
+	inline half_to_float_fn_t get_half_to_float_fn(){
+		//Choosing is idempotent, so there is no harm if two threads race to initialize this.
+		static half_to_float_fn_t s_fn = NULL;
+		if( !s_fn ){
+#if defined(PRTIO_HAS_F16C)
+			s_fn = cpu_has_f16c() ? &half_to_float_f16c : &half_to_float_scalar;
+#elif defined(PRTIO_HAS_NEON_FP16)
+			s_fn = &half_to_float_neon;
+#else
+			s_fn = &half_to_float_scalar;
+#endif
+		}
+		return s_fn;
+	}
+
+	/**
+	 * @return The fastest float32 to float16 array conversion supported by this processor.
+	 */
+	inline float_to_half_fn_t get_float_to_half_fn(){
+		static float_to_half_fn_t s_fn = NULL;
+		if( !s_fn ){
+#if defined(PRTIO_HAS_F16C)
+			s_fn = cpu_has_f16c() ? &float_to_half_f16c : &float_to_half_scalar;
+#elif defined(PRTIO_HAS_NEON_FP16)
+			s_fn = &float_to_half_neon;
+#else
+			s_fn = &float_to_half_scalar;
+#endif
+		}
+		return s_fn;
+	}
+
+	/**
+	 * Converts 'count' values of 'arity' float16 elements each, separated by fixed strides, to float32. Strided values are
+	 * gathered into a contiguous buffer so the whole batch goes through the vectorized conversion.
+	 * @param dest A pointer to the first destination value.
+	 * @param destStride The number of bytes between consecutive destination values.
+	 * @param src A pointer to the first source value.
+	 * @param srcStride The number of bytes between consecutive source values.
+	 * @param arity The number of consecutive elements in each value.
+	 * @param count The number of values to process.
+	 */
+	inline void half_to_float_strided( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t arity, std::size_t count ){
+		enum{ BUFFER_SIZE = 1024 };
+
+		half_to_float_fn_t convertFn = get_half_to_float_fn();
+
+		const std::size_t srcValueSize = sizeof(half) * arity, destValueSize = sizeof(float) * arity;
+		char* pDest = static_cast<char*>( dest );
+		const char* pSrc = static_cast<const char*>( src );
+
+		//The unaligned vector loads and stores mean packed arrays can be converted in place.
+		if( srcStride == srcValueSize && destStride == destValueSize ){
+			convertFn( reinterpret_cast<float*>( pDest ), reinterpret_cast<const data_types::uint16_t*>( pSrc ), arity * count );
+			return;
+		}
+
+		if( arity == 0 || arity > BUFFER_SIZE ){
+			for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride )
+				half_to_float_scalar( reinterpret_cast<float*>( pDest ), reinterpret_cast<const data_types::uint16_t*>( pSrc ), arity );
+			return;
+		}
+
+		data_types::uint16_t srcBuffer[BUFFER_SIZE];
+		float destBuffer[BUFFER_SIZE];
+
+		const std::size_t valuesPerChunk = BUFFER_SIZE / arity;
+
+		while( count > 0 ){
+			std::size_t numValues = ( count < valuesPerChunk ) ? count : valuesPerChunk;
+
+			for( std::size_t i = 0; i < numValues; ++i, pSrc += srcStride )
+				memcpy( srcBuffer + i * arity, pSrc, srcValueSize );
+
+			if( destStride == destValueSize ){
+				convertFn( reinterpret_cast<float*>( pDest ), srcBuffer, numValues * arity );
+				pDest += numValues * destStride;
+			}else{
+				convertFn( destBuffer, srcBuffer, numValues * arity );
+				for( std::size_t i = 0; i < numValues; ++i, pDest += destStride )
+					memcpy( pDest, destBuffer + i * arity, destValueSize );
+			}
+
+			count -= numValues;
+		}
+	}
+
+	/**
+	 * Converts 'count' values of 'arity' float32 elements each, separated by fixed strides, to float16. This is the
+	 * reverse of half_to_float_strided().
+	 */
+	inline void float_to_half_strided( void* dest, std::size_t destStride, const void* src, std::size_t srcStride, std::size_t arity, std::size_t count ){
+		enum{ BUFFER_SIZE = 1024 };
+
+		float_to_half_fn_t convertFn = get_float_to_half_fn();
+
+		const std::size_t srcValueSize = sizeof(float) * arity, destValueSize = sizeof(half) * arity;
+		char* pDest = static_cast<char*>( dest );
+		const char* pSrc = static_cast<const char*>( src );
+
+		if( srcStride == srcValueSize && destStride == destValueSize ){
+			convertFn( reinterpret_cast<data_types::uint16_t*>( pDest ), reinterpret_cast<const float*>( pSrc ), arity * count );
+			return;
+		}
+
+		if( arity == 0 || arity > BUFFER_SIZE ){
+			for( std::size_t i = 0; i < count; ++i, pDest += destStride, pSrc += srcStride )
+				float_to_half_scalar( reinterpret_cast<data_types::uint16_t*>( pDest ), reinterpret_cast<const float*>( pSrc ), arity );
+			return;
+		}
+
+		float srcBuffer[BUFFER_SIZE];
+		data_types::uint16_t destBuffer[BUFFER_SIZE];
+
+		const std::size_t valuesPerChunk = BUFFER_SIZE / arity;
+
+		while( count > 0 ){
+			std::size_t numValues = ( count < valuesPerChunk ) ? count : valuesPerChunk;
+
+			const float* chunkSrc;
+			if( srcStride == srcValueSize ){
+				chunkSrc = reinterpret_cast<const float*>( pSrc );
+				pSrc += numValues * srcStride;
+			}else{
+				for( std::size_t i = 0; i < numValues; ++i, pSrc += srcStride )
+					memcpy( srcBuffer + i * arity, pSrc, srcValueSize );
+				chunkSrc = srcBuffer;
+			}
+
+			convertFn( destBuffer, chunkSrc, numValues * arity );
+
+			for( std::size_t i = 0; i < numValues; ++i, pDest += destStride )
+				memcpy( pDest, destBuffer + i * arity, destValueSize );
+
+			count -= numValues;
+		}
+	}
+
+}//namespace detail
+}//namespace prtio
@@ -0,0 +1,162 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains a minimal read-only memory mapped file, used for reading PRT files without copying.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <ios>
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace prtio{
+namespace detail{
+
+/**
+ * This class maps an entire file into memory for reading. It uses mmap() on POSIX systems and MapViewOfFile() on Windows.
+ */
+class mapped_file{
+	const char* m_data; //The start of the mapped view of the file.
+	std::size_t m_size; //The size of the file in bytes.
+
+#ifdef _WIN32
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif
+
+private:
+	//Not copyable, since we own the mapping.
+	mapped_file( const mapped_file& );
+	mapped_file& operator=( const mapped_file& );
+
+public:
+	mapped_file(){
+		m_data = NULL;
+		m_size = 0;
+#ifdef _WIN32
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = NULL;
+#endif
+	}
+
+	~mapped_file(){
+		close();
+	}
+
+	/**
+	 * Maps the specified file into memory, hinting to the OS that it will be read sequentially.
+	 * @param file Path to the file to map.
+	 */
+	void open( const std::string& file ){
+		close();
+
+#ifdef _WIN32
+		m_file = CreateFileA( file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+		if( m_file == INVALID_HANDLE_VALUE )
+			throw std::ios_base::failure( "Failed to open file \"" + file + "\"" );
+
+		LARGE_INTEGER fileSize;
+		if( !GetFileSizeEx( m_file, &fileSize ) || fileSize.QuadPart == 0 || static_cast<unsigned long long>( fileSize.QuadPart ) > static_cast<std::size_t>( -1 ) ){
+			close();
+			throw std::ios_base::failure( "Failed to memory map file \"" + file + "\"" );
+		}
+
+		m_mapping = CreateFileMappingA( m_file, NULL, PAGE_READONLY, 0, 0, NULL );
+		if( m_mapping != NULL )
+			m_data = static_cast<const char*>( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) );
+
+		if( m_data == NULL ){
+			close();
+			throw std::ios_base::failure( "Failed to memory map file \"" + file + "\"" );
+		}
+
+		m_size = static_cast<std::size_t>( fileSize.QuadPart );
+#else
+		int fd = ::open( file.c_str(), O_RDONLY );
+		if( fd < 0 )
+			throw std::ios_base::failure( "Failed to open file \"" + file + "\"" );
+
+		struct stat st;
+		void* pData = MAP_FAILED;
+
+		if( fstat( fd, &st ) == 0 && st.st_size > 0 )
+			pData = mmap( NULL, static_cast<std::size_t>( st.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+
+		//The mapping stays valid after the descriptor is closed.
+		::close( fd );
+
+		if( pData == MAP_FAILED )
+			throw std::ios_base::failure( "Failed to memory map file \"" + file + "\"" );
+
+		madvise( pData, static_cast<std::size_t>( st.st_size ), MADV_SEQUENTIAL );
+
+		m_data = static_cast<const char*>( pData );
+		m_size = static_cast<std::size_t>( st.st_size );
+#endif
+	}
+
+	/**
+	 * Unmaps the file, invalidating any pointers previously returned by data().
+	 */
+	void close(){
+#ifdef _WIN32
+		if( m_data )
+			UnmapViewOfFile( m_data );
+		if( m_mapping != NULL )
+			CloseHandle( m_mapping );
+		if( m_file != INVALID_HANDLE_VALUE )
+			CloseHandle( m_file );
+		m_mapping = NULL;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if( m_data )
+			munmap( const_cast<char*>( m_data ), m_size );
+#endif
+		m_data = NULL;
+		m_size = 0;
+	}
+
+	bool is_open() const {
+		return m_data != NULL;
+	}
+
+	/**
+	 * @return A pointer to the first byte of the file.
+	 */
+	const char* data() const {
+		return m_data;
+	}
+
+	/**
+	 * @return The size of the file in bytes.
+	 */
+	std::size_t size() const {
+		return m_size;
+	}
+};
+
+}//namespace detail
+}//namespace prtio
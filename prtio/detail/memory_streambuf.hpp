@@ -0,0 +1,144 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the stream buffers that let the PRT streams read from and write to memory instead of files.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <streambuf>
+#include <vector>
+
+namespace prtio{
+namespace detail{
+
+/**
+ * A seekable, read-only stream buffer over a block of memory owned by the caller. Nothing is copied.
+ */
+class memory_istreambuf : public std::streambuf{
+public:
+	memory_istreambuf()
+	{}
+
+	/**
+	 * Starts reading from a new block of memory.
+	 * @param data The memory to read. It must stay valid while this is in use.
+	 * @param size The size of 'data' in bytes.
+	 */
+	void reset( const char* data, std::size_t size ){
+		char* p = const_cast<char*>( data );
+		this->setg( p, p, p + size );
+	}
+
+protected:
+	virtual pos_type seekoff( off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in ){
+		if( !( which & std::ios_base::in ) )
+			return pos_type( off_type( -1 ) );
+
+		const off_type size = static_cast<off_type>( this->egptr() - this->eback() );
+
+		off_type pos = off;
+		if( dir == std::ios_base::cur )
+			pos += static_cast<off_type>( this->gptr() - this->eback() );
+		else if( dir == std::ios_base::end )
+			pos += size;
+
+		if( pos < 0 || pos > size )
+			return pos_type( off_type( -1 ) );
+
+		this->setg( this->eback(), this->eback() + pos, this->egptr() );
+		return pos_type( pos );
+	}
+
+	virtual pos_type seekpos( pos_type pos, std::ios_base::openmode which = std::ios_base::in ){
+		return this->seekoff( off_type( pos ), std::ios_base::beg, which );
+	}
+};
+
+/**
+ * A seekable, write-only stream buffer that stores everything written in a growable std::vector. Writing after seeking
+ * backwards overwrites the earlier bytes, like a file.
+ */
+class vector_ostreambuf : public std::streambuf{
+	std::vector<char>* m_data; //The bytes written so far.
+	std::size_t m_pos;         //The offset in 'm_data' that the next byte is written to.
+
+public:
+	vector_ostreambuf() : m_data( NULL ), m_pos( 0 )
+	{}
+
+	/**
+	 * Starts writing to the beginning of an empty vector.
+	 * @param data The vector to write to. It is cleared, and must stay valid while this is in use.
+	 */
+	void reset( std::vector<char>& data ){
+		m_data = &data;
+		m_data->clear();
+		m_pos = 0;
+	}
+
+protected:
+	virtual std::streamsize xsputn( const char* s, std::streamsize n ){
+		const std::size_t count = static_cast<std::size_t>( n );
+
+		//Overwrite whatever is already there, then append the rest.
+		std::size_t numOverwritten = ( m_pos < m_data->size() ) ? (std::min)( count, m_data->size() - m_pos ) : 0;
+		if( numOverwritten > 0 )
+			memcpy( &(*m_data)[m_pos], s, numOverwritten );
+
+		if( m_pos > m_data->size() )
+			m_data->resize( m_pos );
+		m_data->insert( m_data->end(), s + numOverwritten, s + count );
+
+		m_pos += count;
+		return n;
+	}
+
+	virtual int_type overflow( int_type c = traits_type::eof() ){
+		if( traits_type::eq_int_type( c, traits_type::eof() ) )
+			return traits_type::not_eof( c );
+
+		char ch = traits_type::to_char_type( c );
+		this->xsputn( &ch, 1 );
+		return c;
+	}
+
+	virtual pos_type seekoff( off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::out ){
+		if( !( which & std::ios_base::out ) )
+			return pos_type( off_type( -1 ) );
+
+		off_type pos = off;
+		if( dir == std::ios_base::cur )
+			pos += static_cast<off_type>( m_pos );
+		else if( dir == std::ios_base::end )
+			pos += static_cast<off_type>( m_data->size() );
+
+		if( pos < 0 )
+			return pos_type( off_type( -1 ) );
+
+		m_pos = static_cast<std::size_t>( pos );
+		return pos_type( pos );
+	}
+
+	virtual pos_type seekpos( pos_type pos, std::ios_base::openmode which = std::ios_base::out ){
+		return this->seekoff( off_type( pos ), std::ios_base::beg, which );
+	}
+};
+
+}//namespace detail
+}//namespace prtio
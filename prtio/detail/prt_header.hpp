@@ -26,6 +26,7 @@ namespace prtio{
 namespace detail{
 	typedef prtio::data_types::int32_t prt_int32;
 	typedef prtio::data_types::int64_t prt_int64;
+	typedef prtio::data_types::uint32_t prt_uint32;
 
 	//This is the layout of a PRT file's main header
 	struct prt_header_v1 {
@@ -44,6 +45,32 @@ namespace detail{
 		prt_int32 channelOffset;
 	};
 
+	//This is the layout of each entry in the block index of a PRT file written in independently compressed blocks. The
+	//block index is stored after the compressed particle data, at the file offset given by the 'Bidx' header chunk, as:
+	//  prt_int64 blockCount, prt_int32 entryLength, then 'blockCount' entries of 'entryLength' bytes each.
+	struct prt_block_index_entry_v1 {
+		prt_int64 dataOffset;    //The file offset of the block's first compressed byte.
+		prt_int64 particleCount; //The number of particles in the block.
+	};
+
+	//When the block index entries are long enough, this follows the prt_block_index_entry_v1 part of each entry.
+	struct prt_block_bounds_v1 {
+		float bounds[6]; //The box around the block's Position channel, ordered like the BoundBox metadata. Infinite if the file has no float32[3] Position.
+	};
+
+	//When the block index entries are long enough, this follows the prt_block_bounds_v1 part of each entry.
+	struct prt_block_checksum_v1 {
+		prt_int64  dataLength; //The number of compressed bytes in the block, or -1 if the block's checksum isn't known.
+		prt_uint32 checksum;   //The zlib crc32() of the block's 'dataLength' compressed bytes.
+		prt_uint32 reserved;   //Always 0.
+	};
+
+	//Returns the checksum entry of a block whose checksum isn't known, ex. a block copied from a file written before they were stored.
+	inline prt_block_checksum_v1 unknown_block_checksum(){
+		prt_block_checksum_v1 result = { -1, 0, 0 };
+		return result;
+	}
+
 	//Returns the 8 byte magic number that indicates this file format
 	inline prt_int64 prt_magic_number(){
 		static const unsigned char magic[] = {192, 'P', 'R', 'T', '\r', '\n', 26, '\n'};
@@ -65,6 +92,21 @@ namespace detail{
 		return *reinterpret_cast<const prt_int32*>( magic );
 	}
 	
+	inline prt_int32 prt_block_index_chunk(){
+		static const char magic[] = {'B', 'i', 'd', 'x'};
+		return *reinterpret_cast<const prt_int32*>( magic );
+	}
+	
+	inline prt_int32 prt_codec_chunk(){
+		static const char magic[] = {'C', 'd', 'e', 'c'};
+		return *reinterpret_cast<const prt_int32*>( magic );
+	}
+	
+	inline prt_int32 prt_filter_chunk(){
+		static const char magic[] = {'F', 'i', 'l', 't'};
+		return *reinterpret_cast<const prt_int32*>( magic );
+	}
+	
 	inline bool is_valid_channel_name( const char* name ){
 		if( !std::isalpha(*name) && *name != '_' )
 			return false;
@@ -0,0 +1,136 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the helpers for writing spatially sorted blocks and culling them against boxes. Boxes are stored
+ * as 6 floats like the BoundBox metadata: the minimum x, y, z followed by the maximum x, y, z.
+ */
+
+#pragma once
+
+#include <prtio/detail/data_types.hpp>
+
+#include <cstring>
+#include <limits>
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * Sets a box to be empty, so that growing it by any point gives a box containing just that point.
+	 */
+	inline void set_empty_box( float box[6] ){
+		box[0] = box[1] = box[2] = (std::numeric_limits<float>::max)();
+		box[3] = box[4] = box[5] = -(std::numeric_limits<float>::max)();
+	}
+
+	/**
+	 * Sets a box to contain everything, for blocks whose positions aren't known.
+	 */
+	inline void set_infinite_box( float box[6] ){
+		box[0] = box[1] = box[2] = -(std::numeric_limits<float>::max)();
+		box[3] = box[4] = box[5] = (std::numeric_limits<float>::max)();
+	}
+
+	/**
+	 * Grows a box to contain the positions of 'count' particles.
+	 * @param box The box to grow.
+	 * @param data A pointer to the first particle.
+	 * @param count The number of particles.
+	 * @param particleSize The number of bytes between consecutive particles.
+	 * @param posOffset The offset of the float32[3] Position channel in each particle.
+	 */
+	inline void grow_box( float box[6], const char* data, std::size_t count, std::size_t particleSize, std::size_t posOffset ){
+		for( std::size_t i = 0; i < count; ++i, data += particleSize ){
+			float p[3];
+			memcpy( p, data + posOffset, sizeof(float) * 3 );
+
+			for( int k = 0; k < 3; ++k ){
+				if( p[k] < box[k] )
+					box[k] = p[k];
+				if( p[k] > box[3 + k] )
+					box[3 + k] = p[k];
+			}
+		}
+	}
+
+	/**
+	 * Grows a box to contain another box. Growing by an empty box leaves it as it was.
+	 */
+	inline void merge_box( float box[6], const float other[6] ){
+		for( int k = 0; k < 3; ++k ){
+			if( other[k] < box[k] )
+				box[k] = other[k];
+			if( other[3 + k] > box[3 + k] )
+				box[3 + k] = other[3 + k];
+		}
+	}
+
+	/**
+	 * @return True if the boxes have any points in common.
+	 */
+	inline bool boxes_overlap( const float a[6], const float b[6] ){
+		return a[0] <= b[3] && a[1] <= b[4] && a[2] <= b[5] &&
+		       b[0] <= a[3] && b[1] <= a[4] && b[2] <= a[5];
+	}
+
+	/**
+	 * @return True if the point is inside the box, including its boundary.
+	 */
+	inline bool box_contains( const float box[6], const float p[3] ){
+		return p[0] >= box[0] && p[1] >= box[1] && p[2] >= box[2] &&
+		       p[0] <= box[3] && p[1] <= box[4] && p[2] <= box[5];
+	}
+
+	/**
+	 * Spreads the low 21 bits of 'v' out so there are two zero bits between each of them.
+	 */
+	inline data_types::uint64_t spread_bits_3d( data_types::uint64_t v ){
+		v &= 0x1fffffULL;
+		v = ( v | ( v << 32 ) ) & 0x1f00000000ffffULL;
+		v = ( v | ( v << 16 ) ) & 0x1f0000ff0000ffULL;
+		v = ( v | ( v << 8 ) ) & 0x100f00f00f00f00fULL;
+		v = ( v | ( v << 4 ) ) & 0x10c30c30c30c30c3ULL;
+		v = ( v | ( v << 2 ) ) & 0x1249249249249249ULL;
+		return v;
+	}
+
+	/**
+	 * Computes the position of a point along the Morton (Z-order) curve through a box, so that sorting by it keeps
+	 * nearby points together.
+	 * @param box The box containing all the points being sorted.
+	 * @param p The point.
+	 * @return The 63 bit Morton code of the point, quantized to 21 bits per axis.
+	 */
+	inline data_types::uint64_t morton_code( const float box[6], const float p[3] ){
+		const float maxCell = static_cast<float>( ( 1 << 21 ) - 1 );
+
+		data_types::uint64_t result = 0;
+		for( int k = 0; k < 3; ++k ){
+			float extent = box[3 + k] - box[k];
+			float t = ( extent > 0 ) ? ( p[k] - box[k] ) / extent * maxCell : 0.f;
+
+			//Also catches NaN, which fails every comparison.
+			if( !( t >= 0.f ) )
+				t = 0.f;
+			else if( t > maxCell )
+				t = maxCell;
+
+			result |= spread_bits_3d( static_cast<data_types::uint64_t>( t ) ) << k;
+		}
+		return result;
+	}
+
+}//namespace detail
+}//namespace prtio
@@ -0,0 +1,324 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains minimal threading primitives and a thread pool, used for spreading compression work across cores.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace prtio{
+namespace detail{
+
+/**
+ * A non-recursive mutex.
+ */
+class mutex{
+#ifdef _WIN32
+	CRITICAL_SECTION m_cs;
+#else
+	pthread_mutex_t m_mutex;
+#endif
+
+	friend class condition;
+
+private:
+	mutex( const mutex& );
+	mutex& operator=( const mutex& );
+
+public:
+#ifdef _WIN32
+	mutex(){ InitializeCriticalSection( &m_cs ); }
+	~mutex(){ DeleteCriticalSection( &m_cs ); }
+	void lock(){ EnterCriticalSection( &m_cs ); }
+	void unlock(){ LeaveCriticalSection( &m_cs ); }
+#else
+	mutex(){ pthread_mutex_init( &m_mutex, NULL ); }
+	~mutex(){ pthread_mutex_destroy( &m_mutex ); }
+	void lock(){ pthread_mutex_lock( &m_mutex ); }
+	void unlock(){ pthread_mutex_unlock( &m_mutex ); }
+#endif
+};
+
+/**
+ * Locks a mutex for the lifetime of the object.
+ */
+class scoped_lock{
+	mutex& m_mutex;
+
+private:
+	scoped_lock( const scoped_lock& );
+	scoped_lock& operator=( const scoped_lock& );
+
+public:
+	explicit scoped_lock( mutex& m ) : m_mutex( m ){
+		m_mutex.lock();
+	}
+
+	~scoped_lock(){
+		m_mutex.unlock();
+	}
+};
+
+/**
+ * A condition variable that is waited on while holding a detail::mutex.
+ */
+class condition{
+#ifdef _WIN32
+	CONDITION_VARIABLE m_cond;
+#else
+	pthread_cond_t m_cond;
+#endif
+
+private:
+	condition( const condition& );
+	condition& operator=( const condition& );
+
+public:
+#ifdef _WIN32
+	condition(){ InitializeConditionVariable( &m_cond ); }
+	~condition(){}
+	void wait( mutex& m ){ SleepConditionVariableCS( &m_cond, &m.m_cs, INFINITE ); }
+	void notify_one(){ WakeConditionVariable( &m_cond ); }
+	void notify_all(){ WakeAllConditionVariable( &m_cond ); }
+#else
+	condition(){ pthread_cond_init( &m_cond, NULL ); }
+	~condition(){ pthread_cond_destroy( &m_cond ); }
+	void wait( mutex& m ){ pthread_cond_wait( &m_cond, &m.m_mutex ); }
+	void notify_one(){ pthread_cond_signal( &m_cond ); }
+	void notify_all(){ pthread_cond_broadcast( &m_cond ); }
+#endif
+};
+
+/**
+ * @return The number of hardware threads available, or 1 if it can't be determined.
+ */
+inline std::size_t hardware_concurrency(){
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	return info.dwNumberOfProcessors > 0 ? static_cast<std::size_t>( info.dwNumberOfProcessors ) : 1u;
+#else
+	long result = sysconf( _SC_NPROCESSORS_ONLN );
+	return result > 0 ? static_cast<std::size_t>( result ) : 1u;
+#endif
+}
+
+/**
+ * A unit of work that is run by a thread_pool. The object is not owned by the pool, and must stay alive until
+ * thread_pool::wait() has returned for it.
+ */
+class thread_task{
+	friend class thread_pool;
+
+	bool m_done;
+	bool m_failed;
+	std::string m_error;
+
+protected:
+	/**
+	 * Subclasses implement the work here. Exceptions are caught on the worker thread and rethrown from thread_pool::wait().
+	 */
+	virtual void run() = 0;
+
+public:
+	thread_task() : m_done( true ), m_failed( false )
+	{}
+
+	virtual ~thread_task()
+	{}
+};
+
+/**
+ * A fixed size pool of worker threads that run thread_task objects in the order they were submitted.
+ */
+class thread_pool{
+	std::vector<
+#ifdef _WIN32
+		HANDLE
+#else
+		pthread_t
+#endif
+	> m_threads;
+
+	std::deque< thread_task* > m_queue;
+	mutex m_mutex;
+	condition m_taskReady;
+	condition m_taskDone;
+	bool m_stopping;
+
+private:
+	thread_pool( const thread_pool& );
+	thread_pool& operator=( const thread_pool& );
+
+	void worker_loop(){
+		for(;;){
+			thread_task* task;
+			{
+				scoped_lock lock( m_mutex );
+				while( m_queue.empty() && !m_stopping )
+					m_taskReady.wait( m_mutex );
+				if( m_queue.empty() )
+					return;
+				task = m_queue.front();
+				m_queue.pop_front();
+			}
+
+			bool failed = false;
+			std::string error;
+
+			try{
+				task->run();
+			}catch( const std::exception& e ){
+				failed = true;
+				error = e.what();
+			}catch( ... ){
+				failed = true;
+				error = "Unknown exception in worker thread";
+			}
+
+			scoped_lock lock( m_mutex );
+			task->m_failed = failed;
+			task->m_error.swap( error );
+			task->m_done = true;
+			m_taskDone.notify_all();
+		}
+	}
+
+#ifdef _WIN32
+	static unsigned __stdcall thread_entry( void* pool ){
+		static_cast<thread_pool*>( pool )->worker_loop();
+		return 0;
+	}
+#else
+	static void* thread_entry( void* pool ){
+		static_cast<thread_pool*>( pool )->worker_loop();
+		return NULL;
+	}
+#endif
+
+public:
+	/**
+	 * Starts the worker threads.
+	 * @param numThreads The number of worker threads. If 0, it uses hardware_concurrency().
+	 */
+	explicit thread_pool( std::size_t numThreads = 0 ) : m_stopping( false ){
+		if( numThreads == 0 )
+			numThreads = hardware_concurrency();
+
+		for( std::size_t i = 0; i < numThreads; ++i ){
+#ifdef _WIN32
+			HANDLE h = reinterpret_cast<HANDLE>( _beginthreadex( NULL, 0, &thread_pool::thread_entry, this, 0, NULL ) );
+			if( h == 0 )
+				break;
+			m_threads.push_back( h );
+#else
+			pthread_t t;
+			if( pthread_create( &t, NULL, &thread_pool::thread_entry, this ) != 0 )
+				break;
+			m_threads.push_back( t );
+#endif
+		}
+
+		if( m_threads.empty() )
+			throw std::runtime_error( "Unable to start any worker threads" );
+	}
+
+	/**
+	 * Runs any tasks still queued, then stops the worker threads.
+	 */
+	~thread_pool(){
+		{
+			scoped_lock lock( m_mutex );
+			m_stopping = true;
+			m_taskReady.notify_all();
+		}
+
+		for( std::size_t i = 0; i < m_threads.size(); ++i ){
+#ifdef _WIN32
+			WaitForSingleObject( m_threads[i], INFINITE );
+			CloseHandle( m_threads[i] );
+#else
+			pthread_join( m_threads[i], NULL );
+#endif
+		}
+	}
+
+	/**
+	 * @return The number of worker threads in the pool.
+	 */
+	std::size_t size() const {
+		return m_threads.size();
+	}
+
+	/**
+	 * Queues a task to be run on a worker thread.
+	 * @param task The task to run. It must not already be queued or running.
+	 */
+	void submit( thread_task* task ){
+		scoped_lock lock( m_mutex );
+		task->m_done = false;
+		task->m_failed = false;
+		m_queue.push_back( task );
+		m_taskReady.notify_one();
+	}
+
+	/**
+	 * @return True if the task is not queued or running.
+	 */
+	bool is_done( thread_task* task ){
+		scoped_lock lock( m_mutex );
+		return task->m_done;
+	}
+
+	/**
+	 * Blocks until the task has been run. If the task threw an exception, a std::runtime_error with the same message is thrown here.
+	 * @param task The task to wait for.
+	 */
+	void wait( thread_task* task ){
+		std::string error;
+		{
+			scoped_lock lock( m_mutex );
+			while( !task->m_done )
+				m_taskDone.wait( m_mutex );
+
+			if( !task->m_failed )
+				return;
+
+			task->m_failed = false;
+			error.swap( task->m_error );
+		}
+
+		throw std::runtime_error( error );
+	}
+};
+
+}//namespace detail
+}//namespace prtio
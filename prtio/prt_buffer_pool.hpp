@@ -0,0 +1,135 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains a pool of the temporary buffers that the PRT file streams compress and decompress through, so
+ * programs that open many files can reuse them instead of allocating new ones for every file.
+ */
+
+#pragma once
+
+#include <prtio/detail/threading.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class keeps the buffers released by the streams it is given to (see prt_ifstream::set_buffer_pool() and
+ * prt_ofstream::set_buffer_pool()) and hands them out again when another stream is opened. It can be shared by streams
+ * on different threads. The pool must outlive the streams using it.
+ */
+class prt_buffer_pool{
+	struct free_buffer{
+		char* data;
+		std::size_t size;
+	};
+
+	detail::mutex m_mutex;
+	std::vector<free_buffer> m_freeBuffers;
+	std::size_t m_maxFreeBuffers;
+
+private:
+	prt_buffer_pool( const prt_buffer_pool& );
+	prt_buffer_pool& operator=( const prt_buffer_pool& );
+
+public:
+	/**
+	 * @param maxFreeBuffers The number of released buffers to keep. Buffers released beyond that are freed. It should be
+	 *                       about the number of streams open at the same time.
+	 */
+	explicit prt_buffer_pool( std::size_t maxFreeBuffers = 16 ) : m_maxFreeBuffers( maxFreeBuffers ){
+		m_freeBuffers.reserve( maxFreeBuffers );
+	}
+
+	~prt_buffer_pool(){
+		this->clear();
+	}
+
+	/**
+	 * Hands out a buffer of at least 'size' bytes, reusing a released one if it is big enough.
+	 * @param size The number of bytes needed.
+	 * @param outSize Receives the size of the returned buffer, which must be passed back to release().
+	 * @return The buffer, which belongs to the caller until it is released.
+	 */
+	char* acquire( std::size_t size, std::size_t& outSize ){
+		{
+			detail::scoped_lock lock( m_mutex );
+
+			//Take the smallest buffer that fits, so bigger ones are left for the streams that need them.
+			std::size_t best = m_freeBuffers.size();
+			for( std::size_t i = 0; i < m_freeBuffers.size(); ++i ){
+				if( m_freeBuffers[i].size >= size && ( best == m_freeBuffers.size() || m_freeBuffers[i].size < m_freeBuffers[best].size ) )
+					best = i;
+			}
+
+			if( best != m_freeBuffers.size() ){
+				char* result = m_freeBuffers[best].data;
+				outSize = m_freeBuffers[best].size;
+
+				m_freeBuffers[best] = m_freeBuffers.back();
+				m_freeBuffers.pop_back();
+				return result;
+			}
+		}
+
+		char* result = new char[size];
+		outSize = size;
+		return result;
+	}
+
+	/**
+	 * Gives back a buffer from acquire(), to be handed out again.
+	 * @param data The buffer. Ignored if NULL.
+	 * @param size The size of the buffer, as returned by acquire().
+	 */
+	void release( char* data, std::size_t size ){
+		if( !data )
+			return;
+
+		{
+			detail::scoped_lock lock( m_mutex );
+
+			if( m_freeBuffers.size() < m_maxFreeBuffers ){
+				free_buffer buffer = { data, size };
+				m_freeBuffers.push_back( buffer );
+				return;
+			}
+		}
+
+		delete[] data;
+	}
+
+	/**
+	 * Frees all the buffers that have been released to the pool.
+	 */
+	void clear(){
+		detail::scoped_lock lock( m_mutex );
+
+		for( std::size_t i = 0; i < m_freeBuffers.size(); ++i )
+			delete[] m_freeBuffers[i].data;
+		m_freeBuffers.clear();
+	}
+
+	/**
+	 * @return The number of released buffers waiting to be handed out again.
+	 */
+	std::size_t free_count(){
+		detail::scoped_lock lock( m_mutex );
+		return m_freeBuffers.size();
+	}
+};
+
+}//namespace prtio
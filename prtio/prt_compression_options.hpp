@@ -0,0 +1,61 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the options controlling how prt_ofstream compresses particles.
+ */
+
+#pragma once
+
+#include <prtio/detail/codec.hpp>
+#include <prtio/detail/filter.hpp>
+
+#include <cstddef>
+#include <zlib.h>
+
+namespace prtio{
+
+/**
+ * This struct holds the settings prt_ofstream uses to compress particles. The defaults match the plain zlib compression
+ * of the PRT file spec.
+ */
+struct compression_options{
+	codecs::option codec; //The codec to compress with. See prt_ofstream::set_codec().
+	int level;            //The compression level. Its meaning depends on the codec, so change the codec through the constructor or set this too.
+	filters::option filter; //The filter applied to each block of particles before compressing. See prt_ofstream::set_filter().
+
+	//zlib only settings, as passed to deflateInit2().
+	int strategy;   //Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY or Z_RLE.
+	int windowBits; //The base two logarithm of the window size, from 9 to 15.
+	int memLevel;   //The amount of memory for the internal compression state, from 1 to 9.
+
+	std::size_t bufferSize; //The size in bytes of the buffer compressed data is collected in before writing to disk.
+
+	//If true, the first 'autoSampleSize' particles are compressed with a few settings of the codec (level and zlib strategy)
+	//and the one with the lowest estimated cost is used for the file. The cost is the time to compress plus the time to
+	//write the result at 'autoBytesPerSecond'.
+	bool autoTune;
+	std::size_t autoSampleSize; //The number of particles to sample, or 0 for about 1MB of particle data.
+	double autoBytesPerSecond;  //The expected speed of the storage being written to.
+
+	/**
+	 * @param codec The codec to compress with. The level starts as the codec's default level.
+	 */
+	explicit compression_options( codecs::option codec = codecs::codec_zlib )
+		: codec( codec ), level( detail::codec_default_level( codec ) ), filter( filters::filter_none ), strategy( Z_DEFAULT_STRATEGY ), windowBits( MAX_WBITS ), memLevel( 8 ),
+		  bufferSize( 1 << 19 ), autoTune( false ), autoSampleSize( 0 ), autoBytesPerSecond( 200.0 * 1024 * 1024 )
+	{}
+};
+
+}//namespace prtio
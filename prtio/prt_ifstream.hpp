@@ -19,9 +19,19 @@
 
 #pragma once
 
+#include <prtio/prt_buffer_pool.hpp>
 #include <prtio/prt_istream.hpp>
+#include <prtio/detail/async_io.hpp>
+#include <prtio/detail/codec.hpp>
+#include <prtio/detail/filter.hpp>
+#include <prtio/detail/mapped_file.hpp>
+#include <prtio/detail/memory_streambuf.hpp>
 #include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/spatial.hpp>
+#include <algorithm>
 #include <fstream>
+#include <iostream>
+#include <limits>
 #include <zlib.h>
 
 #ifdef _WIN32
@@ -35,45 +45,87 @@ namespace prtio{
  * This class implements the prt_istream interface, for reading particles from a file.
  */
 class prt_ifstream : public prt_istream{
+public:
+	/**
+	 * The ways the compressed particle data can be read from the file.
+	 */
+	enum input_mode{
+		input_buffered, //The compressed data is read through std::ifstream into a temporary buffer.
+		input_mapped,   //The file is memory mapped and decompressed directly from the mapping, avoiding the temporary buffer.
+		input_async     //The compressed data is read ahead on a background thread while the previous data is decompressed.
+	};
+
+private:
 	std::string m_filePath; //The path to the PRT file.
-	std::ifstream m_fin;    //The stream that is reading bytes from the file.
+	std::ifstream m_file;   //The file being read, unless reading from memory.
+	detail::memory_istreambuf m_memoryBuffer; //The stream buffer over the memory being read, when opened by open_memory().
+	std::istream m_fin;     //The stream that is reading bytes from the file or memory.
 	z_stream m_zstream;     //The zlib stream that is decompressing particle from the file.
+	bool m_zstreamReady;    //True once 'm_zstream' is initialized. It is reset rather than initialized again by reopen().
 
 	char* m_buffer;           //A temporary buffer for storing the compressed file data before being unzipped.
 	std::size_t m_bufferSize; //The size of 'm_buffer' in bytes.
+	prt_buffer_pool* m_bufferPool; //The pool 'm_buffer' is taken from, or NULL to allocate it.
+
+	detail::mapped_file m_mappedFile; //The memory mapping of the file when opened with input_mapped.
+	const char* m_inputData;          //All the bytes of the file when they are in memory (mapped, or given to open_memory()), otherwise NULL.
+	std::size_t m_inputSize;          //The size in bytes of 'm_inputData'.
+	std::size_t m_inputOffset;        //The offset in 'm_inputData' of the next compressed byte to give to zlib.
+
+	detail::async_reader* m_asyncReader; //Reads the compressed data ahead when opened with input_async, or NULL.
 
 	detail::prt_int64 m_particleCount; //The number of particles remaining in the file.
+	detail::prt_int64 m_totalParticles; //The number of particles in the file.
+
+	codecs::option m_codec;          //The codec the particles were compressed with.
+	detail::particle_filter m_filter; //The filter the particles were compressed with.
+	std::vector<char> m_frameInput;  //The compressed data of the current frame, for framed files.
+	std::vector<char> m_frameData;   //The decompressed particle data of the current frame, for framed files.
+	std::vector<char> m_frameFiltered; //The decompressed data of the current frame before unfiltering, for filtered files.
+	std::vector<std::size_t> m_extractedOffsets; //The offsets of the channels being extracted, for filter_columns files.
+	std::vector<bool> m_columnMask;    //The channels of the current frame to decompress, for filter_columns files.
+	std::size_t m_framePos;          //The offset in 'm_frameData' of the next byte to read.
+
+	detail::prt_int64 m_blockIndexOffset; //The file offset of the block index, 0 if the file doesn't have one, or -1 while it is being appended to.
+	std::vector< detail::prt_block_index_entry_v1 > m_blockIndex; //The independently compressed blocks of the file, if it has a block index.
+	std::vector< detail::prt_int64 > m_blockFirstParticle;        //The index of the first particle in each block of 'm_blockIndex'.
+	std::vector< detail::prt_block_bounds_v1 > m_blockBounds;     //The bounds of each block in 'm_blockIndex', or empty if the index doesn't store them.
+	std::vector< detail::prt_block_checksum_v1 > m_blockChecksums; //The checksum of each block in 'm_blockIndex', or empty if the index doesn't store them.
+	std::size_t m_nextCheckedBlock; //The next block of 'm_blockChecksums' to check, once reading reaches it.
 
 private:
 	void read_meta_chunk( detail::prt_int32 chunkLength ){
-		char channelName[32];
-		char valueName[32];
+		// The chunk is: the channel name and the value name, both NULL terminated, then the int32 type and the value.
+		if( chunkLength < 7 )
+			throw std::runtime_error( "A metadata chunk in the input stream \"" + m_filePath + "\" is too short." );
+
+		// Read the whole chunk in one go, straight into the metadata's memory where the names and value stay.
+		char* chunk = m_metadata.begin_chunk( static_cast<std::size_t>( chunkLength ) );
+		m_fin.read( chunk, chunkLength );
+
+		if( m_fin.fail() )
+			throw std::runtime_error( "The header of the input stream \"" + m_filePath + "\" is truncated." );
+
+		const char* chunkEnd = chunk + chunkLength;
+
+		const char* channelName = chunk;
+		const char* channelNameEnd = static_cast<const char*>( memchr( channelName, '\0', (std::min)( std::size_t(32), static_cast<std::size_t>( chunkEnd - channelName ) ) ) );
+
+		const char* valueName = channelNameEnd ? channelNameEnd + 1 : NULL;
+		const char* valueNameEnd = valueName ? static_cast<const char*>( memchr( valueName, '\0', (std::min)( std::size_t(32), static_cast<std::size_t>( chunkEnd - valueName ) ) ) ) : NULL;
+
+		if( !valueNameEnd || chunkEnd - ( valueNameEnd + 1 ) <= 4 )
+			throw std::runtime_error( "A metadata chunk in the input stream \"" + m_filePath + "\" is malformed." );
+
 		detail::prt_int32 valueType;
-		
-		m_fin.getline( channelName, 32, '\0' );
-		chunkLength -= m_fin.gcount();
-		
-		m_fin.getline( valueName, 32, '\0' );
-		chunkLength -= m_fin.gcount();
-		
-		m_fin.read( reinterpret_cast<char*>( &valueType ), 4u );
-		chunkLength -= 4;
-		
-		assert( chunkLength > 0 );
+		memcpy( &valueType, valueNameEnd + 1, 4u );
+
+		char* data = const_cast<char*>( valueNameEnd + 5 );
+		std::size_t dataLength = static_cast<std::size_t>( chunkEnd - data );
 		
 		if( valueType < meta_types::type_string || valueType >= meta_types::type_last )
 			throw std::runtime_error( std::string() + "The data type specified for channel \"" + channelName + "\" metadata \"" + valueName + "\" in the input stream \"" + m_filePath + "\" is not valid." );
 		
-		struct scoped_void_ptr{
-			void* ptr;
-			~scoped_void_ptr(){
-				operator delete( ptr );
-			}
-		} buffer = { operator new( chunkLength ) };
-		
-		// We've been subtracting the read bytes as we go, so this is the remaining number of bytes in the chunk.
-		m_fin.read( static_cast<char*>( buffer.ptr ), chunkLength );
-		
 		if( channelName[0] != '\0' && !detail::is_valid_channel_name( channelName ) ){
 			std::cerr << "Invalid channel name: \"" << channelName << "\" in metadata: \"" << valueName << "\"" << std::endl;
 			return;
@@ -84,11 +136,12 @@ private:
 			return;
 		}
 		
-		std::map< std::string, prt_meta_value >& metaValue = (channelName[0] == '\0') ? m_fileMetadata : m_channelMetadata[ std::string(channelName) ];
-		
 		if( valueType == meta_types::type_string ){
+			// Make sure we have a terminating NULL character.
+			data[dataLength - 1] = '\0';
+
 #ifdef _WIN32
-			int wcharLength = MultiByteToWideChar( CP_UTF8, MB_ERR_INVALID_CHARS, static_cast<const char*>( buffer.ptr ), chunkLength, NULL, 0 );
+			int wcharLength = MultiByteToWideChar( CP_UTF8, MB_ERR_INVALID_CHARS, data, static_cast<int>( dataLength ), NULL, 0 );
 			if( wcharLength <= 0 ){
 				std::cerr << "Invalid string data in metadata: \"" << valueName << "\" in channel: \"" << channelName << "\"" << std::endl;
 				return;
@@ -97,23 +150,23 @@ private:
 			// In Windows we convert from UTF8 to UTF16LE in memory.
 			std::vector<wchar_t> convertedString( wcharLength, L'\0' );
 			
-			int r = MultiByteToWideChar( CP_UTF8, MB_ERR_INVALID_CHARS, static_cast<const char*>( buffer.ptr ), chunkLength, &convertedString.front(), wcharLength );
+			int r = MultiByteToWideChar( CP_UTF8, MB_ERR_INVALID_CHARS, data, static_cast<int>( dataLength ), &convertedString.front(), wcharLength );
 			
 			assert( r > 0 );
 			
-			metaValue[ std::string(valueName) ].set_string( &convertedString.front(), static_cast<std::size_t>( chunkLength - 1 ) );
+			m_metadata.add( channelName, valueName, meta_types::type_string, 1u, &convertedString.front(), convertedString.size() * sizeof(wchar_t) );
 #else
 			// In non-Windows we can work directly with UTF8.
-			metaValue[ std::string(valueName) ].set_string( static_cast<char*>( buffer.ptr ), static_cast<std::size_t> ( chunkLength - 1 ) );
+			m_metadata.commit_chunk( channelName, valueName, meta_types::type_string, 1u, data, dataLength );
 #endif
 		}else{
 			std::size_t basicSize = data_types::sizes[valueType]; // We've already verified that we have a valid index.
 			
-			assert( chunkLength >= basicSize && (chunkLength % basicSize) == 0 );
+			assert( dataLength >= basicSize && (dataLength % basicSize) == 0 );
 			
-			std::size_t arity = chunkLength / basicSize;
+			std::size_t arity = dataLength / basicSize;
 			
-			metaValue[ std::string(valueName) ].set( static_cast<meta_types::option>( valueType ), arity, buffer.ptr );
+			m_metadata.commit_chunk( channelName, valueName, static_cast<meta_types::option>( valueType ), arity, data, arity * basicSize );
 		}
 	}
 
@@ -126,6 +179,8 @@ private:
 		using namespace detail;
 
 		prt_header_v1 header;
+		filters::option filter = filters::filter_none;
+		prt_int32 filterFlags = 0;
 		
 		//m_fin.read(reinterpret_cast<char*>(&header), sizeof(prt_header_v1));
 		m_fin.read( reinterpret_cast<char*>(&header.magicNumber), 8 );
@@ -142,10 +197,14 @@ private:
 		if( strncmp(prt_signature_string(), header.fmtIdentStr, 32) != 0 )
 			throw std::runtime_error( "The input stream \"" + m_filePath + "\" did not contain the signature string '" + prt_signature_string() + "'." );
 
-		m_particleCount = header.particleCount;
+		m_particleCount = m_totalParticles = header.particleCount;
 		if( header.particleCount < 0 )
 			throw std::runtime_error( "The input stream \"" + m_filePath + "\" was not closed correctly and reported negative particles within." );
 
+		// The metadata is most of the header, so this is usually the only allocation it needs.
+		m_metadata.clear();
+		m_metadata.reserve( header.headerLength > 0 ? static_cast<std::size_t>( header.headerLength ) * 2u : 0u );
+
 		if( header.version <= 1 ){
 			// Skip parts of the file header which may have been added since the first version of the .prt format
 			if( header.headerLength != sizeof(prt_header_v1) )
@@ -160,6 +219,22 @@ private:
 			while( chunkType != detail::prt_stop_chunk() ){
 				if( chunkType == detail::prt_meta_chunk() ){
 					this->read_meta_chunk( chunkLength );
+				}else if( chunkType == detail::prt_block_index_chunk() && chunkLength == 8 ){
+					m_fin.read( reinterpret_cast<char*>( &m_blockIndexOffset ), 8 );
+				}else if( chunkType == detail::prt_codec_chunk() && chunkLength == 8 ){
+					detail::prt_int32 codecCode, codecLevel;
+					m_fin.read( reinterpret_cast<char*>( &codecCode ), 4 );
+					m_fin.read( reinterpret_cast<char*>( &codecLevel ), 4 );
+
+					if( !detail::codec_from_fourcc( codecCode, m_codec ) )
+						throw std::runtime_error( "The input stream \"" + m_filePath + "\" was compressed with an unknown codec." );
+				}else if( chunkType == detail::prt_filter_chunk() && chunkLength == 8 ){
+					detail::prt_int32 filterCode;
+					m_fin.read( reinterpret_cast<char*>( &filterCode ), 4 );
+					m_fin.read( reinterpret_cast<char*>( &filterFlags ), 4 );
+
+					if( !detail::filter_from_fourcc( filterCode, filter ) )
+						throw std::runtime_error( "The input stream \"" + m_filePath + "\" was compressed with an unknown filter." );
 				}else{
 					// Skip this unknown chunk.
 					m_fin.seekg( chunkLength, std::ios::cur );
@@ -167,6 +242,10 @@ private:
 
 				m_fin.read( reinterpret_cast<char*>( &chunkType ), 4 );
 				m_fin.read( reinterpret_cast<char*>( &chunkLength ), 4 );
+
+				//Without this, a truncated header would never reach the stop chunk.
+				if( m_fin.fail() )
+					throw std::runtime_error( "The header of the input stream \"" + m_filePath + "\" is truncated." );
 			}
 		}
 
@@ -180,10 +259,16 @@ private:
 		m_fin.read(reinterpret_cast<char*>(&channelCount), 4);
 		m_fin.read(reinterpret_cast<char*>(&perChannelLength), 4);
 
+		if( m_fin.fail() )
+			throw std::runtime_error( "The header of the input stream \"" + m_filePath + "\" is truncated." );
+
 		for(int i = 0; i < channelCount; ++i){
 			prt_channel_header_v1 channel;
 			m_fin.read(reinterpret_cast<char*>(&channel), sizeof(prt_channel_header_v1));
 
+			if( m_fin.fail() )
+				throw std::runtime_error( "The channel table of the input stream \"" + m_filePath + "\" is truncated." );
+
 			// Make sure the channel name is null terminated
 			channel.channelName[31] = '\0';
 			
@@ -205,60 +290,452 @@ private:
 				static_cast<std::size_t>( channel.channelArity ),
 				static_cast<std::size_t>( channel.channelOffset )
 			);
-			
-			// Force metadata creation for this channel if there weren't any values stored in the file.
-			m_channelMetadata[ channel.channelName ];
+
 
 			if( perChannelLength != sizeof(prt_channel_header_v1) )
 				m_fin.seekg(perChannelLength - sizeof(prt_channel_header_v1), std::ios::cur);	//Skip unknown parts of the channel header
 		}
 		
-		// Remove metadata for channels that don't actually exist.
-		for( std::map< std::string, std::map< std::string, prt_meta_value > >::iterator it = m_channelMetadata.begin(), itEnd = m_channelMetadata.end(); it != itEnd; /*Do Nothing*/ ){
-			if( !m_layout.has_channel( it->first ) ){
-				std::cerr << "Invalid metadata channel: \"" << it->first << "\"" << std::endl;
-				m_channelMetadata.erase( it++ );
-			}else{
-				++it;
+		if( filter != filters::filter_none )
+			m_filter = particle_filter( filter, filterFlags, m_layout );
+		
+		// Sort the metadata for lookups, removing it for channels that don't actually exist.
+		m_metadata.finalize( m_layout );
+	}
+
+	/**
+	 * This function reads the block index stored after the compressed particle data, leaving the read pointer of 'm_fin'
+	 * where it was.
+	 */
+	void read_block_index(){
+		using namespace detail;
+
+		std::istream::pos_type dataStart = m_fin.tellg();
+
+		m_fin.seekg( static_cast<std::istream::off_type>( m_blockIndexOffset ), std::ios::beg );
+
+		prt_int64 blockCount;
+		prt_int32 entryLength;
+		m_fin.read( reinterpret_cast<char*>( &blockCount ), 8 );
+		m_fin.read( reinterpret_cast<char*>( &entryLength ), 4 );
+
+		if( m_fin.fail() || blockCount < 0 || entryLength < static_cast<prt_int32>( sizeof(prt_block_index_entry_v1) ) )
+			throw std::runtime_error( "The block index in the input stream \"" + m_filePath + "\" is not valid." );
+
+		//The entries must fit in the rest of the file, so a damaged count can't make us allocate more than the file holds.
+		std::istream::pos_type entriesStart = m_fin.tellg();
+		m_fin.seekg( 0, std::ios::end );
+		const prt_int64 bytesLeft = static_cast<prt_int64>( m_fin.tellg() - entriesStart );
+		m_fin.seekg( entriesStart );
+
+		if( m_fin.fail() || blockCount > bytesLeft / entryLength )
+			throw std::runtime_error( "The block index in the input stream \"" + m_filePath + "\" is not valid." );
+
+		//Older files only store the offset and particle count of each block.
+		const bool hasBounds = entryLength >= static_cast<prt_int32>( sizeof(prt_block_index_entry_v1) + sizeof(prt_block_bounds_v1) );
+		const bool hasChecksums = entryLength >= static_cast<prt_int32>( sizeof(prt_block_index_entry_v1) + sizeof(prt_block_bounds_v1) + sizeof(prt_block_checksum_v1) );
+		const prt_int32 knownLength = static_cast<prt_int32>( sizeof(prt_block_index_entry_v1) + ( hasBounds ? sizeof(prt_block_bounds_v1) : 0 ) + ( hasChecksums ? sizeof(prt_block_checksum_v1) : 0 ) );
+
+		m_blockIndex.resize( static_cast<std::size_t>( blockCount ) );
+		m_blockFirstParticle.resize( static_cast<std::size_t>( blockCount ) );
+		m_blockBounds.resize( hasBounds ? static_cast<std::size_t>( blockCount ) : 0 );
+		m_blockChecksums.resize( hasChecksums ? static_cast<std::size_t>( blockCount ) : 0 );
+
+		prt_int64 particleTotal = 0;
+
+		for( std::size_t i = 0, iEnd = m_blockIndex.size(); i < iEnd; ++i ){
+			m_fin.read( reinterpret_cast<char*>( &m_blockIndex[i].dataOffset ), 8 );
+			m_fin.read( reinterpret_cast<char*>( &m_blockIndex[i].particleCount ), 8 );
+
+			if( hasBounds )
+				m_fin.read( reinterpret_cast<char*>( m_blockBounds[i].bounds ), sizeof(float) * 6 );
+
+			if( hasChecksums ){
+				m_fin.read( reinterpret_cast<char*>( &m_blockChecksums[i].dataLength ), 8 );
+				m_fin.read( reinterpret_cast<char*>( &m_blockChecksums[i].checksum ), 4 );
+				m_fin.read( reinterpret_cast<char*>( &m_blockChecksums[i].reserved ), 4 );
 			}
+
+			if( entryLength != knownLength )
+				m_fin.seekg( entryLength - knownLength, std::ios::cur ); //Skip unknown parts of the entry
+
+			m_blockFirstParticle[i] = particleTotal;
+			particleTotal += m_blockIndex[i].particleCount;
 		}
+
+		if( m_fin.fail() || particleTotal != m_totalParticles )
+			throw std::runtime_error( "The block index in the input stream \"" + m_filePath + "\" does not match the number of particles in the file." );
+
+		m_fin.seekg( dataStart );
 	}
 
 	/**
 	 * This function initializes the zlib decompression stream for the particle data portion of the PRT file.
 	 */
 	void init_zlib(){
-		if(Z_OK != inflateInit(&m_zstream) )
-			throw std::runtime_error( "Unable to initialize a zlib inflate stream for input stream \"" + m_filePath + "\"." );
+		if( m_zstreamReady ){
+			//Go back to the zlib format, since seek_particle() may have switched the stream to raw deflate data.
+			if( Z_OK != inflateReset2( &m_zstream, MAX_WBITS ) )
+				throw std::runtime_error( "Unable to reset the zlib inflate stream for input stream \"" + m_filePath + "\"." );
+
+			//Drop any input left from the previous file.
+			m_zstream.avail_in = 0;
+			m_zstream.next_in = NULL;
+			m_zstream.avail_out = 0;
+		}else{
+			if(Z_OK != inflateInit(&m_zstream) )
+				throw std::runtime_error( "Unable to initialize a zlib inflate stream for input stream \"" + m_filePath + "\"." );
+			m_zstreamReady = true;
+		}
+
+		//Input in memory is decompressed in place, and asynchronous input is decompressed from the reader's buffers.
+		//The buffer may be left from the previous file when reopened.
+		if( m_inputData || m_asyncReader || m_buffer )
+			return;
 
 		if( m_bufferSize == 0 )
 			m_bufferSize = (1 << 19);
 
-		m_buffer = new char[m_bufferSize];
+		m_buffer = m_bufferPool ? m_bufferPool->acquire( m_bufferSize, m_bufferSize ) : new char[m_bufferSize];
 	}
 
-public:
 	/**
-	 * Default constructor. User must later call open().
+	 * Closes the file and resets the stream.
+	 * @param keepBuffers If true, the buffer and the zlib stream are kept for the next file, as by reopen().
 	 */
-	prt_ifstream(){
+	void close_input( bool keepBuffers ){
+		m_stats.finish( m_filePath );
+		m_filePath.clear();
+
+		//Detaching the stream buffer sets badbit, which would otherwise throw.
+		m_fin.exceptions( std::ios::goodbit );
+		m_fin.rdbuf( NULL );
+		m_file.close();
+
+		if( m_zstreamReady && !keepBuffers ){
+			inflateEnd( &m_zstream );
+			memset( &m_zstream, 0, sizeof(z_stream) );
+			m_zstreamReady = false;
+		}
+
+		if( !keepBuffers ){
+			if( m_bufferPool )
+				m_bufferPool->release( m_buffer, m_bufferSize );
+			else
+				delete[] m_buffer;
+			m_buffer = NULL;
+			m_bufferSize = 0;
+		}
+
+		m_mappedFile.close();
+		delete m_asyncReader;
+
+		m_layout.clear();
+
+		m_inputData = NULL;
+		m_inputSize = 0;
+		m_inputOffset = 0;
+		m_asyncReader = NULL;
+		m_particleCount = 0;
+		m_totalParticles = 0;
+
+		m_blockIndexOffset = 0;
+		m_blockIndex.clear();
+		m_blockFirstParticle.clear();
+		m_blockBounds.clear();
+		m_blockChecksums.clear();
+		m_nextCheckedBlock = 0;
+
+		m_codec = codecs::codec_zlib;
+		m_filter = detail::particle_filter();
+		m_framePos = 0;
+
+		if( keepBuffers ){
+			m_frameInput.clear();
+			m_frameData.clear();
+			m_frameFiltered.clear();
+		}else{
+			std::vector<char>().swap( m_frameInput );
+			std::vector<char>().swap( m_frameData );
+			std::vector<char>().swap( m_frameFiltered );
+		}
+	}
+
+	/**
+	 * Gives zlib the next portion of compressed data once it has consumed the previous portion.
+	 */
+	void refill_input(){
+		if( m_inputData ){
+			//zlib can only be given 4GB at a time.
+			std::size_t numBytes = (std::min)( m_inputSize - m_inputOffset, static_cast<std::size_t>( (std::numeric_limits<uInt>::max)() ) );
+
+			m_zstream.avail_in = static_cast<uInt>( numBytes );
+			m_zstream.next_in = reinterpret_cast<unsigned char*>( const_cast<char*>( m_inputData + m_inputOffset ) );
+
+			m_inputOffset += numBytes;
+			detail::stats_count( m_stats.counters().compressedBytes, static_cast<detail::prt_int64>( numBytes ) );
+		}else if( m_asyncReader ){
+			std::size_t numBytes;
+			const char* data;
+			{
+				detail::stats_timer timer( m_stats.counters().ioSeconds );
+				data = m_asyncReader->next( numBytes );
+			}
+			detail::stats_count( m_stats.counters().compressedBytes, static_cast<detail::prt_int64>( numBytes ) );
+
+			m_zstream.avail_in = static_cast<uInt>( numBytes );
+			m_zstream.next_in = reinterpret_cast<unsigned char*>( const_cast<char*>( data ) );
+		}else{
+			{
+				detail::stats_timer timer( m_stats.counters().ioSeconds );
+				m_fin.read(m_buffer, m_bufferSize);
+			}
+
+			if( m_fin.fail() && m_bufferSize == 0 )
+				throw std::ios_base::failure( "Failed to read from file \"" + m_filePath + "\"" );
+
+			detail::stats_count( m_stats.counters().compressedBytes, static_cast<detail::prt_int64>( m_fin.gcount() ) );
+
+			m_zstream.avail_in = static_cast<uInt>(m_fin.gcount());
+			m_zstream.next_in = reinterpret_cast<unsigned char*>(m_buffer);
+		}
+	}
+
+	/**
+	 * @return True if all of the file's compressed data has been consumed.
+	 */
+	bool is_input_exhausted(){
+		if( m_inputData )
+			return m_inputOffset == m_inputSize;
+		if( m_asyncReader )
+			return m_asyncReader->at_end();
+		//Codec frames are read exactly, so we need to look ahead to find the end of the file.
+		if( this->is_framed() && !m_fin.eof() )
+			return m_fin.peek() == std::char_traits<char>::eof();
+		return m_fin.eof();
+	}
+
+	/**
+	 * Reads bytes of the compressed data from the file or the mapping.
+	 * @return False if the end of the file was reached first.
+	 */
+	bool read_input( char* dest, std::size_t numBytes ){
+		detail::stats_count( m_stats.counters().compressedBytes, static_cast<detail::prt_int64>( numBytes ) );
+
+		if( m_inputData ){
+			if( m_inputSize - m_inputOffset < numBytes )
+				return false;
+			memcpy( dest, m_inputData + m_inputOffset, numBytes );
+			m_inputOffset += numBytes;
+			return true;
+		}
+
+		detail::stats_timer timer( m_stats.counters().ioSeconds );
+
+		if( m_asyncReader )
+			return m_asyncReader->read( dest, numBytes ) == numBytes;
+
+		m_fin.read( dest, numBytes );
+		return static_cast<std::size_t>( m_fin.gcount() ) == numBytes;
+	}
+
+	/**
+	 * Checks the compressed data of a block against the checksum in the block index, reading it separately from the data
+	 * being decompressed so the read position is left alone.
+	 * @param block The block to check. Blocks whose checksum is unknown aren't checked.
+	 */
+	void check_block( std::size_t block ){
+		const detail::prt_block_checksum_v1& checksum = m_blockChecksums[block];
+		if( checksum.dataLength < 0 )
+			return;
+
+		const detail::prt_int64 dataOffset = m_blockIndex[block].dataOffset;
+		const std::size_t dataLength = static_cast<std::size_t>( checksum.dataLength );
+		const char* data = NULL;
+		bool valid;
+
+		if( m_inputData ){
+			valid = dataOffset >= 0 && dataOffset <= static_cast<detail::prt_int64>( m_inputSize ) && dataLength <= m_inputSize - static_cast<std::size_t>( dataOffset );
+			if( valid )
+				data = m_inputData + dataOffset;
+		}else{
+			detail::stats_timer timer( m_stats.counters().ioSeconds );
+
+			//The buffered reader may have hit the end of the file, which must still be seen once the position is restored.
+			std::ios::iostate state = m_fin.rdstate();
+			m_fin.clear();
+			std::istream::pos_type readPos = m_fin.tellg();
+
+			//The frame input is only needed while read_frame() decompresses a frame, so it's free to hold the block.
+			m_frameInput.resize( dataLength );
+			m_fin.seekg( static_cast<std::istream::off_type>( dataOffset ), std::ios::beg );
+			if( dataLength > 0 )
+				m_fin.read( &m_frameInput.front(), dataLength );
+			valid = !m_fin.fail();
+			data = m_frameInput.empty() ? NULL : &m_frameInput.front();
+
+			m_fin.clear();
+			m_fin.seekg( readPos );
+			m_fin.setstate( state );
+		}
+
+		if( !valid || checksum.checksum != detail::block_checksum( data, dataLength ) ){
+			std::stringstream ss;
+			ss << "Block " << block << " of file \"" << m_filePath << "\" does not match its checksum, the file is corrupt";
+			throw std::runtime_error( ss.str() );
+		}
+	}
+
+	/**
+	 * Checks the blocks the next 'count' particles are decompressed from, which haven't been checked since reading reached
+	 * them.
+	 */
+	void check_blocks( std::size_t count ){
+		const detail::prt_int64 endIndex = m_totalParticles - m_particleCount + static_cast<detail::prt_int64>( count );
+
+		for( ; m_nextCheckedBlock < m_blockChecksums.size() && m_blockFirstParticle[m_nextCheckedBlock] < endIndex; ++m_nextCheckedBlock )
+			this->check_block( m_nextCheckedBlock );
+	}
+
+	/**
+	 * @return True if the particle data is stored as codec frames, instead of a single zlib stream.
+	 */
+	bool is_framed() const {
+		return detail::uses_frames( m_codec, m_filter );
+	}
+
+	/**
+	 * Reads, decompresses and unfilters the next frame of a framed file.
+	 */
+	void read_frame(){
+		char header[detail::codec_frame_header_size];
+		std::size_t compressedLength, uncompressedLength;
+
+		if( !this->read_input( header, detail::codec_frame_header_size ) )
+			throw std::runtime_error( "The file \"" + m_filePath + "\" did not contain the number of particles it claimed" );
+
+		if( !detail::read_codec_frame_header( header, compressedLength, uncompressedLength ) )
+			throw std::runtime_error( "The file \"" + m_filePath + "\" contained an invalid compressed frame" );
+
+		m_frameData.resize( uncompressedLength );
+		m_framePos = 0;
+
+		const char* compressed;
+		if( m_inputData ){
+			if( m_inputSize - m_inputOffset < compressedLength )
+				throw std::runtime_error( "The file \"" + m_filePath + "\" ended in the middle of a compressed frame" );
+
+			compressed = m_inputData + m_inputOffset;
+			m_inputOffset += compressedLength;
+			detail::stats_count( m_stats.counters().compressedBytes, static_cast<detail::prt_int64>( compressedLength ) );
+		}else{
+			m_frameInput.resize( compressedLength );
+			if( compressedLength > 0 && !this->read_input( &m_frameInput.front(), compressedLength ) )
+				throw std::runtime_error( "The file \"" + m_filePath + "\" ended in the middle of a compressed frame" );
+
+			compressed = m_frameInput.empty() ? NULL : &m_frameInput.front();
+		}
+
+		if( m_filter.enabled() && m_layout.size() > 0 && uncompressedLength % m_layout.size() != 0 )
+			throw std::runtime_error( "The file \"" + m_filePath + "\" contained a frame that isn't a whole number of particles" );
+
+		std::size_t numParticles = ( m_layout.size() > 0 ) ? uncompressedLength / m_layout.size() : 0;
+
+		detail::stats_timer timer( m_stats.counters().codecSeconds );
+
+		try{
+			if( m_filter.columnar() ){
+				//Only the channels that are extracted need to be decompressed.
+				this->get_extracted_offsets( m_extractedOffsets );
+				m_filter.get_column_mask( m_extractedOffsets, m_columnMask );
+
+				detail::decompress_columns( m_codec, m_filter, compressed, compressedLength, numParticles, m_columnMask, m_frameFiltered, m_frameData.empty() ? NULL : &m_frameData.front() );
+			}else{
+				std::vector<char>& dest = m_filter.enabled() ? m_frameFiltered : m_frameData;
+				dest.resize( uncompressedLength );
+
+				detail::codec_decompress( m_codec, compressed, compressedLength, dest.empty() ? NULL : &dest.front(), uncompressedLength );
+
+				if( m_filter.enabled() && numParticles > 0 )
+					m_filter.reverse( &m_frameFiltered.front(), numParticles, &m_frameData.front() );
+			}
+		}catch( const std::exception& e ){
+			throw std::runtime_error( "Decompressing file \"" + m_filePath + "\" failed:\n\t" + e.what() );
+		}
+	}
+
+	/**
+	 * Reads the header from 'm_fin' and prepares to decompress the particle data, once the file or memory is attached.
+	 * @param async If true, the particle data is read ahead on a background thread. Only valid for files.
+	 */
+	void open_input( bool async ){
+		m_stats.start();
+		m_fin.exceptions( std::ios::badbit );
+
+		read_header();
+
+		if( m_blockIndexOffset > 0 )
+			this->read_block_index();
+
+		if( this->is_framed() ){
+			detail::check_codec_available( m_codec, m_filePath );
+
+			detail::prt_int32 codecCode = 0;
+			m_fin.read( reinterpret_cast<char*>( &codecCode ), 4 );
+
+			if( codecCode != detail::codec_fourcc( m_codec ) )
+				throw std::runtime_error( "The particle data in the input stream \"" + m_filePath + "\" does not match its codec." );
+		}
+
+		if( m_inputData ){
+			m_inputOffset = static_cast<std::size_t>( m_fin.tellg() );
+		}else if( async ){
+			m_asyncReader = new detail::async_reader( m_filePath, ( m_bufferSize != 0 ) ? m_bufferSize : (1 << 19) );
+			m_asyncReader->start( static_cast<std::streamoff>( m_fin.tellg() ) );
+		}
+
+		init_zlib();
+	}
+
+	/**
+	 * Puts the members in the state of a stream that hasn't been opened. Shared by the constructors.
+	 */
+	void init(){
+		m_zstreamReady = false;
 		m_buffer = NULL;
 		m_bufferSize = 0;
+		m_bufferPool = NULL;
+		m_inputData = NULL;
+		m_inputSize = 0;
+		m_inputOffset = 0;
+		m_asyncReader = NULL;
 		m_particleCount = 0;
+		m_totalParticles = 0;
+
+		m_blockIndexOffset = 0;
+		m_nextCheckedBlock = 0;
+		m_codec = codecs::codec_zlib;
+		m_framePos = 0;
 		memset( &m_zstream, 0, sizeof(m_zstream) );
 	}
 
+public:
+	/**
+	 * Default constructor. User must later call open().
+	 */
+	prt_ifstream() : m_fin( NULL ){
+		this->init();
+	}
+
 	/**
 	 * Constructor that opens the stream for the given file.
 	 * @param filePath Path to the PRT file to read particles from.
+	 * @param mode How the compressed particle data is read from the file. See input_mode.
 	 */
-	prt_ifstream( const std::string& filePath ){
-		m_buffer = NULL;
-		m_bufferSize = 0;
-		m_particleCount = 0;
-		memset( &m_zstream, 0, sizeof(m_zstream) );
+	prt_ifstream( const std::string& filePath, input_mode mode = input_buffered ) : m_fin( NULL ){
+		this->init();
 
-		open( filePath );
+		open( filePath, mode );
 	}
 
 	virtual ~prt_ifstream(){
@@ -268,17 +745,23 @@ public:
 	/**
 	 * Opens the prt_ifstream to read from the specified file
 	 * @param file Path to the file to read particles from
+	 * @param mode How the compressed particle data is read from the file. See input_mode.
 	 */
-	void open( const std::string& file ){
-		m_fin.open( file.c_str(), std::ios::in | std::ios::binary );
-		if( m_fin.fail() )
+	void open( const std::string& file, input_mode mode = input_buffered ){
+		m_file.open( file.c_str(), std::ios::in | std::ios::binary );
+		if( m_file.fail() )
 			throw std::ios_base::failure( "Failed to open file \"" + file + "\"" );
 
+		m_fin.rdbuf( m_file.rdbuf() );
 		m_filePath = file;
-		m_fin.exceptions( std::ios::badbit );
 
-		read_header();
-		init_zlib();
+		if( mode == input_mapped ){
+			m_mappedFile.open( file );
+			m_inputData = m_mappedFile.data();
+			m_inputSize = m_mappedFile.size();
+		}
+
+		this->open_input( mode == input_async );
 	}
 
 	/**
@@ -289,55 +772,263 @@ public:
 		return m_particleCount;
 	}
 
+	using prt_istream::load_columns;
+
 	/**
-	 * Closes the stream, and deallocates any memory used for decompressing particles.
+	 * Reads all the remaining particles straight into one caller owned array per channel. See prt_istream::load_columns().
+	 * With a predicate (see set_predicate()) only the particles it keeps are loaded, so just the start of each array is
+	 * filled and the return says how much of it.
+	 * @param columns The channels to load and where to put them. Each must have room for particle_count() particles.
+	 * @return The number of particles loaded, which is particle_count() unless a predicate rejected some of them.
 	 */
-	void close(){
-		m_filePath.clear();
-		m_fin.close();
+	std::size_t load_columns( const std::vector<prt_column>& columns ){
+		std::size_t result = this->load_columns( columns, static_cast<std::size_t>( m_particleCount ) );
 
-		if( m_buffer ){
-			inflateEnd( &m_zstream );
-			memset( &m_zstream, 0, sizeof(z_stream) );
+		//Every particle was consumed, even the ones the predicate rejected, unless the file ended early.
+		if( m_particleCount != 0 )
+			throw std::runtime_error( "The file \"" + m_filePath + "\" ended before all of its particles were loaded" );
+		return result;
+	}
 
-			delete[] m_buffer;
-			m_buffer = NULL;
+	/**
+	 * @return True if the file has a block index, which allows seek_particle() to jump directly to any particle.
+	 */
+	bool has_block_index() const {
+		return !m_blockIndex.empty();
+	}
+
+	/**
+	 * @return True if the file's block index stores the bounds of each block, which lets read_region() skip the blocks
+	 *         outside the region without decompressing them. See prt_ofstream::set_spatial_sort().
+	 */
+	bool has_block_bounds() const {
+		return !m_blockBounds.empty();
+	}
+
+	/**
+	 * @return True if the file's block index stores a checksum of each block's compressed data, which is checked before
+	 *         a block is decompressed, and which verify() checks without decompressing anything.
+	 */
+	bool has_block_checksums() const {
+		return !m_blockChecksums.empty();
+	}
+
+	/**
+	 * Reads up to 'count' of the remaining particles whose Position is inside a box, and extracts the channels requested via
+	 * bind() and bind_static() like read_particles(). If the file stores the bounds of its blocks (see has_block_bounds())
+	 * the blocks outside the box are skipped with seek_particle(), so this is much faster on spatially sorted files. Files
+	 * without block bounds are decompressed in full and each particle is tested.
+	 * @param bounds The box to read from, ordered like the BoundBox metadata: the minimum x, y, z then the maximum x, y, z.
+	 *               Particles on its boundary are inside.
+	 * @param count The maximum number of particles to extract.
+	 * @return The number of particles extracted. A return less than 'count' indicates there are no more particles in the box.
+	 */
+	std::size_t read_region( const float bounds[6], std::size_t count ){
+		std::size_t posIndex = m_layout.find_channel( "Position" );
+		if( posIndex == m_layout.num_channels() )
+			throw std::logic_error( "Reading a region of \"" + m_filePath + "\" requires a float32[3] Position channel" );
+
+		const detail::prt_channel& posChannel = m_layout.get_channel_at( posIndex );
+		if( posChannel.type != data_types::type_float32 || posChannel.arity != 3 )
+			throw std::logic_error( "Reading a region of \"" + m_filePath + "\" requires a float32[3] Position channel" );
+
+		const std::size_t particleSize = m_layout.size();
+
+		std::size_t batchSize;
+		char* data = this->get_batch_buffer( batchSize );
+
+		std::size_t result = 0;
+		while( result < count && m_particleCount > 0 ){
+			std::size_t numRequested = (std::min)( batchSize, count - result );
+
+			if( !m_blockBounds.empty() ){
+				const detail::prt_int64 index = m_totalParticles - m_particleCount;
+
+				std::size_t block = static_cast<std::size_t>( std::upper_bound( m_blockFirstParticle.begin(), m_blockFirstParticle.end(), index ) - m_blockFirstParticle.begin() ) - 1;
+				while( block < m_blockBounds.size() && !detail::boxes_overlap( m_blockBounds[block].bounds, bounds ) )
+					++block;
+
+				if( block == m_blockBounds.size() ){
+					this->seek_particle( m_totalParticles );
+					break;
+				}
+
+				if( m_blockFirstParticle[block] > index )
+					this->seek_particle( m_blockFirstParticle[block] );
+
+				//Stop at the end of the block, so the next one gets tested.
+				const detail::prt_int64 blockEnd = m_blockFirstParticle[block] + m_blockIndex[block].particleCount;
+				numRequested = static_cast<std::size_t>( (std::min)( static_cast<detail::prt_int64>( numRequested ), blockEnd - ( m_totalParticles - m_particleCount ) ) );
+			}
+
+			std::size_t numRead = this->read_particles_impl( data, numRequested );
+
+			//Move the particles inside the box to the front of the batch.
+			std::size_t numInside = 0;
+			for( std::size_t i = 0; i < numRead; ++i ){
+				float p[3];
+				memcpy( p, data + i * particleSize + posChannel.offset, sizeof(float) * 3 );
+
+				if( detail::box_contains( bounds, p ) ){
+					if( numInside != i )
+						memcpy( data + numInside * particleSize, data + i * particleSize, particleSize );
+					++numInside;
+				}
+			}
+
+			numInside = this->filter_particles( data, numInside );
+
+			this->extract_particles( data, result, numInside );
+
+			result += numInside;
+
+			if( numRead < numRequested )
+				break;
 		}
 
-		m_layout.clear();
+		return result;
+	}
 
-		m_bufferSize = 0;
-		m_particleCount = 0;
+	/**
+	 * Moves the stream so that the next particle read is the particle with the given index. If the file has a block index
+	 * (see prt_ofstream::set_block_index()) only the part of the containing block up to the particle is decompressed.
+	 * Otherwise the stream can only be moved forward, by decompressing and discarding the particles in between.
+	 * @param index The index of the particle to read next, between 0 and the number of particles in the file.
+	 */
+	virtual void seek_particle( detail::prt_int64 index ){
+		if( index < 0 || index > m_totalParticles )
+			throw std::out_of_range( "Cannot seek beyond the particles in the file \"" + m_filePath + "\"" );
+
+		detail::prt_int64 currentIndex = m_totalParticles - m_particleCount;
+
+		if( !m_blockIndex.empty() ){
+			if( index == m_totalParticles ){
+				m_particleCount = 0;
+				return;
+			}
+
+			std::size_t block = static_cast<std::size_t>( std::upper_bound( m_blockFirstParticle.begin(), m_blockFirstParticle.end(), index ) - m_blockFirstParticle.begin() ) - 1;
+
+			//If the particle is further along in the current block, it's cheaper to just skip ahead to it.
+			if( index < currentIndex || currentIndex < m_blockFirstParticle[block] ){
+				if( !this->is_framed() ){
+					//Blocks start on a byte boundary with an empty dictionary, so we can start decompressing raw deflate data from there.
+					if( Z_OK != inflateReset2( &m_zstream, -MAX_WBITS ) )
+						throw std::runtime_error( "Unable to reset the zlib inflate stream for input stream \"" + m_filePath + "\"." );
+
+					m_zstream.avail_in = 0;
+					m_zstream.avail_out = 0;
+				}else{
+					m_frameData.clear();
+					m_framePos = 0;
+				}
+
+				if( m_inputData ){
+					m_inputOffset = static_cast<std::size_t>( m_blockIndex[block].dataOffset );
+				}else if( m_asyncReader ){
+					m_asyncReader->start( static_cast<std::streamoff>( m_blockIndex[block].dataOffset ) );
+				}else{
+					m_fin.clear();
+					m_fin.seekg( static_cast<std::istream::off_type>( m_blockIndex[block].dataOffset ), std::ios::beg );
+				}
+
+				m_particleCount = m_totalParticles - m_blockFirstParticle[block];
+				currentIndex = m_blockFirstParticle[block];
+				m_nextCheckedBlock = block;
+			}
+		}else if( index < currentIndex ){
+			throw std::logic_error( "The file \"" + m_filePath + "\" has no block index, so it cannot seek backwards" );
+		}
+
+		this->skip_particles( static_cast<std::size_t>( index - currentIndex ) );
 	}
 
-protected:
 	/**
-	 * Reads a single particle from disk into the specified buffer.
-	 * @param data The location to read a single particle to. Must be at least m_layout.size() bytes.
-	 * @return True if a particle was read, false if EOF or the stream was never opened.
+	 * Closes the stream, and deallocates any memory used for decompressing particles.
 	 */
-	virtual bool read_impl( char* data ){
-		if( m_particleCount == 0 ){
-			if( !m_fin.is_open() || m_fin.eof() )
-				return false;
-			throw std::runtime_error( "The file \"" + m_filePath + "\" did not contain the number of particles it claimed" );
+	void close(){
+		this->close_input( false );
+	}
+
+	/**
+	 * Closes the current file and opens another, like close() followed by open(), but keeps the buffer and the zlib
+	 * stream of the current file instead of freeing and allocating them again. This is faster when reading many small
+	 * files one after the other. Everything bound with bind() and bind_static() is released, because the new file's
+	 * layout may be different, so the channels must be bound again.
+	 * @param file Path to the file to read particles from
+	 * @param mode How the compressed particle data is read from the file. See input_mode.
+	 */
+	void reopen( const std::string& file, input_mode mode = input_buffered ){
+		this->close_input( true );
+		this->clear_bindings();
+		this->open( file, mode );
+	}
+
+	/**
+	 * Takes the buffer the compressed data is read into from a pool, and gives it back to the pool when the stream is
+	 * closed, so streams opened one after another or on other threads can reuse it.
+	 * @param pool The pool, which must outlive the stream, or NULL to allocate the buffer.
+	 */
+	void set_buffer_pool( prt_buffer_pool* pool ){
+		if( m_buffer )
+			throw std::logic_error( "The buffer pool can't be changed while reading the file \"" + m_filePath + "\"" );
+		m_bufferPool = pool;
+	}
+
+private:
+	/**
+	 * Decompresses the next 'count' particles from disk into the specified buffer.
+	 * @param data The location to read the particles to. Must be at least count * m_layout.size() bytes.
+	 * @param count The number of particles to read. Must not be more than 'm_particleCount'.
+	 */
+	void inflate_particles( char* data, std::size_t count ){
+		std::size_t bytesLeft = count * m_layout.size();
+
+		if( !m_blockChecksums.empty() )
+			this->check_blocks( count );
+
+		if( this->is_framed() ){
+			while( bytesLeft != 0 ){
+				if( m_framePos == m_frameData.size() ){
+					this->read_frame();
+					continue;
+				}
+
+				std::size_t numBytes = (std::min)( bytesLeft, m_frameData.size() - m_framePos );
+				memcpy( data, &m_frameData.front() + m_framePos, numBytes );
+
+				m_framePos += numBytes;
+				data += numBytes;
+				bytesLeft -= numBytes;
+			}
+
+			m_particleCount -= static_cast<detail::prt_int64>( count );
+			return;
 		}
 
-		m_zstream.avail_out = static_cast<uInt>( m_layout.size() );
 		m_zstream.next_out = reinterpret_cast<unsigned char*>(data);
 
-		do{
-			if(m_zstream.avail_in == 0){
-				m_fin.read(m_buffer, m_bufferSize);
+		while( m_zstream.avail_out != 0 || bytesLeft != 0 ){
+			//zlib can only decompress 4GB at a time.
+			if( m_zstream.avail_out == 0 ){
+				m_zstream.avail_out = static_cast<uInt>( (std::min)( bytesLeft, static_cast<std::size_t>( (std::numeric_limits<uInt>::max)() ) ) );
+				bytesLeft -= m_zstream.avail_out;
+			}
 
-				if( m_fin.fail() && m_bufferSize == 0 )
-					throw std::ios_base::failure( "Failed to read from file \"" + m_filePath + "\"" );
+			if(m_zstream.avail_in == 0)
+				this->refill_input();
 
-				m_zstream.avail_in = static_cast<uInt>(m_fin.gcount());
-				m_zstream.next_in = reinterpret_cast<unsigned char*>(m_buffer);
+			int ret;
+			{
+				detail::stats_timer timer( m_stats.counters().codecSeconds );
+				ret = inflate(&m_zstream, Z_SYNC_FLUSH);
 			}
 
-			int ret = inflate(&m_zstream, Z_SYNC_FLUSH);
+			//In a file being appended to, the data after the last checkpoint may be incomplete. It doesn't matter once the
+			//particles up to the checkpoint are decompressed.
+			if( m_blockIndexOffset < 0 && m_zstream.avail_out == 0 && bytesLeft == 0 )
+				break;
+
 			if(Z_OK != ret && Z_STREAM_END != ret){
 				std::stringstream ss;
 				ss << "inflate() on file \"" << m_filePath << "\" ";
@@ -347,12 +1038,203 @@ protected:
 				throw std::runtime_error( ss.str() );
 			}
 
-		}while(m_zstream.avail_out != 0);
+			if( Z_STREAM_END == ret && m_zstream.avail_out != 0 )
+				throw std::runtime_error( "The file \"" + m_filePath + "\" did not contain the number of particles it claimed" );
+
+		}
+
+		m_particleCount -= static_cast<detail::prt_int64>( count );
+	}
+
+	/**
+	 * Decompresses and discards the next 'count' particles.
+	 * @param count The number of particles to skip. Must not be more than 'm_particleCount'.
+	 */
+	void skip_particles( std::size_t count ){
+		if( count == 0 )
+			return;
+
+		const std::size_t batchSize = (std::max)( std::size_t(1), (std::size_t(1) << 18) / (std::max)( std::size_t(1), m_layout.size() ) );
 
-		--m_particleCount;
+		std::vector<char> scratch( (std::min)( count, batchSize ) * m_layout.size() + 1 );
 
+		while( count > 0 ){
+			std::size_t numParticles = (std::min)( count, batchSize );
+			this->inflate_particles( &scratch.front(), numParticles );
+			count -= numParticles;
+		}
+	}
+
+	/**
+	 * Determines if there are any particles left to read, ensuring the file doesn't contain more particles than it claimed.
+	 * @return True if there are particles left, false if EOF or the stream was never opened.
+	 */
+	bool has_particles_left(){
+		if( m_particleCount == 0 ){
+			//Block indexed files store the index after the particle data, so we don't expect to be at the end of the file.
+			//Nor for files being appended to, which can have particles after the last checkpoint.
+			if( !m_fin.rdbuf() || !m_blockIndex.empty() || m_blockIndexOffset < 0 || this->is_input_exhausted() )
+				return false;
+			throw std::runtime_error( "The file \"" + m_filePath + "\" did not contain the number of particles it claimed" );
+		}
 		return true;
 	}
+
+protected:
+	/**
+	 * Opens the stream to read a PRT file that is already in memory. The particle data is decompressed directly from the
+	 * memory, without copying it.
+	 * @param data The bytes of the PRT file, which must stay valid until the stream is closed.
+	 * @param size The size in bytes of 'data'.
+	 * @param name The name to use for the file in error messages.
+	 */
+	void open_memory( const void* data, std::size_t size, const std::string& name ){
+		m_memoryBuffer.reset( static_cast<const char*>( data ), size );
+
+		m_fin.rdbuf( &m_memoryBuffer );
+		m_filePath = name;
+		m_inputData = static_cast<const char*>( data );
+		m_inputSize = size;
+
+		this->open_input( false );
+	}
+
+	/**
+	 * Parses only the header of a PRT file held in memory, leaving the stream closed. The block index isn't read, and
+	 * nothing is prepared for decompressing, so only layout(), the metadata and the accessors of the header are valid.
+	 * @param data The bytes of the start of the PRT file, up to at least the end of the channel table.
+	 * @param size The size in bytes of 'data'.
+	 * @param name The name to use for the file in error messages.
+	 */
+	void read_header_only( const void* data, std::size_t size, const std::string& name ){
+		m_memoryBuffer.reset( static_cast<const char*>( data ), size );
+
+		m_fin.rdbuf( &m_memoryBuffer );
+		m_fin.exceptions( std::ios::badbit );
+		m_filePath = name;
+
+		this->read_header();
+
+		m_fin.exceptions( std::ios::goodbit );
+		m_fin.rdbuf( NULL );
+	}
+
+	/**
+	 * @return The path of the file this stream is reading.
+	 */
+	const std::string& file_path() const {
+		return m_filePath;
+	}
+
+	/**
+	 * @return The file's block index, which is empty if the file doesn't have one.
+	 */
+	const std::vector< detail::prt_block_index_entry_v1 >& block_index() const {
+		return m_blockIndex;
+	}
+
+	/**
+	 * @return The bounds of each block in block_index(), which is empty if the index doesn't store them.
+	 */
+	const std::vector< detail::prt_block_bounds_v1 >& block_bounds() const {
+		return m_blockBounds;
+	}
+
+	/**
+	 * @return The checksum of each block in block_index(), which is empty if the index doesn't store them.
+	 */
+	const std::vector< detail::prt_block_checksum_v1 >& block_checksums() const {
+		return m_blockChecksums;
+	}
+
+	/**
+	 * @return The file offset of the block index, which is also the end of the compressed particle data. It is 0 if the
+	 *         file doesn't have one, and -1 if the file is being appended to and its index is being rewritten.
+	 */
+	detail::prt_int64 block_index_offset() const {
+		return m_blockIndexOffset;
+	}
+
+	/**
+	 * @return The codec the file's particles were compressed with.
+	 */
+	codecs::option codec() const {
+		return m_codec;
+	}
+
+	/**
+	 * @return The filter the file's particles were compressed with.
+	 */
+	const detail::particle_filter& filter() const {
+		return m_filter;
+	}
+
+	/**
+	 * Used by subclasses that decompress the particle data themselves to keep particle_count() up to date.
+	 * @param count The number of particles the subclass has consumed.
+	 */
+	void consume_particles( detail::prt_int64 count ){
+		m_particleCount -= count;
+	}
+
+	/**
+	 * Skips the blocks whose bounds the predicate rejects, when the file stores them. See prt_istream::skip_rejected_particles().
+	 */
+	virtual std::size_t skip_rejected_particles( const prt_predicate& predicate, std::size_t count ){
+		if( m_blockBounds.empty() || m_particleCount == 0 )
+			return count;
+
+		const detail::prt_int64 index = m_totalParticles - m_particleCount;
+
+		std::size_t block = static_cast<std::size_t>( std::upper_bound( m_blockFirstParticle.begin(), m_blockFirstParticle.end(), index ) - m_blockFirstParticle.begin() ) - 1;
+		std::size_t nextBlock = block;
+		while( nextBlock < m_blockBounds.size() && !predicate.may_keep( m_blockBounds[nextBlock].bounds ) )
+			++nextBlock;
+
+		if( nextBlock == m_blockBounds.size() ){
+			this->seek_particle( m_totalParticles );
+			return count;
+		}
+
+		if( nextBlock != block )
+			this->seek_particle( m_blockFirstParticle[nextBlock] );
+
+		//Stop at the end of the block, so the next one gets tested.
+		const detail::prt_int64 blockEnd = m_blockFirstParticle[nextBlock] + m_blockIndex[nextBlock].particleCount;
+		return static_cast<std::size_t>( (std::min)( static_cast<detail::prt_int64>( count ), blockEnd - ( m_totalParticles - m_particleCount ) ) );
+	}
+
+	/**
+	 * Reads a single particle from disk into the specified buffer.
+	 * @param data The location to read a single particle to. Must be at least m_layout.size() bytes.
+	 * @return True if a particle was read, false if EOF or the stream was never opened.
+	 */
+	virtual bool read_impl( char* data ){
+		if( !this->has_particles_left() )
+			return false;
+
+		this->inflate_particles( data, 1u );
+
+		return true;
+	}
+
+	/**
+	 * Reads many consecutive particles from disk into the specified buffer with a single decompression call.
+	 * @param data The location to read the particles to. Must be at least count * m_layout.size() bytes.
+	 * @param count The maximum number of particles to read.
+	 * @return The number of particles read, which is less than 'count' only when EOF is reached.
+	 */
+	virtual std::size_t read_particles_impl( char* data, std::size_t count ){
+		if( count == 0 || !this->has_particles_left() )
+			return 0;
+
+		if( static_cast<detail::prt_int64>( count ) > m_particleCount )
+			count = static_cast<std::size_t>( m_particleCount );
+
+		this->inflate_particles( data, count );
+
+		return count;
+	}
 };
 
 }//namespace prtio
@@ -20,9 +20,14 @@
 
 #include <prtio/detail/conversion.hpp>
 #include <prtio/detail/data_types.hpp>
+#include <prtio/detail/encoding.hpp>
 #include <prtio/prt_layout.hpp>
-#include <prtio/prt_meta_value.hpp>
+#include <prtio/prt_metadata.hpp>
+#include <prtio/prt_predicate.hpp>
+#include <prtio/prt_static_channels.hpp>
+#include <prtio/prt_stream_stats.hpp>
 
+#include <algorithm>
 #include <cstring>
 #include <exception>
 #include <string>
@@ -31,6 +36,34 @@
 
 namespace prtio{
 
+/**
+ * A caller owned array that a channel is loaded into by prt_istream::load_columns(), with the values of all the
+ * particles one after another.
+ */
+struct prt_column{
+	std::string name;        //The name of the channel to load.
+	data_types::enum_t type; //The type of the values in 'data'.
+	std::size_t arity;       //The number of values of each particle.
+	void* data;              //The destination, with room for all the particles loaded.
+	std::size_t stride;      //The number of bytes between the values of consecutive particles.
+
+	prt_column() : type( data_types::type_float32 ), arity( 0 ), data( NULL ), stride( 0 )
+	{}
+
+	/**
+	 * @tparam T The type of the values to load.
+	 * @param name The name of the channel to load.
+	 * @param data The destination, with room for all the particles loaded.
+	 * @param arity The number of values of each particle.
+	 * @param stride The number of bytes between the values of consecutive particles. Defaults to sizeof(T) * arity,
+	 *               which is a tightly packed array.
+	 */
+	template <class T>
+	prt_column( const std::string& name, T data[], std::size_t arity, std::size_t stride = 0 )
+		: name( name ), type( data_types::traits<T>::data_type() ), arity( arity ), data( data ), stride( stride )
+	{}
+};
+
 /**
  * This class defines the interface for a user extracting data from a prt stream. Subclasses of this will
  * implement the specific source of the prt data. Ex. prt_ifstream reads from a file.
@@ -41,20 +74,42 @@ class prt_istream{
 	 */
 	struct bound_channel{
 		void* dest;
-		std::size_t arity, src;
+		std::size_t arity, src, stride;
 		detail::convert_fn_t copyFn;
+		detail::strided_convert_fn_t batchCopyFn;
+
+		//Set for channels stored with a lossy encoding, to decode them from the stored integers instead of converting them.
+		detail::decode_fn_t decodeFn;
+		std::vector<float> decodeParams;
 	};
 
 	//A list of all channels that we want to extract
 	std::vector< bound_channel > m_boundChannels;
+
+	//The extractors for all the channel lists bound with bind_static().
+	std::vector< detail::static_extractor* > m_staticExtractors;
+
+	//Temporary storage for the source particles of a read_particles() call.
+	std::vector< char > m_batchBuffer;
+
+	//Decides which particles are returned, or NULL to return them all.
+	prt_predicate* m_predicate;
+	std::vector< unsigned char > m_keepFlags;
+
+private:
+	//Not copyable, since we own the static extractors.
+	prt_istream( const prt_istream& );
+	prt_istream& operator=( const prt_istream& );
 	
 protected:
 	//The layout of the particle data from the source (ex. PRT file).
 	prt_layout m_layout;
 	
 	// Metadata is populated here from the source
-	std::map< std::string, prt_meta_value > m_fileMetadata;
-	std::map< std::string, std::map< std::string, prt_meta_value > > m_channelMetadata;
+	prt_metadata m_metadata;
+
+	//The statistics collected when built with PRTIO_ENABLE_STATS. Subclasses start and finish it when opened and closed.
+	detail::stats_recorder m_stats;
 
 	/**
 	 * This abstract function provides the interface for subclasses to produce particle data.
@@ -68,12 +123,203 @@ protected:
 	 */
 	virtual bool read_impl( char* dest ) = 0;
 
+	/**
+	 * This function provides the interface for subclasses to produce many particles at once. When
+	 * prt_istream::read_particles() is called, it uses read_particles_impl() to get a block of consecutive
+	 * source particles before extracting the channel data of all of them. The default implementation calls
+	 * read_impl() once per particle, so subclasses should override it if they can do better.
+	 * @param dest A pointer to the location where the subclass should read 'count' consecutive particles
+	 *             with layout 'm_layout'.
+	 * @param count The maximum number of particles to read.
+	 * @note dest must point to an array of at least count * m_layout.size() bytes.
+	 * @return The number of particles read. A return less than 'count' indicates EOF.
+	 */
+	virtual std::size_t read_particles_impl( char* dest, std::size_t count ){
+		std::size_t result = 0;
+		for( std::size_t particleSize = m_layout.size(); result < count && this->read_impl( dest ); ++result, dest += particleSize )
+			;
+		return result;
+	}
+
+	/**
+	 * Lets subclasses skip past particles that the predicate given to set_predicate() rejects without reading them. Ex.
+	 * prt_ifstream skips the blocks whose bounds the predicate rejects. The default implementation doesn't skip any.
+	 * @param predicate The predicate.
+	 * @param count The number of particles about to be read.
+	 * @return The number of particles to read before this is called again, at most 'count', so the reading can stop
+	 *         where the next particles might be skipped.
+	 */
+	virtual std::size_t skip_rejected_particles( const prt_predicate& /*predicate*/, std::size_t count ){
+		return count;
+	}
+
+	/**
+	 * @return The predicate given to set_predicate(), or NULL.
+	 */
+	const prt_predicate* predicate() const {
+		return m_predicate;
+	}
+
+	/**
+	 * Drops the source particles rejected by the predicate given to set_predicate(), moving the others to the front.
+	 * @param data The source particles, with layout 'm_layout'.
+	 * @param count The number of particles pointed to by 'data'.
+	 * @return The number of particles kept.
+	 */
+	std::size_t filter_particles( char* data, std::size_t count ){
+		if( !m_predicate || count == 0 )
+			return count;
+
+		const std::size_t particleSize = m_layout.size();
+
+		m_keepFlags.assign( count, 1 );
+		m_predicate->test( data, particleSize, count, &m_keepFlags.front() );
+
+		std::size_t result = 0;
+		for( std::size_t i = 0; i < count; ++i ){
+			if( m_keepFlags[i] ){
+				if( result != i )
+					memcpy( data + result * particleSize, data + i * particleSize, particleSize );
+				++result;
+			}
+		}
+
+		return result;
+	}
+
+	/**
+	 * Finds the channels that are extracted from the source particles, so subclasses can avoid producing the others.
+	 * @param outOffsets Receives the offset in 'm_layout' of every channel bound with bind() or bind_static(). Empty if
+	 *                   nothing is bound.
+	 */
+	void get_extracted_offsets( std::vector<std::size_t>& outOffsets ) const {
+		outOffsets.clear();
+
+		for( std::vector< bound_channel >::const_iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it )
+			outOffsets.push_back( it->src );
+
+		for( std::vector< detail::static_extractor* >::const_iterator it = m_staticExtractors.begin(), itEnd = m_staticExtractors.end(); it != itEnd; ++it )
+			(*it)->get_source_offsets( outOffsets );
+
+		if( m_predicate )
+			m_predicate->get_channel_offsets( outOffsets );
+	}
+
+	/**
+	 * Gets the temporary storage that read_particles() takes source particles into, sized for a batch of about 256KB.
+	 * @param outBatchSize Receives the number of particles that fit in the returned buffer.
+	 * @return The buffer, which is reused by every call. NULL if the layout is empty.
+	 */
+	char* get_batch_buffer( std::size_t& outBatchSize ){
+		const std::size_t particleSize = m_layout.size();
+
+		outBatchSize = 0;
+		if( particleSize == 0 )
+			return NULL;
+
+		//Process in blocks of about 256KB so the source particles stay in cache while we extract each channel.
+		outBatchSize = (std::max)( std::size_t(1), (std::size_t(1) << 18) / particleSize );
+
+		if( m_batchBuffer.size() < outBatchSize * particleSize )
+			m_batchBuffer.resize( outBatchSize * particleSize );
+
+		return &m_batchBuffer.front();
+	}
+
+	/**
+	 * Extracts the channels requested via bind() and bind_static() from consecutive source particles.
+	 * @param data The source particles, with layout 'm_layout'.
+	 * @param destIndex The index in the bound destinations of the first particle.
+	 * @param count The number of particles pointed to by 'data'.
+	 */
+	void extract_particles( const char* data, std::size_t destIndex, std::size_t count ){
+		const std::size_t particleSize = m_layout.size();
+
+		detail::stats_timer timer( m_stats.counters().convertSeconds );
+		detail::stats_count( m_stats.counters().particles, static_cast<detail::prt_int64>( count ) );
+		detail::stats_count( m_stats.counters().uncompressedBytes, static_cast<detail::prt_int64>( count * particleSize ) );
+
+		for( std::vector< bound_channel >::iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it ){
+			char* dest = static_cast<char*>( it->dest ) + destIndex * it->stride;
+
+			if( it->decodeFn )
+				it->decodeFn( dest, it->stride, data + it->src, particleSize, it->arity, count, it->decodeParams.empty() ? NULL : &it->decodeParams.front() );
+			else
+				it->batchCopyFn( dest, it->stride, data + it->src, particleSize, it->arity, count );
+		}
+
+		for( std::vector< detail::static_extractor* >::iterator it = m_staticExtractors.begin(), itEnd = m_staticExtractors.end(); it != itEnd; ++it )
+			(*it)->extract( data, particleSize, destIndex, count );
+	}
+
+	/**
+	 * Binds a column given to load_columns(), picking the bind() specialization for its type at runtime.
+	 */
+	void bind_column( const prt_column& column ){
+		std::size_t channelIndex = m_layout.find_channel( column.name );
+		if( channelIndex == m_layout.num_channels() )
+			throw std::out_of_range( "There is no channel named \"" + column.name + "\"" );
+
+		switch( column.type ){
+		case data_types::type_int8:
+			this->bind( channelIndex, static_cast<data_types::int8_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_int16:
+			this->bind( channelIndex, static_cast<data_types::int16_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_int32:
+			this->bind( channelIndex, static_cast<data_types::int32_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_int64:
+			this->bind( channelIndex, static_cast<data_types::int64_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_float16:
+			this->bind( channelIndex, static_cast<data_types::float16_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_float32:
+			this->bind( channelIndex, static_cast<data_types::float32_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_float64:
+			this->bind( channelIndex, static_cast<data_types::float64_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_uint8:
+			this->bind( channelIndex, static_cast<data_types::uint8_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_uint16:
+			this->bind( channelIndex, static_cast<data_types::uint16_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_uint32:
+			this->bind( channelIndex, static_cast<data_types::uint32_t*>( column.data ), column.arity, column.stride );
+			break;
+		case data_types::type_uint64:
+			this->bind( channelIndex, static_cast<data_types::uint64_t*>( column.data ), column.arity, column.stride );
+			break;
+		default:
+			throw std::logic_error( "The column for channel \"" + column.name + "\" has an unsupported type" );
+		}
+	}
+
+	/**
+	 * Releases everything bound with bind() and bind_static(), and the predicate, for when the stream moves on to a file
+	 * with another layout.
+	 */
+	void clear_bindings(){
+		m_boundChannels.clear();
+		m_predicate = NULL;
+
+		for( std::vector< detail::static_extractor* >::iterator it = m_staticExtractors.begin(), itEnd = m_staticExtractors.end(); it != itEnd; ++it )
+			delete *it;
+		m_staticExtractors.clear();
+	}
+
 public:
-	prt_istream()
+	prt_istream() : m_predicate( NULL )
 	{}
 
-	virtual ~prt_istream()
-	{}
+	virtual ~prt_istream(){
+		for( std::vector< detail::static_extractor* >::iterator it = m_staticExtractors.begin(), itEnd = m_staticExtractors.end(); it != itEnd; ++it )
+			delete *it;
+	}
 
 	/**
 	 * Retrieve the channel layout information
@@ -85,10 +331,30 @@ public:
 	
 	/**
 	 * Retrieves the metadata associated with the whole file (ie. not channel specific).
-	 * @return The map of metadata names and values for the file.
+	 * @return The metadata names and values for the file, sorted by name. It is valid until the stream is closed.
+	 */
+	prt_meta_map get_file_metadata() const {
+		return m_metadata.file_metadata();
+	}
+
+	/**
+	 * Gets the statistics of where the stream's time has gone since it was opened, such as reading the file, decompressing,
+	 * and converting the channels to the bound types. They are only collected when built with PRTIO_ENABLE_STATS defined,
+	 * which adds a little overhead to every read. Otherwise they are always zero.
+	 * @return The statistics so far. After the stream is closed, the totals of the last file.
 	 */
-	const std::map< std::string, prt_meta_value >& get_file_metadata() const {
-		return m_fileMetadata;
+	prt_stream_stats stats() const {
+		return m_stats.get();
+	}
+
+	/**
+	 * Sets a function to receive the stream's statistics (see stats()) when it is closed, for logging. It isn't called
+	 * unless built with PRTIO_ENABLE_STATS defined.
+	 * @param callback The function to call, or NULL for none.
+	 * @param userData A pointer passed to 'callback'.
+	 */
+	void set_stats_callback( prt_stats_callback callback, void* userData = NULL ){
+		m_stats.set_callback( callback, userData );
 	}
 
 	/**
@@ -103,13 +369,12 @@ public:
 	/**
 	 * Retrieves the metadata associated with the specified channel.
 	 * @param channel The name of the channel to retrieve the metadata for.
-	 * @return The map of metadata names and values for the channel.
+	 * @return The metadata names and values for the channel, sorted by name. It is valid until the stream is closed.
 	 */
-	const std::map< std::string, prt_meta_value >& get_channel_metadata( const std::string& channel ) const {
-		std::map< std::string, std::map< std::string, prt_meta_value > >::const_iterator it = m_channelMetadata.find( channel );
-		if( it == m_channelMetadata.end() )
+	prt_meta_map get_channel_metadata( const std::string& channel ) const {
+		if( !m_layout.has_channel( channel ) )
 			throw std::out_of_range( "There is no channel named \"" + channel + "\"" );
-		return it->second;
+		return m_metadata.channel_metadata( channel );
 	}
 	
 	/**
@@ -118,43 +383,104 @@ public:
 	 * @param name The name of the channel in the prt_istream to bind to.
 	 * @param dest A pointer to the destination for the extracted data.
 	 * @param arity The size of the array pointed to by 'dest'.
+	 * @param stride The number of bytes between the channel data of consecutive particles when using
+	 *               read_particles(). Defaults to sizeof(T) * arity, which is a tightly packed array.
 	 */
 	template <typename T>
-	void bind( const std::string& name, T dest[], std::size_t arity ){
-		const detail::prt_channel& ch = m_layout.get_channel( name );
+	void bind( const std::string& name, T dest[], std::size_t arity, std::size_t stride = 0 ){
+		std::size_t channelIndex = m_layout.find_channel( name );
+		if( channelIndex == m_layout.num_channels() )
+			throw std::out_of_range( "There is no channel named \"" + name + "\"" );
 
-		if( !detail::is_compatible( data_types::traits<T>::data_type(), ch.type ) ){
-			std::stringstream ss;
-			ss << "Incompatible types for channel \"" << name << "\"";
-			ss << ", cannot convert from type: \"" << data_types::names[ ch.type ] << "\"";
-			ss << "to: \"" << data_types::names[ data_types::traits<T>::data_type() ] << "\"";
+		this->bind( channelIndex, dest, arity, stride );
+	}
 
-			throw std::runtime_error( ss.str() );
-		}
+	/**
+	 * This template function will bind a user-supplied variable to a channel given by its index in layout(), as returned
+	 * by prt_layout::find_channel(). Tools that bind the same channels for many files can look them up once per layout.
+	 * Channels written with prt_ostream::bind_quantized() or prt_ostream::bind_octahedral() are decoded when bound to a
+	 * floating point type, and an octahedral channel is bound with an arity of 3. Integer types get the stored values.
+	 * @tparam T The type of the variable to bind to.
+	 * @param channelIndex The index of the channel in layout().
+	 * @param dest A pointer to the destination for the extracted data.
+	 * @param arity The size of the array pointed to by 'dest'.
+	 * @param stride The number of bytes between the channel data of consecutive particles when using
+	 *               read_particles(). Defaults to sizeof(T) * arity, which is a tightly packed array.
+	 */
+	template <typename T>
+	void bind( std::size_t channelIndex, T dest[], std::size_t arity, std::size_t stride = 0 ){
+		if( channelIndex >= m_layout.num_channels() )
+			throw std::out_of_range( "The channel index is beyond the channels of the layout" );
+
+		const std::string& name = m_layout.get_channel_name( channelIndex );
+		const detail::prt_channel& ch = m_layout.get_channel_at( channelIndex );
 
-		if( arity != ch.arity ){
-			std::stringstream ss;
-			ss << "Incompatible types for channel \"" << name << "\"";
-			ss << ", cannot convert from arity: \"" << ch.arity << "\"";
-			ss << "to: \"" << arity << "\"";
+		bound_channel result;
+		result.decodeFn = NULL;
+
+		//An octahedral channel stores two components, which are decoded into the three of the bound array.
+		std::size_t storedArity = arity;
+		if( detail::is_float( data_types::traits<T>::data_type() ) ){
+			encodings::option encoding = detail::get_channel_encoding( name, ch, m_metadata.channel_metadata( name ), result.decodeParams );
+			if( encoding == encodings::encoding_octahedral ){
+				if( arity != 3 )
+					throw std::runtime_error( "The octahedral channel \"" + name + "\" must be bound with an arity of 3" );
+				storedArity = ch.arity;
+			}
 
-			throw std::runtime_error( ss.str() );
+			result.decodeFn = detail::get_decoder<T>( encoding, ch.type );
 		}
 
-		bound_channel result;
+		//Decoded channels aren't converted from the stored type, so only their arity has to match.
+		detail::check_read_binding( name, result.decodeFn ? ch.type : data_types::traits<T>::data_type(), storedArity, ch.type, ch.arity );
+
 		result.dest = dest;
 		result.src = ch.offset;
 		result.arity = ch.arity;
+		result.stride = ( stride != 0 ) ? stride : sizeof(T) * arity;
 		result.copyFn = detail::get_read_converter<T>( ch.type );
+		result.batchCopyFn = detail::get_strided_read_converter<T>( ch.type );
 
-		if( !result.copyFn )
+		if( !result.copyFn || !result.batchCopyFn )
 			throw std::logic_error( "The channel \"" + name + "\" had an unsupported type: \"" + data_types::names[ ch.type ] + "\"" );
 
 		m_boundChannels.push_back( result );
 	}
 
 	/**
-	 * This reads the next particle, and extracts the channels requested via bind(). Returns false
+	 * Sets a predicate that decides which particles are returned by read_next_particle(), read_particles() and the other
+	 * reading functions. It tests the source particles before their channels are converted, so the particles it rejects
+	 * are never converted or copied into the bound variables. Files that store the bounds of their blocks skip the blocks
+	 * the predicate rejects with prt_predicate::may_keep() without decompressing them. Must be called after the stream is
+	 * opened, since the predicate looks up its channels in layout().
+	 *
+	 * read_particles() and load_columns() count only the kept particles towards their 'count'. They store them one after
+	 * another from the start of the destinations, and keep reading until that many are kept or the file ends, so a return
+	 * less than 'count' still means the end of the file. prt_ifstream::load_columns() without a count consumes the whole
+	 * file but only fills the start of each array, returning the number of particles kept.
+	 * @param predicate The predicate, which must outlive the stream or be replaced, or NULL to return all the particles.
+	 */
+	void set_predicate( prt_predicate* predicate ){
+		if( predicate )
+			predicate->bind( m_layout );
+		m_predicate = predicate;
+	}
+
+	/**
+	 * This template function binds a list of channels known at compile time in one go. They are extracted together by a
+	 * single specialized function, which avoids the per-channel indirect calls of bind() and lets the compiler inline
+	 * the copies. Channels bound with bind() and bind_static() can be mixed.
+	 * @tparam Channels A specialization of prtio::static_channels.
+	 * @param channels The destinations of the channels to extract.
+	 */
+	template <class Channels>
+	void bind_static( const Channels& channels ){
+		m_staticExtractors.reserve( m_staticExtractors.size() + 1 );
+		m_staticExtractors.push_back( channels.create_extractor( m_layout, m_metadata ) );
+	}
+
+	/**
+	 * This reads the next particle, and extracts the channels requested via bind() and bind_static(). Returns false
 	 * if no particle was read (due to EOF).
 	 * @return True if a particle was extracted, false if EOF prevented a particle from being read.
 	 */
@@ -163,12 +489,93 @@ public:
 		char* data = (char*)alloca( m_layout.size() );
 
 		bool result = this->read_impl( data );
+		while( result && this->filter_particles( data, 1 ) == 0 )
+			result = this->read_impl( data );
+
 		if( result ){
+			detail::stats_timer timer( m_stats.counters().convertSeconds );
+			detail::stats_count( m_stats.counters().particles, 1 );
+			detail::stats_count( m_stats.counters().uncompressedBytes, static_cast<detail::prt_int64>( m_layout.size() ) );
+
 			//If we read a particle from the source, extract the channel data as requested by the user.
-			for( std::vector< bound_channel >::iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it )
-				it->copyFn( it->dest, data + it->src, it->arity );
+			for( std::vector< bound_channel >::iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it ){
+				if( it->decodeFn )
+					it->decodeFn( it->dest, 0, data + it->src, 0, it->arity, 1, it->decodeParams.empty() ? NULL : &it->decodeParams.front() );
+				else
+					it->copyFn( it->dest, data + it->src, it->arity );
+			}
+
+			for( std::vector< detail::static_extractor* >::iterator it = m_staticExtractors.begin(), itEnd = m_staticExtractors.end(); it != itEnd; ++it )
+				(*it)->extract( data, m_layout.size(), 0, 1 );
+		}
+
+		return result;
+	}
+
+	/**
+	 * This reads up to 'count' particles, and extracts the channels requested via bind() and bind_static(). The i'th particle
+	 * is extracted to the bound location plus i times the channel's stride, so each bound destination must
+	 * have room for 'count' particles. Particles are taken from the source in large blocks and each channel
+	 * is converted for the whole block at once, which is much faster than calling read_next_particle() repeatedly.
+	 * @param count The number of particles to read.
+	 * @return The number of particles extracted. A return less than 'count' indicates EOF.
+	 */
+	std::size_t read_particles( std::size_t count ){
+		std::size_t batchSize;
+		char* data = this->get_batch_buffer( batchSize );
+		if( !data )
+			return 0;
+
+		std::size_t result = 0;
+		while( result < count ){
+			std::size_t numRequested = (std::min)( batchSize, count - result );
+			if( m_predicate )
+				numRequested = this->skip_rejected_particles( *m_predicate, numRequested );
+
+			std::size_t numRead = this->read_particles_impl( data, numRequested );
+			std::size_t numKept = this->filter_particles( data, numRead );
+
+			this->extract_particles( data, result, numKept );
+
+			result += numKept;
+
+			if( numRead < numRequested )
+				break;
+		}
+
+		return result;
+	}
+
+	/**
+	 * Reads up to 'count' particles straight into one caller owned array per channel, which is the layout renderers usually
+	 * want. Each channel is converted to its column's type like bind(), for large blocks of particles at a time. The
+	 * channels bound with bind() and bind_static() are set aside while loading, so they aren't written to. To also
+	 * decompress on several threads, load from a prt_parallel_ifstream.
+	 * With a predicate (see set_predicate()), only the particles it keeps are loaded and counted towards 'count'.
+	 * @param columns The channels to load and where to put them. Each must have room for 'count' particles.
+	 * @param count The number of particles to load.
+	 * @return The number of particles loaded. A return less than 'count' indicates EOF.
+	 */
+	std::size_t load_columns( const std::vector<prt_column>& columns, std::size_t count ){
+		std::vector< bound_channel > savedChannels;
+		std::vector< detail::static_extractor* > savedExtractors;
+		savedChannels.swap( m_boundChannels );
+		savedExtractors.swap( m_staticExtractors );
+
+		std::size_t result = 0;
+		try{
+			for( std::vector<prt_column>::const_iterator it = columns.begin(), itEnd = columns.end(); it != itEnd; ++it )
+				this->bind_column( *it );
+
+			result = this->read_particles( count );
+		}catch( ... ){
+			m_boundChannels.swap( savedChannels );
+			m_staticExtractors.swap( savedExtractors );
+			throw;
 		}
 
+		m_boundChannels.swap( savedChannels );
+		m_staticExtractors.swap( savedExtractors );
 		return result;
 	}
 };
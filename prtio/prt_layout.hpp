@@ -20,8 +20,9 @@
 
 #include <prtio/detail/data_types.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <exception>
-#include <map>
 #include <string>
 #include <stdexcept>
 #include <vector>
@@ -30,6 +31,7 @@ namespace prtio{
 
 class prt_istream;
 class prt_ostream;
+struct prt_header_info;
 
 namespace detail{
 	//Stores the a PRT channel's offset from the start of the particle, as well as its type and arity.
@@ -41,21 +43,74 @@ namespace detail{
 
 /**
  * This class represents the layout of a particle in the PRT file. It is created and used by the prt_istream and
- * subclasses.
+ * subclasses. The channels are stored in a flat array in the order they were added, with an open addressed hash table of
+ * indices for looking them up by name.
  */
 class prt_layout{
-	std::map<std::string, detail::prt_channel> m_channelMap;
+	std::vector<detail::prt_channel> m_channelData; //Stores each channel, in the same order as 'm_channels'.
 	std::vector<std::string> m_channels; //Stores the name of each channel, for easy integer indexing.
+	std::vector<std::size_t> m_hashTable; //Each slot holds a channel index plus one, or 0 if empty. Its size is a power of two.
 	std::size_t m_totalSize;
 
 private:
 	friend class prt_istream;
 	friend class prt_ostream;
+	friend struct prt_header_info;
 
 	//private constructor so it can only be created by friend classes.
 	prt_layout() : m_totalSize( 0 )
 	{}
 
+	//FNV-1a, which is cheap and spreads the short, similar names of channels well.
+	static std::size_t hash_name( const char* name, std::size_t length ){
+		std::size_t result = 2166136261u;
+		for( std::size_t i = 0; i < length; ++i ){
+			result ^= static_cast<unsigned char>( name[i] );
+			result *= 16777619u;
+		}
+		return result;
+	}
+
+	/**
+	 * Finds the slot of 'm_hashTable' that holds the named channel, or the empty slot where it would be inserted.
+	 * @note 'm_hashTable' must not be empty.
+	 */
+	std::size_t find_slot( const char* name, std::size_t length ) const {
+		const std::size_t mask = m_hashTable.size() - 1;
+
+		for( std::size_t slot = hash_name( name, length ) & mask;; slot = ( slot + 1 ) & mask ){
+			std::size_t entry = m_hashTable[slot];
+			if( entry == 0 )
+				return slot;
+
+			const std::string& entryName = m_channels[entry - 1];
+			if( entryName.size() == length && memcmp( entryName.data(), name, length ) == 0 )
+				return slot;
+		}
+	}
+
+	/**
+	 * @return The index of the named channel, or num_channels() if there is no such channel.
+	 */
+	std::size_t find_index( const char* name, std::size_t length ) const {
+		if( m_hashTable.empty() )
+			return m_channels.size();
+
+		std::size_t entry = m_hashTable[ this->find_slot( name, length ) ];
+		return ( entry != 0 ) ? entry - 1 : m_channels.size();
+	}
+
+	/**
+	 * Rebuilds 'm_hashTable' with the given number of slots.
+	 * @param tableSize A power of two larger than the number of channels.
+	 */
+	void rehash( std::size_t tableSize ){
+		m_hashTable.assign( tableSize, 0 );
+
+		for( std::size_t i = 0, iEnd = m_channels.size(); i < iEnd; ++i )
+			m_hashTable[ this->find_slot( m_channels[i].data(), m_channels[i].size() ) ] = i + 1;
+	}
+
 public:
 	/**
 	 * Adds a named channel if it does not already exist.
@@ -65,16 +120,21 @@ public:
 	 * @param offset The channel;'s offset in bytes from the beginning of the particle.
 	 */
 	void add_channel( const std::string& name, data_types::enum_t type, std::size_t arity, std::size_t offset ){
-		std::map<std::string, detail::prt_channel>::iterator it = m_channelMap.find( name );
-		if( it != m_channelMap.end() )
+		if( this->has_channel( name ) )
 			throw std::runtime_error( "Duplicate channel \"" + name + "\" detected" );
 
-		detail::prt_channel& dest = m_channelMap[ name ];
+		//Keep the table at most half full, so probe sequences stay short.
+		if( ( m_channels.size() + 1 ) * 2 > m_hashTable.size() )
+			this->rehash( (std::max)( std::size_t(16), m_hashTable.size() * 2 ) );
 
+		detail::prt_channel dest;
 		dest.type = type;
 		dest.arity = arity;
 		dest.offset = offset;
 
+		m_hashTable[ this->find_slot( name.data(), name.size() ) ] = m_channels.size() + 1;
+
+		m_channelData.push_back( dest );
 		m_channels.push_back( name );
 
 		m_totalSize += data_types::sizes[ type ] * arity;
@@ -84,7 +144,9 @@ public:
 	 * Clears all channels from the layout.
 	 */
 	void clear(){
-		m_channelMap.clear();
+		m_channelData.clear();
+		m_channels.clear();
+		m_hashTable.clear();
 		m_totalSize = 0;
 	}
 
@@ -92,7 +154,7 @@ public:
 	 * Gets the number of channels in this layout
 	 */
 	std::size_t num_channels() const {
-		return m_channelMap.size();
+		return m_channels.size();
 	}
 
 	/**
@@ -101,7 +163,31 @@ public:
 	 * @return True if the channel exists in this layout, false otherwise.
 	 */
 	bool has_channel( const std::string& name ) const {
-		return m_channelMap.find( name ) != m_channelMap.end();
+		return this->find_index( name.data(), name.size() ) != m_channels.size();
+	}
+
+	/**
+	 * Returns true if the layout has a channel with the given name. This overload avoids constructing a std::string.
+	 */
+	bool has_channel( const char* name ) const {
+		return this->find_index( name, strlen( name ) ) != m_channels.size();
+	}
+
+	/**
+	 * Finds the index of a channel, for use with get_channel_at(), get_channel_name() and prt_istream::bind(). Looking a
+	 * channel up once and keeping its index avoids repeating the lookup by name.
+	 * @param name The name of the channel to look for.
+	 * @return The index of the channel, or num_channels() if there is no channel with the given name.
+	 */
+	std::size_t find_channel( const std::string& name ) const {
+		return this->find_index( name.data(), name.size() );
+	}
+
+	/**
+	 * Finds the index of a channel. This overload avoids constructing a std::string. See find_channel( const std::string& ).
+	 */
+	std::size_t find_channel( const char* name ) const {
+		return this->find_index( name, strlen( name ) );
 	}
 
 	/**
@@ -117,12 +203,20 @@ public:
 	 * @return A const reference to the channel with the given name.
 	 */
 	const detail::prt_channel& get_channel( const std::string& name ) const {
-		std::map<std::string, detail::prt_channel>::const_iterator it = m_channelMap.find( name );
-		if( it != m_channelMap.end() )
-			return it->second;
+		std::size_t index = this->find_index( name.data(), name.size() );
+		if( index != m_channels.size() )
+			return m_channelData[index];
 		throw std::out_of_range( "There is no channel named \"" + name + "\"" );
 	}
 
+	/**
+	 * Returns a const reference to the i'th channel in the layout.
+	 * @param index The index of the channel, less than num_channels().
+	 */
+	const detail::prt_channel& get_channel_at( std::size_t index ) const {
+		return m_channelData[index];
+	}
+
 	/**
 	 * @return The size of a particle with the current layout.
 	 */
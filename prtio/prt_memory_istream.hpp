@@ -0,0 +1,57 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a stream for reading prt files that are already in memory.
+ */
+
+#pragma once
+
+#include <prtio/prt_ifstream.hpp>
+
+namespace prtio{
+
+/**
+ * This class reads particles from the bytes of a PRT file held in memory, for example a buffer received over a socket or
+ * from shared memory. The header and metadata are parsed exactly as prt_ifstream does, and the particle data is
+ * decompressed straight from the caller's memory without copying it. The memory must stay valid until the stream is closed.
+ */
+class prt_memory_istream : public prt_ifstream{
+public:
+	/**
+	 * Default constructor. User must later call open().
+	 */
+	prt_memory_istream()
+	{}
+
+	/**
+	 * Constructor that opens the stream for the given memory.
+	 * @param data The bytes of the PRT file.
+	 * @param size The size in bytes of 'data'.
+	 */
+	prt_memory_istream( const void* data, std::size_t size ){
+		this->open( data, size );
+	}
+
+	/**
+	 * Opens the stream to read from the given memory.
+	 * @param data The bytes of the PRT file, which must stay valid until the stream is closed.
+	 * @param size The size in bytes of 'data'.
+	 */
+	void open( const void* data, std::size_t size ){
+		this->open_memory( data, size, "<memory>" );
+	}
+};
+
+}//namespace prtio
@@ -0,0 +1,116 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a stream for writing prt files to memory.
+ */
+
+#pragma once
+
+#include <prtio/prt_ofstream.hpp>
+
+namespace prtio{
+
+/**
+ * This class writes particles as the bytes of a PRT file in memory instead of on disk, for example to send over a socket
+ * or through shared memory. It supports all the settings of prt_ofstream. The particle count and bounding box in the
+ * header are only known once every particle has been written, so the file is complete when close() returns.
+ */
+class prt_memory_ostream : public prt_ofstream{
+public:
+	/**
+	 * A function that receives the finished file from close().
+	 * @param userData The pointer given to open().
+	 * @param data The bytes of the PRT file. They are only valid during the call.
+	 * @param size The size in bytes of 'data'.
+	 */
+	typedef void (*write_callback)( void* userData, const char* data, std::size_t size );
+
+private:
+	std::vector<char> m_data;  //The file, if it isn't being written to a vector owned by the caller.
+	std::vector<char>* m_dest; //The vector the file is being written to, or NULL if the stream isn't open.
+	write_callback m_callback; //The function to give the finished file to, or NULL.
+	void* m_userData;          //Passed to 'm_callback'.
+
+public:
+	/**
+	 * Default constructor. User must later call open().
+	 */
+	prt_memory_ostream() : m_dest( NULL ), m_callback( NULL ), m_userData( NULL )
+	{}
+
+	virtual ~prt_memory_ostream(){
+		this->close();
+	}
+
+	/**
+	 * Opens the stream to write to an internal buffer, which data() returns once the stream is closed.
+	 */
+	void open(){
+		this->open( m_data );
+	}
+
+	/**
+	 * Opens the stream to write to a vector owned by the caller, which is complete once the stream is closed.
+	 * @param dest The vector that receives the bytes of the PRT file. It is cleared first.
+	 */
+	void open( std::vector<char>& dest ){
+		m_dest = &dest;
+		m_callback = NULL;
+		m_userData = NULL;
+
+		this->open_memory( dest, "<memory>" );
+	}
+
+	/**
+	 * Opens the stream to write to an internal buffer, which is handed to a callback once the stream is closed.
+	 * @param callback The function that receives the bytes of the PRT file from close().
+	 * @param userData Passed to 'callback'.
+	 */
+	void open( write_callback callback, void* userData ){
+		this->open( m_data );
+
+		m_callback = callback;
+		m_userData = userData;
+	}
+
+	/**
+	 * Finishes writing the file, and gives it to the callback if one was passed to open().
+	 */
+	void close(){
+		prt_ofstream::close();
+
+		if( !m_dest )
+			return;
+
+		std::vector<char>* dest = m_dest;
+		m_dest = NULL;
+
+		if( m_callback ){
+			write_callback callback = m_callback;
+			m_callback = NULL;
+
+			callback( m_userData, dest->empty() ? NULL : &dest->front(), dest->size() );
+		}
+	}
+
+	/**
+	 * @return The bytes of the file written by the last open() that used the internal buffer. Complete once the stream is closed.
+	 */
+	const std::vector<char>& data() const {
+		return m_data;
+	}
+};
+
+}//namespace prtio
@@ -27,6 +27,8 @@
 
 namespace prtio{
 
+class prt_metadata;
+
 // We store strings UTF8 encoded, but on Windows we work with them as UTF16LE in memory. The conversion is automatic at the time of file I/O.
 #ifdef _WIN32
 typedef wchar_t uchar_type;
@@ -162,28 +164,40 @@ private:
 	
 	void reset( meta_types::option type, std::size_t arity, void* pData );
 	
+	/**
+	 * Makes this value refer to data owned by a prt_metadata, without copying it. Copies of this value own their data.
+	 */
+	void set_view( meta_types::option type, std::size_t arity, void* pData );
+	
+	friend class prt_metadata;
+	
 private:
 	meta_types::option m_type;
 	std::size_t m_arity;
 	void* m_pData;
+	bool m_owned; //False if 'm_pData' belongs to a prt_metadata.
 };
 
 inline prt_meta_value::prt_meta_value()
-	: m_pData( NULL ), m_type( meta_types::type_invalid ), m_arity( 0 )
+	: m_pData( NULL ), m_type( meta_types::type_invalid ), m_arity( 0 ), m_owned( true )
 {}
 
 inline prt_meta_value::prt_meta_value( const prt_meta_value& rhs )
-	: m_pData( NULL ), m_type( meta_types::type_invalid ), m_arity( 0 )
+	: m_pData( NULL ), m_type( meta_types::type_invalid ), m_arity( 0 ), m_owned( true )
 {
 	if( rhs.is_valid() )
 		this->set( rhs.m_type, rhs.m_arity, rhs.m_pData );
 }
 
 inline prt_meta_value::~prt_meta_value(){
-	operator delete( m_pData );
+	if( m_owned )
+		operator delete( m_pData );
 }
 
 inline prt_meta_value& prt_meta_value::operator=( const prt_meta_value& rhs ){
+	if( this == &rhs )
+		return *this;
+
 	if( rhs.is_valid() ){
 		this->set( rhs.m_type, rhs.m_arity, rhs.m_pData );
 	}else{
@@ -208,11 +222,17 @@ inline std::basic_ostream<uchar_type>& prt_meta_value::to_stream_internal( std::
 }
 
 inline void prt_meta_value::reset( meta_types::option type, std::size_t arity, void* pData ){
-	if( m_pData )
+	if( m_pData && m_owned )
 		operator delete( m_pData );
 	m_pData = pData;
 	m_type = type;
 	m_arity = arity;
+	m_owned = true;
+}
+
+inline void prt_meta_value::set_view( meta_types::option type, std::size_t arity, void* pData ){
+	this->reset( type, arity, pData );
+	m_owned = false;
 }
 
 inline void prt_meta_value::set( meta_types::option type, std::size_t arity, const void* pData ){
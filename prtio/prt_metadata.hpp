@@ -0,0 +1,356 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the store for the metadata read from a PRT file, which keeps all the names and values in a single
+ * block of memory.
+ */
+
+#pragma once
+
+#include <prtio/prt_layout.hpp>
+#include <prtio/prt_meta_value.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * A named metadata value. The members are named like std::map's value_type so code can iterate either the same way.
+ */
+struct prt_meta_entry{
+	const char* first;   //The name of the value.
+	prt_meta_value second;
+
+	prt_meta_entry() : first( NULL )
+	{}
+};
+
+/**
+ * A read-only view of the metadata values of the file or of one channel, sorted by name. It refers to the prt_metadata
+ * that created it, so it is only valid while that is unchanged.
+ */
+class prt_meta_map{
+public:
+	typedef const prt_meta_entry* const_iterator;
+
+private:
+	const_iterator m_begin, m_end;
+
+public:
+	prt_meta_map() : m_begin( NULL ), m_end( NULL )
+	{}
+
+	prt_meta_map( const_iterator begin, const_iterator end ) : m_begin( begin ), m_end( end )
+	{}
+
+	const_iterator begin() const {
+		return m_begin;
+	}
+
+	const_iterator end() const {
+		return m_end;
+	}
+
+	std::size_t size() const {
+		return static_cast<std::size_t>( m_end - m_begin );
+	}
+
+	bool empty() const {
+		return m_begin == m_end;
+	}
+
+	/**
+	 * @return The value with the given name, or end() if there isn't one.
+	 */
+	const_iterator find( const char* name ) const {
+		const_iterator lo = m_begin, hi = m_end;
+		while( lo < hi ){
+			const_iterator mid = lo + ( hi - lo ) / 2;
+			if( strcmp( mid->first, name ) < 0 )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return ( lo != m_end && strcmp( lo->first, name ) == 0 ) ? lo : m_end;
+	}
+
+	const_iterator find( const std::string& name ) const {
+		return this->find( name.c_str() );
+	}
+
+	/**
+	 * @return 1 if there is a value with the given name, otherwise 0.
+	 */
+	std::size_t count( const std::string& name ) const {
+		return this->find( name.c_str() ) != m_end ? 1u : 0u;
+	}
+
+	/**
+	 * @return The value with the given name.
+	 * @throws std::out_of_range If there is no value with that name.
+	 */
+	const prt_meta_value& at( const std::string& name ) const {
+		const_iterator it = this->find( name.c_str() );
+		if( it == m_end )
+			throw std::out_of_range( "There is no metadata named \"" + name + "\"" );
+		return it->second;
+	}
+};
+
+/**
+ * Stores the file and channel metadata read from a PRT file. The names and values live in one block of memory, which
+ * the header's meta chunks are read straight into, and the values are viewed in place rather than copied into separate
+ * allocations. Lookups are binary searches of flat, sorted arrays.
+ */
+class prt_metadata{
+	//The location of a value's parts in 'm_arena'.
+	struct record{
+		std::size_t channel, name, data; //Offsets of the NULL terminated channel name (empty for file metadata), value name, and data.
+		meta_types::option type;
+		std::size_t arity;
+	};
+
+	//The range of 'm_entries' of one channel's values.
+	struct channel_range{
+		const char* channel;
+		std::size_t begin, end;
+	};
+
+	//Orders records by channel, then name. Stable sorting keeps the order they were read for duplicates.
+	struct record_less{
+		const char* arena;
+
+		bool operator()( const record& lhs, const record& rhs ) const {
+			int result = strcmp( arena + lhs.channel, arena + rhs.channel );
+			if( result == 0 )
+				result = strcmp( arena + lhs.name, arena + rhs.name );
+			return result < 0;
+		}
+	};
+
+	std::vector<char> m_arena;
+	std::vector<record> m_records;
+	std::size_t m_used;    //The number of bytes of 'm_arena' holding committed values.
+
+	std::vector<prt_meta_entry> m_entries; //The values, in the same order as 'm_records'.
+	std::vector<channel_range> m_channels; //Sorted by channel name. Doesn't include the file metadata.
+	std::size_t m_fileEnd;                 //The file metadata is 'm_entries' [0, m_fileEnd).
+
+	static std::size_t align( std::size_t offset ){
+		return ( offset + 7u ) & ~std::size_t( 7u );
+	}
+
+	/**
+	 * Points 'm_entries' and 'm_channels' at the current contents of 'm_arena' and 'm_records'.
+	 */
+	void rebuild(){
+		m_entries.clear();
+		m_entries.resize( m_records.size() );
+		m_channels.clear();
+		m_fileEnd = 0;
+
+		const char* arena = m_arena.empty() ? NULL : &m_arena.front();
+
+		for( std::size_t i = 0; i < m_records.size(); ++i ){
+			const record& r = m_records[i];
+
+			m_entries[i].first = arena + r.name;
+			m_entries[i].second.set_view( r.type, r.arity, const_cast<char*>( arena + r.data ) );
+
+			if( arena[r.channel] == '\0' ){
+				m_fileEnd = i + 1;
+			}else if( m_channels.empty() || strcmp( m_channels.back().channel, arena + r.channel ) != 0 ){
+				channel_range range = { arena + r.channel, i, i + 1 };
+				m_channels.push_back( range );
+			}else{
+				m_channels.back().end = i + 1;
+			}
+		}
+	}
+
+public:
+	prt_metadata() : m_used( 0 ), m_fileEnd( 0 )
+	{}
+
+	prt_metadata( const prt_metadata& rhs ) : m_arena( rhs.m_arena ), m_records( rhs.m_records ), m_used( rhs.m_used ), m_fileEnd( 0 ){
+		this->rebuild();
+	}
+
+	prt_metadata& operator=( const prt_metadata& rhs ){
+		if( this != &rhs ){
+			m_arena = rhs.m_arena;
+			m_records = rhs.m_records;
+			m_used = rhs.m_used;
+			this->rebuild();
+		}
+		return *this;
+	}
+
+	void swap( prt_metadata& rhs ){
+		//Swapping vectors keeps their memory, so the views stay valid.
+		m_arena.swap( rhs.m_arena );
+		m_records.swap( rhs.m_records );
+		m_entries.swap( rhs.m_entries );
+		m_channels.swap( rhs.m_channels );
+		std::swap( m_used, rhs.m_used );
+		std::swap( m_fileEnd, rhs.m_fileEnd );
+	}
+
+	void clear(){
+		m_arena.clear();
+		m_records.clear();
+		m_entries.clear();
+		m_channels.clear();
+		m_used = 0;
+		m_fileEnd = 0;
+	}
+
+	/**
+	 * Reserves enough memory that reading a header of this size usually fits in a single allocation.
+	 */
+	void reserve( std::size_t numBytes ){
+		m_arena.reserve( numBytes );
+	}
+
+	/**
+	 * Makes space for reading a meta chunk, which is then passed to commit_chunk() or dropped by calling begin_chunk() again.
+	 * @param chunkLength The length of the chunk in bytes.
+	 * @return Space for 'chunkLength' bytes, which is valid until the next call to this object.
+	 */
+	char* begin_chunk( std::size_t chunkLength ){
+		std::size_t offset = align( m_used );
+
+		//Leave room for moving the value forward to be aligned.
+		m_arena.resize( offset + chunkLength + 8u );
+		return &m_arena[offset];
+	}
+
+	/**
+	 * Adds a value from the chunk returned by begin_chunk(). All the pointers must be inside that chunk, which is
+	 * reused in place.
+	 * @param channelName The channel the value is for, or an empty string for file metadata.
+	 * @param name The name of the value.
+	 * @param type The type of the value.
+	 * @param arity The number of elements in the value.
+	 * @param data The value's data. It is moved to be correctly aligned, so nothing may follow it in the chunk.
+	 * @param numBytes The length of 'data' in bytes. Strings must include the NULL terminator.
+	 */
+	void commit_chunk( const char* channelName, const char* name, meta_types::option type, std::size_t arity, const char* data, std::size_t numBytes ){
+		const char* arena = &m_arena.front();
+
+		record r;
+		r.channel = static_cast<std::size_t>( channelName - arena );
+		r.name = static_cast<std::size_t>( name - arena );
+		r.data = align( static_cast<std::size_t>( data - arena ) );
+		r.type = type;
+		r.arity = arity;
+
+		if( arena + r.data != data )
+			memmove( &m_arena[r.data], data, numBytes );
+
+		m_used = r.data + numBytes;
+		m_records.push_back( r );
+	}
+
+	/**
+	 * Adds a value by copying it in, for values that had to be converted after being read.
+	 * @see commit_chunk()
+	 */
+	void add( const char* channelName, const char* name, meta_types::option type, std::size_t arity, const void* data, std::size_t numBytes ){
+		//Copy the names first in case they are in 'm_arena', which is about to move.
+		std::string channelStr( channelName ), nameStr( name );
+
+		char* chunk = this->begin_chunk( channelStr.size() + nameStr.size() + 2u + numBytes );
+		memcpy( chunk, channelStr.c_str(), channelStr.size() + 1u );
+		memcpy( chunk + channelStr.size() + 1u, nameStr.c_str(), nameStr.size() + 1u );
+
+		char* dest = chunk + channelStr.size() + nameStr.size() + 2u;
+		memcpy( dest, data, numBytes );
+
+		this->commit_chunk( chunk, chunk + channelStr.size() + 1u, type, arity, dest, numBytes );
+	}
+
+	/**
+	 * Sorts the values read so far so they can be looked up. If a name appears more than once, the last one read is kept.
+	 * @param layout Values for channels that aren't in this layout are dropped with a warning.
+	 */
+	void finalize( const prt_layout& layout ){
+		//Drop the space of a chunk that wasn't committed.
+		m_arena.resize( m_used );
+
+		record_less less = { m_arena.empty() ? NULL : &m_arena.front() };
+		std::stable_sort( m_records.begin(), m_records.end(), less );
+
+		std::vector<record>::iterator out = m_records.begin();
+		const char* lastInvalid = NULL;
+
+		for( std::vector<record>::iterator it = m_records.begin(), itEnd = m_records.end(); it != itEnd; ++it ){
+			//Only the last of equal names is kept.
+			if( it + 1 != itEnd && !less( *it, *(it + 1) ) )
+				continue;
+
+			const char* channel = less.arena + it->channel;
+			if( channel[0] != '\0' && !layout.has_channel( channel ) ){
+				if( !lastInvalid || strcmp( lastInvalid, channel ) != 0 )
+					std::cerr << "Invalid metadata channel: \"" << channel << "\"" << std::endl;
+				lastInvalid = channel;
+				continue;
+			}
+
+			*out++ = *it;
+		}
+
+		m_records.erase( out, m_records.end() );
+
+		this->rebuild();
+	}
+
+	/**
+	 * @return The metadata associated with the whole file (ie. not channel specific).
+	 */
+	prt_meta_map file_metadata() const {
+		return m_entries.empty() ? prt_meta_map() : prt_meta_map( &m_entries.front(), &m_entries.front() + m_fileEnd );
+	}
+
+	/**
+	 * @return The metadata associated with a channel, which is empty if the file has none for it.
+	 */
+	prt_meta_map channel_metadata( const char* channel ) const {
+		std::size_t lo = 0, hi = m_channels.size();
+		while( lo < hi ){
+			std::size_t mid = lo + ( hi - lo ) / 2;
+			if( strcmp( m_channels[mid].channel, channel ) < 0 )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if( lo == m_channels.size() || strcmp( m_channels[lo].channel, channel ) != 0 )
+			return prt_meta_map();
+
+		return prt_meta_map( &m_entries.front() + m_channels[lo].begin, &m_entries.front() + m_channels[lo].end );
+	}
+
+	prt_meta_map channel_metadata( const std::string& channel ) const {
+		return this->channel_metadata( channel.c_str() );
+	}
+};
+
+}//namespace prtio
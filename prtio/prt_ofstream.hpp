@@ -19,11 +19,22 @@
 
 #pragma once
 
+#include <prtio/prt_buffer_pool.hpp>
 #include <prtio/prt_ostream.hpp>
+#include <prtio/detail/async_io.hpp>
+#include <prtio/detail/block_deflater.hpp>
+#include <prtio/detail/memory_streambuf.hpp>
 #include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/spatial.hpp>
+#include <prtio/detail/threading.hpp>
+#include <prtio/prt_compression_options.hpp>
+#include <algorithm>
 #include <cassert>
+#include <ctime>
 #include <fstream>
 #include <limits>
+#include <utility>
+#include <vector>
 #include <zlib.h>
 
 #ifdef _WIN32
@@ -33,24 +44,75 @@
 
 namespace prtio{
 
+class prt_ofstream_sink;
+
 /**
  * This class implements the prt_istream interface, for reading particles from a file.
  */
 class prt_ofstream : public prt_ostream{
+	friend class prt_ofstream_sink;
+
 	std::string m_filePath; //The path to the PRT file.
-	std::ofstream m_fout;   //The stream that is writing bytes to the file.
+	std::ofstream m_file;   //The file being written, unless writing to memory.
+	detail::vector_ostreambuf m_memoryBuffer; //The stream buffer collecting the output, when opened by open_memory().
+	std::ostream m_fout;    //The stream that is writing bytes to the file or memory.
 	z_stream m_zstream;     //The zlib stream that is compressing particles for writing to the file.
 
 	char* m_buffer;           //A temporary buffer for storing the compressed file data before being flushed to disk.
 	std::size_t m_bufferSize; //The size of 'm_buffer' in bytes.
+	prt_buffer_pool* m_bufferPool; //The pool 'm_buffer' is taken from, or NULL to allocate it.
+
+	bool m_asyncOutput;                  //If true, the compressed data is written to disk on a background thread.
+	detail::async_writer* m_asyncWriter; //Writes the compressed data while compression continues, if 'm_asyncOutput'.
 
 	detail::prt_int64 m_particleCount; //The number of particles written so far.
 
-	std::ostream::streampos m_countLocation; //The location that we need to write the final particle count to.
-	std::ostream::streampos m_boundBoxLocation; //The location that we need to write the final boundbox to.
+	std::streampos m_countLocation; //The location that we need to write the final particle count to.
+	std::streampos m_boundBoxLocation; //The location that we need to write the final boundbox to.
+	std::streampos m_blockIndexLocation; //The location that we need to write the file offset of the block index to.
+	std::streampos m_codecLevelLocation; //The location that we need to write the final compression level to, if auto tuning.
 	
 	float m_bounds[6];
 	std::ptrdiff_t m_posChannelOffset;
+
+	std::size_t m_numThreads; //The number of threads to compress particles on, or 0 to use all of them.
+	std::size_t m_blockSize;  //The number of particles in each independently compressed block, or 0 for the default.
+
+	detail::block_deflater* m_blockDeflater; //Compresses the particles in independent blocks, if not using 'm_zstream'.
+	std::vector<char> m_blockData;           //The particles of the block currently being filled.
+	std::size_t m_blockParticles;            //The number of particles in 'm_blockData'.
+	std::size_t m_blockCapacity;             //The number of particles in a full block.
+	uLong m_adler;                           //The adler32 checksum of all the particle data compressed in blocks so far.
+	detail::prt_int64 m_blockOffset;         //The file offset that the next compressed block will be written to.
+	float m_blockBounds[6];                  //The box around the positions of the particles in 'm_blockData'.
+
+	compression_options m_options; //The codec and settings used to compress the particles.
+	detail::particle_filter m_filter; //The filter applied to the particles before compressing, set up for 'm_layout' by open().
+
+	bool m_autoTunePending;         //If true, the particles are being sampled to choose the compression settings before compressing.
+	std::vector<char> m_autoSample; //The particles sampled so far.
+	std::size_t m_autoSampleCount;  //The number of particles in 'm_autoSample'.
+
+	bool m_writeBlockIndex; //If true, an index of the compressed blocks is written so the file can be read from any block.
+	std::vector< detail::prt_block_index_entry_v1 > m_blockIndex; //The blocks written so far.
+	std::vector< detail::prt_block_bounds_v1 > m_blockIndexBounds; //The bounds of each block in 'm_blockIndex'.
+	std::vector< detail::prt_block_checksum_v1 > m_blockIndexChecksums; //The checksum of each block in 'm_blockIndex'.
+
+	bool m_spatialSort;             //If true, the particles are held until close() and written sorted along a Morton curve.
+	std::vector<char> m_sortBuffer; //The particles held for sorting.
+	std::size_t m_sortCount;        //The number of particles in 'm_sortBuffer'.
+
+	detail::prt_int64 m_checkpointInterval; //The number of particles between automatic checkpoints, or 0 for only calling checkpoint().
+	detail::prt_int64 m_checkpointCount;    //The particle count at the last checkpoint.
+	bool m_appending;   //If true, blocks are being added to an existing file opened by open_append().
+	bool m_tailPending; //If true, the end of the data holds a complete trailer and block index, which the next block overwrites.
+
+	std::vector< prt_ofstream_sink* > m_sinks; //The sinks made by create_sink(), which are finished and deleted by close().
+	detail::mutex m_sinkMutex;             //Held while writing compressed blocks to 'm_fout', which the sinks do from their threads.
+	detail::prt_int64 m_sinkParticleCount; //The number of particles the sinks have written to the file so far.
+	float m_sinkBounds[6];                 //The box around the positions of the particles the sinks have written so far.
+
+	bool m_copyingData; //If true, the particle data is already compressed and copied in by write_compressed_data(), see open_compressed().
 	
 private:
 	static std::size_t get_value_size( const prt_meta_value& value ){
@@ -103,7 +165,7 @@ private:
 	 * Writes a meta chunk to the stream.
 	 * @return The stream location of the value in case it needs to be re-written later.
 	 */
-	std::ostream::streampos write_meta_chunk( const std::string& channelName, const std::string& valueName, const prt_meta_value& value ){
+	std::streampos write_meta_chunk( const std::string& channelName, const std::string& valueName, const prt_meta_value& value ){
 		if( !detail::is_valid_channel_name( valueName.c_str() ) )
 			throw std::runtime_error( "Invalid metadata name: \"" + valueName + "\" for channel: \"" + channelName + "\" while writing file: \"" + m_filePath + "\"" );
 		
@@ -119,7 +181,7 @@ private:
 		m_fout.write( valueName.c_str(), valueName.size() + 1 );
 		m_fout.write( reinterpret_cast<const char*>( &valueType ), 4 );
 		
-		std::ostream::streampos result = m_fout.tellp();
+		std::streampos result = m_fout.tellp();
 		
 		this->write_value( value );
 		
@@ -130,6 +192,156 @@ private:
 		return 0;
 	}
 	
+	static std::size_t measure_block_index_chunk(){
+		return 8;
+	}
+	
+	static std::size_t measure_codec_chunk(){
+		return 8;
+	}
+	
+	static std::size_t measure_filter_chunk(){
+		return 8;
+	}
+	
+	/**
+	 * Writes the chunk that records the filter applied to the particles before compressing.
+	 */
+	void write_filter_chunk(){
+		detail::prt_int32 chunkType = detail::prt_filter_chunk();
+		detail::prt_int32 chunkLength = static_cast<detail::prt_int32>( measure_filter_chunk() );
+		detail::prt_int32 filterCode = detail::filter_fourcc( m_filter.filter() );
+		detail::prt_int32 filterFlags = m_filter.flags();
+		
+		m_fout.write( reinterpret_cast<const char*>( &chunkType ), 4 );
+		m_fout.write( reinterpret_cast<const char*>( &chunkLength ), 4 );
+		m_fout.write( reinterpret_cast<const char*>( &filterCode ), 4 );
+		m_fout.write( reinterpret_cast<const char*>( &filterFlags ), 4 );
+	}
+	
+	/**
+	 * Writes the chunk that records the codec (other than zlib) used to compress the particles.
+	 * @return The stream location of the compression level, so that it can be re-written later.
+	 */
+	std::streampos write_codec_chunk(){
+		detail::prt_int32 chunkType = detail::prt_codec_chunk();
+		detail::prt_int32 chunkLength = static_cast<detail::prt_int32>( measure_codec_chunk() );
+		detail::prt_int32 codecCode = detail::codec_fourcc( m_options.codec );
+		detail::prt_int32 codecLevel = m_options.level;
+		
+		m_fout.write( reinterpret_cast<const char*>( &chunkType ), 4 );
+		m_fout.write( reinterpret_cast<const char*>( &chunkLength ), 4 );
+		m_fout.write( reinterpret_cast<const char*>( &codecCode ), 4 );
+		
+		std::streampos result = m_fout.tellp();
+		
+		m_fout.write( reinterpret_cast<const char*>( &codecLevel ), 4 );
+		
+		return result;
+	}
+	
+	/**
+	 * Writes the chunk that records where the block index is stored.
+	 * @return The stream location of the index's file offset, so that it can be re-written later.
+	 */
+	std::streampos write_block_index_chunk(){
+		detail::prt_int32 chunkType = detail::prt_block_index_chunk();
+		detail::prt_int32 chunkLength = static_cast<detail::prt_int32>( measure_block_index_chunk() );
+		detail::prt_int64 indexOffset = 0; // Not known until the stream is closed.
+		
+		m_fout.write( reinterpret_cast<const char*>( &chunkType ), 4 );
+		m_fout.write( reinterpret_cast<const char*>( &chunkLength ), 4 );
+		
+		std::streampos result = m_fout.tellp();
+		
+		m_fout.write( reinterpret_cast<const char*>( &indexOffset ), 8 );
+		
+		return result;
+	}
+	
+	/**
+	 * Writes the block index at the current location, after all the compressed particle data.
+	 */
+	void write_block_index(){
+		detail::prt_int64 blockCount = static_cast<detail::prt_int64>( m_blockIndex.size() );
+		detail::prt_int32 entryLength = sizeof(detail::prt_block_index_entry_v1) + sizeof(detail::prt_block_bounds_v1) + sizeof(detail::prt_block_checksum_v1);
+		
+		m_fout.write( reinterpret_cast<const char*>( &blockCount ), 8 );
+		m_fout.write( reinterpret_cast<const char*>( &entryLength ), 4 );
+		
+		for( std::size_t i = 0; i < m_blockIndex.size(); ++i ){
+			m_fout.write( reinterpret_cast<const char*>( &m_blockIndex[i].dataOffset ), 8 );
+			m_fout.write( reinterpret_cast<const char*>( &m_blockIndex[i].particleCount ), 8 );
+			m_fout.write( reinterpret_cast<const char*>( m_blockIndexBounds[i].bounds ), sizeof(float) * 6 );
+			m_fout.write( reinterpret_cast<const char*>( &m_blockIndexChecksums[i].dataLength ), 8 );
+			m_fout.write( reinterpret_cast<const char*>( &m_blockIndexChecksums[i].checksum ), 4 );
+			m_fout.write( reinterpret_cast<const char*>( &m_blockIndexChecksums[i].reserved ), 4 );
+		}
+	}
+	
+	/**
+	 * @return True if the block index is written, which spatial sorting always does so readers can skip blocks by their
+	 *         bounds. Checkpointing and appending also need it, to find the end of the particle data.
+	 */
+	bool writes_block_index() const {
+		return m_writeBlockIndex || m_spatialSort || m_checkpointInterval > 0 || m_appending;
+	}
+
+	/**
+	 * Writes the particle count, bounds and compression level into the header.
+	 */
+	void write_header_totals(){
+		//The particles written through sinks are counted separately, since they arrive on other threads.
+		detail::prt_int64 particleCount = m_particleCount + m_sinkParticleCount;
+
+		float bounds[6];
+		memcpy( bounds, m_bounds, sizeof(float) * 6 );
+		detail::merge_box( bounds, m_sinkBounds );
+
+		if( m_countLocation > 0 ){
+			m_fout.seekp( m_countLocation, std::ios::beg );
+			m_fout.write( reinterpret_cast<const char*>( &particleCount ), 8 );
+		}
+		if( m_boundBoxLocation > 0 ){
+			m_fout.seekp( m_boundBoxLocation, std::ios::beg );
+			m_fout.write( reinterpret_cast<const char*>( bounds ), sizeof(float) * 6 );
+		}
+		if( m_codecLevelLocation > 0 ){
+			detail::prt_int32 codecLevel = m_options.level;
+
+			m_fout.seekp( m_codecLevelLocation, std::ios::beg );
+			m_fout.write( reinterpret_cast<const char*>( &codecLevel ), 4 );
+		}
+	}
+
+	/**
+	 * Writes the file offset of the block index into the header. -1 marks a file whose index is being rewritten.
+	 */
+	void write_block_index_offset( detail::prt_int64 indexOffset ){
+		m_fout.seekp( m_blockIndexLocation, std::ios::beg );
+		m_fout.write( reinterpret_cast<const char*>( &indexOffset ), 8 );
+	}
+
+	/**
+	 * Called before the first block after a checkpoint overwrites its trailer and block index. The header is marked so
+	 * that until the next checkpoint, readers read the particles up to the last checkpoint without using the index.
+	 */
+	void begin_overwriting_tail(){
+		m_tailPending = false;
+
+		this->finish_output();
+
+		this->write_block_index_offset( -1 );
+		{
+			detail::stats_timer timer( m_stats.counters().flushSeconds );
+			m_fout.flush();
+		}
+		m_fout.seekp( static_cast<std::streamoff>( m_blockOffset ), std::ios::beg );
+
+		if( m_asyncOutput )
+			m_asyncWriter = new detail::async_writer( m_fout, m_options.bufferSize );
+	}
+	
 	void write_stop_chunk(){
 		detail::prt_int32 chunkType = detail::prt_stop_chunk();
 		detail::prt_int32 chunkLength = 0;
@@ -162,6 +374,15 @@ private:
 				chunksSizeTotal += 8 + measure_meta_chunk( it->first, itValue->first, itValue->second );
 		}
 		
+		if( this->writes_block_index() )
+			chunksSizeTotal += 8 + measure_block_index_chunk();
+		
+		if( m_options.codec != codecs::codec_zlib )
+			chunksSizeTotal += 8 + measure_codec_chunk();
+		
+		if( m_filter.enabled() )
+			chunksSizeTotal += 8 + measure_filter_chunk();
+		
 		chunksSizeTotal += 8 + measure_stop_chunk();
 		
 		// Write the main header data
@@ -184,7 +405,7 @@ private:
 		m_fout.write( reinterpret_cast<const char*>( &header.particleCount ), 8 );
 		
 		for( std::map< std::string, prt_meta_value >::const_iterator it = m_fileMetadata.begin(), itEnd = m_fileMetadata.end(); it != itEnd; ++it ){
-			std::ostream::streampos p = this->write_meta_chunk( "", it->first, it->second );
+			std::streampos p = this->write_meta_chunk( "", it->first, it->second );
 			
 			if( it->first == "BoundBox" )
 				m_boundBoxLocation = p;
@@ -198,6 +419,15 @@ private:
 				this->write_meta_chunk( it->first, itValue->first, itValue->second );
 		}
 		
+		if( this->writes_block_index() )
+			m_blockIndexLocation = this->write_block_index_chunk();
+		
+		if( m_options.codec != codecs::codec_zlib )
+			m_codecLevelLocation = this->write_codec_chunk();
+		
+		if( m_filter.enabled() )
+			this->write_filter_chunk();
+		
 		this->write_stop_chunk();
 
 #ifdef WIN32		
@@ -226,7 +456,7 @@ private:
 			if( !detail::is_valid_channel_name( chName.c_str() ) )
 				throw std::runtime_error( "Invalid channel name: \"" + chName + "\" while writing file: \"" + m_filePath + "\"" );
 			
-			const detail::prt_channel& ch = m_layout.get_channel( chName );
+			const detail::prt_channel& ch = m_layout.get_channel_at( static_cast<std::size_t>(i) );
 
 			strncpy( prtChannel.channelName, chName.c_str(), 32 );
 			prtChannel.channelArity = (prt_int32)ch.arity;
@@ -237,165 +467,1475 @@ private:
 		}
 	}
 
+	/**
+	 * Reads the header and block index of an existing PRT file written in blocks, and sets up the stream to add blocks
+	 * after its current particle data.
+	 * @param in The file being appended to.
+	 */
+	void read_append_state( std::istream& in ){
+		using namespace detail;
+
+		prt_header_v1 header;
+		in.read( reinterpret_cast<char*>( &header.magicNumber ), 8 );
+		in.read( reinterpret_cast<char*>( &header.headerLength ), 4 );
+		in.read( header.fmtIdentStr, 32 );
+		in.read( reinterpret_cast<char*>( &header.version ), 4 );
+		in.read( reinterpret_cast<char*>( &header.particleCount ), 8 );
+
+		if( in.fail() || header.magicNumber != prt_magic_number() || strncmp( prt_signature_string(), header.fmtIdentStr, 32 ) != 0 )
+			throw std::runtime_error( "The file \"" + m_filePath + "\" is not a PRT file, so it can't be appended to." );
+
+		if( header.particleCount < 0 )
+			throw std::runtime_error( "The file \"" + m_filePath + "\" was not closed correctly, so it can't be appended to." );
+
+		m_particleCount = header.particleCount;
+		m_countLocation = (char*)&header.particleCount - (char*)&header;
+
+		prt_int64 indexOffset = 0;
+		filters::option filter = filters::filter_none;
+		prt_int32 filterFlags = 0;
+
+		m_options.codec = codecs::codec_zlib;
+
+		if( header.version >= 2 ){
+			for(;;){
+				prt_int32 chunkType, chunkLength;
+				in.read( reinterpret_cast<char*>( &chunkType ), 4 );
+				in.read( reinterpret_cast<char*>( &chunkLength ), 4 );
+
+				if( in.fail() || chunkLength < 0 )
+					throw std::runtime_error( "The header of the file \"" + m_filePath + "\" is truncated." );
+
+				if( chunkType == prt_stop_chunk() )
+					break;
+
+				std::istream::pos_type chunkStart = in.tellg();
+
+				if( chunkType == prt_meta_chunk() ){
+					//Only the file's BoundBox is needed, which is updated in place.
+					static const char boundBoxPrefix[] = "\0BoundBox";
+					const std::size_t prefixLength = sizeof(boundBoxPrefix);
+
+					if( static_cast<std::size_t>( chunkLength ) == prefixLength + 4 + sizeof(float) * 6 ){
+						char prefix[sizeof(boundBoxPrefix)];
+						prt_int32 valueType;
+						in.read( prefix, prefixLength );
+						in.read( reinterpret_cast<char*>( &valueType ), 4 );
+
+						if( memcmp( prefix, boundBoxPrefix, prefixLength ) == 0 && valueType == meta_types::type_float32 ){
+							m_boundBoxLocation = in.tellg();
+							in.read( reinterpret_cast<char*>( m_bounds ), sizeof(float) * 6 );
+						}
+					}
+				}else if( chunkType == prt_block_index_chunk() && chunkLength == 8 ){
+					m_blockIndexLocation = in.tellg();
+					in.read( reinterpret_cast<char*>( &indexOffset ), 8 );
+				}else if( chunkType == prt_codec_chunk() && chunkLength == 8 ){
+					prt_int32 codecCode, codecLevel;
+					in.read( reinterpret_cast<char*>( &codecCode ), 4 );
+					m_codecLevelLocation = in.tellg();
+					in.read( reinterpret_cast<char*>( &codecLevel ), 4 );
+
+					if( !codec_from_fourcc( codecCode, m_options.codec ) )
+						throw std::runtime_error( "The file \"" + m_filePath + "\" was compressed with an unknown codec." );
+					m_options.level = codecLevel;
+				}else if( chunkType == prt_filter_chunk() && chunkLength == 8 ){
+					prt_int32 filterCode;
+					in.read( reinterpret_cast<char*>( &filterCode ), 4 );
+					in.read( reinterpret_cast<char*>( &filterFlags ), 4 );
+
+					if( !filter_from_fourcc( filterCode, filter ) )
+						throw std::runtime_error( "The file \"" + m_filePath + "\" was compressed with an unknown filter." );
+				}
+
+				in.seekg( chunkStart + static_cast<std::streamoff>( chunkLength ) );
+			}
+		}
+
+		if( indexOffset < 0 )
+			throw std::runtime_error( "The file \"" + m_filePath + "\" was not closed after particles were last added, so it can't be appended to." );
+		if( indexOffset == 0 )
+			throw std::runtime_error( "The file \"" + m_filePath + "\" doesn't have a block index, so it can't be appended to." );
+
+		check_codec_available( m_options.codec, m_filePath );
+
+		//The new particles must have exactly the same layout as the existing ones.
+		prt_int32 reservedInt, channelCount, perChannelLength;
+		in.read( reinterpret_cast<char*>( &reservedInt ), 4 );
+		in.read( reinterpret_cast<char*>( &channelCount ), 4 );
+		in.read( reinterpret_cast<char*>( &perChannelLength ), 4 );
+
+		if( in.fail() || reservedInt != 4 || perChannelLength < static_cast<prt_int32>( sizeof(prt_channel_header_v1) ) )
+			throw std::runtime_error( "The channel table of the file \"" + m_filePath + "\" is not valid." );
+
+		bool layoutMatches = ( static_cast<std::size_t>( channelCount ) == m_layout.num_channels() );
+
+		for( prt_int32 i = 0; i < channelCount && layoutMatches; ++i ){
+			prt_channel_header_v1 channel;
+			in.read( reinterpret_cast<char*>( &channel ), sizeof(prt_channel_header_v1) );
+			in.seekg( perChannelLength - static_cast<prt_int32>( sizeof(prt_channel_header_v1) ), std::ios::cur );
+
+			channel.channelName[31] = '\0';
+
+			const detail::prt_channel& ch = m_layout.get_channel_at( static_cast<std::size_t>( i ) );
+
+			layoutMatches = !in.fail() &&
+				m_layout.get_channel_name( static_cast<std::size_t>( i ) ) == channel.channelName &&
+				static_cast<prt_int32>( ch.type ) == channel.channelType &&
+				static_cast<prt_int32>( ch.arity ) == channel.channelArity &&
+				static_cast<prt_int32>( ch.offset ) == channel.channelOffset;
+		}
+
+		if( !layoutMatches )
+			throw std::logic_error( "The channels bound for appending to \"" + m_filePath + "\" don't match the channels of the file, in name, type or order." );
+
+		m_options.filter = filter;
+		if( filter != filters::filter_none )
+			m_filter = particle_filter( filter, filterFlags, m_layout );
+
+		const bool framed = uses_frames( m_options.codec, m_filter );
+
+		if( !framed ){
+			//The new blocks must fit the window size declared by the zlib stream header.
+			unsigned char zlibHeader[2];
+			in.read( reinterpret_cast<char*>( zlibHeader ), 2 );
+
+			if( in.fail() || ( zlibHeader[0] & 0x0f ) != Z_DEFLATED )
+				throw std::runtime_error( "The particle data of the file \"" + m_filePath + "\" is not a zlib stream." );
+
+			m_options.windowBits = ( zlibHeader[0] >> 4 ) + 8;
+		}
+
+		//Read the block index, which the new blocks are added to.
+		in.seekg( static_cast<std::streamoff>( indexOffset ), std::ios::beg );
+
+		prt_int64 blockCount;
+		prt_int32 entryLength;
+		in.read( reinterpret_cast<char*>( &blockCount ), 8 );
+		in.read( reinterpret_cast<char*>( &entryLength ), 4 );
+
+		if( in.fail() || blockCount < 0 || entryLength < static_cast<prt_int32>( sizeof(prt_block_index_entry_v1) ) )
+			throw std::runtime_error( "The block index in the file \"" + m_filePath + "\" is not valid." );
+
+		//The entries must fit in the rest of the file, so a damaged count can't make us allocate more than the file holds.
+		std::istream::pos_type entriesStart = in.tellg();
+		in.seekg( 0, std::ios::end );
+		const prt_int64 bytesLeft = static_cast<prt_int64>( in.tellg() - entriesStart );
+		in.seekg( entriesStart );
+
+		if( in.fail() || blockCount > bytesLeft / entryLength )
+			throw std::runtime_error( "The block index in the file \"" + m_filePath + "\" is not valid." );
+
+		const bool hasBounds = entryLength >= static_cast<prt_int32>( sizeof(prt_block_index_entry_v1) + sizeof(prt_block_bounds_v1) );
+		const bool hasChecksums = entryLength >= static_cast<prt_int32>( sizeof(prt_block_index_entry_v1) + sizeof(prt_block_bounds_v1) + sizeof(prt_block_checksum_v1) );
+		const prt_int32 knownLength = static_cast<prt_int32>( sizeof(prt_block_index_entry_v1) + ( hasBounds ? sizeof(prt_block_bounds_v1) : 0 ) + ( hasChecksums ? sizeof(prt_block_checksum_v1) : 0 ) );
+
+		m_blockIndex.resize( static_cast<std::size_t>( blockCount ) );
+		m_blockIndexBounds.resize( static_cast<std::size_t>( blockCount ) );
+		m_blockIndexChecksums.resize( static_cast<std::size_t>( blockCount ) );
+
+		prt_int64 particleTotal = 0;
+
+		for( std::size_t i = 0; i < m_blockIndex.size(); ++i ){
+			in.read( reinterpret_cast<char*>( &m_blockIndex[i].dataOffset ), 8 );
+			in.read( reinterpret_cast<char*>( &m_blockIndex[i].particleCount ), 8 );
+
+			if( hasBounds )
+				in.read( reinterpret_cast<char*>( m_blockIndexBounds[i].bounds ), sizeof(float) * 6 );
+			else
+				set_infinite_box( m_blockIndexBounds[i].bounds );
+
+			if( hasChecksums ){
+				in.read( reinterpret_cast<char*>( &m_blockIndexChecksums[i].dataLength ), 8 );
+				in.read( reinterpret_cast<char*>( &m_blockIndexChecksums[i].checksum ), 4 );
+				in.read( reinterpret_cast<char*>( &m_blockIndexChecksums[i].reserved ), 4 );
+			}else{
+				m_blockIndexChecksums[i] = detail::unknown_block_checksum();
+			}
+
+			if( entryLength != knownLength )
+				in.seekg( entryLength - knownLength, std::ios::cur );
+
+			particleTotal += m_blockIndex[i].particleCount;
+		}
+
+		if( in.fail() || particleTotal != m_particleCount )
+			throw std::runtime_error( "The block index in the file \"" + m_filePath + "\" does not match the number of particles in the file." );
+
+		//The new blocks replace the end of the zlib stream, continuing its checksum.
+		m_blockOffset = indexOffset;
+
+		if( !framed ){
+			unsigned char zlibTrailer[6];
+			in.seekg( static_cast<std::streamoff>( indexOffset - 6 ), std::ios::beg );
+			in.read( reinterpret_cast<char*>( zlibTrailer ), 6 );
+
+			if( in.fail() || zlibTrailer[0] != 0x03 || zlibTrailer[1] != 0x00 )
+				throw std::runtime_error( "The particle data of the file \"" + m_filePath + "\" doesn't end like a stream written in blocks." );
+
+			m_adler = ( static_cast<uLong>( zlibTrailer[2] ) << 24 ) | ( static_cast<uLong>( zlibTrailer[3] ) << 16 ) | ( static_cast<uLong>( zlibTrailer[4] ) << 8 ) | static_cast<uLong>( zlibTrailer[5] );
+			m_blockOffset -= 6;
+		}
+	}
+
 	/**
 	 * This function initializes the zlib decompression stream for the particle data portion of the PRT file.
 	 */
 	void init_zlib(){
-		if(Z_OK != deflateInit( &m_zstream, Z_DEFAULT_COMPRESSION ) )
+		if(Z_OK != deflateInit2( &m_zstream, m_options.level, Z_DEFLATED, m_options.windowBits, m_options.memLevel, m_options.strategy ) )
 			throw std::runtime_error( "Unable to initialize a zlib deflate stream for output stream \"" + m_filePath + "\"." );
 
-		if( m_bufferSize == 0 )
-			m_bufferSize = (1 << 19);
+		m_bufferSize = m_options.bufferSize;
 
-		m_buffer = new char[m_bufferSize];
+		m_buffer = m_bufferPool ? m_bufferPool->acquire( m_bufferSize, m_bufferSize ) : new char[m_bufferSize];
 
 		m_zstream.avail_out = static_cast<unsigned int>( m_bufferSize );
 		m_zstream.next_out = reinterpret_cast<unsigned char*>( m_buffer );
 	}
 
 	/**
-	 * This helper function will write the compressed data stored in 'm_buffer' to disk.
+	 * This function prepares for compressing particles in independent blocks, instead of through 'm_zstream'.
 	 */
-	void flush(){
-		std::size_t numOut = (m_bufferSize - m_zstream.avail_out);
-		if( numOut > 0 ) {
-			m_fout.write( m_buffer, numOut );
-			m_zstream.avail_out = static_cast<unsigned int>( m_bufferSize );
-			m_zstream.next_out = reinterpret_cast<unsigned char*>( m_buffer );
+	void init_blocks(){
+		const std::size_t particleSize = (std::max)( std::size_t(1), m_layout.size() );
+
+		m_blockCapacity = m_blockSize;
+		if( m_blockCapacity == 0 )
+			m_blockCapacity = (std::max)( std::size_t(1), (std::size_t(1) << 20) / particleSize );
+
+		//Codec frames store their lengths as 32 bit integers, and zlib is only given 4GB at a time (or 2GB to adler32_combine()
+		//where z_off_t is 32 bits), so blocks are kept under 1GB of particle data.
+		m_blockCapacity = (std::min)( m_blockCapacity, (std::max)( std::size_t(1), (std::size_t(1) << 30) / particleSize ) );
+
+		m_blockDeflater = new detail::block_deflater( ( m_numThreads == 0 ) ? detail::hardware_concurrency() : m_numThreads, m_options, m_filter );
+
+		m_blockData.reserve( m_blockCapacity * m_layout.size() );
+		m_blockParticles = 0;
+		this->reset_block_bounds();
+
+		//When appending, the stream was started by whoever wrote the file.
+		if( m_appending ){
+			m_fout.seekp( static_cast<std::streamoff>( m_blockOffset ), std::ios::beg );
+			return;
 		}
+
+		m_adler = adler32( 0L, Z_NULL, 0 );
+
+		if( !detail::uses_frames( m_options.codec, m_filter ) ){
+			//The blocks are raw deflate data, so we need to write the zlib stream header ourselves.
+			unsigned char zlibHeader[2];
+			detail::get_zlib_header( m_options.level, m_options.strategy, m_options.windowBits, zlibHeader );
+
+			m_fout.write( reinterpret_cast<const char*>( zlibHeader ), 2 );
+		}else{
+			//The codec's code at the start of the particle data makes readers that only know a zlib stream fail immediately.
+			detail::prt_int32 codecCode = detail::codec_fourcc( m_options.codec );
+
+			m_fout.write( reinterpret_cast<const char*>( &codecCode ), 4 );
+		}
+
+		m_blockOffset = static_cast<detail::prt_int64>( m_fout.tellp() );
 	}
 
-public:
 	/**
-	 * Default constructor. User must later call open().
+	 * Starts the compressor for the particle data, after the header has been written.
 	 */
-	prt_ofstream(){
-		m_buffer = NULL;
-		m_bufferSize = 0;
-		m_particleCount = 0;
-		m_countLocation = 0;
-		m_boundBoxLocation = 0;
-		m_posChannelOffset = -1;
-		memset( &m_zstream, 0, sizeof(m_zstream) );
-		
-		m_bounds[0] = m_bounds[1] = m_bounds[2] = (std::numeric_limits<float>::max)();
-		m_bounds[3] = m_bounds[4] = m_bounds[5] = (std::numeric_limits<float>::min)();
+	void init_compressor(){
+		if( m_blockSize != 0 || m_numThreads != 1 || this->writes_block_index() || detail::uses_frames( m_options.codec, m_filter ) )
+			init_blocks();
+		else
+			init_zlib();
+
+		//From here until finish_output(), 'm_fout' is only written through the background thread.
+		if( m_asyncOutput )
+			m_asyncWriter = new detail::async_writer( m_fout, m_options.bufferSize );
 	}
 
 	/**
-	 * Can't have a constructor that opens the stream too, since we need to know the layout first!
+	 * Writes compressed particle data to the file, on the background thread if enabled.
 	 */
-	 //prt_ofstream( const std::string& file );
+	void write_output( const char* data, std::size_t numBytes ){
+		detail::stats_timer timer( m_stats.counters().ioSeconds );
+		detail::stats_count( m_stats.counters().compressedBytes, static_cast<detail::prt_int64>( numBytes ) );
 
-	virtual ~prt_ofstream(){
-		close();
+		if( m_asyncWriter )
+			m_asyncWriter->write( data, numBytes );
+		else
+			m_fout.write( data, numBytes );
 	}
 
 	/**
-	 * Opens the prt_ofstream to write to the specified file
-	 * @param file Path to the file to write particles to
+	 * Waits for all the compressed particle data to be written, so that 'm_fout' can be used directly again.
 	 */
-	void open( const std::string& file ){
-		m_fout.open( file.c_str(), std::ios::out | std::ios::binary );
-		if( m_fout.fail() )
-			throw std::ios_base::failure( "Failed to open file \"" + file + "\" for writing" );
+	void finish_output(){
+		if( !m_asyncWriter )
+			return;
 
-		m_filePath = file;
-		m_fout.exceptions( std::ios::badbit|std::ios::failbit ); //We want an exception if writing anything fails.
-		
-		if( m_layout.has_channel( "Position" ) ){
-			const detail::prt_channel& ch = m_layout.get_channel( "Position" );
-			if( ch.type == data_types::type_float32 && ch.arity == 3 )
-				m_posChannelOffset = static_cast<std::ptrdiff_t>( ch.offset );
-		}
-		
-		write_header();
-		init_zlib();
+		//Delete the writer even if the last writes failed, so the file can be closed.
+		struct scoped_writer{
+			detail::async_writer*& writer;
+			~scoped_writer(){
+				delete writer;
+				writer = NULL;
+			}
+		} scope = { m_asyncWriter };
+
+		detail::stats_timer timer( m_stats.counters().flushSeconds );
+		scope.writer->finish();
 	}
 
 	/**
-	 * Closes the stream, and deallocates any memory used for decompressing particles.
+	 * Compresses the sample with the given settings, to see how they perform.
+	 * @param sample The sampled particles, after filtering.
+	 * @return The estimated cost in seconds of compressing and writing the sample with the settings.
 	 */
-	void close(){
-		if( m_buffer ){
-			// Write out all the rest of the stream data, until we hit Z_STREAM_END
-			while(Z_STREAM_END != deflate(&m_zstream, Z_FINISH))
-				flush();
-			flush();
+	double measure_compression( const std::vector<char>& sample, int level, int strategy ) const {
+		const std::size_t sampleSize = sample.size();
 
-			delete[] m_buffer;
-			m_buffer = NULL;
+		std::size_t compressedSize = 0;
+		std::clock_t startTime = std::clock();
 
-			int ret = deflateEnd(&m_zstream);
-			if( ret != Z_OK )
-				throw std::runtime_error("deflateEnd() error for \"" + m_filePath + "\" was:" + zError(ret) );
+		if( m_options.codec == codecs::codec_zlib ){
+			z_stream zstream;
+			memset( &zstream, 0, sizeof(z_stream) );
 
-			memset( &m_zstream, 0, sizeof(z_stream) );
+			if( Z_OK != deflateInit2( &zstream, level, Z_DEFLATED, m_options.windowBits, m_options.memLevel, strategy ) )
+				throw std::runtime_error( "Unable to initialize a zlib deflate stream for output stream \"" + m_filePath + "\"." );
+
+			std::vector<char> output( deflateBound( &zstream, static_cast<uLong>( sampleSize ) ) );
+
+			zstream.next_in = reinterpret_cast<Bytef*>( const_cast<char*>( &sample.front() ) );
+			zstream.avail_in = static_cast<uInt>( sampleSize );
+			zstream.next_out = reinterpret_cast<Bytef*>( &output.front() );
+			zstream.avail_out = static_cast<uInt>( output.size() );
+
+			deflate( &zstream, Z_FINISH );
+
+			compressedSize = output.size() - zstream.avail_out;
+
+			deflateEnd( &zstream );
+		}else{
+			std::vector<char> output( detail::codec_frame_header_size + detail::codec_compress_bound( m_options.codec, sampleSize ) );
+
+			compressedSize = detail::codec_compress( m_options.codec, level, &sample.front(), sampleSize, &output.front() );
 		}
 
-		//Seek back to the beginning of the file and write the particle count in the header region.
-		if( m_fout.is_open() ){
-			if( m_countLocation > 0 ){
-				m_fout.seekp( m_countLocation, std::ios::beg );
-				m_fout.write( reinterpret_cast<const char*>( &m_particleCount ), 8 );
+		double compressTime = static_cast<double>( std::clock() - startTime ) / CLOCKS_PER_SEC;
+
+		//Block compression spreads the work across the threads.
+		if( m_numThreads != 1 )
+			compressTime /= static_cast<double>( ( m_numThreads == 0 ) ? detail::hardware_concurrency() : m_numThreads );
+
+		return compressTime + static_cast<double>( compressedSize ) / m_options.autoBytesPerSecond;
+	}
+
+	/**
+	 * Picks the compression settings for the sampled particles, starts the compressor, then compresses the sample.
+	 */
+	void finish_auto_tune(){
+		m_autoTunePending = false;
+
+		if( !m_autoSample.empty() ){
+			//The settings (level, zlib strategy) to try for each codec.
+			static const int zlibCandidates[][2] = { {1, Z_DEFAULT_STRATEGY}, {1, Z_RLE}, {6, Z_DEFAULT_STRATEGY}, {6, Z_FILTERED}, {9, Z_DEFAULT_STRATEGY} };
+			static const int zstdCandidates[][2] = { {1, 0}, {3, 0}, {9, 0}, {15, 0} };
+			static const int lz4Candidates[][2] = { {1, 0}, {4, 0}, {9, 0} };
+
+			const int (*candidates)[2] = zlibCandidates;
+			std::size_t numCandidates = sizeof(zlibCandidates) / sizeof(zlibCandidates[0]);
+
+			if( m_options.codec == codecs::codec_zstd ){
+				candidates = zstdCandidates;
+				numCandidates = sizeof(zstdCandidates) / sizeof(zstdCandidates[0]);
+			}else if( m_options.codec == codecs::codec_lz4 ){
+				candidates = lz4Candidates;
+				numCandidates = sizeof(lz4Candidates) / sizeof(lz4Candidates[0]);
+			}
+
+			//The filter modifies the particles it is given, so it needs a copy of the sample.
+			std::vector<char> sample( m_autoSample );
+			if( m_filter.enabled() ){
+				std::vector<char> filtered( sample.size() );
+				m_filter.apply( &sample.front(), m_autoSampleCount, &filtered.front() );
+				sample.swap( filtered );
 			}
-			if( m_boundBoxLocation > 0 ){
-				m_fout.seekp( m_boundBoxLocation, std::ios::beg );
-				m_fout.write( reinterpret_cast<const char*>( m_bounds ), sizeof(float) * 6 );
+
+			detail::stats_timer timer( m_stats.counters().codecSeconds );
+
+			double bestCost = (std::numeric_limits<double>::max)();
+			for( std::size_t i = 0; i < numCandidates; ++i ){
+				int strategy = ( m_options.codec == codecs::codec_zlib ) ? candidates[i][1] : m_options.strategy;
+
+				double cost = this->measure_compression( sample, candidates[i][0], strategy );
+				if( cost < bestCost ){
+					bestCost = cost;
+					m_options.level = candidates[i][0];
+					m_options.strategy = strategy;
+				}
 			}
-			m_fout.close();
 		}
 
-		m_filePath.clear();
-		m_layout.clear();
+		this->init_compressor();
 
-		m_bufferSize = 0;
-		m_particleCount = 0;
-		m_countLocation = 0;
+		if( !m_autoSample.empty() )
+			this->compress_particles( &m_autoSample.front(), m_autoSampleCount );
+
+		std::vector<char>().swap( m_autoSample );
+		m_autoSampleCount = 0;
 	}
 
-protected:
 	/**
-	 * Compresses a single particle into 'm_buffer' and flushes to disk if the buffer is full.
-	 * @param data The data for the particle to write to disk.
+	 * Writes the oldest compressed block to disk, waiting for it to finish compressing if necessary.
 	 */
-	virtual void write_impl( const char* data ){
-		++m_particleCount;
-		
-		// If we have a valid Position channel, add this particle to bounding box we are tracking.
-		if( m_posChannelOffset >= 0 ){
-			const float* p = reinterpret_cast<const float*>( data + m_posChannelOffset );
-			if( p[0] < m_bounds[0] )
-				m_bounds[0] = p[0];
-			if( p[0] > m_bounds[3] )
-				m_bounds[3] = p[0];
-				
-			if( p[1] < m_bounds[1] )
-				m_bounds[1] = p[1];
-			if( p[1] > m_bounds[4] )
-				m_bounds[4] = p[1];
-				
-			if( p[2] < m_bounds[2] )
-				m_bounds[2] = p[2];
-			if( p[2] > m_bounds[5] )
-				m_bounds[5] = p[2];
+	void write_next_block(){
+		const detail::block_deflater::block* pb;
+		{
+			//Blocks are compressed on the pool, or by submit() without one, so this is the time spent waiting for them.
+			detail::stats_timer timer( m_stats.counters().codecSeconds );
+			pb = &m_blockDeflater->front();
 		}
-		
-		m_zstream.avail_in = static_cast<unsigned>( m_layout.size() );
-		m_zstream.next_in = reinterpret_cast<unsigned char*>( const_cast<char*>(data) );
 
-		for(;;) {
-			int ret = deflate(&m_zstream, Z_NO_FLUSH);
-			if(ret == Z_STREAM_ERROR)
-				throw std::runtime_error( "deflate() call writing to \"" + m_filePath + "\" failed:\n\t" + zError(ret) );
+		{
+			detail::scoped_lock lock( m_sinkMutex );
+			this->write_block( *pb );
+		}
 
-			if(m_zstream.avail_out == 0) {	//Did we fill the output buffer completely? If so flush and loop.
-				flush();
-			} else {
-				break;
-			}
+		m_blockDeflater->pop_front();
+	}
+
+	/**
+	 * Writes a compressed block to disk after the ones written so far, adding it to the block index and checksum.
+	 * @note 'm_sinkMutex' must be held, since sinks write their blocks from other threads.
+	 */
+	void write_block( const detail::block_deflater::block& b ){
+		if( m_tailPending )
+			this->begin_overwriting_tail();
+
+		if( this->writes_block_index() ){
+			detail::prt_block_index_entry_v1 entry;
+			entry.dataOffset = m_blockOffset;
+			entry.particleCount = static_cast<detail::prt_int64>( b.numParticles );
+
+			detail::prt_block_bounds_v1 entryBounds;
+			memcpy( entryBounds.bounds, b.bounds, sizeof(float) * 6 );
+
+			detail::prt_block_checksum_v1 entryChecksum;
+			entryChecksum.dataLength = static_cast<detail::prt_int64>( b.output.size() );
+			entryChecksum.checksum = b.checksum;
+			entryChecksum.reserved = 0;
+
+			m_blockIndex.push_back( entry );
+			m_blockIndexBounds.push_back( entryBounds );
+			m_blockIndexChecksums.push_back( entryChecksum );
 		}
+
+		if( !b.output.empty() )
+			this->write_output( &b.output.front(), b.output.size() );
+
+		m_blockOffset += static_cast<detail::prt_int64>( b.output.size() );
+
+		if( !detail::uses_frames( m_options.codec, m_filter ) )
+			m_adler = adler32_combine( m_adler, b.adler, static_cast<z_off_t>( b.input.size() ) );
 	}
-};
+
+	/**
+	 * Writes a block compressed by a sink, counting its particles and bounds in the header totals.
+	 * @param b The compressed block, which is only used during this call.
+	 * @note Called from the sink's thread.
+	 */
+	void write_sink_block( const detail::block_deflater::block& b ){
+		detail::scoped_lock lock( m_sinkMutex );
+
+		this->write_block( b );
+
+		m_sinkParticleCount += static_cast<detail::prt_int64>( b.numParticles );
+		if( m_posChannelOffset >= 0 )
+			detail::merge_box( m_sinkBounds, b.bounds );
+	}
+
+	/**
+	 * Hands the block currently being filled off for compression, writing finished blocks to make room if necessary.
+	 */
+	void submit_block(){
+		if( !m_blockDeflater->can_submit() )
+			this->write_next_block();
+
+		{
+			detail::stats_timer timer( m_stats.counters().codecSeconds );
+			m_blockDeflater->submit( m_blockData, m_blockParticles, m_blockBounds );
+		}
+
+		m_blockData.clear();
+		m_blockParticles = 0;
+		this->reset_block_bounds();
+	}
+
+	/**
+	 * Starts the bounds of a new block. Without a Position channel, the block could contain anything.
+	 */
+	void reset_block_bounds(){
+		if( m_posChannelOffset >= 0 )
+			detail::set_empty_box( m_blockBounds );
+		else
+			detail::set_infinite_box( m_blockBounds );
+	}
+
+	/**
+	 * Compresses all remaining blocks and writes them to disk.
+	 */
+	void flush_blocks(){
+		if( m_blockParticles > 0 )
+			this->submit_block();
+
+		while( !m_blockDeflater->empty() )
+			this->write_next_block();
+	}
+
+	/**
+	 * Writes the end of the zlib stream after the last block, if not framed.
+	 */
+	void write_blocks_trailer(){
+		if( detail::uses_frames( m_options.codec, m_filter ) )
+			return;
+
+		unsigned char zlibTrailer[6];
+		detail::get_zlib_trailer( m_adler, zlibTrailer );
+
+		this->write_output( reinterpret_cast<const char*>( zlibTrailer ), 6 );
+	}
+
+	/**
+	 * This helper function will write the compressed data stored in 'm_buffer' to disk.
+	 */
+	void flush(){
+		std::size_t numOut = (m_bufferSize - m_zstream.avail_out);
+		if( numOut > 0 ) {
+			this->write_output( m_buffer, numOut );
+			m_zstream.avail_out = static_cast<unsigned int>( m_bufferSize );
+			m_zstream.next_out = reinterpret_cast<unsigned char*>( m_buffer );
+		}
+	}
+
+	/**
+	 * Writes the header and starts the compressor, once the file or memory is attached to 'm_fout'.
+	 */
+	void open_output(){
+		m_stats.start();
+		m_fout.exceptions( std::ios::badbit|std::ios::failbit ); //We want an exception if writing anything fails.
+		
+		m_posChannelOffset = -1;
+		std::size_t posIndex = m_layout.find_channel( "Position" );
+		if( posIndex != m_layout.num_channels() ){
+			const detail::prt_channel& ch = m_layout.get_channel_at( posIndex );
+			if( ch.type == data_types::type_float32 && ch.arity == 3 )
+				m_posChannelOffset = static_cast<std::ptrdiff_t>( ch.offset );
+		}
+		
+		if( m_spatialSort && m_posChannelOffset < 0 ){
+			this->detach_output();
+			throw std::logic_error( "Spatially sorting the particles of \"" + m_filePath + "\" requires a float32[3] Position channel" );
+		}
+		
+		if( m_spatialSort && m_checkpointInterval > 0 ){
+			this->detach_output();
+			throw std::logic_error( "The spatially sorted particles of \"" + m_filePath + "\" are only written on close(), so they can't be checkpointed" );
+		}
+		
+		if( m_appending ){
+			//The header was read by open_append(), and its blocks are continued from the end of the particle data.
+			m_tailPending = true;
+		}else{
+			detail::set_empty_box( m_bounds );
+			
+			if( m_options.filter != filters::filter_none )
+				m_filter = detail::particle_filter( m_options.filter, detail::filter_flag_delta_id, m_layout );
+			
+			write_header();
+		}
+		
+		m_checkpointCount = m_particleCount;
+
+		//With auto tuning, the compressor is started once the sample is collected.
+		if( m_options.autoTune && m_options.codec != codecs::codec_none )
+			m_autoTunePending = true;
+		else
+			init_compressor();
+	}
+
+	/**
+	 * Flushes and detaches the file or memory that 'm_fout' is writing to.
+	 */
+	void detach_output(){
+		{
+			detail::stats_timer timer( m_stats.counters().flushSeconds );
+			m_fout.flush();
+		}
+
+		//Detaching the stream buffer sets badbit, which would otherwise throw.
+		m_fout.exceptions( std::ios::goodbit );
+		m_fout.rdbuf( NULL );
+
+		if( m_file.is_open() ){
+			m_file.close();
+			if( m_file.fail() )
+				throw std::ios_base::failure( "Failed to close file \"" + m_filePath + "\"" );
+		}
+	}
+
+public:
+	/**
+	 * Default constructor. User must later call open().
+	 */
+	prt_ofstream() : m_fout( NULL ){
+		m_buffer = NULL;
+		m_bufferSize = 0;
+		m_bufferPool = NULL;
+		m_asyncOutput = false;
+		m_asyncWriter = NULL;
+		m_particleCount = 0;
+		m_countLocation = 0;
+		m_boundBoxLocation = 0;
+		m_blockIndexLocation = 0;
+		m_codecLevelLocation = 0;
+		m_posChannelOffset = -1;
+		m_writeBlockIndex = false;
+		m_blockOffset = 0;
+		m_numThreads = 1;
+		m_blockSize = 0;
+		m_blockDeflater = NULL;
+		m_blockParticles = 0;
+		m_blockCapacity = 0;
+		m_adler = 0;
+		m_autoTunePending = false;
+		m_autoSampleCount = 0;
+		m_spatialSort = false;
+		m_sortCount = 0;
+		m_checkpointInterval = 0;
+		m_checkpointCount = 0;
+		m_appending = false;
+		m_tailPending = false;
+		m_sinkParticleCount = 0;
+		m_copyingData = false;
+		memset( &m_zstream, 0, sizeof(m_zstream) );
+		
+		detail::set_empty_box( m_bounds );
+		detail::set_infinite_box( m_blockBounds );
+		detail::set_empty_box( m_sinkBounds );
+	}
+
+	/**
+	 * Can't have a constructor that opens the stream too, since we need to know the layout first!
+	 */
+	 //prt_ofstream( const std::string& file );
+
+	virtual ~prt_ofstream(){
+		close();
+	}
+
+	/**
+	 * Sets the number of threads used to compress particles. With more than one thread, the particles are split into
+	 * independent blocks (see set_block_size()) which are compressed concurrently and written in order. The result is still
+	 * a single zlib stream, so it can be read by any PRT reader. Must be called before open().
+	 * @param numThreads The number of threads to compress on. 0 uses all the hardware threads, and 1 (the default) compresses on the calling thread.
+	 */
+	void set_compression_threads( std::size_t numThreads ){
+		m_numThreads = numThreads;
+	}
+
+	/**
+	 * Sets the number of particles in each independently compressed block. Compressing in blocks costs a small amount of
+	 * compression ratio, but the blocks can be compressed in parallel. Must be called before open().
+	 * @param numParticles The number of particles per block. 0 picks a block size of about 1MB of particle data for the layout.
+	 *                     Blocks are only used if this is non-zero, or if compressing on more than one thread. Blocks are
+	 *                     limited to 1GB of particle data.
+	 */
+	void set_block_size( std::size_t numParticles ){
+		m_blockSize = numParticles;
+	}
+
+	/**
+	 * Enables writing an index of the compressed blocks after the particle data, which lets prt_ifstream::seek_particle()
+	 * jump to any particle without decompressing the preceding blocks. This implies compressing in blocks (see set_block_size()).
+	 * The index is stored after the end of the zlib stream, and is found through a 'Bidx' header chunk that other
+	 * readers skip. The index also stores a checksum of each block, which the readers check before decompressing it and
+	 * verify() checks without decompressing anything. Must be called before open().
+	 * @param enabled If true, the block index is written.
+	 */
+	void set_block_index( bool enabled ){
+		m_writeBlockIndex = enabled;
+	}
+
+	/**
+	 * Enables writing the compressed data to disk on a background thread, through a ring of buffers of
+	 * compression_options::bufferSize bytes each. Compression then continues while earlier data is being written, which
+	 * helps most on slow storage such as network shares. Must be called before open().
+	 * @param enabled If true, the compressed data is written asynchronously.
+	 */
+	void set_async_output( bool enabled ){
+		m_asyncOutput = enabled;
+	}
+
+	/**
+	 * Takes the buffer the compressed data is written from out of a pool, and gives it back to the pool when the stream is
+	 * closed, so streams opened one after another or on other threads can reuse it. Must be called before open().
+	 * @param pool The pool, which must outlive the stream, or NULL to allocate the buffer.
+	 */
+	void set_buffer_pool( prt_buffer_pool* pool ){
+		if( m_buffer )
+			throw std::logic_error( "The buffer pool can't be changed while writing the file \"" + m_filePath + "\"" );
+		m_bufferPool = pool;
+	}
+
+	/**
+	 * Enables sorting the particles along a Morton (Z-order) curve through their bounding box, so nearby particles end up
+	 * in the same blocks. Each block's bounds are stored in the block index, letting prt_ifstream::read_region() skip the
+	 * blocks outside a box. The particles are held in memory until close(), which sorts and compresses them. This implies
+	 * writing the block index (see set_block_index()). Must be called before open(), and the layout must have a float32[3]
+	 * Position channel.
+	 * @param enabled If true, the particles are written spatially sorted.
+	 */
+	void set_spatial_sort( bool enabled ){
+		m_spatialSort = enabled;
+	}
+
+	/**
+	 * Enables checkpointing automatically every 'numParticles' particles. See checkpoint(). This implies writing the block
+	 * index (see set_block_index()), and can't be combined with set_spatial_sort(). Must be called before open().
+	 * @param numParticles The number of particles to write between checkpoints, or 0 (the default) to only checkpoint
+	 *                     when checkpoint() is called.
+	 */
+	void set_checkpoint_interval( detail::prt_int64 numParticles ){
+		if( numParticles < 0 )
+			throw std::out_of_range( "Invalid checkpoint interval" );
+
+		m_checkpointInterval = numParticles;
+	}
+
+	/**
+	 * Sets the codec used to compress the particles, at the codec's default level. See set_codec( codecs::option, int ).
+	 * @param codec The codec to compress with.
+	 */
+	void set_codec( codecs::option codec ){
+		this->set_codec( codec, detail::codec_default_level( codec ) );
+	}
+
+	/**
+	 * Sets the codec used to compress the particles. zlib (the default) is the only codec in the PRT file spec, so files
+	 * written with any other codec can only be read by this library. Other codecs always compress in blocks (see
+	 * set_block_size()). Must be called before open().
+	 * @param codec The codec to compress with. zstd and lz4 are only available if PRTIO_USE_ZSTD and PRTIO_USE_LZ4 are defined.
+	 * @param level The compression level, whose meaning depends on the codec. See codecs::option.
+	 */
+	void set_codec( codecs::option codec, int level ){
+		if( codec < 0 || codec >= codecs::codec_count )
+			throw std::out_of_range( "Invalid compression codec" );
+
+		m_options.codec = codec;
+		m_options.level = level;
+	}
+
+	/**
+	 * Sets the filter applied to each block of particles before compressing. Filtering makes the file readable only by this
+	 * library, and always compresses in blocks (see set_block_size()).
+	 * @param filter The filter to apply. filter_shuffle and filter_columns also delta code an integer "ID" channel. With
+	 *               filter_columns, readers only decompress the channels they bind.
+	 */
+	void set_filter( filters::option filter ){
+		if( filter < 0 || filter >= filters::filter_count )
+			throw std::out_of_range( "Invalid compression filter" );
+
+		m_options.filter = filter;
+	}
+
+	/**
+	 * Sets all the settings used to compress the particles. Must be called before open().
+	 * @param options The codec and its settings. See compression_options.
+	 */
+	void set_compression_options( const compression_options& options ){
+		if( options.codec < 0 || options.codec >= codecs::codec_count )
+			throw std::out_of_range( "Invalid compression codec" );
+		if( options.filter < 0 || options.filter >= filters::filter_count )
+			throw std::out_of_range( "Invalid compression filter" );
+		if( options.windowBits < 9 || options.windowBits > MAX_WBITS )
+			throw std::out_of_range( "Invalid compression window bits, it must be between 9 and 15" );
+		if( options.memLevel < 1 || options.memLevel > MAX_MEM_LEVEL )
+			throw std::out_of_range( "Invalid compression memory level, it must be between 1 and 9" );
+		if( options.bufferSize == 0 )
+			throw std::out_of_range( "Invalid compression buffer size" );
+
+		m_options = options;
+	}
+
+	/**
+	 * @return The settings used to compress the particles. If auto tuning, this has the chosen settings once they have been picked.
+	 */
+	const compression_options& get_compression_options() const {
+		return m_options;
+	}
+
+	/**
+	 * Opens the stream to write a PRT file into memory.
+	 * @param dest The vector that receives the bytes of the file. It is cleared, and is complete once the stream is closed.
+	 * @param name The name to use for the file in error messages.
+	 */
+	void open_memory( std::vector<char>& dest, const std::string& name ){
+		detail::check_codec_available( m_options.codec, name );
+
+		m_memoryBuffer.reset( dest );
+
+		m_fout.rdbuf( &m_memoryBuffer );
+		m_filePath = name;
+
+		this->open_output();
+	}
+
+	/**
+	 * Opens an existing PRT file to add particles after the ones it already has. The file must have a block index (see
+	 * set_block_index()) and have been closed or checkpointed, and the channels must be bound exactly as they were when the
+	 * file was written: with the same names, types and order. The new particles are compressed in blocks with the file's
+	 * codec, filter and zlib window, which override the compression options. The header's particle count, BoundBox and
+	 * block index are updated; the rest of the header, including the other metadata, is left as it is.
+	 * @param file Path to the file to add particles to.
+	 */
+	void open_append( const std::string& file ){
+		m_filePath = file;
+		detail::set_empty_box( m_bounds );
+
+		{
+			std::ifstream in( file.c_str(), std::ios::in | std::ios::binary );
+			if( in.fail() )
+				throw std::ios_base::failure( "Failed to open file \"" + file + "\" for appending" );
+
+			try{
+				this->read_append_state( in );
+			}catch( ... ){
+				m_blockIndex.clear();
+				m_blockIndexBounds.clear();
+				m_blockIndexChecksums.clear();
+				m_particleCount = 0;
+				m_countLocation = 0;
+				m_boundBoxLocation = 0;
+				m_blockIndexLocation = 0;
+				m_codecLevelLocation = 0;
+				m_filter = detail::particle_filter();
+				throw;
+			}
+		}
+
+		m_file.open( file.c_str(), std::ios::in | std::ios::out | std::ios::binary );
+		if( m_file.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + file + "\" for appending" );
+
+		m_fout.rdbuf( m_file.rdbuf() );
+		m_appending = true;
+
+		this->open_output();
+	}
+
+	/**
+	 * Makes the file complete and readable up to the particles written so far, so that if the program stops before
+	 * close(), the file still holds them. The remaining particles are compressed and written, followed by the end of the
+	 * stream and the block index, then the header's particle count, BoundBox and block index offset are updated and
+	 * everything is flushed to the operating system. Until the next checkpoint, readers see the file as it was at this one.
+	 * Compressing in parallel pauses at each checkpoint, and the last block before it may be short.
+	 * @note Requires the block index (see set_block_index()), and can't be used with set_spatial_sort().
+	 */
+	void checkpoint(){
+		if( !m_fout.rdbuf() )
+			throw std::logic_error( "Can't checkpoint a stream that isn't open" );
+		if( m_spatialSort )
+			throw std::logic_error( "The spatially sorted particles of \"" + m_filePath + "\" are only written on close(), so they can't be checkpointed" );
+		if( !this->writes_block_index() )
+			throw std::logic_error( "Checkpointing \"" + m_filePath + "\" requires the block index, see set_block_index()" );
+
+		if( m_autoTunePending )
+			this->finish_auto_tune();
+
+		this->flush_blocks();
+
+		//Sinks writing blocks from other threads wait until the checkpoint is complete.
+		detail::scoped_lock lock( m_sinkMutex );
+
+		this->write_blocks_trailer();
+		this->finish_output();
+
+		detail::prt_int64 indexOffset = static_cast<detail::prt_int64>( m_fout.tellp() );
+		this->write_block_index();
+
+		//The count goes before the index offset, so the header is readable if this is interrupted.
+		this->write_header_totals();
+		this->write_block_index_offset( indexOffset );
+		{
+			detail::stats_timer timer( m_stats.counters().flushSeconds );
+			m_fout.flush();
+		}
+
+		m_fout.seekp( static_cast<std::streamoff>( m_blockOffset ), std::ios::beg );
+
+		m_tailPending = true;
+		m_checkpointCount = m_particleCount;
+	}
+
+	/**
+	 * Opens the prt_ofstream to write to the specified file
+	 * @param file Path to the file to write particles to
+	 */
+	void open( const std::string& file ){
+		detail::check_codec_available( m_options.codec, file );
+
+		m_file.open( file.c_str(), std::ios::out | std::ios::binary );
+		if( m_file.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + file + "\" for writing" );
+
+		m_fout.rdbuf( m_file.rdbuf() );
+		m_filePath = file;
+
+		this->open_output();
+	}
+
+	/**
+	 * Closes the stream, and deallocates any memory used for decompressing particles.
+	 */
+	void close(){
+		if( m_sortCount > 0 )
+			this->write_sorted_particles();
+
+		if( m_autoTunePending )
+			this->finish_auto_tune();
+
+		if( m_buffer ){
+			// Write out all the rest of the stream data, until we hit Z_STREAM_END
+			for(;;){
+				int ret;
+				{
+					detail::stats_timer timer( m_stats.counters().codecSeconds );
+					ret = deflate(&m_zstream, Z_FINISH);
+				}
+				if( ret == Z_STREAM_END )
+					break;
+				flush();
+			}
+			flush();
+			this->finish_output();
+
+			if( m_bufferPool )
+				m_bufferPool->release( m_buffer, m_bufferSize );
+			else
+				delete[] m_buffer;
+			m_buffer = NULL;
+
+			int ret = deflateEnd(&m_zstream);
+			if( ret != Z_OK )
+				throw std::runtime_error("deflateEnd() error for \"" + m_filePath + "\" was:" + zError(ret) );
+
+			memset( &m_zstream, 0, sizeof(z_stream) );
+		}
+
+		detail::prt_int64 indexOffset = 0;
+
+		this->finish_sinks();
+
+		if( m_copyingData ){
+			this->finish_output();
+
+			if( this->writes_block_index() ){
+				indexOffset = static_cast<detail::prt_int64>( m_fout.tellp() );
+
+				this->write_block_index();
+			}
+
+			m_blockIndex.clear();
+			m_blockIndexBounds.clear();
+			m_blockIndexChecksums.clear();
+			m_copyingData = false;
+		}
+
+		if( m_blockDeflater ){
+			this->flush_blocks();
+			this->write_blocks_trailer();
+			this->finish_output();
+
+			delete m_blockDeflater;
+			m_blockDeflater = NULL;
+
+			std::vector<char>().swap( m_blockData );
+
+			if( this->writes_block_index() ){
+				indexOffset = static_cast<detail::prt_int64>( m_fout.tellp() );
+
+				this->write_block_index();
+			}
+
+			m_blockIndex.clear();
+			m_blockIndexBounds.clear();
+			m_blockIndexChecksums.clear();
+		}
+
+		//Seek back to the beginning of the file and write the particle count in the header region.
+		if( m_fout.rdbuf() ){
+			this->write_header_totals();
+			if( indexOffset > 0 )
+				this->write_block_index_offset( indexOffset );
+			this->detach_output();
+		}
+
+		m_stats.finish( m_filePath );
+
+		m_filePath.clear();
+		m_layout.clear();
+
+		m_bufferSize = 0;
+		m_particleCount = 0;
+		m_countLocation = 0;
+		m_boundBoxLocation = 0;
+		m_blockIndexLocation = 0;
+		m_codecLevelLocation = 0;
+		m_filter = detail::particle_filter();
+		m_checkpointCount = 0;
+		m_appending = false;
+		m_tailPending = false;
+		m_sinkParticleCount = 0;
+		detail::set_empty_box( m_sinkBounds );
+	}
+
+	/**
+	 * Makes a sink for writing particles to this file from another thread (see prt_ofstream_sink). Each thread binds
+	 * its own variables to its sink and writes through it independently: the sink compresses its particles into blocks
+	 * on its own thread, and they are added to the file as each one is finished. The blocks of the sinks and of the
+	 * stream itself are interleaved in the order they finish, so the file holds each writer's particles in order but
+	 * not the writers in any order. The particle count and BoundBox in the header include the sinks' particles.
+	 * Must be called on the thread that owns the stream, after open().
+	 * @note The stream must be writing in blocks, which it does with more than one compression thread, a block size,
+	 *       a codec other than zlib, or the block index. It can't be used with set_spatial_sort().
+	 * @return The new sink, which belongs to this stream and is deleted by close().
+	 */
+	prt_ofstream_sink* create_sink();
+
+private:
+	/**
+	 * Writes the particles left in the sinks to the file, then deletes them. No sink can be in use.
+	 */
+	void finish_sinks();
+
+	/**
+	 * Records 'count' consecutive particles in the particle count and bounds, then compresses them.
+	 * @param data The data for the particles to write to disk.
+	 * @param count The number of particles pointed to by 'data'.
+	 */
+	void commit_particles( const char* data, std::size_t count ){
+		m_particleCount += static_cast<detail::prt_int64>( count );
+		
+		// If we have a valid Position channel, add these particles to bounding box we are tracking.
+		if( m_posChannelOffset >= 0 )
+			detail::grow_box( m_bounds, data, count, m_layout.size(), static_cast<std::size_t>( m_posChannelOffset ) );
+
+		if( m_spatialSort ){
+			m_sortBuffer.insert( m_sortBuffer.end(), data, data + count * m_layout.size() );
+			m_sortCount += count;
+		}else{
+			this->emit_particles( data, count );
+
+			if( m_checkpointInterval > 0 && m_particleCount - m_checkpointCount >= m_checkpointInterval )
+				this->checkpoint();
+		}
+	}
+
+	/**
+	 * Sends 'count' consecutive particles on to be sampled or compressed, after they have been counted.
+	 * @param data The data for the particles to write to disk.
+	 * @param count The number of particles pointed to by 'data'.
+	 */
+	void emit_particles( const char* data, std::size_t count ){
+		if( m_autoTunePending )
+			this->add_to_sample( data, count );
+		else
+			this->compress_particles( data, count );
+	}
+
+	/**
+	 * Sorts the particles held by set_spatial_sort() along a Morton curve through the file's bounding box, then compresses them.
+	 */
+	void write_sorted_particles(){
+		typedef std::pair< data_types::uint64_t, std::size_t > sort_key;
+
+		const std::size_t particleSize = m_layout.size();
+		const std::size_t posOffset = static_cast<std::size_t>( m_posChannelOffset );
+
+		std::vector< sort_key > keys( m_sortCount );
+		for( std::size_t i = 0; i < m_sortCount; ++i ){
+			float p[3];
+			memcpy( p, &m_sortBuffer[i * particleSize + posOffset], sizeof(float) * 3 );
+
+			keys[i].first = detail::morton_code( m_bounds, p );
+			keys[i].second = i;
+		}
+
+		std::sort( keys.begin(), keys.end() );
+
+		//Gather the sorted particles a chunk at a time, so the extra memory is small next to 'm_sortBuffer'.
+		const std::size_t chunkSize = (std::max)( std::size_t(1), (std::size_t(1) << 20) / (std::max)( std::size_t(1), particleSize ) );
+		std::vector<char> chunk( chunkSize * particleSize );
+
+		for( std::size_t i = 0; i < m_sortCount; i += chunkSize ){
+			std::size_t numParticles = (std::min)( chunkSize, m_sortCount - i );
+
+			for( std::size_t j = 0; j < numParticles; ++j )
+				memcpy( &chunk[j * particleSize], &m_sortBuffer[keys[i + j].second * particleSize], particleSize );
+
+			this->emit_particles( &chunk.front(), numParticles );
+		}
+
+		std::vector<char>().swap( m_sortBuffer );
+		m_sortCount = 0;
+	}
+
+	/**
+	 * Compresses 'count' consecutive particles, either through 'm_zstream' or as independent blocks.
+	 * @param data The data for the particles to write to disk.
+	 * @param count The number of particles pointed to by 'data'.
+	 */
+	void compress_particles( const char* data, std::size_t count ){
+		if( m_blockDeflater )
+			this->add_to_blocks( data, count );
+		else
+			this->deflate_particles( data, count );
+	}
+
+	/**
+	 * Holds on to 'count' consecutive particles for choosing the compression settings, which are chosen once there are enough.
+	 * @param data The data for the particles to write to disk.
+	 * @param count The number of particles pointed to by 'data'.
+	 */
+	void add_to_sample( const char* data, std::size_t count ){
+		const std::size_t particleSize = m_layout.size();
+
+		m_autoSample.insert( m_autoSample.end(), data, data + count * particleSize );
+		m_autoSampleCount += count;
+
+		std::size_t sampleSize = m_options.autoSampleSize;
+		if( sampleSize == 0 )
+			sampleSize = (std::max)( std::size_t(1), (std::size_t(1) << 20) / (std::max)( std::size_t(1), particleSize ) );
+
+		if( m_autoSampleCount >= sampleSize )
+			this->finish_auto_tune();
+	}
+
+	/**
+	 * Copies 'count' consecutive particles into the current block, submitting it for compression whenever it is full.
+	 * @param data The data for the particles to write to disk.
+	 * @param count The number of particles pointed to by 'data'.
+	 */
+	void add_to_blocks( const char* data, std::size_t count ){
+		const std::size_t particleSize = m_layout.size();
+
+		while( count > 0 ){
+			std::size_t numParticles = (std::min)( count, m_blockCapacity - m_blockParticles );
+
+			m_blockData.insert( m_blockData.end(), data, data + numParticles * particleSize );
+			m_blockParticles += numParticles;
+
+			if( m_posChannelOffset >= 0 )
+				detail::grow_box( m_blockBounds, data, numParticles, particleSize, static_cast<std::size_t>( m_posChannelOffset ) );
+
+			if( m_blockParticles == m_blockCapacity )
+				this->submit_block();
+
+			data += numParticles * particleSize;
+			count -= numParticles;
+		}
+	}
+
+	/**
+	 * Compresses 'count' consecutive particles into 'm_buffer', flushing to disk whenever the buffer is full.
+	 * @param data The data for the particles to write to disk.
+	 * @param count The number of particles pointed to by 'data'.
+	 */
+	void deflate_particles( const char* data, std::size_t count ){
+		std::size_t bytesLeft = count * m_layout.size();
+
+		m_zstream.next_in = reinterpret_cast<unsigned char*>( const_cast<char*>(data) );
+
+		while( bytesLeft != 0 ){
+			//zlib can only compress 4GB at a time.
+			m_zstream.avail_in = static_cast<uInt>( (std::min)( bytesLeft, static_cast<std::size_t>( (std::numeric_limits<uInt>::max)() ) ) );
+			bytesLeft -= m_zstream.avail_in;
+
+			for(;;) {
+				int ret;
+				{
+					detail::stats_timer timer( m_stats.counters().codecSeconds );
+					ret = deflate(&m_zstream, Z_NO_FLUSH);
+				}
+				if(ret == Z_STREAM_ERROR)
+					throw std::runtime_error( "deflate() call writing to \"" + m_filePath + "\" failed:\n\t" + zError(ret) );
+
+				if(m_zstream.avail_out == 0) {	//Did we fill the output buffer completely? If so flush and loop.
+					flush();
+				} else {
+					break;
+				}
+			}
+		}
+	}
+
+protected:
+	/**
+	 * Opens the stream to write particle data that is already compressed, for copying it unchanged from another PRT file
+	 * with the same layout (see prt_transcode()). The header is written for the bound channels with the given codec and
+	 * filter, but nothing is compressed: the data is written by write_compressed_data(), and described to the header and
+	 * block index by add_compressed_block() and set_compressed_totals().
+	 * @param file Path to the file to write.
+	 * @param codec The codec the data was compressed with.
+	 * @param filter The filter the data was compressed with.
+	 * @param blockIndex If true, the file has a block index, which add_compressed_block() fills.
+	 */
+	void open_compressed( const std::string& file, codecs::option codec, const detail::particle_filter& filter, bool blockIndex ){
+		m_file.open( file.c_str(), std::ios::out | std::ios::binary );
+		if( m_file.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + file + "\" for writing" );
+
+		m_fout.rdbuf( m_file.rdbuf() );
+		m_filePath = file;
+
+		m_stats.start();
+		m_fout.exceptions( std::ios::badbit|std::ios::failbit );
+
+		m_options = compression_options( codec );
+		m_filter = filter;
+		m_writeBlockIndex = blockIndex;
+		m_posChannelOffset = -1;
+		detail::set_empty_box( m_bounds );
+
+		this->write_header();
+
+		//The offsets of the copied blocks are relative to the start of the data.
+		m_blockOffset = static_cast<detail::prt_int64>( m_fout.tellp() );
+		m_copyingData = true;
+	}
+
+	/**
+	 * Writes the next bytes of the compressed particle data, after open_compressed().
+	 */
+	void write_compressed_data( const char* data, std::size_t numBytes ){
+		this->write_output( data, numBytes );
+	}
+
+	/**
+	 * Adds a block of the copied particle data to the block index, after open_compressed().
+	 * @param dataOffset The offset of the block from the start of the particle data.
+	 * @param particleCount The number of particles in the block.
+	 * @param bounds The box around the particles' positions.
+	 * @param checksum The checksum of the block's compressed data, or unknown_block_checksum() if it isn't known.
+	 */
+	void add_compressed_block( detail::prt_int64 dataOffset, detail::prt_int64 particleCount, const float bounds[6], const detail::prt_block_checksum_v1& checksum ){
+		detail::prt_block_index_entry_v1 entry;
+		entry.dataOffset = m_blockOffset + dataOffset;
+		entry.particleCount = particleCount;
+
+		detail::prt_block_bounds_v1 entryBounds;
+		memcpy( entryBounds.bounds, bounds, sizeof(float) * 6 );
+
+		m_blockIndex.push_back( entry );
+		m_blockIndexBounds.push_back( entryBounds );
+		m_blockIndexChecksums.push_back( checksum );
+	}
+
+	/**
+	 * Sets the particle count and BoundBox written to the header by close(), after open_compressed().
+	 */
+	void set_compressed_totals( detail::prt_int64 particleCount, const float bounds[6] ){
+		m_particleCount = particleCount;
+		memcpy( m_bounds, bounds, sizeof(float) * 6 );
+	}
+
+	/**
+	 * Compresses a single particle, writing compressed data to disk as it becomes available.
+	 * @param data The data for the particle to write to disk.
+	 */
+	virtual void write_impl( const char* data ){
+		this->commit_particles( data, 1u );
+	}
+
+	/**
+	 * Compresses many consecutive particles with a single compression call, writing compressed data to disk as it becomes available.
+	 * @param data The data for the particles to write to disk.
+	 * @param count The number of particles pointed to by 'data'.
+	 */
+	virtual void write_particles_impl( const char* data, std::size_t count ){
+		this->commit_particles( data, count );
+	}
+};
+
+/**
+ * A lightweight stream for writing particles into a prt_ofstream from another thread, made by prt_ofstream::create_sink().
+ * The channels must be bound exactly as the file's are: with the same names, types and order. The sink collects its
+ * particles into blocks and compresses each one on the writing thread, then adds it to the file, so any number of sinks
+ * can be written concurrently. A single sink must only be used by one thread at a time.
+ */
+class prt_ofstream_sink : public prt_ostream{
+	friend class prt_ofstream;
+
+	prt_ofstream* m_owner; //The stream the compressed blocks are written to.
+
+	detail::block_deflater m_blockDeflater; //Compresses the finished blocks on the calling thread.
+	std::vector<char> m_blockData;          //The particles of the block currently being filled.
+	std::size_t m_blockParticles;           //The number of particles in 'm_blockData'.
+	std::size_t m_blockCapacity;            //The number of particles in a full block.
+	float m_blockBounds[6];                 //The box around the positions of the particles in 'm_blockData'.
+
+	bool m_layoutChecked; //If true, the bound channels have been checked against the file's layout.
+
+	explicit prt_ofstream_sink( prt_ofstream& owner ) : m_owner( &owner ), m_blockDeflater( 1, owner.m_options, owner.m_filter ){
+		m_blockParticles = 0;
+		m_blockCapacity = owner.m_blockCapacity;
+		m_layoutChecked = false;
+
+		this->reset_block_bounds();
+		m_stats.start();
+	}
+
+	prt_ofstream_sink( const prt_ofstream_sink& );
+	prt_ofstream_sink& operator=( const prt_ofstream_sink& );
+
+	void reset_block_bounds(){
+		if( m_owner->m_posChannelOffset >= 0 )
+			detail::set_empty_box( m_blockBounds );
+		else
+			detail::set_infinite_box( m_blockBounds );
+	}
+
+	/**
+	 * Checks that the bound channels make particles laid out exactly like the file's, before the first one is written.
+	 */
+	void check_layout(){
+		const prt_layout& fileLayout = m_owner->m_layout;
+
+		bool layoutMatches = ( m_layout.num_channels() == fileLayout.num_channels() );
+		for( std::size_t i = 0; layoutMatches && i < m_layout.num_channels(); ++i ){
+			const detail::prt_channel& ch = m_layout.get_channel_at( i );
+			const detail::prt_channel& fileCh = fileLayout.get_channel_at( i );
+
+			layoutMatches =
+				m_layout.get_channel_name( i ) == fileLayout.get_channel_name( i ) &&
+				ch.type == fileCh.type &&
+				ch.arity == fileCh.arity &&
+				ch.offset == fileCh.offset;
+		}
+
+		if( !layoutMatches )
+			throw std::logic_error( "The channels bound to a sink of \"" + m_owner->m_filePath + "\" must match the file's channels, in the same order" );
+
+		m_layoutChecked = true;
+	}
+
+	/**
+	 * Compresses the block currently being filled, then writes it to the file.
+	 */
+	void write_block(){
+		{
+			detail::stats_timer timer( m_stats.counters().codecSeconds );
+			m_blockDeflater.submit( m_blockData, m_blockParticles, m_blockBounds );
+		}
+
+		//Without a pool, submit() compresses the block before returning, so this doesn't wait.
+		const detail::block_deflater::block& b = m_blockDeflater.front();
+		{
+			detail::stats_timer timer( m_stats.counters().ioSeconds );
+			detail::stats_count( m_stats.counters().compressedBytes, static_cast<detail::prt_int64>( b.output.size() ) );
+
+			m_owner->write_sink_block( b );
+		}
+		m_blockDeflater.pop_front();
+
+		m_blockData.clear();
+		m_blockParticles = 0;
+		this->reset_block_bounds();
+	}
+
+	/**
+	 * Copies 'count' consecutive particles into the current block, compressing and writing it whenever it is full.
+	 * @param data The data for the particles to write.
+	 * @param count The number of particles pointed to by 'data'.
+	 */
+	void add_to_blocks( const char* data, std::size_t count ){
+		if( !m_layoutChecked )
+			this->check_layout();
+
+		const std::size_t particleSize = m_layout.size();
+		const std::ptrdiff_t posOffset = m_owner->m_posChannelOffset;
+
+		while( count > 0 ){
+			std::size_t numParticles = (std::min)( count, m_blockCapacity - m_blockParticles );
+
+			m_blockData.insert( m_blockData.end(), data, data + numParticles * particleSize );
+			m_blockParticles += numParticles;
+
+			if( posOffset >= 0 )
+				detail::grow_box( m_blockBounds, data, numParticles, particleSize, static_cast<std::size_t>( posOffset ) );
+
+			if( m_blockParticles == m_blockCapacity )
+				this->write_block();
+
+			data += numParticles * particleSize;
+			count -= numParticles;
+		}
+	}
+
+protected:
+	virtual void write_impl( const char* data ){
+		this->add_to_blocks( data, 1u );
+	}
+
+	virtual void write_particles_impl( const char* data, std::size_t count ){
+		this->add_to_blocks( data, count );
+	}
+
+public:
+	/**
+	 * Compresses and writes the particles of the block currently being filled, even if it isn't full. The owning stream's
+	 * close() does this for every sink, but calling it when a thread is done writing compresses the last block on that
+	 * thread instead. The sink can still be written to afterwards.
+	 */
+	void flush(){
+		if( m_blockParticles > 0 )
+			this->write_block();
+	}
+};
+
+inline prt_ofstream_sink* prt_ofstream::create_sink(){
+	if( !m_fout.rdbuf() )
+		throw std::logic_error( "Can't make a sink for a stream that isn't open" );
+	if( m_spatialSort )
+		throw std::logic_error( "The spatially sorted particles of \"" + m_filePath + "\" are only written on close(), so they can't be written through sinks" );
+
+	//The sinks compress with the final settings, so they have to be chosen from the particles written so far.
+	if( m_autoTunePending )
+		this->finish_auto_tune();
+
+	if( !m_blockDeflater )
+		throw std::logic_error( "Writing \"" + m_filePath + "\" through sinks requires compressing in blocks, see set_block_size()" );
+
+	m_sinks.reserve( m_sinks.size() + 1 );
+	m_sinks.push_back( new prt_ofstream_sink( *this ) );
+
+	return m_sinks.back();
+}
+
+inline void prt_ofstream::finish_sinks(){
+	//Delete all the sinks even if writing one of them fails.
+	struct scoped_sinks{
+		std::vector< prt_ofstream_sink* >& sinks;
+		~scoped_sinks(){
+			for( std::vector< prt_ofstream_sink* >::iterator it = sinks.begin(), itEnd = sinks.end(); it != itEnd; ++it )
+				delete *it;
+			sinks.clear();
+		}
+	} scope = { m_sinks };
+
+	for( std::vector< prt_ofstream_sink* >::iterator it = m_sinks.begin(), itEnd = m_sinks.end(); it != itEnd; ++it ){
+		(*it)->flush();
+		(*it)->m_stats.finish( m_filePath );
+	}
+}
 
 }//namespace prtio
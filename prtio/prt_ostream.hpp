@@ -20,10 +20,14 @@
 
 #include <prtio/detail/conversion.hpp>
 #include <prtio/detail/data_types.hpp>
+#include <prtio/detail/encoding.hpp>
 #include <prtio/prt_layout.hpp>
 #include <prtio/prt_meta_value.hpp>
+#include <prtio/prt_stream_stats.hpp>
 
+#include <algorithm>
 #include <exception>
+#include <map>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -40,13 +44,51 @@ class prt_ostream{
 	 */
 	struct bound_channel{
 		void* src;
-		std::size_t arity, dest;
+		std::size_t arity, dest, stride;
 		detail::convert_fn_t copyFn;
+		detail::strided_convert_fn_t batchCopyFn;
+
+		//Set for channels stored with a lossy encoding, in place of the copy functions.
+		detail::encode_fn_t encodeFn;
+		std::vector<float> encodeParams;
 	};
 
 	//A list of all channels that we want to extract
 	std::vector< bound_channel > m_boundChannels;
 
+	//Temporary storage for the particles of a write_particles() call.
+	std::vector< char > m_batchBuffer;
+
+	/**
+	 * Adds the channel of an encoded binding to the layout. 'result' has the encoding function and parameters set.
+	 */
+	void bind_encoded( const std::string& name, void* src, std::size_t arity, std::size_t srcSize, data_types::enum_t destType, std::size_t destArity, std::size_t stride, bound_channel& result ){
+		if( m_layout.has_channel( name ) )
+			throw std::logic_error( "Channel \"" + name + "\" is already bound" );
+
+		std::size_t destOffset = m_layout.size();
+
+		m_layout.add_channel( name, destType, destArity, destOffset );
+
+		result.src = src;
+		result.dest = destOffset;
+		result.arity = arity;
+		result.stride = ( stride != 0 ) ? stride : srcSize;
+		result.copyFn = NULL;
+		result.batchCopyFn = NULL;
+
+		m_boundChannels.push_back( result );
+	}
+
+	void set_encoding_metadata( const std::string& name, encodings::option encoding ){
+		const char* encodingName = detail::encoding_name( encoding );
+
+		prt_meta_value value;
+		value.set_string( std::basic_string<uchar_type>( encodingName, encodingName + strlen( encodingName ) ) );
+
+		m_channelMetadata[ name ][ detail::encoding_meta_name() ] = value;
+	}
+
 protected:
 	//The layout of the particle data from the source (ex. PRT file).
 	prt_layout m_layout;
@@ -54,6 +96,9 @@ protected:
 	std::map< std::string, prt_meta_value > m_fileMetadata;
 	std::map< std::string, std::map< std::string, prt_meta_value > > m_channelMetadata;
 
+	//The statistics collected when built with PRTIO_ENABLE_STATS. Subclasses start and finish it when opened and closed.
+	detail::stats_recorder m_stats;
+
 	/**
 	 * This abstract function provides the interface for subclasses to consume a single particle.
 	 * When prt_ostream::write_next_particle() is called, it uses write_impl() to commit the next
@@ -62,12 +107,45 @@ protected:
 	 */
 	virtual void write_impl( const char* src ) = 0;
 
+	/**
+	 * This function provides the interface for subclasses to consume many particles at once. When
+	 * prt_ostream::write_particles() is called, it uses write_particles_impl() to commit a block of
+	 * consecutive particles to the destination. The default implementation calls write_impl() once
+	 * per particle, so subclasses should override it if they can do better.
+	 * @param src A pointer to 'count' consecutive particles with layout described by 'm_layout'.
+	 * @param count The number of particles to commit.
+	 */
+	virtual void write_particles_impl( const char* src, std::size_t count ){
+		for( std::size_t i = 0, particleSize = m_layout.size(); i < count; ++i, src += particleSize )
+			this->write_impl( src );
+	}
+
 public:
 	prt_ostream()
 	{}
 
 	virtual ~prt_ostream()
 	{}
+
+	/**
+	 * Gets the statistics of where the stream's time has gone since it was opened, such as converting the channels from
+	 * the bound types, compressing, and writing the file. They are only collected when built with PRTIO_ENABLE_STATS
+	 * defined, which adds a little overhead to every write. Otherwise they are always zero.
+	 * @return The statistics so far. After the stream is closed, the totals of the last file.
+	 */
+	prt_stream_stats stats() const {
+		return m_stats.get();
+	}
+
+	/**
+	 * Sets a function to receive the stream's statistics (see stats()) when it is closed, for logging. It isn't called
+	 * unless built with PRTIO_ENABLE_STATS defined.
+	 * @param callback The function to call, or NULL for none.
+	 * @param userData A pointer passed to 'callback'.
+	 */
+	void set_stats_callback( prt_stats_callback callback, void* userData = NULL ){
+		m_stats.set_callback( callback, userData );
+	}
 	
 	/**
 	 * Adds a metadata name/value pair associated with the entire file.
@@ -95,9 +173,11 @@ public:
 	 * @param src A pointer to where the channel data will be read from.
 	 * @param arity The size of the array pointed to by 'src'.
 	 * @param destType An optional override on the type of data, for storing the stream data as a different type. Ex. Convert float to half on disk.
+	 * @param stride The number of bytes between the channel data of consecutive particles when using
+	 *               write_particles(). Defaults to sizeof(T) * arity, which is a tightly packed array.
 	 */
 	template <typename T>
-	void bind( const std::string& name, T src[], std::size_t arity, data_types::enum_t destType = data_types::traits<T>::data_type() ){
+	void bind( const std::string& name, T src[], std::size_t arity, data_types::enum_t destType = data_types::traits<T>::data_type(), std::size_t stride = 0 ){
 		if( m_layout.has_channel( name ) )
 			throw std::logic_error( "Channel \"" + name + "\" is already bound" );
 
@@ -118,14 +198,77 @@ public:
 		result.src = src;
 		result.dest = destOffset;
 		result.arity = arity;
+		result.stride = ( stride != 0 ) ? stride : sizeof(T) * arity;
 		result.copyFn = detail::get_write_converter<T>( destType );
+		result.batchCopyFn = detail::get_strided_write_converter<T>( destType );
+		result.encodeFn = NULL;
 
-		if( !result.copyFn )
+		if( !result.copyFn || !result.batchCopyFn )
 			throw std::logic_error( "The requested output type: \"" + std::string(data_types::names[ destType ]) + "\" for channel\"" + name + "\" was unsupported." );
 
 		m_boundChannels.push_back( result );
 	}
 
+	/**
+	 * Binds a floating point variable to a channel stored as fixed point integers, which makes the file smaller at the cost
+	 * of precision. Each component's range is mapped onto the whole range of 'destType', and values outside of it are
+	 * clamped. The offset and scale are stored in the channel's metadata, so prt_istream::bind() with a floating point
+	 * type decodes the values, and other readers see the channel as integers. Ex. Store "Position" as int16[3] in the
+	 * particles' bounding box.
+	 * @tparam T The floating point type of the variable to bind to.
+	 * @param name The name of the channel in the prt_ostream to bind to.
+	 * @param src A pointer to where the channel data will be read from.
+	 * @param arity The size of the array pointed to by 'src'.
+	 * @param destType The integer type each component is stored as.
+	 * @param minValue The smallest value of each component, an array of 'arity' values.
+	 * @param maxValue The largest value of each component, an array of 'arity' values.
+	 * @param stride The number of bytes between the channel data of consecutive particles when using write_particles().
+	 */
+	template <typename T>
+	void bind_quantized( const std::string& name, T src[], std::size_t arity, data_types::enum_t destType, const float minValue[], const float maxValue[], std::size_t stride = 0 ){
+		if( !detail::is_float( data_types::traits<T>::data_type() ) )
+			throw std::logic_error( "Channel \"" + name + "\" can't be quantized because it isn't bound to a floating point type" );
+
+		bound_channel result;
+		result.encodeFn = detail::get_quantize_encoder<T>( destType );
+		if( !result.encodeFn )
+			throw std::logic_error( "Channel \"" + name + "\" can't be quantized to type \"" + std::string(data_types::names[ destType ]) + "\"" );
+
+		detail::get_quantized_params( destType, minValue, maxValue, arity, result.encodeParams );
+
+		this->bind_encoded( name, src, arity, sizeof(T) * arity, destType, arity, stride, result );
+
+		prt_meta_value offset, scale;
+		offset.set_array( &result.encodeParams.front(), arity );
+		scale.set_array( &result.encodeParams.front() + arity, arity );
+
+		this->set_encoding_metadata( name, encodings::encoding_quantized );
+		m_channelMetadata[ name ][ detail::encoding_offset_meta_name() ] = offset;
+		m_channelMetadata[ name ][ detail::encoding_scale_meta_name() ] = scale;
+	}
+
+	/**
+	 * Binds a floating point unit vector[3] to a channel stored as int16[2], the octahedral projection of its direction,
+	 * which is a third of the size of float32[3] with an error below 0.01 degrees. The vectors don't need to be normalized
+	 * but are read back as unit vectors. The encoding is stored in the channel's metadata, so prt_istream::bind() with
+	 * a floating point type decodes the vectors. Ex. Store "Normal".
+	 * @tparam T The floating point type of the variable to bind to.
+	 * @param name The name of the channel in the prt_ostream to bind to.
+	 * @param src A pointer to where the channel data will be read from, an array of 3 values.
+	 * @param stride The number of bytes between the channel data of consecutive particles when using write_particles().
+	 */
+	template <typename T>
+	void bind_octahedral( const std::string& name, T src[], std::size_t stride = 0 ){
+		if( !detail::is_float( data_types::traits<T>::data_type() ) )
+			throw std::logic_error( "Channel \"" + name + "\" can't be octahedral because it isn't bound to a floating point type" );
+
+		bound_channel result;
+		result.encodeFn = &detail::octahedral_encoder<T>::apply;
+
+		this->bind_encoded( name, src, 3, sizeof(T) * 3, data_types::type_int16, 2, stride, result );
+		this->set_encoding_metadata( name, encodings::encoding_octahedral );
+	}
+
 	/**
 	 * This extracts the next particle's channel data from the variables supplied to bind(), then commits the particle to the stream.
 	 */
@@ -133,12 +276,63 @@ public:
 		//Allocate some temporary stack space for the particle.
 		char* data = (char*)alloca( m_layout.size() );
 
-		//Go through each bound channel, grabbing the data from the ptr supplied by the user and writing into the particle.
-		for( std::vector< bound_channel >::iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it )
-			it->copyFn( data + it->dest, it->src, it->arity );
+		{
+			detail::stats_timer timer( m_stats.counters().convertSeconds );
+			detail::stats_count( m_stats.counters().particles, 1 );
+			detail::stats_count( m_stats.counters().uncompressedBytes, static_cast<detail::prt_int64>( m_layout.size() ) );
+
+			//Go through each bound channel, grabbing the data from the ptr supplied by the user and writing into the particle.
+			for( std::vector< bound_channel >::iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it ){
+				if( it->encodeFn )
+					it->encodeFn( data + it->dest, 0, it->src, 0, it->arity, 1, it->encodeParams.empty() ? NULL : &it->encodeParams.front() );
+				else
+					it->copyFn( data + it->dest, it->src, it->arity );
+			}
+		}
 
 		this->write_impl( data );
 	}
+
+	/**
+	 * This extracts the channel data of 'count' particles from the arrays supplied to bind(), then commits them to the stream.
+	 * The i'th particle is taken from the bound location plus i times the channel's stride. Particles are packed in large
+	 * blocks that are committed with a single call, which is much faster than calling write_next_particle() repeatedly.
+	 * @param count The number of particles to write.
+	 */
+	void write_particles( std::size_t count ){
+		const std::size_t particleSize = m_layout.size();
+		if( particleSize == 0 )
+			return;
+
+		//Process in blocks of about 256KB so the packed particles stay in cache until they are committed.
+		const std::size_t batchSize = (std::max)( std::size_t(1), (std::size_t(1) << 18) / particleSize );
+
+		if( m_batchBuffer.size() < batchSize * particleSize )
+			m_batchBuffer.resize( batchSize * particleSize );
+
+		char* data = &m_batchBuffer.front();
+
+		for( std::size_t i = 0; i < count; i += batchSize ){
+			std::size_t numParticles = (std::min)( batchSize, count - i );
+
+			{
+				detail::stats_timer timer( m_stats.counters().convertSeconds );
+				detail::stats_count( m_stats.counters().particles, static_cast<detail::prt_int64>( numParticles ) );
+				detail::stats_count( m_stats.counters().uncompressedBytes, static_cast<detail::prt_int64>( numParticles * particleSize ) );
+
+				for( std::vector< bound_channel >::iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it ){
+					const char* src = static_cast<const char*>( it->src ) + i * it->stride;
+
+					if( it->encodeFn )
+						it->encodeFn( data + it->dest, particleSize, src, it->stride, it->arity, numParticles, it->encodeParams.empty() ? NULL : &it->encodeParams.front() );
+					else
+						it->batchCopyFn( data + it->dest, particleSize, src, it->stride, it->arity, numParticles );
+				}
+			}
+
+			this->write_particles_impl( data, numParticles );
+		}
+	}
 };
 
 }//namespace prtio
@@ -0,0 +1,299 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a stream for reading block indexed prt files on many threads.
+ */
+
+#pragma once
+
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/detail/block_inflater.hpp>
+
+namespace prtio{
+
+/**
+ * This class reads particles from a file like prt_ifstream, but decompresses the blocks of a block indexed file (see
+ * prt_ofstream::set_block_index()) concurrently on a pool of threads. Files without a block index are read on the
+ * calling thread exactly as prt_ifstream does.
+ */
+class prt_parallel_ifstream : public prt_ifstream{
+public:
+	/**
+	 * The order that particles are returned in.
+	 */
+	enum particle_order{
+		order_sequential, //Particles are returned in the same order as the file.
+		order_any         //Blocks of particles are returned in the order they finish decompressing. Within a block, the order is preserved.
+	};
+
+private:
+	detail::block_inflater* m_inflater; //Decompresses the blocks, or NULL if reading on the calling thread.
+	particle_order m_order;
+
+	std::size_t m_nextBlock;       //The next block to submit for decompression.
+	const detail::block_inflater::block* m_currentBlock; //The block particles are being read from, or NULL if we need the next block.
+	std::size_t m_currentParticle; //The index in 'm_currentBlock' of the next particle to read.
+
+	std::vector<std::size_t> m_extractedOffsets; //The offsets of the channels being extracted, for filter_columns files.
+	std::vector<bool> m_columnMask;              //The channels to decompress in each block, for filter_columns files.
+
+private:
+	/**
+	 * Files written with filter_columns only need the extracted channels decompressed, so this finds them in 'm_columnMask'.
+	 */
+	void update_column_mask(){
+		if( this->filter().columnar() ){
+			this->get_extracted_offsets( m_extractedOffsets );
+			this->filter().get_column_mask( m_extractedOffsets, m_columnMask );
+		}
+	}
+
+	/**
+	 * Submits blocks for decompression until the inflater is full or there are no more blocks.
+	 */
+	void submit_blocks(){
+		const std::vector< detail::prt_block_index_entry_v1 >& blockIndex = this->block_index();
+
+		if( m_inflater->can_submit() && m_nextBlock < blockIndex.size() )
+			this->update_column_mask();
+
+		const prt_predicate* predicate = this->predicate();
+		const std::vector< detail::prt_block_bounds_v1 >& blockBounds = this->block_bounds();
+		const std::vector< detail::prt_block_checksum_v1 >& blockChecksums = this->block_checksums();
+
+		while( m_inflater->can_submit() && m_nextBlock < blockIndex.size() ){
+			const detail::prt_block_index_entry_v1& entry = blockIndex[m_nextBlock];
+
+			//Skip the blocks the predicate rejects without decompressing them.
+			if( predicate && !blockBounds.empty() && !predicate->may_keep( blockBounds[m_nextBlock].bounds ) ){
+				this->consume_particles( entry.particleCount );
+				++m_nextBlock;
+				continue;
+			}
+
+			//The compressed data of a block ends where the next one starts. The last one ends at the block index.
+			detail::prt_int64 dataEnd = ( m_nextBlock + 1 < blockIndex.size() ) ? blockIndex[m_nextBlock + 1].dataOffset : this->block_index_offset();
+
+			m_inflater->submit( m_nextBlock, entry.dataOffset, static_cast<std::size_t>( dataEnd - entry.dataOffset ), static_cast<std::size_t>( entry.particleCount ), m_layout.size(),
+				m_columnMask, blockChecksums.empty() ? NULL : &blockChecksums[m_nextBlock] );
+			detail::stats_count( m_stats.counters().compressedBytes, dataEnd - entry.dataOffset );
+
+			++m_nextBlock;
+		}
+	}
+
+	/**
+	 * Makes sure 'm_currentBlock' has particles left to read, moving on to the next decompressed block if needed.
+	 * @return False if there are no particles left.
+	 */
+	bool next_block(){
+		while( !m_currentBlock || m_currentParticle == m_currentBlock->numParticles ){
+			if( m_currentBlock ){
+				m_inflater->pop_front();
+				m_currentBlock = NULL;
+			}
+
+			this->submit_blocks();
+
+			if( m_inflater->empty() )
+				return false;
+
+			//The blocks are read and decompressed on the pool, so this only measures the time spent waiting for them.
+			detail::stats_timer timer( m_stats.counters().codecSeconds );
+			m_currentBlock = ( m_order == order_any ) ? &m_inflater->any_finished() : &m_inflater->front();
+			m_currentParticle = 0;
+		}
+
+		return true;
+	}
+
+	void init(){
+		m_inflater = NULL;
+		m_order = order_sequential;
+		m_nextBlock = 0;
+		m_currentBlock = NULL;
+		m_currentParticle = 0;
+	}
+
+public:
+	/**
+	 * Default constructor. User must later call open().
+	 */
+	prt_parallel_ifstream(){
+		this->init();
+	}
+
+	/**
+	 * Constructor that opens the stream for the given file.
+	 * @param filePath Path to the PRT file to read particles from.
+	 * @param numThreads The number of threads to decompress on. If 0, it uses all the hardware threads.
+	 * @param order The order in which particles are returned.
+	 */
+	prt_parallel_ifstream( const std::string& filePath, std::size_t numThreads = 0, particle_order order = order_sequential ){
+		this->init();
+		this->open( filePath, numThreads, order );
+	}
+
+	virtual ~prt_parallel_ifstream(){
+		this->close();
+	}
+
+	/**
+	 * Opens the stream to read from the specified file.
+	 * @param file Path to the file to read particles from.
+	 * @param numThreads The number of threads to decompress on. If 0, it uses all the hardware threads.
+	 * @param order The order in which particles are returned.
+	 */
+	void open( const std::string& file, std::size_t numThreads = 0, particle_order order = order_sequential ){
+		prt_ifstream::open( file );
+
+		m_order = order;
+
+		if( this->has_block_index() )
+			m_inflater = new detail::block_inflater( file, this->codec(), this->filter(), numThreads );
+	}
+
+	/**
+	 * Closes the current file and opens another, keeping the buffers of the current file like prt_ifstream::reopen().
+	 * Everything bound with bind() and bind_static() is released, so the channels must be bound again.
+	 * @param file Path to the file to read particles from.
+	 * @param numThreads The number of threads to decompress on. If 0, it uses all the hardware threads.
+	 * @param order The order in which particles are returned.
+	 */
+	void reopen( const std::string& file, std::size_t numThreads = 0, particle_order order = order_sequential ){
+		delete m_inflater;
+		this->init();
+
+		prt_ifstream::reopen( file );
+
+		m_order = order;
+
+		if( this->has_block_index() )
+			m_inflater = new detail::block_inflater( file, this->codec(), this->filter(), numThreads );
+	}
+
+	/**
+	 * Moves the stream so that the next particle read is the particle with the given index. Decompression restarts
+	 * from the block containing the particle.
+	 * @param index The index of the particle to read next, between 0 and the number of particles in the file.
+	 */
+	virtual void seek_particle( detail::prt_int64 index ){
+		if( !m_inflater ){
+			prt_ifstream::seek_particle( index );
+			return;
+		}
+
+		const std::vector< detail::prt_block_index_entry_v1 >& blockIndex = this->block_index();
+
+		//Drop all the blocks in flight.
+		if( m_currentBlock )
+			m_inflater->pop_front();
+		while( !m_inflater->empty() ){
+			m_inflater->front();
+			m_inflater->pop_front();
+		}
+
+		m_currentBlock = NULL;
+		m_currentParticle = 0;
+
+		detail::prt_int64 firstParticle = 0;
+		for( m_nextBlock = 0; m_nextBlock < blockIndex.size() && firstParticle + blockIndex[m_nextBlock].particleCount <= index; ++m_nextBlock )
+			firstParticle += blockIndex[m_nextBlock].particleCount;
+
+		if( index < 0 || ( m_nextBlock == blockIndex.size() && index != firstParticle ) )
+			throw std::out_of_range( "Cannot seek beyond the particles in the file \"" + this->file_path() + "\"" );
+
+		//particle_count() is the number of particles remaining, so adjust it to match the new position.
+		detail::prt_int64 totalParticles = firstParticle;
+		for( std::size_t i = m_nextBlock; i < blockIndex.size(); ++i )
+			totalParticles += blockIndex[i].particleCount;
+
+		this->consume_particles( this->particle_count() - ( totalParticles - index ) );
+
+		if( index != firstParticle ){
+			const std::vector< detail::prt_block_checksum_v1 >& blockChecksums = this->block_checksums();
+			this->update_column_mask();
+
+			//Start one block at a time so we know the first block returned is the one containing the particle.
+			m_inflater->submit( m_nextBlock, blockIndex[m_nextBlock].dataOffset,
+				static_cast<std::size_t>( ( ( m_nextBlock + 1 < blockIndex.size() ) ? blockIndex[m_nextBlock + 1].dataOffset : this->block_index_offset() ) - blockIndex[m_nextBlock].dataOffset ),
+				static_cast<std::size_t>( blockIndex[m_nextBlock].particleCount ), m_layout.size(), m_columnMask, blockChecksums.empty() ? NULL : &blockChecksums[m_nextBlock] );
+			++m_nextBlock;
+
+			m_currentBlock = &m_inflater->front();
+			m_currentParticle = static_cast<std::size_t>( index - firstParticle );
+		}
+	}
+
+	/**
+	 * Closes the stream, waiting for any outstanding decompression and freeing its memory.
+	 */
+	void close(){
+		delete m_inflater;
+		this->init();
+
+		prt_ifstream::close();
+	}
+
+protected:
+	/**
+	 * With several threads the rejected blocks are skipped as they are submitted, so there is nothing to do here.
+	 */
+	virtual std::size_t skip_rejected_particles( const prt_predicate& predicate, std::size_t count ){
+		if( !m_inflater )
+			return prt_ifstream::skip_rejected_particles( predicate, count );
+		return count;
+	}
+
+	virtual bool read_impl( char* data ){
+		if( !m_inflater )
+			return prt_ifstream::read_impl( data );
+
+		if( !this->next_block() )
+			return false;
+
+		const std::size_t particleSize = m_layout.size();
+
+		memcpy( data, &m_currentBlock->output.front() + m_currentParticle * particleSize, particleSize );
+
+		++m_currentParticle;
+		this->consume_particles( 1 );
+
+		return true;
+	}
+
+	virtual std::size_t read_particles_impl( char* data, std::size_t count ){
+		if( !m_inflater )
+			return prt_ifstream::read_particles_impl( data, count );
+
+		const std::size_t particleSize = m_layout.size();
+
+		std::size_t result = 0;
+		while( result < count && this->next_block() ){
+			std::size_t numParticles = (std::min)( count - result, m_currentBlock->numParticles - m_currentParticle );
+
+			memcpy( data + result * particleSize, &m_currentBlock->output.front() + m_currentParticle * particleSize, numParticles * particleSize );
+
+			m_currentParticle += numParticles;
+			result += numParticles;
+		}
+
+		this->consume_particles( static_cast<detail::prt_int64>( result ) );
+
+		return result;
+	}
+};
+
+}//namespace prtio
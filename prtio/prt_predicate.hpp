@@ -0,0 +1,324 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the predicates that prt_istream::set_predicate() uses to drop particles while reading, before
+ * their channels are converted into the bound variables.
+ */
+
+#pragma once
+
+#include <prtio/detail/data_types.hpp>
+#include <prtio/detail/spatial.hpp>
+#include <prtio/prt_layout.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class is the interface for deciding which particles a prt_istream returns. It tests the source particles, in the
+ * stream's layout, a batch at a time. Channels are tested as they are stored, so an encoded channel (see
+ * prt_ostream::bind_quantized()) is tested on its stored integers.
+ */
+class prt_predicate{
+public:
+	virtual ~prt_predicate()
+	{}
+
+	/**
+	 * Called by prt_istream::set_predicate() so the predicate can find the channels it tests.
+	 * @param layout The layout of the particles that will be tested.
+	 */
+	virtual void bind( const prt_layout& layout ) = 0;
+
+	/**
+	 * Tests consecutive particles, clearing the flag of each particle that is rejected. The flags of the other particles
+	 * must be left alone, so predicates can be combined by testing one after another.
+	 * @param particles The particles, in the layout given to bind().
+	 * @param particleSize The size of each particle in bytes.
+	 * @param count The number of particles.
+	 * @param keep One flag per particle, which is non-zero for the particles kept so far.
+	 */
+	virtual void test( const char* particles, std::size_t particleSize, std::size_t count, unsigned char* keep ) const = 0;
+
+	/**
+	 * Finds the channels that test() reads, so streams that only decompress the channels they need include them.
+	 * @param outOffsets The offsets in the layout of the tested channels are added to this.
+	 */
+	virtual void get_channel_offsets( std::vector<std::size_t>& outOffsets ) const = 0;
+
+	/**
+	 * Lets whole blocks of a file be skipped without decompressing them, when the file stores the bounds of its blocks
+	 * (see prt_ifstream::has_block_bounds()).
+	 * @param bounds The box around the Position of a group of particles, ordered like the BoundBox metadata.
+	 * @return False if none of the particles in the box can be kept.
+	 */
+	virtual bool may_keep( const float /*bounds*/[6] ) const {
+		return true;
+	}
+};
+
+namespace detail{
+
+	/**
+	 * Finds a channel tested by a predicate, checking that 'component' is one of its values.
+	 */
+	inline const prt_channel& get_predicate_channel( const prt_layout& layout, const std::string& name, std::size_t component ){
+		const prt_channel& ch = layout.get_channel( name );
+		if( component >= ch.arity )
+			throw std::out_of_range( "The channel \"" + name + "\" doesn't have the component tested by the predicate" );
+		return ch;
+	}
+
+	/**
+	 * Clears the flags of the particles whose value of type T is outside [minValue, maxValue].
+	 */
+	template <class T>
+	struct range_tester{
+		static void apply( const char* particles, std::size_t particleSize, std::size_t count, std::size_t offset, double minValue, double maxValue, unsigned char* keep ){
+			particles += offset;
+
+			for( std::size_t i = 0; i < count; ++i, particles += particleSize ){
+				T value;
+				memcpy( &value, particles, sizeof(T) );
+
+				const double v = static_cast<double>( value );
+				keep[i] &= static_cast<unsigned char>( v >= minValue && v <= maxValue );
+			}
+		}
+	};
+
+	typedef void(*range_test_fn_t)( const char*, std::size_t, std::size_t, std::size_t, double, double, unsigned char* );
+
+	/**
+	 * Clears the flags of the particles whose integer value of type T isn't in the sorted list.
+	 */
+	template <class T>
+	struct set_tester{
+		static void apply( const char* particles, std::size_t particleSize, std::size_t count, std::size_t offset, const std::vector<data_types::int64_t>& values, unsigned char* keep ){
+			particles += offset;
+
+			for( std::size_t i = 0; i < count; ++i, particles += particleSize ){
+				if( !keep[i] )
+					continue;
+
+				T value;
+				memcpy( &value, particles, sizeof(T) );
+
+				keep[i] = static_cast<unsigned char>( std::binary_search( values.begin(), values.end(), static_cast<data_types::int64_t>( value ) ) );
+			}
+		}
+	};
+
+	typedef void(*set_test_fn_t)( const char*, std::size_t, std::size_t, std::size_t, const std::vector<data_types::int64_t>&, unsigned char* );
+
+}//namespace detail
+
+/**
+ * Keeps the particles whose channel component is between two values, including them. Ex. Age >= 2 is the range
+ * [2, infinity].
+ */
+class prt_range_predicate : public prt_predicate{
+	std::string m_channel;
+	std::size_t m_component;
+	double m_minValue, m_maxValue;
+
+	std::size_t m_channelOffset, m_offset; //The offsets of the channel, and of the tested component.
+	detail::range_test_fn_t m_testFn;
+
+public:
+	/**
+	 * @param channel The name of the channel to test.
+	 * @param minValue The smallest value kept.
+	 * @param maxValue The largest value kept.
+	 * @param component The component of the channel to test, for channels with an arity above 1.
+	 */
+	prt_range_predicate( const std::string& channel, double minValue, double maxValue, std::size_t component = 0 )
+		: m_channel( channel ), m_component( component ), m_minValue( minValue ), m_maxValue( maxValue ), m_channelOffset( 0 ), m_offset( 0 ), m_testFn( NULL )
+	{}
+
+	virtual void bind( const prt_layout& layout ){
+		const detail::prt_channel& ch = detail::get_predicate_channel( layout, m_channel, m_component );
+		m_channelOffset = ch.offset;
+		m_offset = ch.offset + m_component * data_types::sizes[ ch.type ];
+
+		switch( ch.type ){
+		case data_types::type_int8:    m_testFn = &detail::range_tester<data_types::int8_t>::apply; break;
+		case data_types::type_int16:   m_testFn = &detail::range_tester<data_types::int16_t>::apply; break;
+		case data_types::type_int32:   m_testFn = &detail::range_tester<data_types::int32_t>::apply; break;
+		case data_types::type_int64:   m_testFn = &detail::range_tester<data_types::int64_t>::apply; break;
+		case data_types::type_float16: m_testFn = &detail::range_tester<data_types::float16_t>::apply; break;
+		case data_types::type_float32: m_testFn = &detail::range_tester<data_types::float32_t>::apply; break;
+		case data_types::type_float64: m_testFn = &detail::range_tester<data_types::float64_t>::apply; break;
+		case data_types::type_uint8:   m_testFn = &detail::range_tester<data_types::uint8_t>::apply; break;
+		case data_types::type_uint16:  m_testFn = &detail::range_tester<data_types::uint16_t>::apply; break;
+		case data_types::type_uint32:  m_testFn = &detail::range_tester<data_types::uint32_t>::apply; break;
+		case data_types::type_uint64:  m_testFn = &detail::range_tester<data_types::uint64_t>::apply; break;
+		default:
+			throw std::logic_error( "The channel \"" + m_channel + "\" has an unsupported type" );
+		}
+	}
+
+	virtual void test( const char* particles, std::size_t particleSize, std::size_t count, unsigned char* keep ) const {
+		m_testFn( particles, particleSize, count, m_offset, m_minValue, m_maxValue, keep );
+	}
+
+	virtual void get_channel_offsets( std::vector<std::size_t>& outOffsets ) const {
+		outOffsets.push_back( m_channelOffset );
+	}
+
+	virtual bool may_keep( const float bounds[6] ) const {
+		//The block bounds are of the Position.
+		if( m_channel != "Position" || m_component > 2 )
+			return true;
+		return bounds[m_component] <= m_maxValue && bounds[3 + m_component] >= m_minValue;
+	}
+};
+
+/**
+ * Keeps the particles whose integer channel is one of a set of values. Ex. Read the particles with some IDs.
+ */
+class prt_set_predicate : public prt_predicate{
+	std::string m_channel;
+	std::vector<data_types::int64_t> m_values; //Sorted.
+
+	std::size_t m_offset;
+	detail::set_test_fn_t m_testFn;
+
+public:
+	/**
+	 * @param channel The name of the integer channel to test. Only its first component is tested.
+	 * @param values The values kept.
+	 */
+	prt_set_predicate( const std::string& channel, const std::vector<data_types::int64_t>& values )
+		: m_channel( channel ), m_values( values ), m_offset( 0 ), m_testFn( NULL )
+	{
+		std::sort( m_values.begin(), m_values.end() );
+	}
+
+	virtual void bind( const prt_layout& layout ){
+		const detail::prt_channel& ch = detail::get_predicate_channel( layout, m_channel, 0 );
+		m_offset = ch.offset;
+
+		switch( ch.type ){
+		case data_types::type_int8:   m_testFn = &detail::set_tester<data_types::int8_t>::apply; break;
+		case data_types::type_int16:  m_testFn = &detail::set_tester<data_types::int16_t>::apply; break;
+		case data_types::type_int32:  m_testFn = &detail::set_tester<data_types::int32_t>::apply; break;
+		case data_types::type_int64:  m_testFn = &detail::set_tester<data_types::int64_t>::apply; break;
+		case data_types::type_uint8:  m_testFn = &detail::set_tester<data_types::uint8_t>::apply; break;
+		case data_types::type_uint16: m_testFn = &detail::set_tester<data_types::uint16_t>::apply; break;
+		case data_types::type_uint32: m_testFn = &detail::set_tester<data_types::uint32_t>::apply; break;
+		case data_types::type_uint64: m_testFn = &detail::set_tester<data_types::uint64_t>::apply; break;
+		default:
+			throw std::logic_error( "The channel \"" + m_channel + "\" must have an integer type to be tested against a set" );
+		}
+	}
+
+	virtual void test( const char* particles, std::size_t particleSize, std::size_t count, unsigned char* keep ) const {
+		m_testFn( particles, particleSize, count, m_offset, m_values, keep );
+	}
+
+	virtual void get_channel_offsets( std::vector<std::size_t>& outOffsets ) const {
+		outOffsets.push_back( m_offset );
+	}
+};
+
+/**
+ * Keeps the particles whose float32[3] Position is inside a box, including its boundary. On files with block bounds, the
+ * blocks outside the box are skipped.
+ */
+class prt_box_predicate : public prt_predicate{
+	float m_bounds[6];
+	std::size_t m_offset;
+
+public:
+	/**
+	 * @param bounds The box, ordered like the BoundBox metadata: the minimum x, y, z then the maximum x, y, z.
+	 */
+	explicit prt_box_predicate( const float bounds[6] ) : m_offset( 0 ){
+		memcpy( m_bounds, bounds, sizeof(m_bounds) );
+	}
+
+	virtual void bind( const prt_layout& layout ){
+		const detail::prt_channel& ch = layout.get_channel( "Position" );
+		if( ch.type != data_types::type_float32 || ch.arity != 3 )
+			throw std::logic_error( "Testing particles against a box requires a float32[3] Position channel" );
+
+		m_offset = ch.offset;
+	}
+
+	virtual void test( const char* particles, std::size_t particleSize, std::size_t count, unsigned char* keep ) const {
+		particles += m_offset;
+
+		for( std::size_t i = 0; i < count; ++i, particles += particleSize ){
+			float p[3];
+			memcpy( p, particles, sizeof(p) );
+
+			keep[i] &= static_cast<unsigned char>( detail::box_contains( m_bounds, p ) );
+		}
+	}
+
+	virtual void get_channel_offsets( std::vector<std::size_t>& outOffsets ) const {
+		outOffsets.push_back( m_offset );
+	}
+
+	virtual bool may_keep( const float bounds[6] ) const {
+		return detail::boxes_overlap( m_bounds, bounds );
+	}
+};
+
+/**
+ * Keeps the particles kept by all of a list of predicates. The predicates must outlive this.
+ */
+class prt_all_predicate : public prt_predicate{
+	std::vector<prt_predicate*> m_predicates;
+
+public:
+	/**
+	 * @param predicate A predicate to add to the list.
+	 */
+	void add( prt_predicate* predicate ){
+		m_predicates.push_back( predicate );
+	}
+
+	virtual void bind( const prt_layout& layout ){
+		for( std::size_t i = 0; i < m_predicates.size(); ++i )
+			m_predicates[i]->bind( layout );
+	}
+
+	virtual void test( const char* particles, std::size_t particleSize, std::size_t count, unsigned char* keep ) const {
+		for( std::size_t i = 0; i < m_predicates.size(); ++i )
+			m_predicates[i]->test( particles, particleSize, count, keep );
+	}
+
+	virtual void get_channel_offsets( std::vector<std::size_t>& outOffsets ) const {
+		for( std::size_t i = 0; i < m_predicates.size(); ++i )
+			m_predicates[i]->get_channel_offsets( outOffsets );
+	}
+
+	virtual bool may_keep( const float bounds[6] ) const {
+		for( std::size_t i = 0; i < m_predicates.size(); ++i ){
+			if( !m_predicates[i]->may_keep( bounds ) )
+				return false;
+		}
+		return true;
+	}
+};
+
+}//namespace prtio
@@ -0,0 +1,233 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the functions for quickly reading just the headers of PRT files, for example to list the particle
+ * counts and bounds of many files in an asset browser.
+ */
+
+#pragma once
+
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/detail/threading.hpp>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * The information in the header of a PRT file, as returned by probe().
+ */
+struct prt_header_info{
+	std::string filePath;
+	detail::prt_int64 particleCount;
+	prt_layout layout;
+
+	prt_metadata metadata; //The file metadata and the metadata of each channel in 'layout'.
+
+	codecs::option codec;
+	filters::option filter;
+	bool hasBlockIndex; //True if the file was written in independently compressed blocks that can be seeked to.
+
+	bool valid;        //Only false when probing several files, if this one couldn't be read.
+	std::string error; //The reason this file couldn't be read, if 'valid' is false.
+
+	prt_header_info() : particleCount( 0 ), codec( codecs::codec_zlib ), filter( filters::filter_none ), hasBlockIndex( false ), valid( false )
+	{}
+};
+
+namespace detail{
+	/**
+	 * Parses the header of a PRT file and moves the results into a prt_header_info.
+	 */
+	class prt_header_reader : public prt_ifstream{
+	public:
+		void read( const std::vector<char>& data, prt_header_info& outInfo ){
+			this->read_header_only( data.empty() ? NULL : &data.front(), data.size(), outInfo.filePath );
+
+			outInfo.particleCount = this->particle_count();
+			outInfo.layout = this->layout();
+			outInfo.metadata.swap( m_metadata );
+			outInfo.codec = this->codec();
+			outInfo.filter = this->filter().filter();
+			outInfo.hasBlockIndex = this->block_index_offset() > 0;
+			outInfo.valid = true;
+		}
+	};
+
+	/**
+	 * Reads bytes from the start of a file until 'data' holds at least 'size' bytes, or the whole file.
+	 */
+	inline void read_file_prefix( std::ifstream& file, std::vector<char>& data, std::size_t size ){
+		if( data.size() >= size || file.eof() )
+			return;
+
+		std::size_t oldSize = data.size();
+		data.resize( size );
+		file.read( &data[oldSize], static_cast<std::streamsize>( size - oldSize ) );
+		data.resize( oldSize + static_cast<std::size_t>( file.gcount() ) );
+	}
+
+	/**
+	 * Reads the bytes of a PRT file up to the end of its channel table, which is usually done with a single small read.
+	 * The sizes in the header are checked against the size of the file before anything is allocated for them.
+	 */
+	inline void read_header_bytes( const std::string& filePath, std::vector<char>& outData ){
+		std::ifstream file( filePath.c_str(), std::ios::in | std::ios::binary );
+		if( file.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + filePath + "\"" );
+
+		file.seekg( 0, std::ios::end );
+		const prt_int64 fileSize = static_cast<prt_int64>( file.tellg() );
+		file.seekg( 0, std::ios::beg );
+
+		//This covers the header, metadata and channel table of most files.
+		outData.clear();
+		read_file_prefix( file, outData, 4096 );
+
+		if( outData.size() < 12 )
+			return; //Too short to be a PRT file, which parsing reports.
+
+		//The header is followed by the reserved int, the channel count and the per channel length.
+		prt_int32 headerLength;
+		memcpy( &headerLength, &outData[8], 4 );
+		if( headerLength < 0 )
+			return;
+
+		if( static_cast<prt_int64>( headerLength ) + 12 > fileSize )
+			throw std::runtime_error( "The header of the input stream \"" + filePath + "\" is not valid." );
+
+		std::size_t channelTableOffset = static_cast<std::size_t>( headerLength ) + 12;
+		read_file_prefix( file, outData, channelTableOffset );
+
+		if( outData.size() < channelTableOffset )
+			return;
+
+		prt_int32 channelCount, perChannelLength;
+		memcpy( &channelCount, &outData[channelTableOffset - 8], 4 );
+		memcpy( &perChannelLength, &outData[channelTableOffset - 4], 4 );
+		if( channelCount < 0 || perChannelLength < 0 )
+			return;
+
+		if( static_cast<prt_int64>( channelCount ) * static_cast<prt_int64>( perChannelLength ) > fileSize - static_cast<prt_int64>( channelTableOffset ) )
+			throw std::runtime_error( "The channel table of the input stream \"" + filePath + "\" is not valid." );
+
+		read_file_prefix( file, outData, channelTableOffset + static_cast<std::size_t>( channelCount ) * static_cast<std::size_t>( perChannelLength ) );
+	}
+
+	/**
+	 * Probes every 'stride'th file of a list on a worker thread.
+	 */
+	class probe_task : public thread_task{
+		const std::vector<std::string>* m_paths;
+		std::vector<prt_header_info>* m_results;
+		std::size_t m_first, m_stride;
+
+	public:
+		probe_task( const std::vector<std::string>& paths, std::vector<prt_header_info>& results, std::size_t first, std::size_t stride )
+			: m_paths( &paths ), m_results( &results ), m_first( first ), m_stride( stride )
+		{}
+
+	protected:
+		virtual void run(){
+			std::vector<char> data;
+
+			for( std::size_t i = m_first; i < m_paths->size(); i += m_stride ){
+				prt_header_info& info = (*m_results)[i];
+				info.filePath = (*m_paths)[i];
+
+				try{
+					read_header_bytes( info.filePath, data );
+
+					prt_header_reader reader;
+					reader.read( data, info );
+				}catch( const std::exception& e ){
+					info.valid = false;
+					info.error = e.what();
+				}
+			}
+		}
+	};
+}//namespace detail
+
+/**
+ * Reads the header of a PRT file without preparing to decompress its particles. This is much cheaper than opening a
+ * prt_ifstream when only the particle count, layout or metadata (ex. BoundBox) are needed.
+ * @param filePath The PRT file to read.
+ * @return The information in the file's header.
+ */
+inline prt_header_info probe( const std::string& filePath ){
+	std::vector<char> data;
+	detail::read_header_bytes( filePath, data );
+
+	prt_header_info result;
+	result.filePath = filePath;
+
+	detail::prt_header_reader reader;
+	reader.read( data, result );
+
+	return result;
+}
+
+/**
+ * Reads the headers of many PRT files in parallel. A file that can't be read doesn't stop the others; its entry has
+ * 'valid' set to false and the reason in 'error'.
+ * @param filePaths The PRT files to read.
+ * @param outInfos Receives the information in each file's header, in the same order as 'filePaths'.
+ * @param numThreads The number of threads to read on. If 0, it uses all the hardware threads.
+ */
+inline void probe( const std::vector<std::string>& filePaths, std::vector<prt_header_info>& outInfos, std::size_t numThreads = 0 ){
+	outInfos.clear();
+	outInfos.resize( filePaths.size() );
+
+	if( filePaths.empty() )
+		return;
+
+	if( numThreads == 0 )
+		numThreads = detail::hardware_concurrency();
+	if( numThreads > filePaths.size() )
+		numThreads = filePaths.size();
+
+	detail::thread_pool pool( numThreads );
+
+	std::vector< detail::probe_task* > tasks;
+	tasks.reserve( numThreads );
+
+	try{
+		for( std::size_t i = 0; i < numThreads; ++i ){
+			tasks.push_back( new detail::probe_task( filePaths, outInfos, i, numThreads ) );
+			pool.submit( tasks.back() );
+		}
+
+		//The tasks catch their own errors, so waiting doesn't throw.
+		for( std::size_t i = 0; i < tasks.size(); ++i )
+			pool.wait( tasks[i] );
+	}catch( ... ){
+		for( std::size_t i = 0; i < tasks.size(); ++i ){
+			try{
+				pool.wait( tasks[i] );
+			}catch( ... ){
+			}
+			delete tasks[i];
+		}
+		throw;
+	}
+
+	for( std::size_t i = 0; i < tasks.size(); ++i )
+		delete tasks[i];
+}
+
+}//namespace prtio
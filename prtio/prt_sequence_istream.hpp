@@ -0,0 +1,495 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a stream that reads a list of prt files, such as the partitions of a frame, as
+ * though they were one file, decompressing the upcoming files on background threads.
+ */
+
+#pragma once
+
+#include <prtio/prt_probe.hpp>
+#include <prtio/detail/encoding.hpp>
+#include <prtio/detail/threading.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <glob.h>
+#endif
+
+namespace prtio{
+
+/**
+ * Finds the files matching a wildcard pattern, such as "frame_0042_part*.prt". Only the file name part of the pattern
+ * may contain wildcards.
+ * @param pattern The pattern to match, with '*' matching any characters and '?' matching one.
+ * @param outPaths Receives the paths of the matching files, sorted by name.
+ */
+inline void glob_files( const std::string& pattern, std::vector<std::string>& outPaths ){
+	outPaths.clear();
+
+#ifdef _WIN32
+	std::string::size_type slash = pattern.find_last_of( "/\\" );
+	std::string directory = ( slash != std::string::npos ) ? pattern.substr( 0, slash + 1 ) : std::string();
+
+	WIN32_FIND_DATAA data;
+	HANDLE h = FindFirstFileA( pattern.c_str(), &data );
+	if( h != INVALID_HANDLE_VALUE ){
+		do{
+			if( !( data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) )
+				outPaths.push_back( directory + data.cFileName );
+		}while( FindNextFileA( h, &data ) );
+		FindClose( h );
+	}
+#else
+	glob_t result;
+	if( glob( pattern.c_str(), 0, NULL, &result ) == 0 ){
+		for( std::size_t i = 0; i < result.gl_pathc; ++i )
+			outPaths.push_back( result.gl_pathv[i] );
+	}
+	globfree( &result );
+#endif
+
+	std::sort( outPaths.begin(), outPaths.end() );
+}
+
+namespace detail{
+	/**
+	 * Exposes the particles of a prt_ifstream in the file's own layout.
+	 */
+	class prt_raw_reader : public prt_ifstream{
+	public:
+		std::size_t read_raw( char* data, std::size_t count ){
+			return this->read_particles_impl( data, count );
+		}
+	};
+
+	/**
+	 * Decompresses a file of a sequence in chunks on a worker thread. Each run decompresses the next chunk into 'output'.
+	 */
+	class sequence_file_task : public thread_task{
+		//A channel copied from the file's layout to the sequence's.
+		struct channel_copy{
+			std::size_t src, dest, size;
+		};
+
+		std::string m_filePath;
+		const prt_layout* m_layout;
+		std::size_t m_chunkSize;
+
+		prt_raw_reader* m_reader;
+		std::vector<channel_copy> m_copies; //Empty if the file's layout is the same as the sequence's.
+		std::vector<char> m_scratch;        //The particles in the file's layout, when they must be rearranged.
+		bool m_finished;
+
+	private:
+		sequence_file_task( const sequence_file_task& );
+		sequence_file_task& operator=( const sequence_file_task& );
+
+		void open(){
+			m_reader = new prt_raw_reader;
+			m_reader->open( m_filePath );
+
+			const prt_layout& fileLayout = m_reader->layout();
+
+			bool same = ( fileLayout.size() == m_layout->size() && fileLayout.num_channels() == m_layout->num_channels() );
+
+			for( std::size_t i = 0; i < m_layout->num_channels(); ++i ){
+				const std::string& name = m_layout->get_channel_name( i );
+				const prt_channel& ch = m_layout->get_channel_at( i );
+
+				std::size_t index = fileLayout.find_channel( name );
+				if( index == fileLayout.num_channels() )
+					throw std::runtime_error( "The file \"" + m_filePath + "\" doesn't have the channel \"" + name + "\" of the sequence" );
+
+				const prt_channel& fileCh = fileLayout.get_channel_at( index );
+				if( fileCh.type != ch.type || fileCh.arity != ch.arity )
+					throw std::runtime_error( "The channel \"" + name + "\" of the file \"" + m_filePath + "\" doesn't have the same type as in the rest of the sequence" );
+
+				channel_copy copy = { fileCh.offset, ch.offset, data_types::sizes[ch.type] * ch.arity };
+				m_copies.push_back( copy );
+
+				same = same && fileCh.offset == ch.offset;
+			}
+
+			if( same )
+				m_copies.clear();
+		}
+
+	public:
+		std::vector<char> output;  //The particles of the last chunk, in the sequence's layout.
+		std::size_t numParticles; //The number of particles in 'output'.
+
+		sequence_file_task( const std::string& filePath, const prt_layout& layout, std::size_t chunkSize )
+			: m_filePath( filePath ), m_layout( &layout ), m_chunkSize( chunkSize ), m_reader( NULL ), m_finished( false ), numParticles( 0 )
+		{}
+
+		virtual ~sequence_file_task(){
+			delete m_reader;
+		}
+
+		/**
+		 * @return True once the last chunk has been decompressed.
+		 */
+		bool finished() const {
+			return m_finished;
+		}
+
+	protected:
+		virtual void run(){
+			if( !m_reader )
+				this->open();
+
+			const std::size_t particleSize = m_layout->size();
+
+			//Only ask for as many particles as the header claims, so the file is finished as soon as they are read.
+			std::size_t numRequested = static_cast<std::size_t>( (std::min)( static_cast<prt_int64>( m_chunkSize ), m_reader->particle_count() ) );
+
+			output.resize( numRequested * particleSize );
+			numParticles = 0;
+
+			if( numRequested > 0 && m_copies.empty() ){
+				numParticles = m_reader->read_raw( &output.front(), numRequested );
+			}else if( numRequested > 0 ){
+				const std::size_t fileParticleSize = m_reader->layout().size();
+
+				m_scratch.resize( numRequested * fileParticleSize );
+				numParticles = m_reader->read_raw( &m_scratch.front(), numRequested );
+
+				for( std::size_t i = 0; i < numParticles; ++i ){
+					const char* src = &m_scratch[i * fileParticleSize];
+					char* dest = &output[i * particleSize];
+
+					for( std::vector<channel_copy>::const_iterator it = m_copies.begin(), itEnd = m_copies.end(); it != itEnd; ++it )
+						memcpy( dest + it->dest, src + it->src, it->size );
+				}
+			}
+
+			if( numParticles < numRequested )
+				throw std::runtime_error( "The file \"" + m_filePath + "\" did not contain the number of particles it claimed" );
+
+			if( m_reader->particle_count() == 0 ){
+				m_finished = true;
+
+				//Release the file and its buffers as soon as it is done.
+				delete m_reader;
+				m_reader = NULL;
+				std::vector<char>().swap( m_scratch );
+			}
+		}
+	};
+}//namespace detail
+
+/**
+ * This class reads a list of PRT files, such as the partition files of one frame of a simulation, as a single stream.
+ * The files are decompressed in chunks on a pool of threads, a few files ahead of the one being read, so opening and
+ * decompressing the next file overlaps with processing the current one.
+ *
+ * The channels of the stream are those of the first file. Every other file must have those channels with the same
+ * types, though they may be in a different order or have others as well, which are ignored. The metadata is that of the
+ * first file.
+ */
+class prt_sequence_istream : public prt_istream{
+public:
+	/**
+	 * The order that particles are returned in.
+	 */
+	enum particle_order{
+		order_sequential, //Particles are returned in the order of the files, and the order within each file.
+		order_any         //Files are read concurrently and chunks of particles are returned as they are decompressed.
+	};
+
+private:
+	std::vector<std::string> m_filePaths;
+	particle_order m_order;
+	detail::prt_int64 m_particleCount; //The number of particles remaining in all the files.
+
+	detail::thread_pool* m_pool;
+	std::size_t m_maxActive;   //The number of files decompressed at the same time.
+	std::size_t m_nextFile;    //The next file in 'm_filePaths' to start decompressing.
+	std::vector< detail::sequence_file_task* > m_active; //The files being decompressed, in the order they were started.
+
+	std::vector<char> m_chunk;   //The particles being returned, in 'm_layout'.
+	std::size_t m_chunkParticles; //The number of particles in 'm_chunk'.
+	std::size_t m_chunkPos;       //The index in 'm_chunk' of the next particle to return.
+
+private:
+	void init(){
+		m_order = order_sequential;
+		m_particleCount = 0;
+		m_pool = NULL;
+		m_maxActive = 0;
+		m_nextFile = 0;
+		m_chunkParticles = 0;
+		m_chunkPos = 0;
+	}
+
+	/**
+	 * Starts decompressing more files, until there are 'm_maxActive' of them or no more files.
+	 */
+	void start_files(){
+		//Particles for about 4MB per chunk, so a chunk is processed while the next one is decompressed.
+		const std::size_t chunkSize = (std::max)( std::size_t(1), (std::size_t(1) << 22) / (std::max)( std::size_t(1), m_layout.size() ) );
+
+		while( m_active.size() < m_maxActive && m_nextFile < m_filePaths.size() ){
+			//'m_active' has room reserved, so this can't fail after the task is created.
+			m_active.push_back( new detail::sequence_file_task( m_filePaths[m_nextFile], m_layout, chunkSize ) );
+			++m_nextFile;
+
+			m_pool->submit( m_active.back() );
+		}
+	}
+
+	/**
+	 * Makes sure 'm_chunk' has particles left to return, moving on to the next decompressed chunk if needed.
+	 * @return False if there are no particles left.
+	 */
+	bool next_chunk(){
+		while( m_chunkPos == m_chunkParticles ){
+			this->start_files();
+
+			if( m_active.empty() )
+				return false;
+
+			//In any order, take a file that has already finished its chunk, otherwise wait for the oldest.
+			std::size_t index = 0;
+			if( m_order == order_any ){
+				for( std::size_t i = 0; i < m_active.size(); ++i ){
+					if( m_pool->is_done( m_active[i] ) ){
+						index = i;
+						break;
+					}
+				}
+			}
+
+			detail::sequence_file_task* task = m_active[index];
+			{
+				detail::stats_timer timer( m_stats.counters().codecSeconds );
+				m_pool->wait( task );
+			}
+
+			m_chunk.swap( task->output );
+			m_chunkParticles = task->numParticles;
+			m_chunkPos = 0;
+
+			//Decompress the file's next chunk while this one is returned.
+			if( task->finished() ){
+				delete task;
+				m_active.erase( m_active.begin() + index );
+			}else{
+				m_pool->submit( task );
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Waits for and deletes the files being decompressed.
+	 */
+	void stop_files(){
+		for( std::size_t i = 0; i < m_active.size(); ++i ){
+			try{
+				m_pool->wait( m_active[i] );
+			}catch( ... ){
+			}
+			delete m_active[i];
+		}
+		m_active.clear();
+	}
+
+public:
+	/**
+	 * Default constructor. User must later call open().
+	 */
+	prt_sequence_istream(){
+		this->init();
+	}
+
+	/**
+	 * Constructor that opens the stream for the given files.
+	 * @param filePaths The PRT files to read, in order. See glob_files() for finding them.
+	 * @param numThreads The number of threads to decompress on. If 0, it uses all the hardware threads.
+	 * @param order The order in which particles are returned.
+	 */
+	prt_sequence_istream( const std::vector<std::string>& filePaths, std::size_t numThreads = 0, particle_order order = order_sequential ){
+		this->init();
+		this->open( filePaths, numThreads, order );
+	}
+
+	virtual ~prt_sequence_istream(){
+		this->close();
+	}
+
+	/**
+	 * Opens the stream to read the given files. Their headers are read first to check that they have compatible
+	 * layouts and channel encodings, and then the first few are started decompressing.
+	 * @param filePaths The PRT files to read, in order. See glob_files() for finding them.
+	 * @param numThreads The number of threads to decompress on. If 0, it uses all the hardware threads. One more file is
+	 *                   decompressed than there are threads, so the next file is ready when the current one ends.
+	 * @param order The order in which particles are returned.
+	 */
+	void open( const std::vector<std::string>& filePaths, std::size_t numThreads = 0, particle_order order = order_sequential ){
+		if( filePaths.empty() )
+			throw std::logic_error( "Can't open a sequence of no files" );
+
+		this->close();
+		m_stats.start();
+
+		if( numThreads == 0 )
+			numThreads = detail::hardware_concurrency();
+
+		std::vector<prt_header_info> infos;
+		prtio::probe( filePaths, infos, numThreads );
+
+		for( std::size_t i = 0; i < infos.size(); ++i ){
+			if( !infos[i].valid )
+				throw std::runtime_error( infos[i].error );
+		}
+
+		m_layout = infos[0].layout;
+		m_metadata.swap( infos[0].metadata );
+
+		//Check all the layouts now, rather than failing part way through reading. The channels are decoded with the first
+		//file's encodings, so quantized channels must also have the same offsets and scales in every file.
+		for( std::size_t i = 1; i < infos.size(); ++i ){
+			const prt_layout& fileLayout = infos[i].layout;
+
+			for( std::size_t c = 0; c < m_layout.num_channels(); ++c ){
+				const std::string& name = m_layout.get_channel_name( c );
+				const detail::prt_channel& ch = m_layout.get_channel_at( c );
+
+				std::size_t index = fileLayout.find_channel( name );
+				if( index == fileLayout.num_channels() || fileLayout.get_channel_at( index ).type != ch.type || fileLayout.get_channel_at( index ).arity != ch.arity ){
+					this->close();
+					throw std::runtime_error( "The file \"" + filePaths[i] + "\" doesn't have the channel \"" + name + "\" with the same type as \"" + filePaths[0] + "\"" );
+				}
+
+				bool sameEncoding;
+				try{
+					sameEncoding = detail::same_channel_encoding( name, ch, m_metadata.channel_metadata( name ), fileLayout.get_channel_at( index ), infos[i].metadata.channel_metadata( name ) );
+				}catch( ... ){
+					this->close();
+					throw;
+				}
+
+				if( !sameEncoding ){
+					this->close();
+					throw std::runtime_error( "The file \"" + filePaths[i] + "\" doesn't store the channel \"" + name + "\" with the same encoding as \"" + filePaths[0] + "\"" );
+				}
+			}
+		}
+
+		m_filePaths = filePaths;
+		for( std::size_t i = 0; i < infos.size(); ++i )
+			m_particleCount += infos[i].particleCount;
+
+		m_order = order;
+		m_pool = new detail::thread_pool( numThreads );
+		m_maxActive = m_pool->size() + 1;
+		m_active.reserve( m_maxActive );
+
+		this->start_files();
+	}
+
+	/**
+	 * Closes the stream, waiting for any outstanding decompression and freeing its memory.
+	 */
+	void close(){
+		if( m_pool ){
+			this->stop_files();
+
+			delete m_pool;
+			m_pool = NULL;
+
+			m_stats.finish( m_filePaths.empty() ? std::string() : m_filePaths.front() );
+		}
+
+		m_filePaths.clear();
+		m_layout.clear();
+		m_metadata.clear();
+		std::vector<char>().swap( m_chunk );
+
+		this->init();
+	}
+
+	/**
+	 * The number of particles remaining in all the files.
+	 */
+	detail::prt_int64 particle_count() const {
+		return m_particleCount;
+	}
+
+	/**
+	 * @return The number of files in the sequence.
+	 */
+	std::size_t num_files() const {
+		return m_filePaths.size();
+	}
+
+	/**
+	 * @return The path of a file in the sequence.
+	 */
+	const std::string& file_path( std::size_t index ) const {
+		return m_filePaths.at( index );
+	}
+
+protected:
+	virtual bool read_impl( char* data ){
+		if( !m_pool || !this->next_chunk() )
+			return false;
+
+		const std::size_t particleSize = m_layout.size();
+
+		memcpy( data, &m_chunk[m_chunkPos * particleSize], particleSize );
+
+		++m_chunkPos;
+		--m_particleCount;
+
+		return true;
+	}
+
+	virtual std::size_t read_particles_impl( char* data, std::size_t count ){
+		if( !m_pool )
+			return 0;
+
+		const std::size_t particleSize = m_layout.size();
+
+		std::size_t result = 0;
+		while( result < count && this->next_chunk() ){
+			std::size_t numParticles = (std::min)( count - result, m_chunkParticles - m_chunkPos );
+
+			memcpy( data + result * particleSize, &m_chunk[m_chunkPos * particleSize], numParticles * particleSize );
+
+			m_chunkPos += numParticles;
+			result += numParticles;
+		}
+
+		m_particleCount -= static_cast<detail::prt_int64>( result );
+
+		return result;
+	}
+};
+
+}//namespace prtio
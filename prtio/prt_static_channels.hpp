@@ -0,0 +1,282 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the classes for binding a list of channels known at compile time to a prt_istream, so that
+ * extracting them compiles down to a single fused copy per particle.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/data_types.hpp>
+#include <prtio/detail/encoding.hpp>
+#include <prtio/prt_layout.hpp>
+#include <prtio/prt_metadata.hpp>
+
+#include <cstring>
+#include <vector>
+
+/**
+ * Declares a channel tag for use with prtio::static_channels.
+ * @param tag The name of the tag struct to declare.
+ * @param channelName The name of the channel in the PRT file.
+ * @param type The C++ type of the destination for the channel's values.
+ * @param channelArity The arity of the channel.
+ */
+#define PRTIO_DEFINE_STATIC_CHANNEL( tag, channelName, type, channelArity ) \
+	struct tag{ \
+		typedef type value_type; \
+		enum{ arity = channelArity }; \
+		static const char* name(){ \
+			return channelName; \
+		} \
+	};
+
+namespace prtio{
+
+/**
+ * Tags for the channels commonly found in PRT files. Custom channels are declared with PRTIO_DEFINE_STATIC_CHANNEL.
+ * The value_type of a tag is the destination type. If the file stores the channel as a different (compatible) type,
+ * it is converted at runtime like prt_istream::bind() does, and channels stored with an encoding are decoded into
+ * floating point value_types the same way.
+ */
+namespace channels{
+	//Marks an unused entry in a static_channels list.
+	struct none{
+		typedef none value_type;
+		enum{ arity = 0 };
+	};
+
+	PRTIO_DEFINE_STATIC_CHANNEL( position, "Position", data_types::float32_t, 3 )
+	PRTIO_DEFINE_STATIC_CHANNEL( velocity, "Velocity", data_types::float32_t, 3 )
+	PRTIO_DEFINE_STATIC_CHANNEL( normal, "Normal", data_types::float32_t, 3 )
+	PRTIO_DEFINE_STATIC_CHANNEL( color, "Color", data_types::float32_t, 3 )
+	PRTIO_DEFINE_STATIC_CHANNEL( density, "Density", data_types::float32_t, 1 )
+	PRTIO_DEFINE_STATIC_CHANNEL( age, "Age", data_types::float32_t, 1 )
+	PRTIO_DEFINE_STATIC_CHANNEL( life_span, "LifeSpan", data_types::float32_t, 1 )
+	PRTIO_DEFINE_STATIC_CHANNEL( id, "ID", data_types::int64_t, 1 )
+}//namespace channels
+
+namespace detail{
+
+	/**
+	 * The interface prt_istream uses to run the extraction for a bound static_channels list.
+	 */
+	class static_extractor{
+	public:
+		virtual ~static_extractor()
+		{}
+
+		/**
+		 * Extracts the channels of 'count' consecutive particles.
+		 * @param src A pointer to the first source particle.
+		 * @param srcStride The size in bytes of a source particle.
+		 * @param destIndex The index in the bound destination arrays to write the first particle to.
+		 * @param count The number of particles to extract.
+		 */
+		virtual void extract( const char* src, std::size_t srcStride, std::size_t destIndex, std::size_t count ) = 0;
+
+		/**
+		 * Adds the offsets in the source particle of the extracted channels to 'outOffsets'.
+		 */
+		virtual void get_source_offsets( std::vector<std::size_t>& outOffsets ) const = 0;
+	};
+
+	/**
+	 * The end of a static channel list.
+	 */
+	struct static_channel_nil{};
+
+	/**
+	 * A node of a compile time list of channels, holding the runtime binding for 'Channel'.
+	 * @tparam Channel The channel tag.
+	 * @tparam Tail The rest of the list.
+	 */
+	template <class Channel, class Tail>
+	struct static_channel_cons{
+		typename Channel::value_type* dest;
+		std::size_t offset;
+		convert_fn_t copyFn; //NULL if the file stores the channel as Channel::value_type, so no conversion is needed.
+		decode_fn_t decodeFn; //Set for channels stored with an encoding, to decode them instead of copying or converting them.
+		std::size_t storedArity; //The number of stored components, which differs from Channel::arity for octahedral channels.
+		std::vector<float> decodeParams; //The offsets then scales of a quantized channel.
+		Tail tail;
+	};
+
+	/**
+	 * Builds the static_channel_cons list for a sequence of channel tags, stopping at the first channels::none.
+	 */
+	template <class C1, class C2, class C3, class C4, class C5, class C6, class C7, class C8>
+	struct make_static_channel_list{
+		typedef static_channel_cons< C1, typename make_static_channel_list<C2, C3, C4, C5, C6, C7, C8, channels::none>::type > type;
+	};
+
+	template <>
+	struct make_static_channel_list<channels::none, channels::none, channels::none, channels::none, channels::none, channels::none, channels::none, channels::none>{
+		typedef static_channel_nil type;
+	};
+
+	/**
+	 * Resolves each channel of a list against a layout, and performs the fused extraction of a particle.
+	 */
+	template <class List>
+	struct static_channel_ops;
+
+	template <>
+	struct static_channel_ops<static_channel_nil>{
+		static void bind( static_channel_nil&, const prt_layout&, const prt_metadata&, void* const* )
+		{}
+
+		static void extract( const static_channel_nil&, const char*, std::size_t )
+		{}
+
+		static void get_offsets( const static_channel_nil&, std::vector<std::size_t>& )
+		{}
+	};
+
+	template <class Channel, class Tail>
+	struct static_channel_ops< static_channel_cons<Channel, Tail> >{
+		typedef typename Channel::value_type value_type;
+
+		static void bind( static_channel_cons<Channel, Tail>& node, const prt_layout& layout, const prt_metadata& metadata, void* const* dests ){
+			std::size_t channelIndex = layout.find_channel( Channel::name() );
+			if( channelIndex == layout.num_channels() )
+				throw std::out_of_range( std::string() + "There is no channel named \"" + Channel::name() + "\"" );
+
+			const prt_channel& ch = layout.get_channel_at( channelIndex );
+
+			node.dest = static_cast<value_type*>( dests[0] );
+			node.offset = ch.offset;
+			node.copyFn = NULL;
+			node.decodeFn = NULL;
+			node.storedArity = Channel::arity;
+
+			//Encoded channels are decoded as prt_istream::bind() does. An octahedral channel stores two components.
+			if( is_float( data_types::traits<value_type>::data_type() ) ){
+				encodings::option encoding = get_channel_encoding( Channel::name(), ch, metadata.channel_metadata( Channel::name() ), node.decodeParams );
+				if( encoding == encodings::encoding_octahedral ){
+					if( Channel::arity != 3 )
+						throw std::runtime_error( std::string() + "The octahedral channel \"" + Channel::name() + "\" must be bound with an arity of 3" );
+					node.storedArity = ch.arity;
+				}
+
+				node.decodeFn = get_decoder<value_type>( encoding, ch.type );
+			}
+
+			//Decoded channels aren't converted from the stored type, so only their arity has to match.
+			check_read_binding( Channel::name(), node.decodeFn ? ch.type : data_types::traits<value_type>::data_type(), node.storedArity, ch.type, ch.arity );
+
+			if( !node.decodeFn && ch.type != data_types::traits<value_type>::data_type() ){
+				node.copyFn = get_read_converter<value_type>( ch.type );
+				if( !node.copyFn )
+					throw std::logic_error( std::string() + "The channel \"" + Channel::name() + "\" had an unsupported type: \"" + data_types::names[ ch.type ] + "\"" );
+			}
+
+			static_channel_ops<Tail>::bind( node.tail, layout, metadata, dests + 1 );
+		}
+
+		static inline void extract( const static_channel_cons<Channel, Tail>& node, const char* src, std::size_t destIndex ){
+			value_type* dest = node.dest + destIndex * Channel::arity;
+
+			//The size is a compile time constant, so this becomes a few loads and stores.
+			if( node.decodeFn )
+				node.decodeFn( dest, sizeof(value_type) * Channel::arity, src + node.offset, 0, node.storedArity, 1, node.decodeParams.empty() ? NULL : &node.decodeParams.front() );
+			else if( !node.copyFn )
+				memcpy( dest, src + node.offset, sizeof(value_type) * Channel::arity );
+			else
+				node.copyFn( dest, src + node.offset, Channel::arity );
+
+			static_channel_ops<Tail>::extract( node.tail, src, destIndex );
+		}
+
+		static void get_offsets( const static_channel_cons<Channel, Tail>& node, std::vector<std::size_t>& outOffsets ){
+			outOffsets.push_back( node.offset );
+			static_channel_ops<Tail>::get_offsets( node.tail, outOffsets );
+		}
+	};
+
+	/**
+	 * The static_extractor for a specific list of channels.
+	 */
+	template <class List>
+	class static_extractor_impl : public static_extractor{
+		List m_list;
+
+	public:
+		static_extractor_impl( const prt_layout& layout, const prt_metadata& metadata, void* const* dests ){
+			static_channel_ops<List>::bind( m_list, layout, metadata, dests );
+		}
+
+		virtual void extract( const char* src, std::size_t srcStride, std::size_t destIndex, std::size_t count ){
+			for( std::size_t i = 0; i < count; ++i, src += srcStride )
+				static_channel_ops<List>::extract( m_list, src, destIndex + i );
+		}
+
+		virtual void get_source_offsets( std::vector<std::size_t>& outOffsets ) const {
+			static_channel_ops<List>::get_offsets( m_list, outOffsets );
+		}
+	};
+
+}//namespace detail
+
+/**
+ * This class holds the destinations for a list of channels known at compile time, to be bound to a prt_istream with
+ * prt_istream::bind_static(). All the channels are extracted together by one function that the compiler can inline
+ * and unroll, instead of one indirect conversion call per channel per particle.
+ * Ex.
+ *   prtio::static_channels< prtio::channels::position, prtio::channels::density > bindings( &pos[0], &density[0] );
+ *   stream.bind_static( bindings );
+ *
+ * @tparam C1 ... C8 The channel tags. Unused entries are left as channels::none.
+ * @note The destinations are indexed as tightly packed arrays of Channel::value_type[Channel::arity] when using
+ *       prt_istream::read_particles().
+ */
+template <class C1, class C2 = channels::none, class C3 = channels::none, class C4 = channels::none,
+          class C5 = channels::none, class C6 = channels::none, class C7 = channels::none, class C8 = channels::none>
+class static_channels{
+	void* m_dests[8];
+
+public:
+	typedef typename detail::make_static_channel_list<C1, C2, C3, C4, C5, C6, C7, C8>::type list_type;
+
+	/**
+	 * @param dest1 ... dest8 The destination for each channel in the list.
+	 */
+	static_channels( typename C1::value_type* dest1, typename C2::value_type* dest2 = NULL, typename C3::value_type* dest3 = NULL,
+	                 typename C4::value_type* dest4 = NULL, typename C5::value_type* dest5 = NULL, typename C6::value_type* dest6 = NULL,
+	                 typename C7::value_type* dest7 = NULL, typename C8::value_type* dest8 = NULL )
+	{
+		m_dests[0] = dest1;
+		m_dests[1] = dest2;
+		m_dests[2] = dest3;
+		m_dests[3] = dest4;
+		m_dests[4] = dest5;
+		m_dests[5] = dest6;
+		m_dests[6] = dest7;
+		m_dests[7] = dest8;
+	}
+
+	/**
+	 * Creates the extractor for these channels in the given layout.
+	 * @param layout The layout of the stream's particles.
+	 * @param metadata The stream's metadata, which holds the encodings of its channels.
+	 * @return A new object, owned by the caller.
+	 */
+	detail::static_extractor* create_extractor( const prt_layout& layout, const prt_metadata& metadata ) const {
+		return new detail::static_extractor_impl<list_type>( layout, metadata, m_dests );
+	}
+};
+
+}//namespace prtio
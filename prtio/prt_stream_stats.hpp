@@ -0,0 +1,209 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the statistics the PRT streams collect about where their time goes, when built with
+ * PRTIO_ENABLE_STATS defined. Without it, the counters and timers compile to nothing.
+ */
+
+#pragma once
+
+#include <prtio/detail/prt_header.hpp>
+
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/time.h>
+#include <time.h>
+#endif
+
+namespace prtio{
+
+/**
+ * The work a stream has done since it was opened. The times are wall clock time spent on the calling thread, so when
+ * reading or writing with background threads they are the time spent waiting for those threads.
+ */
+struct prt_stream_stats{
+	detail::prt_int64 particles;         //The number of particles read or written.
+	detail::prt_int64 compressedBytes;   //The bytes of particle data read from or written to the file, as stored.
+	detail::prt_int64 uncompressedBytes; //The bytes of particle data in the file's layout, before compressing or after decompressing.
+
+	double ioSeconds;      //Time reading compressed data from the file, or writing it.
+	double codecSeconds;   //Time in inflate()/deflate() and the other codecs, or waiting for compression threads.
+	double convertSeconds; //Time converting channels between the bound variables and the file's layout.
+	double flushSeconds;   //Time flushing written data to the operating system, or waiting for the background writer to finish.
+	double elapsedSeconds; //Time since the stream was opened, or until it was closed.
+
+	prt_stream_stats(){
+		this->clear();
+	}
+
+	void clear(){
+		particles = 0;
+		compressedBytes = 0;
+		uncompressedBytes = 0;
+		ioSeconds = 0;
+		codecSeconds = 0;
+		convertSeconds = 0;
+		flushSeconds = 0;
+		elapsedSeconds = 0;
+	}
+
+	/**
+	 * @return The average number of particles read or written per second since the stream was opened.
+	 */
+	double particles_per_second() const {
+		return ( elapsedSeconds > 0 ) ? static_cast<double>( particles ) / elapsedSeconds : 0.0;
+	}
+};
+
+/**
+ * A function that receives a stream's statistics when it is closed. See prt_istream::set_stats_callback().
+ * @param userData The pointer given with the callback.
+ * @param filePath The file the stream read or wrote.
+ * @param stats The stream's statistics.
+ */
+typedef void (*prt_stats_callback)( void* userData, const std::string& filePath, const prt_stream_stats& stats );
+
+namespace detail{
+
+#ifdef PRTIO_ENABLE_STATS
+	/**
+	 * @return A high resolution wall clock time in seconds, from an arbitrary starting point.
+	 */
+	inline double stats_clock(){
+#if defined(_WIN32)
+		LARGE_INTEGER frequency, counter;
+		QueryPerformanceFrequency( &frequency );
+		QueryPerformanceCounter( &counter );
+		return static_cast<double>( counter.QuadPart ) / static_cast<double>( frequency.QuadPart );
+#elif defined(CLOCK_MONOTONIC)
+		timespec ts;
+		clock_gettime( CLOCK_MONOTONIC, &ts );
+		return static_cast<double>( ts.tv_sec ) + 1e-9 * static_cast<double>( ts.tv_nsec );
+#else
+		timeval tv;
+		gettimeofday( &tv, NULL );
+		return static_cast<double>( tv.tv_sec ) + 1e-6 * static_cast<double>( tv.tv_usec );
+#endif
+	}
+
+	/**
+	 * Adds the time until it goes out of scope to one of the times of a prt_stream_stats.
+	 */
+	class stats_timer{
+		double* m_dest;
+		double m_start;
+
+		stats_timer( const stats_timer& );
+		stats_timer& operator=( const stats_timer& );
+
+	public:
+		explicit stats_timer( double& dest ) : m_dest( &dest ), m_start( stats_clock() )
+		{}
+
+		~stats_timer(){
+			*m_dest += stats_clock() - m_start;
+		}
+	};
+
+	inline void stats_count( prt_int64& counter, prt_int64 amount ){
+		counter += amount;
+	}
+#else
+	class stats_timer{
+	public:
+		explicit stats_timer( double& )
+		{}
+	};
+
+	inline void stats_count( prt_int64&, prt_int64 )
+	{}
+#endif
+
+	/**
+	 * Holds the statistics of a stream between it being opened and closed, and reports them to the callback.
+	 */
+	class stats_recorder{
+		prt_stream_stats m_stats;
+		prt_stats_callback m_callback;
+		void* m_userData;
+		double m_startTime;
+		bool m_running;
+
+	public:
+		stats_recorder() : m_callback( NULL ), m_userData( NULL ), m_startTime( 0 ), m_running( false )
+		{}
+
+		/**
+		 * The counters, for the stream to add to.
+		 */
+		prt_stream_stats& counters(){
+			return m_stats;
+		}
+
+		void set_callback( prt_stats_callback callback, void* userData ){
+			m_callback = callback;
+			m_userData = userData;
+		}
+
+		/**
+		 * Clears the statistics when the stream is opened.
+		 */
+		void start(){
+#ifdef PRTIO_ENABLE_STATS
+			m_stats.clear();
+			m_startTime = stats_clock();
+			m_running = true;
+#endif
+		}
+
+		/**
+		 * Stops the clock when the stream is closed, and reports the final statistics.
+		 */
+		void finish( const std::string& filePath ){
+#ifdef PRTIO_ENABLE_STATS
+			if( !m_running )
+				return;
+
+			m_stats.elapsedSeconds = stats_clock() - m_startTime;
+			m_running = false;
+
+			if( m_callback )
+				m_callback( m_userData, filePath, m_stats );
+#else
+			(void)filePath;
+#endif
+		}
+
+		/**
+		 * @return The statistics so far.
+		 */
+		prt_stream_stats get() const {
+			prt_stream_stats result( m_stats );
+#ifdef PRTIO_ENABLE_STATS
+			if( m_running )
+				result.elapsedSeconds = stats_clock() - m_startTime;
+#endif
+			return result;
+		}
+	};
+
+}//namespace detail
+}//namespace prtio
@@ -0,0 +1,422 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains prt_transcode(), for copying a PRT file to a new one with channels dropped, renamed or stored as
+ * different types, its metadata edited, or its particles recompressed.
+ */
+
+#pragma once
+
+#include <prtio/prt_ofstream.hpp>
+#include <prtio/prt_parallel_ifstream.hpp>
+#include <prtio/prt_probe.hpp>
+#include <prtio/detail/encoding.hpp>
+
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace prtio{
+
+/**
+ * The changes prt_transcode() makes while copying a PRT file. The defaults copy it unchanged. Channels are named by
+ * their names in the source file, except in 'channelMetadata'.
+ */
+struct prt_transcode_options{
+	std::set< std::string > droppedChannels;                   //The channels that aren't copied.
+	std::map< std::string, std::string > renamedChannels;      //The new name of each renamed channel.
+	std::map< std::string, data_types::enum_t > channelTypes;  //The type each channel is stored as, if changed. Ex. type_float16 to halve a float32 channel.
+	                                                           //Quantized and octahedral channels are decoded, and can only change to floating point types.
+
+	std::map< std::string, prt_meta_value > fileMetadata;      //File metadata to add, replacing any value with the same name.
+	std::set< std::string > removedFileMetadata;               //The names of the file metadata that aren't copied.
+	std::map< std::string, std::map< std::string, prt_meta_value > > channelMetadata; //Channel metadata to add, by the channel's new name.
+
+	bool recompress;                 //If true, the particles are compressed with 'compression' instead of the source file's codec and filter.
+	compression_options compression; //The compression settings, if 'recompress'.
+	bool blockIndex;                 //If true, the new file has a block index even if the source file doesn't.
+	std::size_t numThreads;          //The number of threads to decompress and compress on, or 0 for all the hardware threads.
+
+	prt_transcode_options() : recompress( false ), blockIndex( false ), numThreads( 0 )
+	{}
+};
+
+namespace detail{
+	/**
+	 * @return True if both paths name the same existing file, even through different paths or links.
+	 */
+	inline bool is_same_file( const std::string& lhs, const std::string& rhs ){
+		if( lhs == rhs )
+			return true;
+
+#ifdef _WIN32
+		BY_HANDLE_FILE_INFORMATION info[2];
+		bool found = true;
+
+		const std::string* paths[] = { &lhs, &rhs };
+		for( int i = 0; i < 2; ++i ){
+			HANDLE file = CreateFileA( paths[i]->c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+			if( file == INVALID_HANDLE_VALUE )
+				return false;
+
+			found = found && GetFileInformationByHandle( file, &info[i] ) != 0;
+			CloseHandle( file );
+		}
+
+		return found && info[0].dwVolumeSerialNumber == info[1].dwVolumeSerialNumber &&
+			info[0].nFileIndexHigh == info[1].nFileIndexHigh && info[0].nFileIndexLow == info[1].nFileIndexLow;
+#else
+		struct stat lhsInfo, rhsInfo;
+		if( stat( lhs.c_str(), &lhsInfo ) != 0 || stat( rhs.c_str(), &rhsInfo ) != 0 )
+			return false;
+
+		return lhsInfo.st_dev == rhsInfo.st_dev && lhsInfo.st_ino == rhsInfo.st_ino;
+#endif
+	}
+
+	/**
+	 * Reads the particles of the source file in its own layout, and exposes its header for copying the data unchanged.
+	 */
+	class prt_transcode_reader : public prt_parallel_ifstream{
+	public:
+		std::size_t read_raw( char* data, std::size_t count ){
+			return this->read_particles_impl( data, count );
+		}
+
+		//Extracts the channels bound with bind() from particles returned by read_raw(), decoding any encoded channels.
+		void extract_raw( const char* data, std::size_t count ){
+			this->extract_particles( data, 0, count );
+		}
+
+		const std::vector< prt_block_index_entry_v1 >& get_block_index() const { return this->block_index(); }
+		const std::vector< prt_block_bounds_v1 >& get_block_bounds() const { return this->block_bounds(); }
+		const std::vector< prt_block_checksum_v1 >& get_block_checksums() const { return this->block_checksums(); }
+		prt_int64 get_block_index_offset() const { return this->block_index_offset(); }
+		codecs::option get_codec() const { return this->codec(); }
+		const particle_filter& get_filter() const { return this->filter(); }
+	};
+
+	/**
+	 * Writes the new file, either by compressing particles or by copying the source's compressed data.
+	 */
+	class prt_transcode_writer : public prt_ofstream{
+	public:
+		void open_copy( const std::string& file, codecs::option codec, const particle_filter& filter, bool blockIndex ){
+			this->open_compressed( file, codec, filter, blockIndex );
+		}
+
+		void write_copy( const char* data, std::size_t numBytes ){
+			this->write_compressed_data( data, numBytes );
+		}
+
+		void add_copied_block( prt_int64 dataOffset, prt_int64 particleCount, const float bounds[6], const prt_block_checksum_v1& checksum ){
+			this->add_compressed_block( dataOffset, particleCount, bounds, checksum );
+		}
+
+		void set_copied_totals( prt_int64 particleCount, const float bounds[6] ){
+			this->set_compressed_totals( particleCount, bounds );
+		}
+	};
+
+	/**
+	 * Binds a channel of 'out' to particle data in another layout, converting from the type it has there.
+	 * @param out The stream to bind.
+	 * @param name The name of the channel in 'out'.
+	 * @param srcType The type of the channel in the particle data.
+	 * @param src A pointer to the channel in the first particle.
+	 * @param arity The arity of the channel.
+	 * @param destType The type to store the channel as.
+	 * @param stride The size of a particle in the particle data.
+	 */
+	inline void bind_converted_channel( prt_ostream& out, const std::string& name, data_types::enum_t srcType, char* src, std::size_t arity, data_types::enum_t destType, std::size_t stride ){
+		switch( srcType ){
+		case data_types::type_int8:
+			out.bind( name, reinterpret_cast<data_types::int8_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_int16:
+			out.bind( name, reinterpret_cast<data_types::int16_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_int32:
+			out.bind( name, reinterpret_cast<data_types::int32_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_int64:
+			out.bind( name, reinterpret_cast<data_types::int64_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_float16:
+			out.bind( name, reinterpret_cast<data_types::float16_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_float32:
+			out.bind( name, reinterpret_cast<data_types::float32_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_float64:
+			out.bind( name, reinterpret_cast<data_types::float64_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_uint8:
+			out.bind( name, reinterpret_cast<data_types::uint8_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_uint16:
+			out.bind( name, reinterpret_cast<data_types::uint16_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_uint32:
+			out.bind( name, reinterpret_cast<data_types::uint32_t*>( src ), arity, destType, stride );
+			break;
+		case data_types::type_uint64:
+			out.bind( name, reinterpret_cast<data_types::uint64_t*>( src ), arity, destType, stride );
+			break;
+		default:
+			throw std::logic_error( "The channel \"" + name + "\" has an unsupported type" );
+		}
+	}
+
+	/**
+	 * @return The file offset of the compressed particle data, which follows the channel table.
+	 */
+	inline prt_int64 get_data_offset( const std::string& filePath ){
+		std::vector<char> data;
+		read_header_bytes( filePath, data );
+
+		//The header was parsed when the file was opened, so these are all in 'data'.
+		prt_int32 headerLength, channelCount, perChannelLength;
+		memcpy( &headerLength, &data[8], 4 );
+
+		std::size_t channelTableOffset = static_cast<std::size_t>( headerLength ) + 12;
+		memcpy( &channelCount, &data[channelTableOffset - 8], 4 );
+		memcpy( &perChannelLength, &data[channelTableOffset - 4], 4 );
+
+		return static_cast<prt_int64>( channelTableOffset ) + static_cast<prt_int64>( channelCount ) * perChannelLength;
+	}
+
+	/**
+	 * Copies the compressed particle data and block index of the source file into the new one.
+	 */
+	inline void copy_compressed_data( const std::string& filePath, prt_transcode_reader& in, prt_transcode_writer& out ){
+		std::ifstream file( filePath.c_str(), std::ios::in | std::ios::binary );
+		if( file.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + filePath + "\"" );
+
+		prt_int64 dataStart = get_data_offset( filePath );
+		prt_int64 dataEnd = in.get_block_index_offset();
+		if( dataEnd <= 0 ){
+			file.seekg( 0, std::ios::end );
+			dataEnd = static_cast<prt_int64>( file.tellg() );
+		}
+
+		file.seekg( static_cast<std::streamoff>( dataStart ), std::ios::beg );
+
+		std::vector<char> buffer( std::size_t(1) << 20 );
+		for( prt_int64 pos = dataStart; pos < dataEnd; ){
+			std::size_t numBytes = static_cast<std::size_t>( (std::min)( static_cast<prt_int64>( buffer.size() ), dataEnd - pos ) );
+
+			file.read( &buffer.front(), static_cast<std::streamsize>( numBytes ) );
+			if( file.fail() )
+				throw std::runtime_error( "The particle data of the file \"" + filePath + "\" is truncated." );
+
+			out.write_copy( &buffer.front(), numBytes );
+			pos += static_cast<prt_int64>( numBytes );
+		}
+
+		const std::vector< prt_block_index_entry_v1 >& blockIndex = in.get_block_index();
+		const std::vector< prt_block_bounds_v1 >& blockBounds = in.get_block_bounds();
+		const std::vector< prt_block_checksum_v1 >& blockChecksums = in.get_block_checksums();
+
+		for( std::size_t i = 0; i < blockIndex.size(); ++i ){
+			float bounds[6];
+			if( i < blockBounds.size() )
+				memcpy( bounds, blockBounds[i].bounds, sizeof(float) * 6 );
+			else
+				set_infinite_box( bounds );
+
+			//The copied bytes are unchanged, so their checksums still hold.
+			out.add_copied_block( blockIndex[i].dataOffset - dataStart, blockIndex[i].particleCount, bounds, ( i < blockChecksums.size() ) ? blockChecksums[i] : unknown_block_checksum() );
+		}
+
+		float fileBounds[6];
+		set_empty_box( fileBounds );
+
+		prt_meta_map metadata = in.get_file_metadata();
+		prt_meta_map::const_iterator it = metadata.find( "BoundBox" );
+		if( it != metadata.end() && it->second.get_type() == meta_types::type_float32 && it->second.get_arity() == 6 )
+			memcpy( fileBounds, it->second.get_ptr<float>(), sizeof(float) * 6 );
+
+		out.set_copied_totals( in.particle_count(), fileBounds );
+	}
+}//namespace detail
+
+/**
+ * Copies a PRT file to a new one, making the changes in 'options'. When the channels keep their types and order and the
+ * particles don't need recompressing, the compressed particle data is copied byte for byte, so only the header is
+ * rewritten. Otherwise the particles are decompressed, converted and compressed again: blocks of a block indexed file are
+ * decompressed ahead on a pool of threads while the new file is compressed on another, and the channels are converted a
+ * batch at a time on the calling thread.
+ * @param srcPath The PRT file to copy.
+ * @param destPath The new PRT file to write. It can't be the same file as 'srcPath', since writing it would truncate the
+ *                 particles before they are copied.
+ * @param options The changes to make.
+ * @return True if the compressed particle data was copied unchanged, false if the particles were recompressed.
+ */
+inline bool prt_transcode( const std::string& srcPath, const std::string& destPath, const prt_transcode_options& options = prt_transcode_options() ){
+	if( detail::is_same_file( srcPath, destPath ) )
+		throw std::logic_error( "The file \"" + srcPath + "\" can't be transcoded onto itself, the output must be a different file" );
+
+	std::size_t numThreads = ( options.numThreads == 0 ) ? detail::hardware_concurrency() : options.numThreads;
+
+	detail::prt_transcode_reader in;
+	in.open( srcPath, numThreads );
+
+	const prt_layout& srcLayout = in.layout();
+
+	//Channels named in the options must exist, so that a typo isn't silently ignored.
+	const std::string* unknownChannel = NULL;
+	for( std::set< std::string >::const_iterator it = options.droppedChannels.begin(); !unknownChannel && it != options.droppedChannels.end(); ++it ){
+		if( !srcLayout.has_channel( *it ) )
+			unknownChannel = &*it;
+	}
+	for( std::map< std::string, std::string >::const_iterator it = options.renamedChannels.begin(); !unknownChannel && it != options.renamedChannels.end(); ++it ){
+		if( !srcLayout.has_channel( it->first ) )
+			unknownChannel = &it->first;
+	}
+	for( std::map< std::string, data_types::enum_t >::const_iterator it = options.channelTypes.begin(); !unknownChannel && it != options.channelTypes.end(); ++it ){
+		if( !srcLayout.has_channel( it->first ) )
+			unknownChannel = &it->first;
+	}
+	if( unknownChannel )
+		throw std::logic_error( "The file \"" + srcPath + "\" doesn't have a channel named \"" + *unknownChannel + "\"" );
+
+	//The compressed data can be copied if every particle is stored exactly as it was.
+	bool copyData = !options.recompress && options.droppedChannels.empty() && in.get_block_index_offset() >= 0 && ( in.has_block_index() || !options.blockIndex );
+
+	const std::size_t particleSize = (std::max)( std::size_t(1), srcLayout.size() );
+	const std::size_t batchSize = (std::max)( std::size_t(1), (std::size_t(1) << 20) / particleSize );
+
+	std::vector<char> buffer( batchSize * particleSize );
+
+	//Encoded channels that change type are decoded into these arrays through the reader's bindings, then stored as plain
+	//values of the new type.
+	std::vector< std::vector<data_types::float64_t> > decoded;
+	decoded.reserve( srcLayout.num_channels() );
+
+	detail::prt_transcode_writer out;
+
+	for( std::size_t i = 0; i < srcLayout.num_channels(); ++i ){
+		const std::string& name = srcLayout.get_channel_name( i );
+		const detail::prt_channel& ch = srcLayout.get_channel_at( i );
+
+		if( options.droppedChannels.count( name ) )
+			continue;
+
+		std::string newName = name;
+		std::map< std::string, std::string >::const_iterator itName = options.renamedChannels.find( name );
+		if( itName != options.renamedChannels.end() )
+			newName = itName->second;
+
+		data_types::enum_t newType = ch.type;
+		std::map< std::string, data_types::enum_t >::const_iterator itType = options.channelTypes.find( name );
+		if( itType != options.channelTypes.end() )
+			newType = itType->second;
+
+		//A delta coded ID channel is found by its name, so renaming it changes how the data is decoded.
+		if( newType != ch.type || ( in.get_filter().enabled() && newName != name && ( name == "ID" || newName == "ID" ) ) )
+			copyData = false;
+
+		prt_meta_map channelMetadata = in.get_channel_metadata( name );
+
+		std::vector<float> encodingParams;
+		encodings::option encoding = detail::get_channel_encoding( name, ch, channelMetadata, encodingParams );
+
+		bool decode = ( encoding != encodings::encoding_none && newType != ch.type );
+		if( decode ){
+			//The encoding's offset and scale only describe the stored integers, so the channel has to be decoded.
+			if( !detail::is_float( newType ) )
+				throw std::logic_error( "The encoded channel \"" + name + "\" of the file \"" + srcPath + "\" can only be changed to a floating point type" );
+
+			const std::size_t arity = ( encoding == encodings::encoding_octahedral ) ? 3 : ch.arity;
+
+			decoded.push_back( std::vector<data_types::float64_t>( batchSize * arity ) );
+			in.bind( name, &decoded.back().front(), arity );
+			out.bind( newName, &decoded.back().front(), arity, newType );
+		}else{
+			detail::bind_converted_channel( out, newName, ch.type, &buffer.front() + ch.offset, ch.arity, newType, srcLayout.size() );
+		}
+
+		for( prt_meta_map::const_iterator it = channelMetadata.begin(), itEnd = channelMetadata.end(); it != itEnd; ++it ){
+			if( decode && ( strcmp( it->first, detail::encoding_meta_name() ) == 0 || strcmp( it->first, detail::encoding_offset_meta_name() ) == 0 ||
+				strcmp( it->first, detail::encoding_scale_meta_name() ) == 0 ) )
+				continue;
+			out.add_channel_metadata( newName, it->first, it->second );
+		}
+	}
+
+	prt_meta_map fileMetadata = in.get_file_metadata();
+	for( prt_meta_map::const_iterator it = fileMetadata.begin(), itEnd = fileMetadata.end(); it != itEnd; ++it ){
+		if( !options.removedFileMetadata.count( it->first ) )
+			out.add_file_metadata( it->first, it->second );
+	}
+
+	for( std::map< std::string, prt_meta_value >::const_iterator it = options.fileMetadata.begin(), itEnd = options.fileMetadata.end(); it != itEnd; ++it )
+		out.add_file_metadata( it->first, it->second );
+
+	for( std::map< std::string, std::map< std::string, prt_meta_value > >::const_iterator it = options.channelMetadata.begin(), itEnd = options.channelMetadata.end(); it != itEnd; ++it ){
+		for( std::map< std::string, prt_meta_value >::const_iterator itValue = it->second.begin(), itValueEnd = it->second.end(); itValue != itValueEnd; ++itValue )
+			out.add_channel_metadata( it->first, itValue->first, itValue->second );
+	}
+
+	if( copyData ){
+		out.open_copy( destPath, in.get_codec(), in.get_filter(), in.has_block_index() );
+		detail::copy_compressed_data( srcPath, in, out );
+		out.close();
+		return true;
+	}
+
+	if( options.recompress ){
+		out.set_compression_options( options.compression );
+	}else{
+		out.set_codec( in.get_codec() );
+		out.set_filter( in.get_filter().filter() );
+	}
+
+	out.set_compression_threads( numThreads );
+	out.set_block_index( options.blockIndex || in.has_block_index() );
+	out.open( destPath );
+
+	//Stop at the particle count, since reading past the end of a file without a block index is an error.
+	while( in.particle_count() > 0 ){
+		std::size_t numRequested = static_cast<std::size_t>( (std::min)( static_cast<detail::prt_int64>( batchSize ), in.particle_count() ) );
+		std::size_t numRead = in.read_raw( &buffer.front(), numRequested );
+
+		if( numRead != numRequested )
+			throw std::runtime_error( "The input stream \"" + srcPath + "\" did not contain the number of particles it claimed." );
+
+		if( !decoded.empty() )
+			in.extract_raw( &buffer.front(), numRead );
+
+		out.write_particles( numRead );
+	}
+
+	out.close();
+	return false;
+}
+
+}//namespace prtio
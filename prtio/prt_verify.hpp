@@ -0,0 +1,274 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the functions for checking the integrity of PRT files, for example to find the damaged files in a
+ * particle cache without reading their particles.
+ */
+
+#pragma once
+
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/detail/block_inflater.hpp>
+#include <prtio/detail/codec.hpp>
+#include <prtio/detail/threading.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * A block of a PRT file that failed verification, as returned by verify().
+ */
+struct prt_block_error{
+	std::size_t block;               //The index of the block in the file's block index.
+	detail::prt_int64 firstParticle; //The index in the file of the block's first particle.
+	detail::prt_int64 particleCount; //The number of particles in the block.
+	std::string error;               //What was wrong with the block.
+};
+
+/**
+ * The results of verifying a PRT file, as returned by verify().
+ */
+struct prt_verify_result{
+	std::string filePath;
+
+	bool valid;        //True if nothing wrong was found with the file.
+	std::string error; //If 'valid' is false, the first problem found. The details of each damaged block are in 'badBlocks'.
+
+	std::size_t numBlocks;      //The number of blocks in the file's block index, or 0 if it doesn't have one.
+	std::size_t numChecksummed; //The number of blocks that were checked against their checksums.
+	std::size_t numInflated;    //The number of blocks without checksums that were decompressed to check them instead.
+
+	std::vector<prt_block_error> badBlocks; //The blocks that failed verification, in the order of the block index.
+
+	prt_verify_result() : valid( false ), numBlocks( 0 ), numChecksummed( 0 ), numInflated( 0 )
+	{}
+};
+
+namespace detail{
+	/**
+	 * Opens a PRT file and exposes the parts of its block index that verify() needs.
+	 */
+	class prt_verify_reader : public prt_ifstream{
+	public:
+		using prt_ifstream::block_index;
+		using prt_ifstream::block_checksums;
+		using prt_ifstream::block_index_offset;
+		using prt_ifstream::codec;
+		using prt_ifstream::filter;
+		using prt_ifstream::file_path;
+	};
+
+	/**
+	 * Compares every 'stride'th block in a list with its checksum on a worker thread, reading each block through its own
+	 * file stream.
+	 */
+	class verify_task : public thread_task{
+		const std::string* m_filePath;
+		const std::vector<prt_block_index_entry_v1>* m_blockIndex;
+		const std::vector<prt_block_checksum_v1>* m_blockChecksums;
+		const std::vector<std::size_t>* m_blocks;
+		std::vector<std::string>* m_errors;
+		std::size_t m_first, m_stride;
+
+	public:
+		verify_task( const std::string& filePath, const std::vector<prt_block_index_entry_v1>& blockIndex, const std::vector<prt_block_checksum_v1>& blockChecksums,
+			const std::vector<std::size_t>& blocks, std::vector<std::string>& errors, std::size_t first, std::size_t stride )
+			: m_filePath( &filePath ), m_blockIndex( &blockIndex ), m_blockChecksums( &blockChecksums ), m_blocks( &blocks ), m_errors( &errors ), m_first( first ), m_stride( stride )
+		{}
+
+	protected:
+		virtual void run(){
+			std::ifstream fin( m_filePath->c_str(), std::ios::in | std::ios::binary );
+			if( fin.fail() )
+				throw std::ios_base::failure( "Failed to open file \"" + *m_filePath + "\"" );
+
+			std::vector<char> data;
+
+			for( std::size_t i = m_first; i < m_blocks->size(); i += m_stride ){
+				std::size_t block = (*m_blocks)[i];
+				const prt_block_checksum_v1& checksum = (*m_blockChecksums)[block];
+
+				data.resize( static_cast<std::size_t>( checksum.dataLength ) );
+
+				fin.clear();
+				fin.seekg( static_cast<std::istream::off_type>( (*m_blockIndex)[block].dataOffset ), std::ios::beg );
+				if( !data.empty() )
+					fin.read( &data.front(), static_cast<std::streamsize>( data.size() ) );
+
+				if( static_cast<std::size_t>( fin.gcount() ) != data.size() && !data.empty() )
+					(*m_errors)[block] = "The block's data is truncated";
+				else if( block_checksum( data.empty() ? NULL : &data.front(), data.size() ) != checksum.checksum )
+					(*m_errors)[block] = "The block does not match its checksum";
+			}
+		}
+	};
+
+	/**
+	 * Decompresses the blocks in a list that don't have checksums, recording the ones that fail.
+	 */
+	inline void inflate_blocks( prt_verify_reader& reader, const std::vector<std::size_t>& blocks, std::size_t numThreads, std::vector<std::string>& errors ){
+		const std::vector<prt_block_index_entry_v1>& blockIndex = reader.block_index();
+
+		block_inflater inflater( reader.file_path(), reader.codec(), reader.filter(), numThreads );
+
+		//The inflater hands the blocks back in the order they were submitted.
+		for( std::size_t next = 0, done = 0; done < blocks.size(); ++done ){
+			while( inflater.can_submit() && next < blocks.size() ){
+				std::size_t block = blocks[next++];
+
+				//The compressed data of a block ends where the next one starts. The last one ends at the block index.
+				prt_int64 dataEnd = ( block + 1 < blockIndex.size() ) ? blockIndex[block + 1].dataOffset : reader.block_index_offset();
+
+				inflater.submit( block, blockIndex[block].dataOffset, static_cast<std::size_t>( dataEnd - blockIndex[block].dataOffset ),
+					static_cast<std::size_t>( blockIndex[block].particleCount ), reader.layout().size() );
+			}
+
+			try{
+				inflater.front();
+			}catch( const std::exception& e ){
+				errors[ blocks[done] ] = e.what();
+			}
+
+			inflater.pop_front();
+		}
+	}
+}//namespace detail
+
+/**
+ * Checks a PRT file for damage without converting its particles. The blocks of files written with checksums (see
+ * prt_ofstream::set_block_index()) are compared with them in parallel, which only reads the file. Blocks without
+ * checksums are decompressed instead, and files without a block index are decompressed in full.
+ * @param filePath The PRT file to check.
+ * @param numThreads The number of threads to check blocks on. If 0, it uses all the hardware threads.
+ * @return What was found. A file that can't be opened is reported in the result instead of thrown.
+ */
+inline prt_verify_result verify( const std::string& filePath, std::size_t numThreads = 0 ){
+	prt_verify_result result;
+	result.filePath = filePath;
+
+	if( numThreads == 0 )
+		numThreads = detail::hardware_concurrency();
+
+	try{
+		//Opening reads the header and block index, so this finds files truncated before the end of their index.
+		detail::prt_verify_reader reader;
+		reader.open( filePath );
+
+		const std::vector<detail::prt_block_index_entry_v1>& blockIndex = reader.block_index();
+		const std::vector<detail::prt_block_checksum_v1>& blockChecksums = reader.block_checksums();
+
+		if( blockIndex.empty() ){
+			//Without a block index the only way to check the particle data is to decompress all of it.
+			reader.seek_particle( reader.particle_count() );
+			reader.read_next_particle(); //Throws if the particle data doesn't end where the file claims.
+
+			result.valid = true;
+			return result;
+		}
+
+		result.numBlocks = blockIndex.size();
+
+		std::vector<std::string> errors( blockIndex.size() );
+		std::vector<std::size_t> checksummed, inflated;
+
+		for( std::size_t i = 0; i < blockIndex.size(); ++i ){
+			detail::prt_int64 dataEnd = ( i + 1 < blockIndex.size() ) ? blockIndex[i + 1].dataOffset : reader.block_index_offset();
+
+			if( dataEnd < blockIndex[i].dataOffset ){
+				errors[i] = "The block's offset in the block index is not valid";
+			}else if( i < blockChecksums.size() && blockChecksums[i].dataLength >= 0 ){
+				if( blockChecksums[i].dataLength > dataEnd - blockIndex[i].dataOffset )
+					errors[i] = "The block's length in the block index is not valid";
+				else
+					checksummed.push_back( i );
+			}else{
+				inflated.push_back( i );
+			}
+		}
+
+		if( !checksummed.empty() ){
+			std::size_t numTasks = (std::min)( numThreads, checksummed.size() );
+
+			detail::thread_pool pool( numTasks );
+
+			std::vector<detail::verify_task*> tasks;
+			tasks.reserve( numTasks );
+
+			try{
+				for( std::size_t i = 0; i < numTasks; ++i ){
+					tasks.push_back( new detail::verify_task( reader.file_path(), blockIndex, blockChecksums, checksummed, errors, i, numTasks ) );
+					pool.submit( tasks.back() );
+				}
+
+				for( std::size_t i = 0; i < tasks.size(); ++i )
+					pool.wait( tasks[i] );
+			}catch( ... ){
+				for( std::size_t i = 0; i < tasks.size(); ++i ){
+					try{
+						pool.wait( tasks[i] );
+					}catch( ... ){
+					}
+					delete tasks[i];
+				}
+				throw;
+			}
+
+			for( std::size_t i = 0; i < tasks.size(); ++i )
+				delete tasks[i];
+		}
+
+		if( !inflated.empty() )
+			detail::inflate_blocks( reader, inflated, numThreads, errors );
+
+		result.numChecksummed = checksummed.size();
+		result.numInflated = inflated.size();
+
+		detail::prt_int64 firstParticle = 0;
+		for( std::size_t i = 0; i < blockIndex.size(); ++i ){
+			if( !errors[i].empty() ){
+				prt_block_error blockError;
+				blockError.block = i;
+				blockError.firstParticle = firstParticle;
+				blockError.particleCount = blockIndex[i].particleCount;
+				blockError.error = errors[i];
+
+				result.badBlocks.push_back( blockError );
+			}
+
+			firstParticle += blockIndex[i].particleCount;
+		}
+
+		if( !result.badBlocks.empty() ){
+			std::stringstream ss;
+			ss << result.badBlocks.size() << " of the " << blockIndex.size() << " blocks of the file \"" << filePath << "\" are damaged, starting with block "
+				<< result.badBlocks.front().block << ": " << result.badBlocks.front().error;
+			result.error = ss.str();
+			return result;
+		}
+
+		result.valid = true;
+	}catch( const std::exception& e ){
+		result.valid = false;
+		result.error = e.what();
+	}
+
+	return result;
+}
+
+}//namespace prtio
@@ -0,0 +1,551 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains a benchmark of the throughput of reading and writing PRT files. It writes synthetic particles with
+ * several layouts using each available codec and thread count, reads them back, and measures the cost of converting
+ * channels while extracting them. The results are printed to stdout as CSV, one line per measurement, so they can be
+ * collected and compared between runs. Progress is printed to stderr.
+ *
+ * Usage: prtio_bench [-n count] [-t threads,...] [-c codec,...] [-l layout,...] [-r repeats] [-d directory] [-k]
+ *   -n  The number of particles in each file. Defaults to 1000000.
+ *   -t  The thread counts to compress and decompress with. Defaults to 1 and the number of hardware threads.
+ *   -c  The codecs to write with (zlib, none, zstd, lz4). Defaults to all the codecs in this build.
+ *   -l  The layouts to write (compact, standard, precise). Defaults to all of them.
+ *   -r  The number of times to repeat each measurement, reporting the fastest. Defaults to 1.
+ *   -d  The directory to write the files in. Defaults to the current directory.
+ *   -k  Keep the files instead of deleting them at the end.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/prt_memory_istream.hpp>
+#include <prtio/prt_memory_ostream.hpp>
+#include <prtio/prt_ofstream.hpp>
+#include <prtio/prt_parallel_ifstream.hpp>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+namespace{
+
+//The number of particles generated, written and read per call.
+const std::size_t chunk_size = 65536;
+
+/**
+ * @return The wall clock time in seconds, from an arbitrary starting point.
+ */
+double wall_time(){
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency( &frequency );
+	QueryPerformanceCounter( &counter );
+	return static_cast<double>( counter.QuadPart ) / static_cast<double>( frequency.QuadPart );
+#else
+	timeval tv;
+	gettimeofday( &tv, NULL );
+	return static_cast<double>( tv.tv_sec ) + 1e-6 * static_cast<double>( tv.tv_usec );
+#endif
+}
+
+/**
+ * A channel of a benchmark layout. The particles are generated in memory as 'memType' and stored in the file as 'fileType'.
+ */
+struct channel_spec{
+	const char* name;
+	prtio::data_types::enum_t fileType;
+	prtio::data_types::enum_t memType;
+	std::size_t arity;
+};
+
+struct layout_spec{
+	const char* name;
+	const channel_spec* channels;
+	std::size_t numChannels;
+};
+
+const channel_spec compact_channels[] = {
+	{ "Position", prtio::data_types::type_float32, prtio::data_types::type_float32, 3 },
+	{ "ID", prtio::data_types::type_int32, prtio::data_types::type_int32, 1 }
+};
+
+const channel_spec standard_channels[] = {
+	{ "Position", prtio::data_types::type_float32, prtio::data_types::type_float32, 3 },
+	{ "Velocity", prtio::data_types::type_float16, prtio::data_types::type_float32, 3 },
+	{ "Color", prtio::data_types::type_float16, prtio::data_types::type_float32, 3 },
+	{ "Density", prtio::data_types::type_float32, prtio::data_types::type_float32, 1 },
+	{ "ID", prtio::data_types::type_int64, prtio::data_types::type_int64, 1 }
+};
+
+const channel_spec precise_channels[] = {
+	{ "Position", prtio::data_types::type_float64, prtio::data_types::type_float64, 3 },
+	{ "Velocity", prtio::data_types::type_float32, prtio::data_types::type_float64, 3 },
+	{ "Color", prtio::data_types::type_float32, prtio::data_types::type_float32, 3 },
+	{ "Density", prtio::data_types::type_float64, prtio::data_types::type_float64, 1 },
+	{ "MtlIndex", prtio::data_types::type_uint16, prtio::data_types::type_uint16, 1 },
+	{ "Age", prtio::data_types::type_int32, prtio::data_types::type_int32, 1 },
+	{ "ID", prtio::data_types::type_int64, prtio::data_types::type_int64, 1 }
+};
+
+const layout_spec all_layouts[] = {
+	{ "compact", compact_channels, sizeof(compact_channels) / sizeof(channel_spec) },
+	{ "standard", standard_channels, sizeof(standard_channels) / sizeof(channel_spec) },
+	{ "precise", precise_channels, sizeof(precise_channels) / sizeof(channel_spec) }
+};
+
+/**
+ * @return The type a channel is converted to when measuring converting binds. Floats switch between float32 and
+ *         float64, and integers widen to 64 bits.
+ */
+prtio::data_types::enum_t convert_type( prtio::data_types::enum_t type ){
+	using namespace prtio::data_types;
+
+	switch( type ){
+	case type_float32:
+		return type_float64;
+	case type_float16:
+	case type_float64:
+		return type_float32;
+	case type_uint64:
+		return type_uint64;
+	default:
+		return type_int64;
+	}
+}
+
+/**
+ * Binds a channel of an input or output stream to memory holding values of a type known only at runtime.
+ */
+struct binder{
+	template <class Stream>
+	static void bind_input( Stream& stream, const char* name, char* data, prtio::data_types::enum_t type, std::size_t arity ){
+		using namespace prtio::data_types;
+
+		switch( type ){
+		case type_int8: stream.bind( name, reinterpret_cast<int8_t*>( data ), arity ); break;
+		case type_int16: stream.bind( name, reinterpret_cast<int16_t*>( data ), arity ); break;
+		case type_int32: stream.bind( name, reinterpret_cast<int32_t*>( data ), arity ); break;
+		case type_int64: stream.bind( name, reinterpret_cast<int64_t*>( data ), arity ); break;
+		case type_uint8: stream.bind( name, reinterpret_cast<uint8_t*>( data ), arity ); break;
+		case type_uint16: stream.bind( name, reinterpret_cast<uint16_t*>( data ), arity ); break;
+		case type_uint32: stream.bind( name, reinterpret_cast<uint32_t*>( data ), arity ); break;
+		case type_uint64: stream.bind( name, reinterpret_cast<uint64_t*>( data ), arity ); break;
+		case type_float16: stream.bind( name, reinterpret_cast<float16_t*>( data ), arity ); break;
+		case type_float32: stream.bind( name, reinterpret_cast<float32_t*>( data ), arity ); break;
+		case type_float64: stream.bind( name, reinterpret_cast<float64_t*>( data ), arity ); break;
+		default: throw std::logic_error( "Unknown data type" );
+		}
+	}
+
+	static void bind_output( prtio::prt_ofstream& stream, const char* name, char* data, prtio::data_types::enum_t type, std::size_t arity, prtio::data_types::enum_t fileType ){
+		using namespace prtio::data_types;
+
+		switch( type ){
+		case type_int16: stream.bind( name, reinterpret_cast<int16_t*>( data ), arity, fileType ); break;
+		case type_int32: stream.bind( name, reinterpret_cast<int32_t*>( data ), arity, fileType ); break;
+		case type_int64: stream.bind( name, reinterpret_cast<int64_t*>( data ), arity, fileType ); break;
+		case type_uint16: stream.bind( name, reinterpret_cast<uint16_t*>( data ), arity, fileType ); break;
+		case type_uint32: stream.bind( name, reinterpret_cast<uint32_t*>( data ), arity, fileType ); break;
+		case type_float32: stream.bind( name, reinterpret_cast<float32_t*>( data ), arity, fileType ); break;
+		case type_float64: stream.bind( name, reinterpret_cast<float64_t*>( data ), arity, fileType ); break;
+		default: throw std::logic_error( "Unsupported benchmark data type" );
+		}
+	}
+};
+
+/**
+ * Stores a double as a value of the given type.
+ */
+void store_value( char* dest, prtio::data_types::enum_t type, double value ){
+	using namespace prtio::data_types;
+
+	switch( type ){
+	case type_int16: *reinterpret_cast<int16_t*>( dest ) = static_cast<int16_t>( value ); break;
+	case type_int32: *reinterpret_cast<int32_t*>( dest ) = static_cast<int32_t>( value ); break;
+	case type_int64: *reinterpret_cast<int64_t*>( dest ) = static_cast<int64_t>( value ); break;
+	case type_uint16: *reinterpret_cast<uint16_t*>( dest ) = static_cast<uint16_t>( value ); break;
+	case type_uint32: *reinterpret_cast<uint32_t*>( dest ) = static_cast<uint32_t>( value ); break;
+	case type_float32: *reinterpret_cast<float32_t*>( dest ) = static_cast<float32_t>( value ); break;
+	case type_float64: *reinterpret_cast<float64_t*>( dest ) = value; break;
+	default: break;
+	}
+}
+
+/**
+ * Holds a chunk of generated particles, one array per channel, and the settings of the run.
+ */
+class benchmark{
+	struct settings{
+		prtio::detail::prt_int64 count;
+		std::vector<std::size_t> threads;
+		std::vector<prtio::codecs::option> codecs;
+		std::vector<const layout_spec*> layouts;
+		int repeats;
+		std::string directory;
+		bool keepFiles;
+	} m_settings;
+
+	const layout_spec* m_layout;
+	std::vector< std::vector<char> > m_chunk; //The generated values of each channel, with room for any type.
+	std::size_t m_particleSize;               //The size of a particle in the file, before compression.
+	std::vector<std::string> m_files;         //The files written, to delete at the end.
+
+	char* channel_data( std::size_t i ){
+		return &m_chunk[i].front();
+	}
+
+	/**
+	 * Fills the chunk with the particles of the current layout. Positions are clustered and velocities vary smoothly, so
+	 * the data compresses somewhat like a simulation's.
+	 */
+	void generate(){
+		std::srand( 12345 );
+
+		m_chunk.assign( m_layout->numChannels, std::vector<char>() );
+		m_particleSize = 0;
+
+		for( std::size_t c = 0; c < m_layout->numChannels; ++c ){
+			const channel_spec& ch = m_layout->channels[c];
+			const std::size_t memSize = prtio::data_types::sizes[ch.memType];
+
+			m_chunk[c].resize( chunk_size * ch.arity * 8 );
+			m_particleSize += prtio::data_types::sizes[ch.fileType] * ch.arity;
+
+			for( std::size_t i = 0; i < chunk_size; ++i ){
+				for( std::size_t k = 0; k < ch.arity; ++k ){
+					double r = static_cast<double>( std::rand() ) / RAND_MAX;
+					double value;
+
+					if( strcmp( ch.name, "Position" ) == 0 )
+						value = static_cast<double>( ( i / 256 ) % 16 ) * 10.0 + r;
+					else if( strcmp( ch.name, "Velocity" ) == 0 )
+						value = std::sin( i * 1e-3 + k ) + 0.01 * r;
+					else if( strcmp( ch.name, "ID" ) == 0 )
+						value = static_cast<double>( i );
+					else if( prtio::detail::is_float( ch.memType ) )
+						value = r;
+					else
+						value = static_cast<double>( std::rand() % 64 );
+
+					store_value( &m_chunk[c][( i * ch.arity + k ) * memSize], ch.memType, value );
+				}
+			}
+		}
+	}
+
+	/**
+	 * Renumbers the ID channel for the chunk starting at 'first', so IDs increase through the file like real ones.
+	 */
+	void number_chunk( prtio::detail::prt_int64 first ){
+		for( std::size_t c = 0; c < m_layout->numChannels; ++c ){
+			const channel_spec& ch = m_layout->channels[c];
+			if( strcmp( ch.name, "ID" ) != 0 )
+				continue;
+
+			for( std::size_t i = 0; i < chunk_size; ++i )
+				store_value( &m_chunk[c][i * prtio::data_types::sizes[ch.memType]], ch.memType, static_cast<double>( first + static_cast<prtio::detail::prt_int64>( i ) ) );
+		}
+	}
+
+	std::string file_path( prtio::codecs::option codec ) const {
+		std::string result = m_settings.directory;
+		if( !result.empty() && result[result.size() - 1] != '/' && result[result.size() - 1] != '\\' )
+			result += '/';
+		return result + "prtio_bench_" + m_layout->name + "_" + prtio::detail::codec_name( codec ) + ".prt";
+	}
+
+	static prtio::detail::prt_int64 file_size( const std::string& path ){
+		std::ifstream file( path.c_str(), std::ios::in | std::ios::binary );
+		file.seekg( 0, std::ios::end );
+		return static_cast<prtio::detail::prt_int64>( file.tellg() );
+	}
+
+	/**
+	 * Prints one measurement as a line of CSV.
+	 */
+	void report( const char* op, const char* codec, std::size_t threads, double seconds, prtio::detail::prt_int64 particles, prtio::detail::prt_int64 fileBytes ){
+		double bytes = static_cast<double>( particles ) * static_cast<double>( m_particleSize );
+
+		std::printf( "%s,%s,%s,%u,%lld,%u,%lld,%.6f,%.2f,%.0f\n", m_layout->name, op, codec, static_cast<unsigned>( threads ),
+			static_cast<long long>( particles ), static_cast<unsigned>( m_particleSize ), static_cast<long long>( fileBytes ), seconds,
+			seconds > 0 ? bytes / seconds / 1e6 : 0.0, seconds > 0 ? static_cast<double>( particles ) / seconds : 0.0 );
+		std::fflush( stdout );
+	}
+
+	double time_write( prtio::codecs::option codec, std::size_t threads, const std::string& path ){
+		prtio::prt_ofstream stream;
+
+		for( std::size_t c = 0; c < m_layout->numChannels; ++c ){
+			const channel_spec& ch = m_layout->channels[c];
+			binder::bind_output( stream, ch.name, this->channel_data( c ), ch.memType, ch.arity, ch.fileType );
+		}
+
+		stream.set_codec( codec );
+		stream.set_compression_threads( threads );
+		stream.set_block_index( true ); //So the files can be read on several threads.
+
+		double start = wall_time();
+
+		stream.open( path );
+		for( prtio::detail::prt_int64 written = 0; written < m_settings.count; ){
+			std::size_t n = static_cast<std::size_t>( std::min<prtio::detail::prt_int64>( chunk_size, m_settings.count - written ) );
+
+			this->number_chunk( written );
+			stream.write_particles( n );
+			written += n;
+		}
+		stream.close();
+
+		return wall_time() - start;
+	}
+
+	template <class Stream>
+	prtio::detail::prt_int64 read_all( Stream& stream, bool convert ){
+		for( std::size_t c = 0; c < m_layout->numChannels; ++c ){
+			const channel_spec& ch = m_layout->channels[c];
+			binder::bind_input( stream, ch.name, this->channel_data( c ), convert ? convert_type( ch.fileType ) : ch.fileType, ch.arity );
+		}
+
+		prtio::detail::prt_int64 total = 0;
+		while( std::size_t n = stream.read_particles( chunk_size ) )
+			total += static_cast<prtio::detail::prt_int64>( n );
+		return total;
+	}
+
+	double time_read( std::size_t threads, const std::string& path ){
+		double start = wall_time();
+		prtio::detail::prt_int64 numRead;
+
+		if( threads > 1 ){
+			prtio::prt_parallel_ifstream stream( path, threads );
+			numRead = this->read_all( stream, false );
+		}else{
+			prtio::prt_ifstream stream( path );
+			numRead = this->read_all( stream, false );
+		}
+
+		double seconds = wall_time() - start;
+		if( numRead != m_settings.count )
+			throw std::runtime_error( "Read the wrong number of particles from \"" + path + "\"" );
+		return seconds;
+	}
+
+	double time_bind( const std::vector<char>& data, bool convert ){
+		double start = wall_time();
+
+		prtio::prt_memory_istream stream( &data.front(), data.size() );
+		prtio::detail::prt_int64 numRead = this->read_all( stream, convert );
+
+		double seconds = wall_time() - start;
+		if( numRead != m_settings.count )
+			throw std::runtime_error( "Read the wrong number of particles from memory" );
+		return seconds;
+	}
+
+	void run_layout(){
+		this->generate();
+
+		for( std::size_t i = 0; i < m_settings.codecs.size(); ++i ){
+			const prtio::codecs::option codec = m_settings.codecs[i];
+			const char* codecName = prtio::detail::codec_name( codec );
+			const std::string path = this->file_path( codec );
+
+			m_files.push_back( path );
+
+			for( std::size_t t = 0; t < m_settings.threads.size(); ++t ){
+				std::cerr << m_layout->name << ": writing " << codecName << " on " << m_settings.threads[t] << " thread(s)" << std::endl;
+
+				double seconds = this->time_write( codec, m_settings.threads[t], path );
+				for( int r = 1; r < m_settings.repeats; ++r )
+					seconds = std::min( seconds, this->time_write( codec, m_settings.threads[t], path ) );
+				this->report( "write", codecName, m_settings.threads[t], seconds, m_settings.count, file_size( path ) );
+			}
+
+			for( std::size_t t = 0; t < m_settings.threads.size(); ++t ){
+				std::cerr << m_layout->name << ": reading " << codecName << " on " << m_settings.threads[t] << " thread(s)" << std::endl;
+
+				double seconds = this->time_read( m_settings.threads[t], path );
+				for( int r = 1; r < m_settings.repeats; ++r )
+					seconds = std::min( seconds, this->time_read( m_settings.threads[t], path ) );
+				this->report( "read", codecName, m_settings.threads[t], seconds, m_settings.count, file_size( path ) );
+			}
+		}
+
+		//Extracting from an uncompressed file in memory isolates the cost of copying and converting the channels.
+		std::cerr << m_layout->name << ": binding" << std::endl;
+
+		std::vector<char> data;
+		{
+			prtio::prt_memory_ostream stream;
+			for( std::size_t c = 0; c < m_layout->numChannels; ++c ){
+				const channel_spec& ch = m_layout->channels[c];
+				binder::bind_output( stream, ch.name, this->channel_data( c ), ch.memType, ch.arity, ch.fileType );
+			}
+			stream.set_codec( prtio::codecs::codec_none );
+			stream.open( data );
+			for( prtio::detail::prt_int64 written = 0; written < m_settings.count; ){
+				std::size_t n = static_cast<std::size_t>( std::min<prtio::detail::prt_int64>( chunk_size, m_settings.count - written ) );
+				stream.write_particles( n );
+				written += n;
+			}
+		}
+
+		for( int convert = 0; convert < 2; ++convert ){
+			double seconds = this->time_bind( data, convert != 0 );
+			for( int r = 1; r < m_settings.repeats; ++r )
+				seconds = std::min( seconds, this->time_bind( data, convert != 0 ) );
+
+			this->report( convert ? "bind_convert" : "bind_native", "none", 1, seconds, m_settings.count, static_cast<prtio::detail::prt_int64>( data.size() ) );
+		}
+	}
+
+	static std::vector<std::string> split( const char* list ){
+		std::vector<std::string> result;
+		std::stringstream ss( list );
+		std::string item;
+		while( std::getline( ss, item, ',' ) ){
+			if( !item.empty() )
+				result.push_back( item );
+		}
+		return result;
+	}
+
+public:
+	benchmark() : m_layout( NULL ), m_particleSize( 0 ){
+		m_settings.count = 1000000;
+		m_settings.repeats = 1;
+		m_settings.keepFiles = false;
+	}
+
+	/**
+	 * Reads the settings from the command line.
+	 * @return False if the command line isn't valid.
+	 */
+	bool parse( int argc, char* argv[] ){
+		std::vector<std::string> threadNames, codecNames, layoutNames;
+
+		for( int i = 1; i < argc; ++i ){
+			const std::string arg = argv[i];
+			const char* value = ( i + 1 < argc ) ? argv[i + 1] : NULL;
+
+			if( arg == "-k" ){
+				m_settings.keepFiles = true;
+				continue;
+			}
+
+			if( !value )
+				return false;
+			++i;
+
+			if( arg == "-n" )
+				m_settings.count = std::atol( value );
+			else if( arg == "-t" )
+				threadNames = split( value );
+			else if( arg == "-c" )
+				codecNames = split( value );
+			else if( arg == "-l" )
+				layoutNames = split( value );
+			else if( arg == "-r" )
+				m_settings.repeats = std::atoi( value );
+			else if( arg == "-d" )
+				m_settings.directory = value;
+			else
+				return false;
+		}
+
+		if( m_settings.count <= 0 || m_settings.repeats <= 0 )
+			return false;
+
+		for( std::size_t i = 0; i < threadNames.size(); ++i ){
+			int numThreads = std::atoi( threadNames[i].c_str() );
+			if( numThreads <= 0 )
+				return false;
+			m_settings.threads.push_back( static_cast<std::size_t>( numThreads ) );
+		}
+		if( m_settings.threads.empty() ){
+			m_settings.threads.push_back( 1 );
+			if( prtio::detail::hardware_concurrency() > 1 )
+				m_settings.threads.push_back( prtio::detail::hardware_concurrency() );
+		}
+
+		const prtio::codecs::option allCodecs[] = { prtio::codecs::codec_zlib, prtio::codecs::codec_none, prtio::codecs::codec_zstd, prtio::codecs::codec_lz4 };
+		for( std::size_t i = 0; i < sizeof(allCodecs) / sizeof(allCodecs[0]); ++i ){
+			bool requested = codecNames.empty() || std::find( codecNames.begin(), codecNames.end(), prtio::detail::codec_name( allCodecs[i] ) ) != codecNames.end();
+			if( requested && prtio::detail::is_codec_available( allCodecs[i] ) )
+				m_settings.codecs.push_back( allCodecs[i] );
+		}
+
+		for( std::size_t i = 0; i < sizeof(all_layouts) / sizeof(all_layouts[0]); ++i ){
+			if( layoutNames.empty() || std::find( layoutNames.begin(), layoutNames.end(), all_layouts[i].name ) != layoutNames.end() )
+				m_settings.layouts.push_back( &all_layouts[i] );
+		}
+
+		return !m_settings.codecs.empty() && !m_settings.layouts.empty();
+	}
+
+	void run(){
+		std::printf( "layout,op,codec,threads,particles,particle_bytes,file_bytes,seconds,mb_per_s,particles_per_s\n" );
+
+		try{
+			for( std::size_t i = 0; i < m_settings.layouts.size(); ++i ){
+				m_layout = m_settings.layouts[i];
+				this->run_layout();
+			}
+		}catch( ... ){
+			this->remove_files();
+			throw;
+		}
+
+		this->remove_files();
+	}
+
+	void remove_files(){
+		if( !m_settings.keepFiles ){
+			for( std::size_t i = 0; i < m_files.size(); ++i )
+				std::remove( m_files[i].c_str() );
+		}
+		m_files.clear();
+	}
+};
+
+}//namespace
+
+int main( int argc, char* argv[] ){
+	benchmark bench;
+
+	if( !bench.parse( argc, argv ) ){
+		std::cerr << "Usage: prtio_bench [-n count] [-t threads,...] [-c codec,...] [-l layout,...] [-r repeats] [-d directory] [-k]" << std::endl;
+		return 1;
+	}
+
+	try{
+		bench.run();
+	}catch( const std::exception& e ){
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1725 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the tests of the library. Each test writes PRT files, reads them back and checks that every particle
+ * and metadata value survived exactly. The files are deleted as each test finishes. Failures are printed to stderr, and
+ * the exit code is the number of tests that failed.
+ *
+ * Usage: prtio_test [-n count] [-s seed] [-i iterations] [-d directory] [test ...]
+ *   -n  The number of particles in each file. Defaults to 20000 (and to just over 4GB of particles for "large").
+ *   -s  The seed of the random layouts, metadata and particles. Defaults to 1.
+ *   -i  The number of random layouts to test with. Defaults to 24.
+ *   -d  The directory to write the files in. Defaults to the current directory.
+ *
+ * The tests are:
+ *   roundtrip  Random layouts, covering every data type and arities 1 to 16, with random metadata, written with each of the
+ *              writers and compression settings and read back with each of the readers, with and without predicates.
+ *              Each layout is also written with quantized and octahedral channels, which are checked against the error
+ *              of their encoding, and with a damaged block and truncated, which verify() and the readers must report.
+ *              This is the default.
+ *   large      Files with over 4GB of particles, written as a single zlib stream, as uncompressed blocks, and as zlib blocks
+ *              asked to be bigger than the 1GB block limit. It needs about 5GB of free disk space at a time.
+ *   scaling    Writes, reads and verifies the same file on 1 to the number of hardware threads (and at least 4), printing the
+ *              throughput and speedup of each thread count to stdout as CSV. It writes 500000 particles by default.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <prtio/prt_buffer_pool.hpp>
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/prt_memory_istream.hpp>
+#include <prtio/prt_memory_ostream.hpp>
+#include <prtio/prt_ofstream.hpp>
+#include <prtio/prt_parallel_ifstream.hpp>
+#include <prtio/prt_predicate.hpp>
+#include <prtio/prt_probe.hpp>
+#include <prtio/prt_sequence_istream.hpp>
+#include <prtio/prt_static_channels.hpp>
+#include <prtio/prt_transcode.hpp>
+#include <prtio/prt_verify.hpp>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#define TEST_CHECK( condition ) check( ( condition ), #condition, __FILE__, __LINE__ )
+
+namespace{
+
+typedef prtio::detail::prt_int64 prt_int64;
+
+//The most particles the roundtrip test writes or reads per call.
+const std::size_t chunk_size = 5000;
+
+//The most particle data a compressed block may hold. See prt_ofstream::set_block_size().
+const prt_int64 max_block_bytes = prt_int64(1) << 30;
+
+//The files in the "large" test hold 5GB of particles, which compress to over 4GB so 32 bit sizes and offsets overflow.
+const prt_int64 large_file_bytes = prt_int64(5) << 30;
+
+/**
+ * Thrown by the tests' own checks, so they can be told apart from the errors the library throws.
+ */
+class test_failure : public std::runtime_error{
+public:
+	explicit test_failure( const std::string& message ) : std::runtime_error( message )
+	{}
+};
+
+/**
+ * Throws a test_failure naming the failed condition, unless it holds.
+ */
+void check( bool condition, const char* expression, const char* file, int line ){
+	if( !condition ){
+		std::stringstream ss;
+		ss << file << "(" << line << "): check failed: " << expression;
+		throw test_failure( ss.str() );
+	}
+}
+
+/**
+ * @return The wall clock time in seconds, from an arbitrary starting point.
+ */
+double wall_time(){
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency( &frequency );
+	QueryPerformanceCounter( &counter );
+	return static_cast<double>( counter.QuadPart ) / static_cast<double>( frequency.QuadPart );
+#else
+	timeval tv;
+	gettimeofday( &tv, NULL );
+	return static_cast<double>( tv.tv_sec ) + 1e-6 * static_cast<double>( tv.tv_usec );
+#endif
+}
+
+/**
+ * A small random number generator (splitmix64), so the tests generate the same files with every C library.
+ */
+class random_source{
+	prtio::data_types::uint64_t m_state;
+
+public:
+	explicit random_source( prtio::data_types::uint64_t seed ) : m_state( seed )
+	{}
+
+	prtio::data_types::uint64_t next(){
+		prtio::data_types::uint64_t z = ( m_state += 0x9E3779B97F4A7C15ull );
+		z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+		z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+		return z ^ ( z >> 31 );
+	}
+
+	/**
+	 * @return A random integer from 0 to n - 1.
+	 */
+	std::size_t below( std::size_t n ){
+		return static_cast<std::size_t>( this->next() % n );
+	}
+
+	bool coin(){
+		return ( this->next() & 1 ) != 0;
+	}
+
+	/**
+	 * @return A random number from 'minValue' to 'maxValue'.
+	 */
+	double uniform( double minValue, double maxValue ){
+		return minValue + ( maxValue - minValue ) * static_cast<double>( this->next() >> 11 ) / 9007199254740992.0;
+	}
+};
+
+/**
+ * Stores a random value of the given type. Integers use all their bits, and floats are finite so they compare equal after
+ * the round trip.
+ */
+void store_random( char* dest, prtio::data_types::enum_t type, random_source& rng ){
+	using namespace prtio::data_types;
+
+	if( type == type_float16 ){
+		float16_t value( static_cast<float>( rng.uniform( -1000.0, 1000.0 ) ) );
+		memcpy( dest, &value, sizeof(float16_t) );
+	}else if( type == type_float32 ){
+		float32_t value = static_cast<float32_t>( rng.uniform( -1e6, 1e6 ) );
+		memcpy( dest, &value, sizeof(float32_t) );
+	}else if( type == type_float64 ){
+		float64_t value = rng.uniform( -1e12, 1e12 );
+		memcpy( dest, &value, sizeof(float64_t) );
+	}else{
+		uint64_t value = rng.next();
+		memcpy( dest, &value, sizes[type] ); //Little endian, like the file format.
+	}
+}
+
+/**
+ * Binds a channel of an input or output stream to memory holding values of a type known only at runtime.
+ */
+struct binder{
+	template <class Stream>
+	static void bind_input( Stream& stream, const std::string& name, char* data, prtio::data_types::enum_t type, std::size_t arity, std::size_t stride ){
+		using namespace prtio::data_types;
+
+		switch( type ){
+		case type_int8: stream.bind( name, reinterpret_cast<int8_t*>( data ), arity, stride ); break;
+		case type_int16: stream.bind( name, reinterpret_cast<int16_t*>( data ), arity, stride ); break;
+		case type_int32: stream.bind( name, reinterpret_cast<int32_t*>( data ), arity, stride ); break;
+		case type_int64: stream.bind( name, reinterpret_cast<int64_t*>( data ), arity, stride ); break;
+		case type_uint8: stream.bind( name, reinterpret_cast<uint8_t*>( data ), arity, stride ); break;
+		case type_uint16: stream.bind( name, reinterpret_cast<uint16_t*>( data ), arity, stride ); break;
+		case type_uint32: stream.bind( name, reinterpret_cast<uint32_t*>( data ), arity, stride ); break;
+		case type_uint64: stream.bind( name, reinterpret_cast<uint64_t*>( data ), arity, stride ); break;
+		case type_float16: stream.bind( name, reinterpret_cast<float16_t*>( data ), arity, stride ); break;
+		case type_float32: stream.bind( name, reinterpret_cast<float32_t*>( data ), arity, stride ); break;
+		case type_float64: stream.bind( name, reinterpret_cast<float64_t*>( data ), arity, stride ); break;
+		default: throw std::logic_error( "Unknown data type" );
+		}
+	}
+
+	static void bind_output( prtio::prt_ostream& stream, const std::string& name, char* data, prtio::data_types::enum_t type, std::size_t arity, std::size_t stride ){
+		using namespace prtio::data_types;
+
+		switch( type ){
+		case type_int8: stream.bind( name, reinterpret_cast<int8_t*>( data ), arity, type, stride ); break;
+		case type_int16: stream.bind( name, reinterpret_cast<int16_t*>( data ), arity, type, stride ); break;
+		case type_int32: stream.bind( name, reinterpret_cast<int32_t*>( data ), arity, type, stride ); break;
+		case type_int64: stream.bind( name, reinterpret_cast<int64_t*>( data ), arity, type, stride ); break;
+		case type_uint8: stream.bind( name, reinterpret_cast<uint8_t*>( data ), arity, type, stride ); break;
+		case type_uint16: stream.bind( name, reinterpret_cast<uint16_t*>( data ), arity, type, stride ); break;
+		case type_uint32: stream.bind( name, reinterpret_cast<uint32_t*>( data ), arity, type, stride ); break;
+		case type_uint64: stream.bind( name, reinterpret_cast<uint64_t*>( data ), arity, type, stride ); break;
+		case type_float16: stream.bind( name, reinterpret_cast<float16_t*>( data ), arity, type, stride ); break;
+		case type_float32: stream.bind( name, reinterpret_cast<float32_t*>( data ), arity, type, stride ); break;
+		case type_float64: stream.bind( name, reinterpret_cast<float64_t*>( data ), arity, type, stride ); break;
+		default: throw std::logic_error( "Unknown data type" );
+		}
+	}
+};
+
+template <class T>
+void set_random_array( prtio::prt_meta_value& value, std::size_t arity, random_source& rng ){
+	std::vector<T> values( arity );
+	for( std::size_t i = 0; i < arity; ++i )
+		store_random( reinterpret_cast<char*>( &values[i] ), prtio::data_types::traits<T>::data_type(), rng );
+	value.set_array( &values.front(), arity );
+}
+
+/**
+ * @return A metadata value of a random type, string or arity.
+ */
+prtio::prt_meta_value random_meta_value( random_source& rng ){
+	using namespace prtio::data_types;
+
+	prtio::prt_meta_value result;
+
+	const std::size_t arity = 1 + rng.below( 16 );
+	const std::size_t type = rng.below( type_count + 1 );
+
+	switch( type ){
+	case type_int8: set_random_array<int8_t>( result, arity, rng ); break;
+	case type_int16: set_random_array<int16_t>( result, arity, rng ); break;
+	case type_int32: set_random_array<int32_t>( result, arity, rng ); break;
+	case type_int64: set_random_array<int64_t>( result, arity, rng ); break;
+	case type_uint8: set_random_array<uint8_t>( result, arity, rng ); break;
+	case type_uint16: set_random_array<uint16_t>( result, arity, rng ); break;
+	case type_uint32: set_random_array<uint32_t>( result, arity, rng ); break;
+	case type_uint64: set_random_array<uint64_t>( result, arity, rng ); break;
+	case type_float16: set_random_array<float16_t>( result, arity, rng ); break;
+	case type_float32: set_random_array<float32_t>( result, arity, rng ); break;
+	case type_float64: set_random_array<float64_t>( result, arity, rng ); break;
+	default:{
+		std::string text;
+		for( std::size_t i = 0, length = rng.below( 40 ); i < length; ++i )
+			text += static_cast<char>( ' ' + rng.below( 95 ) );
+		result.set_string( text.c_str() );
+	}
+	}
+
+	return result;
+}
+
+bool same_meta_value( const prtio::prt_meta_value& lhs, const prtio::prt_meta_value& rhs ){
+	if( lhs.get_type() != rhs.get_type() )
+		return false;
+	if( lhs.get_type() == prtio::meta_types::type_string )
+		return strcmp( lhs.get_string(), rhs.get_string() ) == 0;
+	return lhs.get_arity() == rhs.get_arity() &&
+		memcmp( lhs.get_void_ptr(), rhs.get_void_ptr(), lhs.get_arity() * prtio::data_types::sizes[lhs.get_type()] ) == 0;
+}
+
+/**
+ * Checks that every value in 'expected' is in 'actual'. The writers add metadata of their own, like the BoundBox.
+ */
+void check_metadata( const std::vector< std::pair<std::string, prtio::prt_meta_value> >& expected, const prtio::prt_meta_map& actual ){
+	for( std::size_t i = 0; i < expected.size(); ++i ){
+		TEST_CHECK( actual.count( expected[i].first ) == 1 );
+		TEST_CHECK( same_meta_value( actual.at( expected[i].first ), expected[i].second ) );
+	}
+}
+
+/**
+ * A channel of a test layout. It is stored in the file, and read back, as the same type it is generated as.
+ */
+struct test_channel{
+	std::string name;
+	prtio::data_types::enum_t type;
+	std::size_t arity;
+	std::size_t offset; //The offset of the channel in a particle in memory.
+	std::vector< std::pair<std::string, prtio::prt_meta_value> > metadata;
+};
+
+/**
+ * A random layout, its metadata, and the particles written with it. The particles are stored interleaved in memory, and
+ * every layout has an "ID" channel holding the index of each particle so shuffled particles can be matched up. Layouts also
+ * have a float32[3] "Position" channel, for spatial sorting.
+ */
+class test_particles{
+	std::vector<test_channel> m_channels;
+	std::vector< std::pair<std::string, prtio::prt_meta_value> > m_fileMetadata;
+	std::size_t m_particleSize;
+	std::vector<char> m_data;
+
+	void add_channel( const std::string& name, prtio::data_types::enum_t type, std::size_t arity ){
+		test_channel ch;
+		ch.name = name;
+		ch.type = type;
+		ch.arity = arity;
+		ch.offset = m_particleSize;
+
+		m_channels.push_back( ch );
+		m_particleSize += prtio::data_types::sizes[type] * arity;
+	}
+
+public:
+	/**
+	 * @param rng Generates the layout, metadata and particles.
+	 * @param count The number of particles.
+	 * @param firstChannel The number of channels made before this one. The first layout has 16 channels, cycling through
+	 *                     every type and the arities from 1 to 16, so every run covers them all whatever the random choices.
+	 */
+	test_particles( random_source& rng, std::size_t count, std::size_t firstChannel ) : m_particleSize( 0 ){
+		this->add_channel( "ID", prtio::data_types::type_int64, 1 );
+		this->add_channel( "Position", prtio::data_types::type_float32, 3 );
+
+		for( std::size_t i = 0, numChannels = ( firstChannel == 0 ) ? 16 : 1 + rng.below( 8 ); i < numChannels; ++i ){
+			const std::size_t n = firstChannel + i;
+
+			std::stringstream name;
+			name << "Channel" << n;
+
+			prtio::data_types::enum_t type;
+			std::size_t arity;
+			if( n < 16 ){
+				type = static_cast<prtio::data_types::enum_t>( n % prtio::data_types::type_count );
+				arity = 1 + n;
+			}else{
+				type = static_cast<prtio::data_types::enum_t>( rng.below( prtio::data_types::type_count ) );
+				arity = 1 + rng.below( 16 );
+			}
+
+			this->add_channel( name.str(), type, arity );
+		}
+
+		for( std::size_t i = 0, numValues = rng.below( 5 ); i < numValues; ++i ){
+			std::stringstream name;
+			name << "FileValue" << i;
+			m_fileMetadata.push_back( std::make_pair( name.str(), random_meta_value( rng ) ) );
+		}
+
+		for( std::size_t c = 0; c < m_channels.size(); ++c ){
+			for( std::size_t i = 0, numValues = rng.below( 3 ); i < numValues; ++i ){
+				std::stringstream name;
+				name << "Value" << i;
+				m_channels[c].metadata.push_back( std::make_pair( name.str(), random_meta_value( rng ) ) );
+			}
+		}
+
+		m_data.resize( count * m_particleSize + 1 );
+		for( std::size_t p = 0; p < count; ++p ){
+			char* particle = this->particle( p );
+
+			prt_int64 id = static_cast<prt_int64>( p );
+			memcpy( particle, &id, sizeof(prt_int64) );
+
+			for( std::size_t c = 1; c < m_channels.size(); ++c ){
+				const test_channel& ch = m_channels[c];
+				for( std::size_t k = 0; k < ch.arity; ++k )
+					store_random( particle + ch.offset + k * prtio::data_types::sizes[ch.type], ch.type, rng );
+			}
+		}
+	}
+
+	std::size_t count() const {
+		return ( m_data.size() - 1 ) / m_particleSize;
+	}
+
+	std::size_t particle_size() const {
+		return m_particleSize;
+	}
+
+	const std::vector<test_channel>& channels() const {
+		return m_channels;
+	}
+
+	char* particle( std::size_t index ){
+		return &m_data[index * m_particleSize];
+	}
+
+	/**
+	 * Binds the channels and adds the metadata to an output stream. The channels are read from 'data', holding particles
+	 * laid out like this object's.
+	 */
+	void bind_output( prtio::prt_ostream& stream, char* data ){
+		for( std::size_t c = 0; c < m_channels.size(); ++c ){
+			const test_channel& ch = m_channels[c];
+			binder::bind_output( stream, ch.name, data + ch.offset, ch.type, ch.arity, m_particleSize );
+
+			for( std::size_t i = 0; i < ch.metadata.size(); ++i )
+				stream.add_channel_metadata( ch.name, ch.metadata[i].first, ch.metadata[i].second );
+		}
+
+		for( std::size_t i = 0; i < m_fileMetadata.size(); ++i )
+			stream.add_file_metadata( m_fileMetadata[i].first, m_fileMetadata[i].second );
+	}
+
+	/**
+	 * Binds the channels of an input stream to particles laid out like this object's, in 'data'.
+	 * @param firstChannel The first channel to bind, to leave the ones before it for bind_static().
+	 */
+	template <class Stream>
+	void bind_input( Stream& stream, char* data, std::size_t firstChannel = 0 ){
+		for( std::size_t c = firstChannel; c < m_channels.size(); ++c ){
+			const test_channel& ch = m_channels[c];
+			binder::bind_input( stream, ch.name, data + ch.offset, ch.type, ch.arity, m_particleSize );
+		}
+	}
+
+	/**
+	 * Checks the layout and metadata an input stream read from a file.
+	 */
+	void check_header( const prtio::prt_istream& stream ){
+		TEST_CHECK( stream.layout().num_channels() == m_channels.size() );
+
+		for( std::size_t c = 0; c < m_channels.size(); ++c ){
+			const test_channel& ch = m_channels[c];
+			TEST_CHECK( stream.has_channel( ch.name ) );
+			TEST_CHECK( stream.layout().get_channel( ch.name ).type == ch.type );
+			TEST_CHECK( stream.layout().get_channel( ch.name ).arity == ch.arity );
+			check_metadata( ch.metadata, stream.get_channel_metadata( ch.name ) );
+		}
+
+		check_metadata( m_fileMetadata, stream.get_file_metadata() );
+	}
+
+	/**
+	 * Checks the layout and metadata probe() read from a file.
+	 */
+	void check_header( const prtio::prt_header_info& info ){
+		TEST_CHECK( info.valid );
+		TEST_CHECK( info.particleCount == static_cast<prt_int64>( this->count() ) );
+		TEST_CHECK( info.layout.num_channels() == m_channels.size() );
+
+		for( std::size_t c = 0; c < m_channels.size(); ++c ){
+			const test_channel& ch = m_channels[c];
+			TEST_CHECK( info.layout.find_channel( ch.name ) != info.layout.num_channels() );
+			TEST_CHECK( info.layout.get_channel( ch.name ).type == ch.type );
+			TEST_CHECK( info.layout.get_channel( ch.name ).arity == ch.arity );
+			check_metadata( ch.metadata, info.metadata.channel_metadata( ch.name ) );
+		}
+
+		check_metadata( m_fileMetadata, info.metadata.file_metadata() );
+	}
+
+	/**
+	 * @return True if the Position of a particle is inside a box ordered like prt_ifstream::read_region()'s.
+	 */
+	bool in_box( std::size_t index, const float bounds[6] ){
+		float position[3];
+		memcpy( position, this->particle( index ) + m_channels[1].offset, sizeof(float) * 3 );
+
+		for( int k = 0; k < 3; ++k ){
+			if( !( position[k] >= bounds[k] && position[k] <= bounds[k + 3] ) )
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Checks particles that were read back against the ones written, matching them up by their IDs.
+	 * @param data The particles read, laid out like this object's.
+	 * @param count The number of particles read.
+	 * @param seen The number of times each ID has been seen, which this increments.
+	 */
+	void check_particles( const char* data, std::size_t count, std::vector<int>& seen ){
+		for( std::size_t i = 0; i < count; ++i ){
+			const char* particle = data + i * m_particleSize;
+
+			prt_int64 id;
+			memcpy( &id, particle, sizeof(prt_int64) );
+
+			TEST_CHECK( id >= 0 && id < static_cast<prt_int64>( this->count() ) );
+			TEST_CHECK( memcmp( particle, this->particle( static_cast<std::size_t>( id ) ), m_particleSize ) == 0 );
+			++seen[ static_cast<std::size_t>( id ) ];
+		}
+	}
+};
+
+std::string join_path( const std::string& directory, const std::string& name ){
+	if( directory.empty() || directory[directory.size() - 1] == '/' || directory[directory.size() - 1] == '\\' )
+		return directory + name;
+	return directory + "/" + name;
+}
+
+prt_int64 file_size( const std::string& path ){
+	std::ifstream file( path.c_str(), std::ios::in | std::ios::binary );
+	file.seekg( 0, std::ios::end );
+	return static_cast<prt_int64>( file.tellg() );
+}
+
+void read_file( const std::string& path, std::vector<char>& outData ){
+	std::ifstream file( path.c_str(), std::ios::in | std::ios::binary );
+	outData.resize( static_cast<std::size_t>( file_size( path ) ) );
+	if( !outData.empty() )
+		file.read( &outData.front(), static_cast<std::streamsize>( outData.size() ) );
+	TEST_CHECK( !file.fail() );
+}
+
+void write_file( const std::string& path, const std::vector<char>& data ){
+	std::ofstream file( path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+	if( !data.empty() )
+		file.write( &data.front(), static_cast<std::streamsize>( data.size() ) );
+	file.close();
+	TEST_CHECK( !file.fail() );
+}
+
+/**
+ * Exposes the block index of a file, so the tests can damage one of its blocks.
+ */
+class block_index_reader : public prtio::prt_ifstream{
+public:
+	explicit block_index_reader( const std::string& path ) : prtio::prt_ifstream( path )
+	{}
+
+	using prtio::prt_ifstream::block_index;
+	using prtio::prt_ifstream::block_checksums;
+};
+
+/**
+ * Receives the file written by prt_memory_ostream::open( write_callback, void* ).
+ */
+void receive_file( void* userData, const char* data, std::size_t size ){
+	std::vector<char>* dest = static_cast< std::vector<char>* >( userData );
+	dest->assign( data, data + size );
+}
+
+/**
+ * The ways the roundtrip test writes a file.
+ */
+enum writer_mode{
+	write_file_stream,     //prt_ofstream::open() and write_particles() in chunks of random sizes.
+	write_next_particles,  //prt_ofstream::open() and write_next_particle().
+	write_memory,          //prt_ofstream::open_memory().
+	write_memory_ostream,  //prt_memory_ostream::open() to a vector.
+	write_memory_callback, //prt_memory_ostream::open() to a callback.
+	write_appended,        //A file written half at a time, the second half through prt_ofstream::open_append().
+	write_checkpointed,    //A file with checkpoints written every so often, and once more by hand.
+	write_transcoded,      //A file copied by prt_transcode(), half the time recompressing it.
+	writer_mode_count
+};
+
+const char* writer_names[] = {
+	"file", "next_particle", "open_memory", "memory_ostream", "memory_callback", "append", "checkpoint", "transcode"
+};
+
+/**
+ * The ways the roundtrip test reads a file.
+ */
+enum reader_mode{
+	read_buffered,                   //prt_ifstream with input_buffered.
+	read_mapped,                     //prt_ifstream with input_mapped.
+	read_async,                      //prt_ifstream with input_async.
+	read_next_particles,             //prt_ifstream::read_next_particle().
+	read_parallel,                   //prt_parallel_ifstream returning the particles in order.
+	read_parallel_any,               //prt_parallel_ifstream returning blocks as they finish.
+	read_memory,                     //prt_memory_istream.
+	read_sequence,                   //prt_sequence_istream reading the file twice.
+	read_columns,                    //prt_ifstream::load_columns().
+	read_seek,                       //prt_ifstream::seek_particle() to a random particle, then reading the rest.
+	read_parallel_seek,              //prt_parallel_ifstream::seek_particle() to a random particle, then reading the rest.
+	read_predicate,                  //prt_parallel_ifstream::read_particles() keeping a random range of IDs.
+	read_predicate_columns,          //prt_ifstream::load_columns() keeping a random range of IDs.
+	read_parallel_predicate_columns, //prt_parallel_ifstream::load_columns() keeping a random range of IDs.
+	read_static,                     //prt_ifstream with ID and Position bound by bind_static(), and the rest by bind().
+	read_region,                     //prt_ifstream::read_region() of a random box.
+	read_probe,                      //probe() of the header, then prt_ifstream.
+	read_stats,                      //prt_ifstream, checking its stats() afterwards.
+	reader_mode_count
+};
+
+const char* reader_names[] = {
+	"buffered", "mapped", "async", "next_particle", "parallel", "parallel_any", "memory", "sequence", "load_columns", "seek", "parallel_seek", "predicate", "predicate_columns",
+	"parallel_predicate_columns", "static", "region", "probe", "stats"
+};
+
+/**
+ * Holds the settings of the run and the tests.
+ */
+class tester{
+	struct settings{
+		std::size_t count;
+		bool countSet;
+		prtio::data_types::uint64_t seed;
+		std::size_t iterations;
+		std::string directory;
+		std::vector<std::string> tests;
+	} m_settings;
+
+	std::vector<prtio::codecs::option> m_codecs; //The codecs available in this build.
+	prtio::prt_buffer_pool m_bufferPool;
+
+	std::string file_path( const std::string& name ) const {
+		return join_path( m_settings.directory, "prtio_test_" + name + ".prt" );
+	}
+
+	/**
+	 * Picks random compression settings for a writer.
+	 * @return A description of the settings, for reporting failures.
+	 */
+	std::string configure_writer( prtio::prt_ofstream& stream, writer_mode mode, random_source& rng ){
+		std::stringstream ss;
+
+		const prtio::codecs::option codec = m_codecs[ rng.below( m_codecs.size() ) ];
+		const prtio::filters::option filter = static_cast<prtio::filters::option>( rng.below( prtio::filters::filter_count ) );
+		const std::size_t threads = 1 + rng.below( 4 );
+
+		stream.set_codec( codec );
+		stream.set_filter( filter );
+		stream.set_compression_threads( threads );
+		ss << "codec " << prtio::detail::codec_name( codec ) << ", filter " << filter << ", " << threads << " thread(s)";
+
+		if( rng.coin() ){
+			const std::size_t blockSize = 1 + rng.below( 3000 );
+			stream.set_block_size( blockSize );
+			ss << ", blocks of " << blockSize;
+		}
+
+		//Appending needs a block index.
+		if( rng.coin() || mode == write_appended ){
+			stream.set_block_index( true );
+			ss << ", block index";
+		}
+
+		if( rng.coin() ){
+			stream.set_async_output( true );
+			ss << ", async";
+		}
+
+		if( rng.coin() ){
+			stream.set_buffer_pool( &m_bufferPool );
+			ss << ", buffer pool";
+		}
+
+		//Spatial sorting holds the particles until close(), so it can't be combined with checkpoints.
+		if( mode != write_checkpointed && mode != write_appended && rng.below( 4 ) == 0 ){
+			stream.set_spatial_sort( true );
+			ss << ", spatial sort";
+		}
+
+		return ss.str();
+	}
+
+	/**
+	 * Writes particles to an open stream, in chunks of random sizes.
+	 * @param buffer The chunk_size particles the stream is bound to.
+	 */
+	static void write_chunks( test_particles& particles, prtio::prt_ostream& stream, std::vector<char>& buffer, std::size_t first, std::size_t last, random_source& rng ){
+		while( first < last ){
+			const std::size_t n = (std::min)( last - first, 1 + rng.below( chunk_size ) );
+
+			memcpy( &buffer.front(), particles.particle( first ), n * particles.particle_size() );
+			stream.write_particles( n );
+			first += n;
+		}
+	}
+
+	/**
+	 * Writes the particles to 'path' one of the ways the library can write files.
+	 * @param description Receives a description of how the file was written, for reporting failures.
+	 */
+	void write_particles( test_particles& particles, writer_mode mode, const std::string& path, random_source& rng, std::string& description ){
+		description = std::string( "writer " ) + writer_names[mode] + ", ";
+		const std::size_t count = particles.count();
+
+		std::vector<char> buffer( chunk_size * particles.particle_size() );
+
+		switch( mode ){
+		case write_file_stream:{
+			prtio::prt_ofstream stream;
+			description += this->configure_writer( stream, mode, rng );
+			particles.bind_output( stream, &buffer.front() );
+			stream.open( path );
+			write_chunks( particles, stream, buffer, 0, count, rng );
+			stream.close();
+			break;
+		}
+		case write_next_particles:{
+			prtio::prt_ofstream stream;
+			description += this->configure_writer( stream, mode, rng );
+
+			std::vector<char> particle( particles.particle_size() );
+			particles.bind_output( stream, &particle.front() );
+
+			stream.open( path );
+			for( std::size_t i = 0; i < count; ++i ){
+				memcpy( &particle.front(), particles.particle( i ), particles.particle_size() );
+				stream.write_next_particle();
+			}
+			stream.close();
+			break;
+		}
+		case write_memory:{
+			std::vector<char> data;
+			{
+				prtio::prt_ofstream stream;
+				description += this->configure_writer( stream, mode, rng );
+				particles.bind_output( stream, &buffer.front() );
+				stream.open_memory( data, path );
+				write_chunks( particles, stream, buffer, 0, count, rng );
+				stream.close();
+			}
+			write_file( path, data );
+			break;
+		}
+		case write_memory_ostream:
+		case write_memory_callback:{
+			std::vector<char> data;
+			{
+				prtio::prt_memory_ostream stream;
+				description += this->configure_writer( stream, mode, rng );
+				particles.bind_output( stream, &buffer.front() );
+				if( mode == write_memory_ostream )
+					stream.open( data );
+				else
+					stream.open( &receive_file, &data );
+				write_chunks( particles, stream, buffer, 0, count, rng );
+				stream.close();
+			}
+			write_file( path, data );
+			break;
+		}
+		case write_appended:{
+			const std::size_t half = count / 2;
+			{
+				prtio::prt_ofstream stream;
+				description += this->configure_writer( stream, mode, rng );
+				particles.bind_output( stream, &buffer.front() );
+				stream.open( path );
+				write_chunks( particles, stream, buffer, 0, half, rng );
+				stream.close();
+			}
+			{
+				prtio::prt_ofstream stream;
+				particles.bind_output( stream, &buffer.front() );
+				stream.open_append( path );
+				write_chunks( particles, stream, buffer, half, count, rng );
+				stream.close();
+			}
+			break;
+		}
+		case write_checkpointed:{
+			prtio::prt_ofstream stream;
+			description += this->configure_writer( stream, mode, rng );
+			stream.set_checkpoint_interval( 1 + rng.below( count + 1 ) );
+			particles.bind_output( stream, &buffer.front() );
+			stream.open( path );
+			write_chunks( particles, stream, buffer, 0, count / 3, rng );
+			stream.checkpoint();
+			write_chunks( particles, stream, buffer, count / 3, count, rng );
+			stream.close();
+			break;
+		}
+		case write_transcoded:{
+			const std::string srcPath = path + ".src";
+			{
+				prtio::prt_ofstream stream;
+				description += this->configure_writer( stream, mode, rng );
+				particles.bind_output( stream, &buffer.front() );
+				stream.open( srcPath );
+				write_chunks( particles, stream, buffer, 0, count, rng );
+				stream.close();
+			}
+
+			prtio::prt_transcode_options options;
+			options.numThreads = 1 + rng.below( 4 );
+			options.blockIndex = rng.coin();
+			if( rng.coin() ){
+				options.recompress = true;
+				options.compression = prtio::compression_options( m_codecs[ rng.below( m_codecs.size() ) ] );
+				options.compression.filter = static_cast<prtio::filters::option>( rng.below( prtio::filters::filter_count ) );
+				description += ", recompressed";
+			}
+
+			bool copied;
+			try{
+				//Transcoding a file onto itself would truncate it before it's read, so it must be refused.
+				bool threw = false;
+				try{
+					prtio::prt_transcode( srcPath, srcPath, options );
+				}catch( const std::logic_error& ){
+					threw = true;
+				}
+				TEST_CHECK( threw );
+
+				copied = prtio::prt_transcode( srcPath, path, options );
+			}catch( ... ){
+				std::remove( srcPath.c_str() );
+				throw;
+			}
+			std::remove( srcPath.c_str() );
+
+			//The particles can be recompressed without being asked to, when adding a block index.
+			TEST_CHECK( !( copied && options.recompress ) );
+			break;
+		}
+		default:
+			throw std::logic_error( "Unknown writer" );
+		}
+	}
+
+	/**
+	 * Reads a whole stream in chunks of random sizes, checking each chunk.
+	 * @return The number of particles read.
+	 */
+	template <class Stream>
+	static std::size_t read_chunks( test_particles& particles, Stream& stream, std::vector<int>& seen, random_source& rng ){
+		std::vector<char> buffer( chunk_size * particles.particle_size() );
+		particles.bind_input( stream, &buffer.front() );
+
+		std::size_t total = 0;
+		while( std::size_t n = stream.read_particles( 1 + rng.below( chunk_size ) ) ){
+			particles.check_particles( &buffer.front(), n, seen );
+			total += n;
+		}
+
+		return total;
+	}
+
+	/**
+	 * Reads the file at 'path' one of the ways the library can read files, and checks it matches the particles. Seeking
+	 * readers skip a random number of particles, which aren't checked.
+	 */
+	void read_particles( test_particles& particles, reader_mode mode, const std::string& path, random_source& rng ){
+		const std::size_t count = particles.count();
+
+		std::vector<int> seen( count, 0 );
+		std::size_t expectedCount = count, numRead = 0;
+
+		//The particles each reader should return at least once, and how many times.
+		int expectedSeen = 1;
+
+		switch( mode ){
+		case read_buffered:
+		case read_mapped:
+		case read_async:{
+			const prtio::prt_ifstream::input_mode inputMode = ( mode == read_buffered ) ? prtio::prt_ifstream::input_buffered :
+				( mode == read_mapped ) ? prtio::prt_ifstream::input_mapped : prtio::prt_ifstream::input_async;
+
+			prtio::prt_ifstream stream( path, inputMode );
+			particles.check_header( stream );
+			TEST_CHECK( stream.particle_count() == static_cast<prt_int64>( count ) );
+			numRead = read_chunks( particles, stream, seen, rng );
+			break;
+		}
+		case read_next_particles:{
+			prtio::prt_ifstream stream( path );
+			particles.check_header( stream );
+
+			std::vector<char> particle( particles.particle_size() );
+			particles.bind_input( stream, &particle.front() );
+			while( stream.read_next_particle() ){
+				particles.check_particles( &particle.front(), 1, seen );
+				++numRead;
+			}
+			break;
+		}
+		case read_parallel:
+		case read_parallel_any:{
+			prtio::prt_parallel_ifstream stream( path, 1 + rng.below( 4 ), ( mode == read_parallel ) ? prtio::prt_parallel_ifstream::order_sequential : prtio::prt_parallel_ifstream::order_any );
+			particles.check_header( stream );
+			numRead = read_chunks( particles, stream, seen, rng );
+			break;
+		}
+		case read_memory:{
+			std::vector<char> data;
+			read_file( path, data );
+
+			prtio::prt_memory_istream stream( &data.front(), data.size() );
+			particles.check_header( stream );
+			numRead = read_chunks( particles, stream, seen, rng );
+			break;
+		}
+		case read_sequence:{
+			std::vector<std::string> paths( 2, path );
+
+			prtio::prt_sequence_istream stream( paths, 1 + rng.below( 4 ), rng.coin() ? prtio::prt_sequence_istream::order_sequential : prtio::prt_sequence_istream::order_any );
+			particles.check_header( stream );
+			numRead = read_chunks( particles, stream, seen, rng );
+
+			expectedCount = 2 * count;
+			expectedSeen = 2;
+			break;
+		}
+		case read_columns:{
+			prtio::prt_ifstream stream( path );
+			particles.check_header( stream );
+
+			std::vector<char> buffer( count * particles.particle_size() + 1 );
+			std::vector<prtio::prt_column> columns;
+
+			//Load a random subset of the channels, always including the IDs so the particles can be matched up.
+			const std::vector<test_channel>& channels = particles.channels();
+			std::vector<bool> loaded( channels.size(), false );
+			for( std::size_t c = 0; c < channels.size(); ++c ){
+				prtio::prt_column column;
+				column.name = channels[c].name;
+				column.type = channels[c].type;
+				column.arity = channels[c].arity;
+				column.data = &buffer[channels[c].offset];
+				column.stride = particles.particle_size();
+
+				if( c == 0 || rng.coin() ){
+					columns.push_back( column );
+					loaded[c] = true;
+				}
+			}
+
+			numRead = stream.load_columns( columns );
+
+			//The channels that weren't loaded aren't checked, so fill them in from the original particles.
+			for( std::size_t i = 0; i < numRead; ++i ){
+				char* particle = &buffer[i * particles.particle_size()];
+
+				prt_int64 id;
+				memcpy( &id, particle, sizeof(prt_int64) );
+				if( id < 0 || id >= static_cast<prt_int64>( count ) )
+					continue;
+
+				for( std::size_t c = 0; c < channels.size(); ++c ){
+					if( !loaded[c] )
+						memcpy( particle + channels[c].offset, particles.particle( static_cast<std::size_t>( id ) ) + channels[c].offset,
+							prtio::data_types::sizes[channels[c].type] * channels[c].arity );
+				}
+			}
+			particles.check_particles( &buffer.front(), numRead, seen );
+			break;
+		}
+		case read_seek:
+		case read_parallel_seek:{
+			prtio::prt_ifstream* stream = ( mode == read_seek ) ? new prtio::prt_ifstream( path ) : new prtio::prt_parallel_ifstream( path, 1 + rng.below( 4 ) );
+			try{
+				const std::size_t first = rng.below( count + 1 );
+				stream->seek_particle( static_cast<prt_int64>( first ) );
+				numRead = read_chunks( particles, *stream, seen, rng );
+				expectedCount = count - first;
+			}catch( ... ){
+				delete stream;
+				throw;
+			}
+			delete stream;
+
+			//Without knowing the file's order, the particles before the seek are unknown.
+			for( std::size_t i = 0; i < count; ++i )
+				seen[i] = ( seen[i] == 0 ) ? 1 : seen[i];
+			break;
+		}
+		case read_predicate:
+		case read_predicate_columns:
+		case read_parallel_predicate_columns:{
+			const std::size_t first = rng.below( count ), last = first + rng.below( count - first );
+			prtio::prt_range_predicate predicate( "ID", static_cast<double>( first ), static_cast<double>( last ) );
+
+			prtio::prt_ifstream* stream = ( mode == read_predicate_columns ) ? new prtio::prt_ifstream( path ) : new prtio::prt_parallel_ifstream( path, 1 + rng.below( 4 ) );
+			try{
+				stream->set_predicate( &predicate );
+
+				if( mode == read_predicate ){
+					numRead = read_chunks( particles, *stream, seen, rng );
+				}else{
+					//The kept particles are loaded consecutively. The rest of the arrays must be left untouched.
+					std::vector<prt_int64> ids( count, -1 );
+
+					std::vector<prtio::prt_column> columns;
+					columns.push_back( prtio::prt_column( "ID", &ids.front(), 1 ) );
+
+					numRead = stream->load_columns( columns );
+
+					for( std::size_t i = 0; i < numRead; ++i ){
+						TEST_CHECK( ids[i] >= static_cast<prt_int64>( first ) && ids[i] <= static_cast<prt_int64>( last ) );
+						++seen[ static_cast<std::size_t>( ids[i] ) ];
+					}
+					for( std::size_t i = numRead; i < count; ++i )
+						TEST_CHECK( ids[i] == -1 );
+				}
+			}catch( ... ){
+				delete stream;
+				throw;
+			}
+			delete stream;
+
+			expectedCount = last - first + 1;
+
+			//The particles outside the range must not be returned.
+			for( std::size_t i = 0; i < count; ++i ){
+				if( i < first || i > last ){
+					TEST_CHECK( seen[i] == 0 );
+					seen[i] = 1;
+				}
+			}
+			break;
+		}
+		case read_static:{
+			prtio::prt_ifstream stream( path );
+			particles.check_header( stream );
+
+			std::vector<char> buffer( chunk_size * particles.particle_size() );
+			std::vector<prtio::data_types::int64_t> ids( chunk_size );
+			std::vector<prtio::data_types::float32_t> positions( 3 * chunk_size );
+
+			prtio::static_channels< prtio::channels::id, prtio::channels::position > bindings( &ids.front(), &positions.front() );
+			stream.bind_static( bindings );
+			particles.bind_input( stream, &buffer.front(), 2 );
+
+			const std::vector<test_channel>& channels = particles.channels();
+			while( std::size_t n = stream.read_particles( 1 + rng.below( chunk_size ) ) ){
+				//The static channels are packed arrays, so copy them into the particles to check them.
+				for( std::size_t i = 0; i < n; ++i ){
+					char* particle = &buffer[i * particles.particle_size()];
+					memcpy( particle + channels[0].offset, &ids[i], sizeof(prtio::data_types::int64_t) );
+					memcpy( particle + channels[1].offset, &positions[3 * i], 3 * sizeof(prtio::data_types::float32_t) );
+				}
+				particles.check_particles( &buffer.front(), n, seen );
+				numRead += n;
+			}
+			break;
+		}
+		case read_region:{
+			float bounds[6];
+			for( int k = 0; k < 3; ++k ){
+				const float a = static_cast<float>( rng.uniform( -1e6, 1e6 ) ), b = static_cast<float>( rng.uniform( -1e6, 1e6 ) );
+				bounds[k] = (std::min)( a, b );
+				bounds[k + 3] = (std::max)( a, b );
+			}
+
+			prtio::prt_ifstream stream( path, rng.coin() ? prtio::prt_ifstream::input_buffered : prtio::prt_ifstream::input_mapped );
+
+			std::vector<char> buffer( chunk_size * particles.particle_size() );
+			particles.bind_input( stream, &buffer.front() );
+			while( std::size_t n = stream.read_region( bounds, 1 + rng.below( chunk_size ) ) ){
+				particles.check_particles( &buffer.front(), n, seen );
+				numRead += n;
+			}
+
+			//Exactly the particles inside the box must be returned.
+			expectedCount = 0;
+			for( std::size_t i = 0; i < count; ++i ){
+				if( particles.in_box( i, bounds ) ){
+					++expectedCount;
+				}else{
+					TEST_CHECK( seen[i] == 0 );
+					seen[i] = 1;
+				}
+			}
+			break;
+		}
+		case read_probe:{
+			prtio::prt_header_info info = prtio::probe( path );
+			particles.check_header( info );
+
+			prtio::prt_ifstream stream( path );
+			TEST_CHECK( info.hasBlockIndex == stream.has_block_index() );
+			numRead = read_chunks( particles, stream, seen, rng );
+			break;
+		}
+		case read_stats:{
+			prtio::prt_ifstream stream( path, rng.coin() ? prtio::prt_ifstream::input_buffered : prtio::prt_ifstream::input_async );
+			numRead = read_chunks( particles, stream, seen, rng );
+
+			const prtio::prt_stream_stats stats = stream.stats();
+#ifdef PRTIO_ENABLE_STATS
+			TEST_CHECK( stats.particles == static_cast<prt_int64>( numRead ) );
+			TEST_CHECK( stats.uncompressedBytes == static_cast<prt_int64>( numRead * stream.layout().size() ) );
+			TEST_CHECK( stats.compressedBytes > 0 && stats.compressedBytes <= file_size( path ) );
+			TEST_CHECK( stats.elapsedSeconds >= stats.ioSeconds && stats.elapsedSeconds >= stats.codecSeconds );
+#else
+			//Without PRTIO_ENABLE_STATS nothing is collected.
+			TEST_CHECK( stats.particles == 0 && stats.compressedBytes == 0 && stats.uncompressedBytes == 0 );
+#endif
+			break;
+		}
+		default:
+			throw std::logic_error( "Unknown reader" );
+		}
+
+		TEST_CHECK( numRead == expectedCount );
+		for( std::size_t i = 0; i < count; ++i )
+			TEST_CHECK( seen[i] == expectedSeen );
+	}
+
+	/**
+	 * Checks that reading a damaged file fails with an error from the library, instead of returning the wrong particles.
+	 * @param expectedError Part of the error the library must report, or NULL for any error.
+	 */
+	void check_read_fails( test_particles& particles, reader_mode mode, const std::string& path, random_source& rng, const char* expectedError ){
+		try{
+			this->read_particles( particles, mode, path, rng );
+		}catch( const test_failure& e ){
+			throw test_failure( std::string( "reader " ) + reader_names[mode] + ": " + e.what() );
+		}catch( const std::exception& e ){
+			if( expectedError && std::string( e.what() ).find( expectedError ) == std::string::npos )
+				throw test_failure( std::string( "reader " ) + reader_names[mode] + " failed with the wrong error: " + e.what() );
+			return;
+		}
+		throw test_failure( std::string( "reader " ) + reader_names[mode] + " read the damaged file without an error" );
+	}
+
+	/**
+	 * Tests that verify() and the readers find a changed byte in a block of a file with a block index, and a truncated file.
+	 * The readers that seek or skip blocks might not reach the damage, so they aren't tested.
+	 */
+	void test_damaged( test_particles& particles, const std::string& path, random_source& rng, std::string& description ){
+		const reader_mode readers[] = { read_buffered, read_mapped, read_async, read_next_particles, read_parallel, read_parallel_any, read_memory,
+			read_sequence, read_columns, read_predicate, read_predicate_columns, read_parallel_predicate_columns, read_static, read_stats };
+		const std::size_t numReaders = sizeof(readers) / sizeof(readers[0]);
+
+		std::vector<char> buffer( chunk_size * particles.particle_size() );
+		{
+			prtio::prt_ofstream stream;
+			description = "damaged, " + this->configure_writer( stream, write_file_stream, rng );
+			stream.set_block_index( true );
+			particles.bind_output( stream, &buffer.front() );
+			stream.open( path );
+			write_chunks( particles, stream, buffer, 0, particles.count(), rng );
+			stream.close();
+		}
+
+		//Change one byte of a random block holding data. Every block written with a block index has a checksum.
+		std::size_t block;
+		prt_int64 offset;
+		{
+			block_index_reader reader( path );
+			const std::vector<prtio::detail::prt_block_checksum_v1>& checksums = reader.block_checksums();
+			TEST_CHECK( checksums.size() == reader.block_index().size() );
+
+			std::vector<std::size_t> blocks;
+			for( std::size_t i = 0; i < checksums.size(); ++i ){
+				if( checksums[i].dataLength > 0 )
+					blocks.push_back( i );
+			}
+			TEST_CHECK( !blocks.empty() );
+
+			block = blocks[ rng.below( blocks.size() ) ];
+			offset = reader.block_index()[block].dataOffset + static_cast<prt_int64>( rng.below( static_cast<std::size_t>( checksums[block].dataLength ) ) );
+		}
+
+		std::vector<char> data;
+		read_file( path, data );
+		data[ static_cast<std::size_t>( offset ) ] ^= static_cast<char>( 1 + rng.below( 255 ) );
+		write_file( path, data );
+
+		prtio::prt_verify_result verified = prtio::verify( path, 1 + rng.below( 4 ) );
+		TEST_CHECK( !verified.valid );
+		TEST_CHECK( verified.badBlocks.size() == 1 && verified.badBlocks[0].block == block );
+
+		for( std::size_t r = 0; r < numReaders; ++r )
+			this->check_read_fails( particles, readers[r], path, rng, "does not match its checksum" );
+
+		//Cut off at least half the file, so some of the particle data is always lost, not just the block index.
+		data.resize( rng.below( data.size() / 2 + 1 ) );
+		write_file( path, data );
+
+		TEST_CHECK( !prtio::verify( path, 1 + rng.below( 4 ) ).valid );
+
+		for( std::size_t r = 0; r < numReaders; ++r )
+			this->check_read_fails( particles, readers[r], path, rng, NULL );
+	}
+
+	/**
+	 * Tests channels stored with bind_quantized() and bind_octahedral(), read back with several of the readers. The decoded
+	 * values are checked against the error of their encoding, instead of exactly.
+	 */
+	void test_encodings( test_particles& particles, const std::string& path, random_source& rng, std::string& description ){
+		const std::size_t count = particles.count();
+
+		//A Velocity quantized over its whole range and a Normal stored octahedral, both made from the Positions.
+		std::vector<prtio::data_types::int64_t> ids( count );
+		std::vector<prtio::data_types::float32_t> positions( 3 * count ), velocities( 3 * count ), normals( 3 * count );
+		for( std::size_t i = 0; i < count; ++i ){
+			ids[i] = static_cast<prtio::data_types::int64_t>( i );
+			memcpy( &positions[3 * i], particles.particle( i ) + particles.channels()[1].offset, 3 * sizeof(float) );
+
+			const float* p = &positions[3 * i];
+			const float length = std::sqrt( p[0] * p[0] + p[1] * p[1] + p[2] * p[2] );
+			for( std::size_t k = 0; k < 3; ++k ){
+				velocities[3 * i + k] = 0.5f * p[k];
+				normals[3 * i + k] = ( length > 0 ) ? p[k] / length : ( k == 2 ? 1.0f : 0.0f );
+			}
+		}
+
+		const prtio::data_types::enum_t quantizedTypes[] = { prtio::data_types::type_int8, prtio::data_types::type_int16, prtio::data_types::type_int32,
+			prtio::data_types::type_uint8, prtio::data_types::type_uint16, prtio::data_types::type_uint32 };
+		const prtio::data_types::enum_t quantizedType = quantizedTypes[ rng.below( sizeof(quantizedTypes) / sizeof(quantizedTypes[0]) ) ];
+		const float minValues[] = { -5e5f, -5e5f, -5e5f }, maxValues[] = { 5e5f, 5e5f, 5e5f };
+
+		{
+			prtio::prt_ofstream stream;
+			description = "encoded as " + std::string( prtio::data_types::names[quantizedType] ) + ", " + this->configure_writer( stream, write_file_stream, rng );
+			stream.bind( "ID", &ids.front(), 1 );
+			stream.bind( "Position", &positions.front(), 3 );
+			stream.bind_quantized( "Velocity", &velocities.front(), 3, quantizedType, minValues, maxValues );
+			stream.bind_octahedral( "Normal", &normals.front() );
+			stream.open( path );
+			stream.write_particles( count );
+			stream.close();
+		}
+
+		//A step of the integers, plus the rounding of float32.
+		const double quantizedError = 1e6 / ( std::pow( 2.0, 8.0 * prtio::data_types::sizes[quantizedType] ) - 1.0 ) + 0.1;
+		const double octahedralError = 1e-3;
+
+		const char* readerNames[] = { "prt_ifstream", "parallel", "memory", "static", "load_columns" };
+		for( std::size_t r = 0; r < sizeof(readerNames) / sizeof(readerNames[0]); ++r ){
+			std::vector<prtio::data_types::int64_t> readIds( count + 1, -1 );
+			std::vector<prtio::data_types::float32_t> readVelocities( 3 * count + 3 ), readNormals( 3 * count + 3 );
+			std::vector<char> data;
+
+			try{
+				std::size_t numRead;
+
+				if( r == 0 || r == 1 ){
+					prtio::prt_ifstream* stream = ( r == 0 ) ? new prtio::prt_ifstream( path, rng.coin() ? prtio::prt_ifstream::input_buffered : prtio::prt_ifstream::input_mapped ) :
+						new prtio::prt_parallel_ifstream( path, 1 + rng.below( 4 ), rng.coin() ? prtio::prt_parallel_ifstream::order_sequential : prtio::prt_parallel_ifstream::order_any );
+					try{
+						TEST_CHECK( stream->layout().get_channel( "Velocity" ).type == quantizedType );
+						stream->bind( "ID", &readIds.front(), 1 );
+						stream->bind( "Velocity", &readVelocities.front(), 3 );
+						stream->bind( "Normal", &readNormals.front(), 3 );
+						numRead = stream->read_particles( count + 1 );
+					}catch( ... ){
+						delete stream;
+						throw;
+					}
+					delete stream;
+				}else if( r == 2 ){
+					read_file( path, data );
+
+					prtio::prt_memory_istream stream( &data.front(), data.size() );
+					stream.bind( "ID", &readIds.front(), 1 );
+					stream.bind( "Velocity", &readVelocities.front(), 3 );
+					stream.bind( "Normal", &readNormals.front(), 3 );
+					numRead = stream.read_particles( count + 1 );
+				}else if( r == 3 ){
+					prtio::prt_ifstream stream( path );
+					prtio::static_channels< prtio::channels::id, prtio::channels::velocity, prtio::channels::normal > bindings( &readIds.front(), &readVelocities.front(), &readNormals.front() );
+					stream.bind_static( bindings );
+					numRead = stream.read_particles( count + 1 );
+				}else{
+					prtio::prt_ifstream stream( path );
+					std::vector<prtio::prt_column> columns;
+					columns.push_back( prtio::prt_column( "ID", &readIds.front(), 1 ) );
+					columns.push_back( prtio::prt_column( "Velocity", &readVelocities.front(), 3 ) );
+					columns.push_back( prtio::prt_column( "Normal", &readNormals.front(), 3 ) );
+					numRead = stream.load_columns( columns );
+				}
+
+				TEST_CHECK( numRead == count );
+
+				std::vector<int> seen( count, 0 );
+				for( std::size_t i = 0; i < count; ++i ){
+					TEST_CHECK( readIds[i] >= 0 && readIds[i] < static_cast<prtio::data_types::int64_t>( count ) );
+					const std::size_t id = static_cast<std::size_t>( readIds[i] );
+					++seen[id];
+
+					for( std::size_t k = 0; k < 3; ++k ){
+						TEST_CHECK( std::fabs( readVelocities[3 * i + k] - velocities[3 * id + k] ) <= quantizedError );
+						TEST_CHECK( std::fabs( readNormals[3 * i + k] - normals[3 * id + k] ) <= octahedralError );
+					}
+				}
+				for( std::size_t i = 0; i < count; ++i )
+					TEST_CHECK( seen[i] == 1 );
+			}catch( const std::exception& e ){
+				throw std::runtime_error( std::string( "reader " ) + readerNames[r] + ": " + e.what() );
+			}
+		}
+	}
+
+	/**
+	 * Tests random layouts, each written every way and read back every way.
+	 */
+	void test_roundtrip(){
+		random_source rng( m_settings.seed );
+		const std::string path = this->file_path( "roundtrip" );
+
+		std::size_t numChannels = 0;
+		std::vector<bool> typesSeen( prtio::data_types::type_count, false ), aritiesSeen( 17, false );
+
+		for( std::size_t iteration = 0; iteration < m_settings.iterations; ++iteration ){
+			//Vary the count a little, so the blocks don't always divide the particles exactly.
+			test_particles particles( rng, m_settings.count + rng.below( 100 ), numChannels );
+			numChannels += particles.channels().size() - 2;
+
+			for( std::size_t c = 0; c < particles.channels().size(); ++c ){
+				typesSeen[ particles.channels()[c].type ] = true;
+				aritiesSeen[ particles.channels()[c].arity ] = true;
+			}
+
+			for( int w = 0; w < writer_mode_count; ++w ){
+				std::string description;
+				try{
+					this->write_particles( particles, static_cast<writer_mode>( w ), path, rng, description );
+
+					prtio::prt_verify_result verified = prtio::verify( path, 1 + rng.below( 4 ) );
+					if( !verified.valid )
+						throw std::runtime_error( "verify() failed: " + verified.error );
+
+					for( int r = 0; r < reader_mode_count; ++r ){
+						try{
+							this->read_particles( particles, static_cast<reader_mode>( r ), path, rng );
+						}catch( const std::exception& e ){
+							throw std::runtime_error( std::string( "reader " ) + reader_names[r] + ": " + e.what() );
+						}
+					}
+				}catch( const std::exception& e ){
+					std::remove( path.c_str() );
+
+					std::stringstream ss;
+					ss << "Layout " << iteration << " with " << particles.count() << " particles, " << description << ": " << e.what();
+					throw std::runtime_error( ss.str() );
+				}
+			}
+
+			std::string description;
+			try{
+				this->test_encodings( particles, path, rng, description );
+				this->test_damaged( particles, path, rng, description );
+			}catch( const std::exception& e ){
+				std::remove( path.c_str() );
+
+				std::stringstream ss;
+				ss << "Layout " << iteration << " with " << particles.count() << " particles, " << description << ": " << e.what();
+				throw std::runtime_error( ss.str() );
+			}
+		}
+
+		std::remove( path.c_str() );
+
+		//Make sure enough layouts were tested to cover every type and arity.
+		for( std::size_t i = 0; i < typesSeen.size(); ++i )
+			TEST_CHECK( typesSeen[i] );
+		for( std::size_t i = 1; i < aritiesSeen.size(); ++i )
+			TEST_CHECK( aritiesSeen[i] );
+
+		this->test_sequence_encodings();
+	}
+
+	/**
+	 * Writes a file with one particle whose Position is quantized over a box.
+	 */
+	static void write_quantized( const std::string& path, float position[3], float minValue, float maxValue ){
+		const float minValues[] = { minValue, minValue, minValue };
+		const float maxValues[] = { maxValue, maxValue, maxValue };
+
+		prtio::prt_ofstream stream;
+		stream.bind_quantized( "Position", position, 3, prtio::data_types::type_int16, minValues, maxValues );
+		stream.open( path );
+		stream.write_next_particle();
+		stream.close();
+	}
+
+	/**
+	 * Tests that prt_sequence_istream only reads quantized files together when they share their offsets and scales, since
+	 * the particles of every file are decoded with the first file's.
+	 */
+	void test_sequence_encodings(){
+		std::vector<std::string> paths;
+		paths.push_back( this->file_path( "sequence0" ) );
+		paths.push_back( this->file_path( "sequence1" ) );
+
+		try{
+			float first[] = { 0.5f, 0.5f, 0.5f }, second[] = { 150.0f, 150.0f, 150.0f };
+
+			//Quantized over different boxes, so reading them as one stream would decode the second file wrongly.
+			write_quantized( paths[0], first, 0.0f, 1.0f );
+			write_quantized( paths[1], second, 100.0f, 200.0f );
+
+			bool threw = false;
+			try{
+				prtio::prt_sequence_istream stream( paths, 2 );
+			}catch( const std::runtime_error& ){
+				threw = true;
+			}
+			TEST_CHECK( threw );
+
+			//Quantized over the same box, they are read back together.
+			write_quantized( paths[0], first, 0.0f, 200.0f );
+			write_quantized( paths[1], second, 0.0f, 200.0f );
+
+			prtio::prt_sequence_istream stream( paths, 2 );
+
+			float position[3];
+			stream.bind( "Position", position, 3 );
+
+			TEST_CHECK( stream.read_next_particle() );
+			TEST_CHECK( std::fabs( position[0] - first[0] ) < 0.01f );
+			TEST_CHECK( stream.read_next_particle() );
+			TEST_CHECK( std::fabs( position[0] - second[0] ) < 0.01f );
+			TEST_CHECK( !stream.read_next_particle() );
+		}catch( ... ){
+			std::remove( paths[0].c_str() );
+			std::remove( paths[1].c_str() );
+			throw;
+		}
+
+		std::remove( paths[0].c_str() );
+		std::remove( paths[1].c_str() );
+	}
+
+	/**
+	 * Generates the particles of the "large" test. Every value is a hash of the particle's ID, so the particles can be
+	 * checked as they are read without keeping them, and compress about as much as noise.
+	 */
+	struct large_particle{
+		prtio::data_types::int64_t id;
+		prtio::data_types::float32_t position[3];
+		prtio::data_types::uint32_t noise[29];
+
+		void generate( prt_int64 index ){
+			random_source rng( static_cast<prtio::data_types::uint64_t>( index ) );
+
+			id = index;
+			for( int k = 0; k < 3; ++k )
+				position[k] = static_cast<float>( rng.below( 1 << 20 ) ) * 0.001f;
+			for( int k = 0; k < 29; ++k )
+				noise[k] = static_cast<prtio::data_types::uint32_t>( rng.next() );
+		}
+
+		static void bind_output( prtio::prt_ostream& stream, large_particle* particles ){
+			stream.bind( "ID", &particles->id, 1, prtio::data_types::type_int64, sizeof(large_particle) );
+			stream.bind( "Position", particles->position, 3, prtio::data_types::type_float32, sizeof(large_particle) );
+			stream.bind( "Noise", particles->noise, 29, prtio::data_types::type_uint32, sizeof(large_particle) );
+		}
+
+		static void bind_input( prtio::prt_istream& stream, large_particle* particles ){
+			stream.bind( "ID", &particles->id, 1, sizeof(large_particle) );
+			stream.bind( "Position", particles->position, 3, sizeof(large_particle) );
+			stream.bind( "Noise", particles->noise, 29, sizeof(large_particle) );
+		}
+	};
+
+	/**
+	 * Writes a file of the "large" test's particles.
+	 * @param stream The stream to write with, with its compression settings chosen.
+	 */
+	static void write_large( prtio::prt_ofstream& stream, const std::string& path, prt_int64 count ){
+		std::vector<large_particle> chunk( 1 << 16 );
+		large_particle::bind_output( stream, &chunk.front() );
+
+		stream.open( path );
+
+		for( prt_int64 written = 0; written < count; ){
+			const std::size_t n = static_cast<std::size_t>( (std::min)( static_cast<prt_int64>( chunk.size() ), count - written ) );
+			for( std::size_t i = 0; i < n; ++i )
+				chunk[i].generate( written + static_cast<prt_int64>( i ) );
+
+			stream.write_particles( n );
+			written += static_cast<prt_int64>( n );
+		}
+
+		stream.close();
+	}
+
+	/**
+	 * Reads the rest of a stream of the "large" test's particles, checking each one.
+	 * @param first The index of the next particle in the file, or -1 if the particles may be in any order.
+	 * @return The number of particles read.
+	 */
+	static prt_int64 read_large( prtio::prt_istream& stream, prt_int64 first ){
+		std::vector<large_particle> chunk( 1 << 16 );
+		large_particle::bind_input( stream, &chunk.front() );
+
+		large_particle expected;
+		prt_int64 total = 0;
+
+		while( std::size_t n = stream.read_particles( chunk.size() ) ){
+			for( std::size_t i = 0; i < n; ++i ){
+				if( first >= 0 )
+					TEST_CHECK( chunk[i].id == first + total + static_cast<prt_int64>( i ) );
+
+				expected.generate( chunk[i].id );
+				TEST_CHECK( memcmp( &chunk[i], &expected, sizeof(large_particle) ) == 0 );
+			}
+			total += static_cast<prt_int64>( n );
+		}
+
+		return total;
+	}
+
+	/**
+	 * Tests files with over 4GB of particles, which overflow 32 bit sizes and offsets.
+	 */
+	void test_large(){
+		const prt_int64 particleSize = static_cast<prt_int64>( sizeof(large_particle) );
+		const prt_int64 count = m_settings.countSet ? static_cast<prt_int64>( m_settings.count ) : large_file_bytes / particleSize;
+		const std::string path = this->file_path( "large" );
+
+		try{
+			//A single zlib stream, as other PRT writers make.
+			{
+				std::cerr << "large: writing " << count << " particles as a zlib stream" << std::endl;
+				prtio::prt_ofstream stream;
+				stream.set_codec( prtio::codecs::codec_zlib, 1 );
+				write_large( stream, path, count );
+			}
+			TEST_CHECK( m_settings.countSet || file_size( path ) > ( prt_int64(1) << 32 ) );
+			{
+				std::cerr << "large: reading the zlib stream" << std::endl;
+				prtio::prt_ifstream stream( path );
+				TEST_CHECK( stream.particle_count() == count );
+				TEST_CHECK( read_large( stream, 0 ) == count );
+			}
+
+			//Uncompressed blocks on several threads, so every offset in the block index is exact.
+			{
+				std::cerr << "large: writing uncompressed blocks" << std::endl;
+				prtio::prt_ofstream stream;
+				stream.set_codec( prtio::codecs::codec_none );
+				stream.set_block_index( true );
+				stream.set_compression_threads( 4 );
+				write_large( stream, path, count );
+			}
+			TEST_CHECK( m_settings.countSet || file_size( path ) > ( prt_int64(1) << 32 ) );
+			TEST_CHECK( prtio::verify( path ).valid );
+			{
+				std::cerr << "large: reading the uncompressed blocks" << std::endl;
+				prtio::prt_parallel_ifstream stream( path, 4, prtio::prt_parallel_ifstream::order_any );
+				TEST_CHECK( read_large( stream, -1 ) == count );
+			}
+			{
+				//Seeking past 4GB of particles.
+				const prt_int64 first = count - 1000;
+				prtio::prt_ifstream stream( path, prtio::prt_ifstream::input_mapped );
+				stream.seek_particle( first );
+				TEST_CHECK( read_large( stream, first ) == 1000 );
+			}
+
+			//zlib blocks asked to hold every particle. The data of a block is compressed and checksummed with single calls
+			//taking 32 bit sizes, so without the 1GB limit a block this big would be truncated.
+			{
+				std::cerr << "large: writing zlib blocks bigger than the block limit" << std::endl;
+				prtio::prt_ofstream stream;
+				stream.set_codec( prtio::codecs::codec_zlib, 1 );
+				stream.set_block_index( true );
+				stream.set_block_size( static_cast<std::size_t>( count ) );
+				write_large( stream, path, count );
+			}
+			{
+				prtio::prt_verify_result verified = prtio::verify( path );
+				TEST_CHECK( verified.valid );
+
+				const prt_int64 blockSize = max_block_bytes / particleSize;
+				TEST_CHECK( verified.numBlocks == static_cast<std::size_t>( ( count + blockSize - 1 ) / blockSize ) );
+				TEST_CHECK( verified.numChecksummed == verified.numBlocks );
+			}
+			{
+				std::cerr << "large: reading the zlib blocks" << std::endl;
+				prtio::prt_ifstream stream( path, prtio::prt_ifstream::input_mapped );
+				TEST_CHECK( stream.particle_count() == count );
+				TEST_CHECK( read_large( stream, 0 ) == count );
+			}
+		}catch( ... ){
+			std::remove( path.c_str() );
+			throw;
+		}
+
+		std::remove( path.c_str() );
+	}
+
+	/**
+	 * Measures writing, reading and verifying the same file on different numbers of threads.
+	 */
+	void test_scaling(){
+		const std::string path = this->file_path( "scaling" );
+		const prt_int64 count = m_settings.countSet ? static_cast<prt_int64>( m_settings.count ) : 500000;
+		const double megabytes = static_cast<double>( count ) * sizeof(large_particle) / 1e6;
+
+		//Powers of two up to the number of hardware threads, and at least up to 4.
+		const std::size_t maxThreads = (std::max)( prtio::detail::hardware_concurrency(), std::size_t(4) );
+
+		std::vector<std::size_t> threads;
+		for( std::size_t t = 1; t < maxThreads; t *= 2 )
+			threads.push_back( t );
+		threads.push_back( maxThreads );
+
+		double writeBase = 0, readBase = 0, verifyBase = 0;
+
+		std::printf( "op,threads,seconds,MB/s,speedup\n" );
+
+		try{
+			for( std::size_t i = 0; i < threads.size(); ++i ){
+				double start = wall_time();
+				{
+					prtio::prt_ofstream stream;
+					stream.set_block_index( true );
+					stream.set_compression_threads( threads[i] );
+					write_large( stream, path, count );
+				}
+				double writeSeconds = wall_time() - start;
+
+				start = wall_time();
+				{
+					prtio::prt_parallel_ifstream stream( path, threads[i] );
+					TEST_CHECK( read_large( stream, 0 ) == count );
+				}
+				double readSeconds = wall_time() - start;
+
+				start = wall_time();
+				TEST_CHECK( prtio::verify( path, threads[i] ).valid );
+				double verifySeconds = wall_time() - start;
+
+				if( i == 0 ){
+					writeBase = writeSeconds;
+					readBase = readSeconds;
+					verifyBase = verifySeconds;
+				}
+
+				std::printf( "write,%u,%.6f,%.2f,%.2f\n", static_cast<unsigned>( threads[i] ), writeSeconds, megabytes / writeSeconds, writeBase / writeSeconds );
+				std::printf( "read,%u,%.6f,%.2f,%.2f\n", static_cast<unsigned>( threads[i] ), readSeconds, megabytes / readSeconds, readBase / readSeconds );
+				std::printf( "verify,%u,%.6f,%.2f,%.2f\n", static_cast<unsigned>( threads[i] ), verifySeconds, megabytes / verifySeconds, verifyBase / verifySeconds );
+				std::fflush( stdout );
+			}
+		}catch( ... ){
+			std::remove( path.c_str() );
+			throw;
+		}
+
+		std::remove( path.c_str() );
+	}
+
+public:
+	tester(){
+		m_settings.count = 20000;
+		m_settings.countSet = false;
+		m_settings.seed = 1;
+		m_settings.iterations = 24;
+
+		for( int i = 0; i < prtio::codecs::codec_count; ++i ){
+			if( prtio::detail::is_codec_available( static_cast<prtio::codecs::option>( i ) ) )
+				m_codecs.push_back( static_cast<prtio::codecs::option>( i ) );
+		}
+	}
+
+	/**
+	 * Reads the settings from the command line.
+	 * @return False if the command line isn't valid.
+	 */
+	bool parse( int argc, char* argv[] ){
+		for( int i = 1; i < argc; ++i ){
+			const std::string arg = argv[i];
+
+			if( arg.empty() || arg[0] != '-' ){
+				if( arg != "roundtrip" && arg != "large" && arg != "scaling" ){
+					std::cerr << "Unknown test \"" << arg << "\"" << std::endl;
+					return false;
+				}
+				m_settings.tests.push_back( arg );
+				continue;
+			}
+
+			if( i + 1 >= argc )
+				return false;
+			const char* value = argv[++i];
+
+			if( arg == "-n" ){
+				m_settings.count = static_cast<std::size_t>( std::atol( value ) );
+				m_settings.countSet = true;
+			}else if( arg == "-s" ){
+				m_settings.seed = static_cast<prtio::data_types::uint64_t>( std::atol( value ) );
+			}else if( arg == "-i" ){
+				m_settings.iterations = static_cast<std::size_t>( std::atol( value ) );
+			}else if( arg == "-d" ){
+				m_settings.directory = value;
+			}else{
+				return false;
+			}
+		}
+
+		if( m_settings.count == 0 )
+			return false;
+
+		if( m_settings.tests.empty() )
+			m_settings.tests.push_back( "roundtrip" );
+
+		return true;
+	}
+
+	/**
+	 * Runs the tests.
+	 * @return The number of tests that failed.
+	 */
+	int run(){
+		int failures = 0;
+
+		for( std::size_t i = 0; i < m_settings.tests.size(); ++i ){
+			const std::string& name = m_settings.tests[i];
+			std::cerr << "Running " << name << std::endl;
+
+			try{
+				if( name == "roundtrip" )
+					this->test_roundtrip();
+				else if( name == "large" )
+					this->test_large();
+				else
+					this->test_scaling();
+
+				std::cerr << "Passed " << name << std::endl;
+			}catch( const std::exception& e ){
+				std::cerr << "FAILED " << name << ": " << e.what() << std::endl;
+				++failures;
+			}
+		}
+
+		return failures;
+	}
+};
+
+}//namespace
+
+int main( int argc, char* argv[] ){
+	tester tests;
+	if( !tests.parse( argc, argv ) ){
+		std::cerr << "Usage: prtio_test [-n count] [-s seed] [-i iterations] [-d directory] [roundtrip|large|scaling ...]" << std::endl;
+		return 1;
+	}
+
+	return tests.run();
+}
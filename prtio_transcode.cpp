@@ -0,0 +1,208 @@
+/**
+ * Copyright 2012 Thinkbox Software Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains a command line tool for converting PRT files with prt_transcode(). When only names and metadata
+ * change, the compressed particle data is copied without recompressing it.
+ *
+ * Usage: prtio_transcode [options] input.prt output.prt
+ *   The output must be a different file from the input, which is left as it was if they are the same.
+ *   -drop name,...        Channels to leave out.
+ *   -rename old=new,...   Channels to rename.
+ *   -type name=type,...   Channels to store as another type, ex. Velocity=float16. Quantized and octahedral channels are
+ *                         decoded, so they can only be stored as floating point types.
+ *   -meta name=value      A string of file metadata to add. Can be repeated.
+ *   -unmeta name,...      File metadata to leave out.
+ *   -codec name           Recompress with a codec (zlib, none, zstd, lz4).
+ *   -level n              The compression level, with -codec.
+ *   -filter name          Recompress with a filter (none, shuffle, columns).
+ *   -index                Write a block index, even if the input doesn't have one.
+ *   -threads n            The number of threads. Defaults to all the hardware threads.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <prtio/prt_transcode.hpp>
+
+namespace{
+
+/**
+ * Splits a comma separated list.
+ */
+std::vector<std::string> split( const std::string& list ){
+	std::vector<std::string> result;
+
+	std::string::size_type start = 0;
+	for(;;){
+		std::string::size_type end = list.find( ',', start );
+		result.push_back( list.substr( start, ( end == std::string::npos ) ? std::string::npos : end - start ) );
+		if( end == std::string::npos )
+			break;
+		start = end + 1;
+	}
+
+	return result;
+}
+
+/**
+ * Splits "name=value" at the '='.
+ * @return False if there is no '='.
+ */
+bool split_pair( const std::string& pair, std::string& outName, std::string& outValue ){
+	std::string::size_type equals = pair.find( '=' );
+	if( equals == std::string::npos || equals == 0 )
+		return false;
+
+	outName = pair.substr( 0, equals );
+	outValue = pair.substr( equals + 1 );
+	return true;
+}
+
+/**
+ * Reads the settings from the command line.
+ * @return False if the command line isn't valid.
+ */
+bool parse( int argc, char* argv[], prtio::prt_transcode_options& options, std::string& inputPath, std::string& outputPath ){
+	std::vector<std::string> paths;
+	bool hasLevel = false;
+	int level = 0;
+
+	for( int i = 1; i < argc; ++i ){
+		const std::string arg = argv[i];
+
+		if( arg.empty() || arg[0] != '-' ){
+			paths.push_back( arg );
+			continue;
+		}
+
+		if( arg == "-index" ){
+			options.blockIndex = true;
+			continue;
+		}
+
+		if( i + 1 >= argc )
+			return false;
+		const std::string value = argv[++i];
+
+		std::string name, newValue;
+
+		if( arg == "-drop" ){
+			std::vector<std::string> names = split( value );
+			options.droppedChannels.insert( names.begin(), names.end() );
+		}else if( arg == "-rename" ){
+			std::vector<std::string> pairs = split( value );
+			for( std::size_t j = 0; j < pairs.size(); ++j ){
+				if( !split_pair( pairs[j], name, newValue ) )
+					return false;
+				options.renamedChannels[name] = newValue;
+			}
+		}else if( arg == "-type" ){
+			std::vector<std::string> pairs = split( value );
+			for( std::size_t j = 0; j < pairs.size(); ++j ){
+				if( !split_pair( pairs[j], name, newValue ) )
+					return false;
+
+				int type = 0;
+				while( type < prtio::data_types::type_count && newValue != prtio::data_types::names[type] )
+					++type;
+				if( type == prtio::data_types::type_count )
+					return false;
+
+				options.channelTypes[name] = static_cast<prtio::data_types::enum_t>( type );
+			}
+		}else if( arg == "-meta" ){
+			if( !split_pair( value, name, newValue ) )
+				return false;
+
+			prtio::prt_meta_value metaValue;
+			metaValue.set_string( std::basic_string<prtio::uchar_type>( newValue.begin(), newValue.end() ) );
+			options.fileMetadata[name] = metaValue;
+		}else if( arg == "-unmeta" ){
+			std::vector<std::string> names = split( value );
+			options.removedFileMetadata.insert( names.begin(), names.end() );
+		}else if( arg == "-codec" ){
+			int codec = 0;
+			while( codec < prtio::codecs::codec_count && value != prtio::detail::codec_name( static_cast<prtio::codecs::option>( codec ) ) )
+				++codec;
+			if( codec == prtio::codecs::codec_count )
+				return false;
+
+			//Keep a filter given before the codec.
+			prtio::filters::option filter = options.compression.filter;
+			options.compression = prtio::compression_options( static_cast<prtio::codecs::option>( codec ) );
+			options.compression.filter = filter;
+			options.recompress = true;
+		}else if( arg == "-level" ){
+			level = std::atoi( value.c_str() );
+			hasLevel = true;
+		}else if( arg == "-filter" ){
+			static const char* filterNames[] = { "none", "shuffle", "columns" };
+
+			int filter = 0;
+			while( filter < prtio::filters::filter_count && value != filterNames[filter] )
+				++filter;
+			if( filter == prtio::filters::filter_count )
+				return false;
+
+			options.compression.filter = static_cast<prtio::filters::option>( filter );
+			options.recompress = true;
+		}else if( arg == "-threads" ){
+			int numThreads = std::atoi( value.c_str() );
+			if( numThreads <= 0 )
+				return false;
+			options.numThreads = static_cast<std::size_t>( numThreads );
+		}else{
+			return false;
+		}
+	}
+
+	if( hasLevel ){
+		options.compression.level = level;
+		options.recompress = true;
+	}
+
+	if( paths.size() != 2 )
+		return false;
+
+	inputPath = paths[0];
+	outputPath = paths[1];
+	return true;
+}
+
+}//namespace
+
+int main( int argc, char* argv[] ){
+	prtio::prt_transcode_options options;
+	std::string inputPath, outputPath;
+
+	if( !parse( argc, argv, options, inputPath, outputPath ) ){
+		std::cerr << "Usage: prtio_transcode [-drop name,...] [-rename old=new,...] [-type name=type,...] [-meta name=value] [-unmeta name,...]" << std::endl;
+		std::cerr << "                       [-codec name] [-level n] [-filter name] [-index] [-threads n] input.prt output.prt" << std::endl;
+		return 1;
+	}
+
+	try{
+		bool copied = prtio::prt_transcode( inputPath, outputPath, options );
+
+		std::cerr << ( copied ? "Copied the compressed particles of \"" : "Recompressed the particles of \"" ) << inputPath << "\" to \"" << outputPath << "\"" << std::endl;
+	}catch( const std::exception& e ){
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}